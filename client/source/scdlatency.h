@@ -0,0 +1,144 @@
+/**
+ * @struct SCDLatencyHistogram https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Client latency histogram
+ *
+ *        Latencies in microseconds, counted into log-linear buckets: 4 buckets for each power of two, so that a
+ *        percentile is known within 25% from 1 usec to about 30 sec, with a fixed size and no allocation for each
+ *        sample. Same as the server one (server/source/scdlatency.h).
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDLATENCY_H
+#define SCDLATENCY_H
+
+#include <QString>
+#include <QtAlgorithms>
+
+#include <chrono>
+
+struct SCDLatencyHistogram
+{
+   static const int bucketCount = 140; // up to 2^35 usec, larger latencies are counted into the last bucket
+
+   quint64 buckets[bucketCount];
+   quint64 count;
+   qint64  sum; // usec
+   qint64  max; // usec
+
+   SCDLatencyHistogram() { clear(); }
+
+   void clear()
+   {
+      for (int n=0; n<bucketCount; n++)
+      {
+         buckets[n] = 0;
+      }
+
+      count = 0;
+      sum   = 0;
+      max   = 0;
+   }
+
+   /**
+    * @brief add count a latency
+    * @param latency usec, negative values (clocks not synchronized) are counted as 0
+    */
+   void add(qint64 latency)
+   {
+      latency = qMax(latency, qint64(0));
+
+      buckets[bucketOf(quint64(latency))]++;
+
+      count++;
+      sum += latency;
+      max  = qMax(max, latency);
+   }
+
+   /**
+    * @brief percentile
+    * @param p 0..100
+    * @return upper bound of the bucket holding the percentile (usec), never over max
+    */
+   qint64 percentile(double p) const
+   {
+      if (count==0)
+      {
+         return 0;
+      }
+
+      quint64 rank = quint64(p/100.0*count + 0.5);
+      quint64 seen = 0;
+
+      for (int n=0; n<bucketCount; n++)
+      {
+         seen += buckets[n];
+
+         if (seen >= qMax(rank, quint64(1)))
+         {
+            return qMin(upperBound(n), max);
+         }
+      }
+
+      return max;
+   }
+
+   qint64 mean() const { return count ? sum/qint64(count) : 0; }
+
+   /**
+    * @brief toString
+    * @return <count>|<mean>|<p50>|<p99>|<p99.9>|<max> (usec)
+    */
+   QString toString() const
+   {
+      return QString::number(count) + "|" + QString::number(mean()) + "|" + QString::number(percentile(50)) + "|"
+           + QString::number(percentile(99)) + "|" + QString::number(percentile(99.9)) + "|" + QString::number(max);
+   }
+
+   static int bucketOf(quint64 value)
+   {
+      if (value<4)
+      {
+         return int(value);
+      }
+
+      int msb = 63 - int(qCountLeadingZeroBits(value));
+
+      return qMin(bucketCount-1, (msb-1)*4 + int((value >> (msb-2)) & 3));
+   }
+
+   static qint64 upperBound(int bucket)
+   {
+      if (bucket<4)
+      {
+         return bucket;
+      }
+
+      int msb = bucket/4 + 1;
+
+      return (qint64(4 + bucket%4 + 1) << (msb-2)) - 1;
+   }
+
+   /**
+    * @brief now monotonic time
+    * @return usec
+    */
+   static qint64 now()
+   {
+      return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+   }
+
+   /**
+    * @brief epochNow wall clock time
+    * @return usec since epoch
+    */
+   static qint64 epochNow()
+   {
+      return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+   }
+};
+
+#endif // SCDLATENCY_H
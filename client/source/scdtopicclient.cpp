@@ -18,15 +18,34 @@
 #include <QDir>
 #include <QUrl>
 #include <QDateTime>
+#include <QJsonDocument>
+#include <QUuid>
 
 #include "scdtopicclient.h"
 
 /**
  * @brief SCDTopicClient::SCDTopicClient
  */
-SCDTopicClient::SCDTopicClient() : QWebSocket()
+SCDTopicClient::SCDTopicClient() : QWebSocket(), chunkSize(0), lastStreamId(0), reassembleChunks(true), lastSequence(0), ackedSequence(0), sessionResume(true), batchLinger(-1),
+                                   batchBytes(65536), batchCount(0), latencyTracing(false), multicastPort(0)
 {
+   setTlsConfiguration(QSslConfiguration::defaultConfiguration());
+
+   clientId = QUuid::createUuid().toString().mid(1,36); // without braces
+
+   ackTimer.setSingleShot(true);
+   ackTimer.setInterval(20);
+
    connect(this,SIGNAL(textMessageReceived(QString)),this,SLOT(onTextMessageReceived(QString)));
+   connect(this,SIGNAL(connected()),this,SLOT(onConnected()));
+   connect(&ackTimer,SIGNAL(timeout()),this,SLOT(onAckTimeout()));
+
+   batchTimer.setSingleShot(true);
+   batchTimer.setTimerType(Qt::PreciseTimer);
+
+   connect(&batchTimer,SIGNAL(timeout()),this,SLOT(onBatchTimeout()));
+
+   connect(&multicastSocket,SIGNAL(readyRead()),this,SLOT(onDatagramReceived()));
 }
 
 /**
@@ -47,28 +66,286 @@ SCDTopicClient::QWebSocket::~QWebSocket()
 
 /**
  * @brief SCDTopicClient::_connected executed on client connection signal
+ * @param host
+ * @param port
+ * @param secure connect thru TLS (wss://), see setTlsConfiguration
  */
-int SCDTopicClient::connectToHost(QString host, quint16 port)
+int SCDTopicClient::connectToHost(QString host, quint16 port, bool secure)
 {
-   QUrl url=QUrl(QString("ws://"+host+":"+QString::number(port)));
+   QUrl url=QUrl(QString((secure ? "wss://" : "ws://")+host+":"+QString::number(port)));
+
+   if (secure)
+   {
+      setSslConfiguration(tlsConfiguration);
+   }
 
    open(url);
 
    return 1;
 }
 
+/**
+ * @brief SCDTopicClient::setTlsConfiguration TLS configuration of wss:// connections, e.g. the CA certificates
+ *                                            trusted to verify a server having a self-signed certificate: the session
+ *                                            ticket of each connection is kept, so that a reconnect resumes the session
+ * @param configuration
+ */
+void SCDTopicClient::setTlsConfiguration(const QSslConfiguration &configuration)
+{
+   tlsConfiguration = configuration;
+
+   tlsConfiguration.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+   tlsConfiguration.setSslOption(QSsl::SslOptionDisableSessionPersistence, false); // sessionTicket() is filled
+}
+
+/**
+ * @brief SCDTopicClient::setChunkSize send messages larger than size in chunks: the server forwards each chunk
+ *                                     as it arrives, so large messages are not buffered whole
+ * @param size max chunk size, 0 to disable chunking
+ */
+void SCDTopicClient::setChunkSize(int size)
+{
+   chunkSize = qMax(size,0);
+}
+
+/**
+ * @brief SCDTopicClient::setReassembleChunks choose how a message received in chunks is delivered: reassembled thru
+ *                                            topicMessageReceived (default), or chunk by chunk thru topicChunkReceived
+ * @param reassemble
+ */
+void SCDTopicClient::setReassembleChunks(bool reassemble)
+{
+   reassembleChunks = reassemble;
+
+   if (!reassemble)
+   {
+      chunks.clear();
+   }
+}
+
+/**
+ * @brief SCDTopicClient::setClientId set the client id of at-least-once subscriptions: a client reconnecting with
+ *                                    the same id receives the messages it did not acknowledge. A random id is made
+ *                                    for each client object: set it to resume the session of a previous process.
+ * @param id no tab, new line or ':' allowed
+ */
+void SCDTopicClient::setClientId(QString id)
+{
+   clientId = id;
+}
+
+/**
+ * @brief SCDTopicClient::setSessionResume the client asks a resume token when it connects (TSR command): when it
+ *                                        reconnects within the server grace period, the server gives back all the
+ *                                        subscriptions of the previous connection, so they are not made again.
+ *                                        notifySessionResume reports SC_RESUMED, or SC_SUCCESS (new token) and
+ *                                        SC_WARNING (token expired): the subscriptions must be made again.
+ *                                        Set before connecting; enabled by default.
+ * @param enabled
+ */
+void SCDTopicClient::setSessionResume(bool enabled)
+{
+   sessionResume = enabled;
+
+   if (!enabled)
+   {
+      resumeToken.clear();
+   }
+}
+
+/**
+ * @brief SCDTopicClient::setPublishBatching coalesce the messages sent (sendMessageToTopic) into batches: a batch is
+ *                                           sent as a single frame when it exceeds maxBytes or when its first message
+ *                                           has waited linger msec, and before any other command (order is kept).
+ *                                           The server routes each message as if sent on its own, and notifies the
+ *                                           whole batch thru notifyBatchSent instead of each message thru
+ *                                           notifyMessageSent. Chunked messages are not coalesced.
+ * @param linger max msec a message waits, 0: the batch is sent when control returns to the event loop, -1: disabled
+ *               (the pending batch is sent)
+ * @param maxBytes batch size limit (chars)
+ */
+void SCDTopicClient::setPublishBatching(int linger, int maxBytes)
+{
+   if (linger<0)
+   {
+      flushBatch();
+   }
+
+   batchLinger = qMax(linger,-1);
+   batchBytes  = qMax(maxBytes,1);
+}
+
+/**
+ * @brief SCDTopicClient::flushBatch send the coalesced messages now
+ * @return bytes sent, 0 if no message is waiting
+ */
+int SCDTopicClient::flushBatch()
+{
+   batchTimer.stop();
+
+   if (batchCount==0)
+   {
+      return 0;
+   }
+
+   QString frame = "SCDTMH:1.0\tTBM:" + QString::number(batchCount) + "\n" + batch;
+
+   batch.clear();
+   batchCount = 0;
+
+   if (!isValid())
+   {
+      lastError = "Can't read or write socket";
+      return 0;
+   }
+
+   return int(sendTextMessage(frame));
+}
+
+/**
+ * @brief SCDTopicClient::onBatchTimeout the first message of the batch has waited linger msec
+ */
+void SCDTopicClient::onBatchTimeout()
+{
+   flushBatch();
+}
+
+/**
+ * @brief SCDTopicClient::sendFrame send a command frame, after the coalesced messages
+ * @param frame
+ * @return bytes sent
+ */
+qint64 SCDTopicClient::sendFrame(const QString &frame)
+{
+   if (batchCount>0)
+   {
+      flushBatch();
+   }
+
+   return sendTextMessage(frame);
+}
+
+/**
+ * @brief SCDTopicClient::setLatencyTracing send the messages with their publish time: the server adds its receive and
+ *                                          write times, and the subscribers tracing latency count each hop (see
+ *                                          getLatencyReport). Publisher and subscriber clocks should be synchronized
+ *                                          (e.g. NTP), chunked messages are not traced.
+ * @param enabled
+ */
+void SCDTopicClient::setLatencyTracing(bool enabled)
+{
+   latencyTracing = enabled;
+}
+
+/**
+ * @brief SCDTopicClient::getLatencyReport latencies of the traced messages received
+ * @return one line for each hop in format: <publish|server|delivery|total>|<count>|<mean>|<p50>|<p99>|<p99.9>|<max>
+ *         (usec)
+ */
+QStringList SCDTopicClient::getLatencyReport() const
+{
+   static const char *hops[] = {"publish", "server", "delivery", "total"};
+
+   QStringList report;
+
+   for (int n=0; n<4; n++)
+   {
+      report << QString(hops[n]) + "|" + latency[n].toString();
+   }
+
+   return report;
+}
+
+/**
+ * @brief SCDTopicClient::resetLatency clear the latency histograms
+ */
+void SCDTopicClient::resetLatency()
+{
+   for (int n=0; n<4; n++)
+   {
+      latency[n].clear();
+   }
+}
+
 /**
  * @brief SCDTopicClient::sendMessage
  * @param message
+ * @param priority high, normal or bulk: overrides the topic priority for this message, empty for topic priority
+ * @param ttl msec: the server drops the message if not delivered meanwhile (chunked messages never expire), 0: no TTL
  * @return
  */
-int SCDTopicClient::sendMessageToTopic(QString msg, QString topic)
+int SCDTopicClient::sendMessageToTopic(QString msg, QString topic, QString priority, int ttl)
 {
    if (isValid())
    {
+      if (states.contains(topic)) // the server doesn't send back own messages: this is the topic last document
+      {
+         QJsonDocument document = QJsonDocument::fromJson(msg.toUtf8());
+
+         if (document.isObject())
+         {
+            states[topic] = document.object();
+         }
+         else
+         {
+            states.remove(topic);
+         }
+      }
+
+      if (!priority.isEmpty())
+      {
+         topic += "\tPRI:" + priority; // optional header field following the command
+      }
+
+      if (chunkSize>0 && msg.size()>chunkSize) // large message: send in chunks
+      {
+         QString stream = QString::number(++lastStreamId);
+
+         qint64 sent = 0;
+
+         for (int pos=0; pos<msg.size(); pos+=chunkSize)
+         {
+            bool last = (pos+chunkSize >= msg.size());
+
+            message = "SCDTMH:1.0\tTSM:" + topic + "\tCHK:" + stream + "\tFIN:" + (last ? "1" : "0") + "\n" + msg.mid(pos,chunkSize);
+
+            sent += sendFrame(message);
+         }
+
+         return int(sent);
+      }
+
+      if (ttl>0)
+      {
+         topic += "\tTTL:" + QString::number(ttl);
+      }
+
+      if (latencyTracing)
+      {
+         topic += "\tTRA:" + QString::number(SCDLatencyHistogram::epochNow());
+      }
+
       message = "SCDTMH:1.0\tTSM:" + topic + "\n" + msg;
 
-      return sendTextMessage(message);
+      if (batchLinger>=0) // coalesced with the following messages
+      {
+         batch += QString::number(message.size()) + "\n" + message;
+         batchCount++;
+
+         if (batch.size() >= batchBytes)
+         {
+            flushBatch();
+         }
+         else
+         if (!batchTimer.isActive())
+         {
+            batchTimer.start(batchLinger);
+         }
+
+         return message.size();
+      }
+
+      return sendFrame(message);
    }
 
    lastError = "Can't read or write socket";
@@ -80,21 +357,60 @@ int SCDTopicClient::sendMessageToTopic(QString msg, QString topic)
  * @brief SCDTopicClient::registerToTopic
  * @param topic
  * @param createNewTopic
+ * @param priority priority of the topic created: high, normal or bulk, empty for normal
+ * @param filter content filter over JSON message fields, e.g. "value > 10 && sensorId in {'s1','s2'}":
+ *               the server sends only the matching messages (no tab or new line allowed)
+ * @param reliable at-least-once delivery (QoS 1): the messages are acknowledged automatically, and sent again by the
+ *                 server if lost or not acknowledged before a reconnection (see setClientId). A message can be
+ *                 received twice after a reconnection.
+ * @param durable durable subscription (implies reliable) named by client id: the server keeps it and queues its
+ *                messages while the client is offline, a client reconnecting with the same id receives them. It is
+ *                dropped when the client disconnects without any durable subscription left (see unregisterToTopic).
+ * @param multicast receive a multicast topic from the multicast group (no filter, not reliable): the messages are
+ *                  delivered in order, the missing ones are asked to server. A topic created is a multicast topic.
+ *                  If the server has no multicast egress, or the topic is not a multicast topic, the messages are
+ *                  received thru the connection as usual.
  */
-int SCDTopicClient::registerToTopic(QString topic, bool createNewTopic)
+int SCDTopicClient::registerToTopic(QString topic, bool createNewTopic, QString priority, QString filter, bool reliable, bool durable, bool multicast)
 {
    if (isValid())
    {
       if (createNewTopic)
       {
-         message =  "SCDTMH:1.0\tTRN:" + topic + "\n";
+         message =  "SCDTMH:1.0\tTRN:" + topic + (priority.isEmpty() ? "" : "\tPRI:" + priority);
+      }
+      else
+      {
+         message =  "SCDTMH:1.0\tTRC:" + topic;
+      }
+
+      if (!filter.isEmpty())
+      {
+         message += "\tFLT:" + filter;
+      }
+
+      if (durable)
+      {
+         message += "\tDUR:" + clientId;
+      }
+      else
+      if (reliable)
+      {
+         message += "\tQOS:1\tCID:" + clientId;
+      }
+
+      if (multicast)
+      {
+         message += "\tMCA:1";
       }
       else
       {
-         message =  "SCDTMH:1.0\tTRC:" + topic + "\n";
+         leaveMulticast(topic); // a new subscription replaces the multicast one
       }
 
-      return sendTextMessage(message);
+      message += "\n";
+
+      return sendFrame(message);
    }   
 
    lastError = "Can't read or write socket";
@@ -111,9 +427,13 @@ int SCDTopicClient::unregisterToTopic(QString topic)
 {
    if (isValid())
    {
+      states.remove(topic);
+
+      leaveMulticast(topic);
+
       message =  "SCDTMH:1.0\tTUC:" + topic + "\n";
 
-      return sendTextMessage(message);
+      return sendFrame(message);
    }
 
    lastError = "Can't read or write socket";
@@ -124,14 +444,21 @@ int SCDTopicClient::unregisterToTopic(QString topic)
 /**
  * @brief SCDTopicClient::makeTopic
  * @param topic
+ * @param priority high (e.g. alarms), normal or bulk (e.g. telemetry): messages of higher priority topics are
+ *                 delivered ahead of queued lower priority messages; set the priority of an existing topic too
+ * @param delta delta encoded topic, for state like JSON documents: subscribers receive only the changes of each
+ *              document, the client library rebuilds the full document
+ * @param multicast multicast topic: the server sends each message once to its multicast group, for the subscribers
+ *                  on the LAN receiving from there (see registerToTopic); set the multicast egress of an existing
+ *                  topic too
  */
-int SCDTopicClient::makeTopic(QString topic)
+int SCDTopicClient::makeTopic(QString topic, QString priority, bool delta, bool multicast)
 {
    if (isValid())
    {
-      message =  "SCDTMH:1.0\tTMK:" + topic + "\n";
+      message =  "SCDTMH:1.0\tTMK:" + topic + (priority.isEmpty() ? "" : "\tPRI:" + priority) + (delta ? "\tDLT:1" : "") + (multicast ? "\tMCA:1" : "") + "\n";
 
-      return sendTextMessage(message);
+      return sendFrame(message);
    }
 
    lastError = "Can't read or write socket";
@@ -149,7 +476,7 @@ int SCDTopicClient::deleteTopic(QString topic)
    {
       message =  "SCDTMH:1.0\tTDL:" + topic + "\n";
 
-      return sendTextMessage(message);
+      return sendFrame(message);
    }
 
    lastError = "Can't read or write socket";
@@ -158,12 +485,105 @@ int SCDTopicClient::deleteTopic(QString topic)
 }
 
 /**
- * @brief SCDTopicClient::getAllTopics
+ * @brief SCDTopicClient::getAllTopics request the list of all topics: see listTopics
  * @return
  */
 int SCDTopicClient::getAllTopics()
 {
-  return 0;
+   return listTopics();
+}
+
+/**
+ * @brief SCDTopicClient::listTopics request the list of topics. The list is received in chunks thru topicListReceived signal,
+ *                                   each item in format <topic name>:<static|dynamic>; at the end of listing notifyTopicList
+ *                                   signal is emitted.
+ * @param prefix list only topics whose name starts with prefix
+ * @param cursor list topics which follow the cursor (as received by notifyTopicList for previous page)
+ * @param max page size, 0 for no limit
+ * @param type 'static' or 'dynamic', empty for all topics
+ * @return
+ */
+int SCDTopicClient::listTopics(QString prefix, QString cursor, int max, QString type)
+{
+   return sendListRequest("TLT", prefix, cursor, max, type);
+}
+
+/**
+ * @brief SCDTopicClient::getTopicStats request the statistics of topics. Statistics are received in chunks thru
+ *                                      topicStatsReceived signal, each item in format:
+ *                                      <topic name>|<subscribers>|<messages>|<bytes>|<rate msg/sec>|<last publish msec since epoch>|<drops>|
+ *                                      <traced writes>|<mean>|<p50>|<p99>|<p99.9>|<max>
+ *                                      where the last fields are the server queue-to-write times (usec) of traced
+ *                                      messages (see setLatencyTracing); at the end notifyTopicStats signal is emitted.
+ * @param prefix as listTopics
+ * @param cursor as listTopics
+ * @param max as listTopics
+ * @return
+ */
+int SCDTopicClient::getTopicStats(QString prefix, QString cursor, int max)
+{
+   return sendListRequest("TST", prefix, cursor, max, "");
+}
+
+/**
+ * @brief SCDTopicClient::getDurableStats request the statistics of a durable subscription, received thru
+ *                                        topicStatsReceived signal in format:
+ *                                        <name>|<online 0|1>|<messages in memory>|<messages on disk>|<disk bytes>|<disk limit bytes>|<drops>
+ * @param name durable subscription name, empty for the client id
+ * @return
+ */
+int SCDTopicClient::getDurableStats(QString name)
+{
+   if (isValid())
+   {
+      message = "SCDTMH:1.0\tTDS:" + (name.isEmpty() ? clientId : name) + "\n";
+
+      return sendFrame(message);
+   }
+
+   lastError = "Can't read or write socket";
+
+   return 0;
+}
+
+/**
+ * @brief SCDTopicClient::sendListRequest send a topic listing command (TLT or TST)
+ * @param command
+ * @param prefix
+ * @param cursor
+ * @param max
+ * @param type
+ * @return
+ */
+int SCDTopicClient::sendListRequest(QString command, QString prefix, QString cursor, int max, QString type)
+{
+   if (isValid())
+   {
+      message = "SCDTMH:1.0\t" + command + ":" + prefix;
+
+      if (!cursor.isEmpty())
+      {
+         message += "\tCUR:" + cursor;
+      }
+
+      if (max>0)
+      {
+         message += "\tMAX:" + QString::number(max);
+      }
+
+      if (!type.isEmpty())
+      {
+         message += "\tTYP:" + type;
+      }
+
+      message += "\n";
+
+      return sendFrame(message);
+   }
+
+   lastError = "Can't read or write socket";
+
+   return 0;
 }
 
 /**
@@ -172,6 +592,25 @@ int SCDTopicClient::getAllTopics()
  */
 void SCDTopicClient::onTextMessageReceived(const QString &message)
 {
+   if (message.startsWith("SCDMCA:")) // multicast message sent thru connection: repaired, or too large for the group
+   {
+      processDatagram(message);
+
+      return;
+   }
+
+   if (!message.isEmpty() && message[0].isDigit()) // at-least-once subscription: <sequence>[<sender>@<topic>]:<message>
+   {
+      int pos = message.indexOf("[");
+
+      if (pos>0 && acceptSequence(message.left(pos).toULongLong()))
+      {
+         onTextMessageReceived(message.mid(pos));
+      }
+
+      return;
+   }
+
    if (message[0]=="[")
    {
      int pos = message.indexOf("]:"); // find the end of message header
@@ -186,6 +625,15 @@ void SCDTopicClient::onTextMessageReceived(const QString &message)
         QString topic  = items[1];
         QString mess   = message.mid(pos+2);
 
+        int trace = sender.indexOf("~"); // traced message: <sender>~<published>,<received>,<dispatched>
+
+        if (trace>=0)
+        {
+           processTrace(sender.mid(trace+1));
+
+           sender.truncate(trace);
+        }
+
         if (sender=="server" && topic=="notify")
         {
            QStringList items = mess.split("|");
@@ -216,6 +664,35 @@ void SCDTopicClient::onTextMessageReceived(const QString &message)
            emitNotifySignal(message, topic, statusCode, errMess);
         }
         else
+        if (sender=="server" && topic=="topics")
+        {
+           emit topicListReceived(mess.split("\n",QString::SkipEmptyParts));
+        }
+        else
+        if (sender=="server" && topic=="expired") // at-least-once message expired before delivery: only its sequence counts
+        {
+        }
+        else
+        if (sender=="server" && topic=="stats")
+        {
+           emit topicStatsReceived(mess.split("\n",QString::SkipEmptyParts));
+        }
+        else
+        if (sender=="server" && topic=="multicast")
+        {
+           processAnnounce(mess);
+        }
+        else
+        if (sender.contains("#")) // chunk of a large message
+        {
+           processChunk(sender, topic, mess);
+        }
+        else
+        if (sender.contains("%")) // document of a delta encoded topic
+        {
+           processState(sender, topic, mess);
+        }
+        else
         {
            emit topicMessageReceived(topic, mess);
         }
@@ -227,6 +704,426 @@ void SCDTopicClient::onTextMessageReceived(const QString &message)
    }
 }
 
+/**
+ * @brief SCDTopicClient::processTrace count the latencies of a traced message
+ * @param timestamps <published>,<received>,<dispatched> epoch usec: publisher send time (0 if not given), server
+ *                   receive and dispatch time
+ */
+void SCDTopicClient::processTrace(const QString &timestamps)
+{
+   QStringList items = timestamps.split(",");
+
+   if (items.size()!=3)
+   {
+      return;
+   }
+
+   qint64 published  = items[0].toLongLong();
+   qint64 received   = items[1].toLongLong();
+   qint64 dispatched = items[2].toLongLong();
+   qint64 now        = SCDLatencyHistogram::epochNow();
+
+   if (published>0)
+   {
+      latency[LH_PUBLISH].add(received - published);
+      latency[LH_TOTAL].add(now - published);
+   }
+
+   latency[LH_SERVER].add(dispatched - received);
+   latency[LH_DELIVERY].add(now - dispatched);
+}
+
+/**
+ * @brief SCDTopicClient::acceptSequence the server sends the messages of at-least-once subscriptions in order, and
+ *                                       sends them again from the first one not acknowledged: a message out of order
+ *                                       follows a lost one and is discarded, as a message already received.
+ *                                       The last message received in order is acknowledged (cumulatively).
+ * @param sequence
+ * @return true if the message must be processed
+ */
+bool SCDTopicClient::acceptSequence(quint64 sequence)
+{
+   bool accepted = (lastSequence==0 || sequence==lastSequence+1); // first message on this connection: sessions resume anywhere
+
+   if (accepted)
+   {
+      lastSequence = sequence;
+   }
+
+   if (lastSequence - ackedSequence >= 32)
+   {
+      onAckTimeout();
+   }
+   else
+   if (!ackTimer.isActive())
+   {
+      ackTimer.start();
+   }
+
+   return accepted;
+}
+
+/**
+ * @brief SCDTopicClient::onAckTimeout acknowledge the messages received
+ */
+void SCDTopicClient::onAckTimeout()
+{
+   ackTimer.stop();
+
+   if (lastSequence > ackedSequence && isValid())
+   {
+      ackedSequence = lastSequence;
+
+      sendFrame("SCDTMH:1.0\tTAK:" + QString::number(lastSequence) + "\n");
+   }
+}
+
+/**
+ * @brief SCDTopicClient::onConnected sequence numbers restart from the first message not acknowledged, the
+ *                                    subscriptions of the previous connection are resumed (see setSessionResume), the
+ *                                    TLS session ticket is kept for the next connection
+ */
+void SCDTopicClient::onConnected()
+{
+   lastSequence  = 0;
+   ackedSequence = 0;
+
+   multicastTopics.clear(); // subscriptions are made again, or resumed with a new announce
+
+   multicastSocket.close();
+
+   QByteArray ticket = sslConfiguration().sessionTicket(); // empty for ws://
+
+   if (!ticket.isEmpty())
+   {
+      tlsConfiguration.setSessionTicket(ticket); // redeemed by any server thread on reconnect
+   }
+
+   if (sessionResume)
+   {
+      sendFrame("SCDTMH:1.0\tTSR:" + resumeToken + "\n");
+   }
+}
+
+/**
+ * @brief SCDTopicClient::setMulticastInterface set the interface joining the multicast group (e.g. the LAN of the
+ *                                             publishers, or loopback for tests), before subscribing
+ * @param iface invalid interface: system default
+ */
+void SCDTopicClient::setMulticastInterface(const QNetworkInterface &iface)
+{
+   multicastInterface = iface;
+}
+
+/**
+ * @brief SCDTopicClient::processAnnounce join the multicast group of a multicast subscription
+ * @param announce <topic>|<source>|<group>|<port>|<next sequence>
+ */
+void SCDTopicClient::processAnnounce(const QString &announce)
+{
+   QStringList items = announce.trimmed().split("|");
+
+   if (items.size()!=5)
+   {
+      return;
+   }
+
+   QString      topic = items[0];
+   QHostAddress group(items[2]);
+   quint16      port  = quint16(items[3].toUInt());
+
+   if (multicastSocket.state()!=QAbstractSocket::BoundState || group!=multicastGroup || port!=multicastPort)
+   {
+      multicastSocket.close();
+
+      QHostAddress any(group.protocol()==QAbstractSocket::IPv6Protocol ? QHostAddress::AnyIPv6 : QHostAddress::AnyIPv4);
+
+      bool joined = multicastSocket.bind(any, port, QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)
+                 && (multicastInterface.isValid() ? multicastSocket.joinMulticastGroup(group, multicastInterface) : multicastSocket.joinMulticastGroup(group));
+
+      if (!joined) // receive thru connection
+      {
+         QString error = multicastSocket.errorString();
+
+         multicastSocket.close();
+
+         multicastTopics.clear();
+
+         emit notifyMessage("TRC", topic, SC_ERROR, "unable to join multicast group " + items[2] + ": " + error);
+
+         registerToTopic(topic, false);
+
+         return;
+      }
+
+      multicastGroup = group;
+      multicastPort  = port;
+   }
+
+   multicastSource = items[1];
+
+   MulticastTopic &entry = multicastTopics[topic];
+
+   entry.expected  = items[4].toULongLong();
+   entry.requested = entry.expected - 1;
+
+   entry.pending.clear();
+}
+
+/**
+ * @brief SCDTopicClient::onDatagramReceived
+ */
+void SCDTopicClient::onDatagramReceived()
+{
+   while (multicastSocket.hasPendingDatagrams())
+   {
+      QByteArray datagram;
+
+      datagram.resize(int(multicastSocket.pendingDatagramSize()));
+
+      multicastSocket.readDatagram(datagram.data(), datagram.size());
+
+      processDatagram(QString::fromUtf8(datagram));
+   }
+}
+
+/**
+ * @brief SCDTopicClient::processDatagram process a multicast message: SCDMCA:1.0\t<source>\t<topic>\t<sequence>\n<frame>
+ *                                        received from the group or thru connection. The frames are delivered in
+ *                                        sequence order: on a gap the missing messages are asked to server (TMR
+ *                                        command), and the next ones wait until they arrive. A marker
+ *                                        SCDMCA:1.0\t<source>\t<topic>\t<sequence>\tLOST\n tells that the messages
+ *                                        before sequence are no more available, the periodic announce
+ *                                        SCDMCA:1.0\t<source>\t<topic>\t<sequence>\tLAST\n the sequence of the last
+ *                                        message sent: the missing ones up to it are asked too.
+ * @param datagram
+ */
+void SCDTopicClient::processDatagram(const QString &datagram)
+{
+   int end = datagram.indexOf("\n");
+
+   if (end<0)
+   {
+      return;
+   }
+
+   QStringList items = datagram.left(end).split("\t");
+
+   if (items.size()<4 || items[0]!="SCDMCA:1.0" || items[1]!=multicastSource)
+   {
+      return; // another server, or another version
+   }
+
+   QString topic = items[2];
+
+   QHash<QString, MulticastTopic>::iterator it = multicastTopics.find(topic);
+
+   if (it == multicastTopics.end())
+   {
+      return; // not a multicast subscription of this client
+   }
+
+   quint64 sequence = items[3].toULongLong();
+
+   if (items.size()>4 && items[4]=="LOST")
+   {
+      deliverSequenced(topic, sequence);
+
+      return;
+   }
+
+   if (items.size()>4 && items[4]=="LAST") // last message sent to the group: the ones up to it not received are lost
+   {
+      if (sequence >= it->expected && sequence > it->requested && !it->pending.contains(sequence))
+      {
+         quint64 first = qMax(it->expected, it->requested+1);
+
+         it->requested = sequence;
+
+         sendFrame("SCDTMH:1.0\tTMR:" + topic + "\tSEQ:" + QString::number(first) + "\tEND:" + QString::number(sequence) + "\n");
+      }
+
+      return;
+   }
+
+   if (sequence < it->expected)
+   {
+      return; // already delivered
+   }
+
+   it->pending.insert(sequence, datagram.mid(end+1));
+
+   if (sequence > it->expected && sequence-1 > it->requested) // gap: ask the missing messages once
+   {
+      quint64 first = qMax(it->expected, it->requested+1);
+
+      it->requested = sequence-1;
+
+      sendFrame("SCDTMH:1.0\tTMR:" + topic + "\tSEQ:" + QString::number(first) + "\tEND:" + QString::number(sequence-1) + "\n");
+   }
+
+   deliverSequenced(topic);
+}
+
+/**
+ * @brief SCDTopicClient::deliverSequenced deliver the frames of a multicast topic received in order
+ * @param topic
+ * @param lostBefore the messages before this sequence number are lost: the gaps below it are skipped
+ */
+void SCDTopicClient::deliverSequenced(const QString &topic, quint64 lostBefore)
+{
+   for (;;)
+   {
+      QHash<QString, MulticastTopic>::iterator it = multicastTopics.find(topic); // a slot can unregister the topic meanwhile
+
+      if (it == multicastTopics.end())
+      {
+         return;
+      }
+
+      MulticastTopic &entry = it.value();
+
+      if (entry.expected < lostBefore && (entry.pending.isEmpty() || entry.pending.firstKey() > entry.expected))
+      {
+         entry.expected = entry.pending.isEmpty() ? lostBefore : qMin(entry.pending.firstKey(), lostBefore);
+      }
+
+      if (entry.pending.isEmpty() || entry.pending.firstKey() != entry.expected)
+      {
+         return;
+      }
+
+      QString frame = entry.pending.take(entry.expected);
+
+      entry.expected++;
+
+      onTextMessageReceived(frame);
+   }
+}
+
+/**
+ * @brief SCDTopicClient::leaveMulticast drop a multicast subscription: the group is left with the last one
+ * @param topic
+ */
+void SCDTopicClient::leaveMulticast(const QString &topic)
+{
+   if (multicastTopics.remove(topic) && multicastTopics.isEmpty())
+   {
+      multicastSocket.close();
+   }
+}
+
+/**
+ * @brief SCDTopicClient::processChunk process a chunk of a large message, sender format is:
+ *                                     <sender>#<stream id>:<M|F|A> (M: more chunks follow, F: final chunk, A: aborted)
+ * @param sender
+ * @param topic
+ * @param chunk
+ */
+void SCDTopicClient::processChunk(QString sender, QString topic, QString chunk)
+{
+   int pos = sender.lastIndexOf(":");
+
+   QString state  = sender.mid(pos+1);
+   QString stream = sender.left(pos) + "@" + topic;
+
+   if (state=="A") // aborted by server: discard partial message
+   {
+      chunks.remove(stream);
+
+      emit notifyMessage("TSM", topic, SC_MESSAGE_TOO_LARGE, "message aborted");
+
+      return;
+   }
+
+   bool last = (state=="F");
+
+   if (!reassembleChunks)
+   {
+      emit topicChunkReceived(topic, chunk, last);
+
+      return;
+   }
+
+   if (!last)
+   {
+      chunks[stream].append(chunk);
+
+      return;
+   }
+
+   emit topicMessageReceived(topic, chunks.take(stream) + chunk);
+}
+
+/**
+ * @brief SCDTopicClient::processState process a document of a delta encoded topic, sender format is:
+ *                                     <sender>%S (full document) or <sender>%D (JSON merge patch of last document).
+ *                                     The full document is rebuilt and emitted thru topicMessageReceived.
+ * @param sender
+ * @param topic
+ * @param message
+ */
+void SCDTopicClient::processState(QString sender, QString topic, QString message)
+{
+   QJsonDocument document = QJsonDocument::fromJson(message.toUtf8());
+
+   if (!document.isObject())
+   {
+      emit notifyMessage(message, topic, SC_ERROR, "Invalid document");
+      return;
+   }
+
+   if (sender.endsWith("%S"))
+   {
+      states.insert(topic, document.object());
+
+      emit topicMessageReceived(topic, message);
+
+      return;
+   }
+
+   QHash<QString, QJsonObject>::iterator it = states.find(topic);
+
+   if (it == states.end()) // missed the full document: wait for the next one
+   {
+      emit notifyMessage(message, topic, SC_ERROR, "Delta without document");
+      return;
+   }
+
+   applyMergePatch(it.value(), document.object());
+
+   emit topicMessageReceived(topic, QString::fromUtf8(QJsonDocument(it.value()).toJson(QJsonDocument::Compact)));
+}
+
+/**
+ * @brief SCDTopicClient::applyMergePatch apply a JSON merge patch (RFC 7386)
+ * @param document
+ * @param patch
+ */
+void SCDTopicClient::applyMergePatch(QJsonObject &document, const QJsonObject &patch)
+{
+   for (QJsonObject::const_iterator it = patch.constBegin(); it != patch.constEnd(); ++it)
+   {
+      if (it.value().isNull())
+      {
+         document.remove(it.key());
+      }
+      else
+      if (it.value().isObject() && document.value(it.key()).isObject())
+      {
+         QJsonObject member = document.value(it.key()).toObject();
+
+         applyMergePatch(member, it.value().toObject());
+
+         document.insert(it.key(), member);
+      }
+      else
+      {
+         document.insert(it.key(), it.value());
+      }
+   }
+}
+
 /**
  * @brief SCDTopicClient::SCDTopicClient
  * @param Host
@@ -276,4 +1173,38 @@ void SCDTopicClient::emitNotifySignal(QString message, QString topic, int status
    {
       emit notifyMessageSent(topic, statusCode, errMsg);
    }
+   else
+   if (message == "TBM") // topic: messages into batch
+   {
+      emit notifyBatchSent(topic.toInt(), statusCode, errMsg);
+   }
+   else
+   if (message == "TSR") // topic: resume token
+   {
+      resumeToken = (statusCode>0) ? topic : QString();
+
+      emit notifySessionResume(statusCode, errMsg);
+   }
+   else
+   if (message == "TMR" && statusCode<=0) // missing multicast messages not sent again: skip them
+   {
+      QHash<QString, MulticastTopic>::const_iterator it = multicastTopics.constFind(topic);
+
+      if (it != multicastTopics.constEnd())
+      {
+         deliverSequenced(topic, it->requested+1);
+      }
+   }
+   else
+   if (message == "TLT")
+   {
+      // status code 3: page complete, errMsg is the cursor to request next page
+
+      emit notifyTopicList(topic, (statusCode==3) ? SC_SUCCESS : statusCode, (statusCode==3) ? errMsg : QString());
+   }
+   else
+   if (message == "TST")
+   {
+      emit notifyTopicStats(topic, (statusCode==3) ? SC_SUCCESS : statusCode, (statusCode==3) ? errMsg : QString());
+   }
 }
@@ -5,6 +5,17 @@
 #include <QByteArray>
 #include <QWebSocket>
 #include <QDir>
+#include <QHash>
+#include <QMap>
+#include <QJsonObject>
+#include <QUdpSocket>
+#include <QHostAddress>
+#include <QNetworkInterface>
+#include <QSslConfiguration>
+#include <QTimer>
+
+#include "scdlatency.h"
+
 /**
  * @brief The SCDTopicClient class
  */
@@ -22,36 +33,139 @@ class SCDTopicClient : public QWebSocket
 
     bool registered;
 
+    QSslConfiguration tlsConfiguration; // wss:// connections
+
+    int     chunkSize;        // split messages larger than chunkSize into chunks, 0: disabled
+    quint32 lastStreamId;
+    bool    reassembleChunks; // emit topicMessageReceived for the whole message instead of topicChunkReceived
+
+    QHash <QString, QString> chunks; // chunked messages in progress: <sender>#<stream id>@<topic> => chunks received
+
+    void processChunk(QString sender, QString topic, QString chunk);
+
+    QHash <QString, QJsonObject> states; // delta encoded topics: last document of each topic
+
+    void processState(QString sender, QString topic, QString message);
+
+    QString clientId;      // at-least-once subscriptions: identifies the session across reconnections
+    quint64 lastSequence;  // last sequence number received in order on this connection, 0: none yet
+    quint64 ackedSequence; // last sequence number acknowledged
+    QTimer  ackTimer;      // acknowledges are coalesced
+
+    bool acceptSequence(quint64 sequence);
+
+    bool    sessionResume; // ask a resume token on connect, and resume the subscriptions of the previous connection
+    QString resumeToken;   // token of last connection, empty: none
+
+    int     batchLinger; // publish coalescing: max msec a message waits into batch, -1: messages are sent at once
+    int     batchBytes;  // the batch is sent when it exceeds this size
+    int     batchCount;  // messages into batch
+    QString batch;       // coalesced TSM commands, see SCDTopicServer::publishBatch
+    QTimer  batchTimer;
+
+    qint64 sendFrame(const QString &frame);
+
+    bool latencyTracing; // send messages with the publish time (TRA header field)
+
+    SCDLatencyHistogram latency[4]; // traced messages received, see LatencyHop
+
+    void processTrace(const QString &timestamps);
+
+    /**
+     * @brief The MulticastTopic struct multicast subscription: messages received from the multicast group
+     */
+    struct MulticastTopic
+    {
+       quint64 expected;  // sequence number of next message to deliver
+       quint64 requested; // last sequence number asked to server (TMR command)
+
+       QMap<quint64, QString> pending; // frames received out of order, by sequence number
+    };
+
+    QUdpSocket        multicastSocket;
+    QHostAddress      multicastGroup;
+    quint16           multicastPort;
+    QNetworkInterface multicastInterface; // invalid: system default
+    QString           multicastSource;    // server source id: datagrams of other servers are ignored
+
+    QHash <QString, MulticastTopic> multicastTopics;
+
+    void processAnnounce(const QString &announce);
+    void processDatagram(const QString &datagram);
+    void deliverSequenced(const QString &topic, quint64 lostBefore=0);
+    void leaveMulticast(const QString &topic);
+
+    static void applyMergePatch(QJsonObject &document, const QJsonObject &patch);
+
     void emitNotifySignal(QString message, QString topic, int statusCode, QString errMsg);
 
+    int sendListRequest(QString command, QString prefix, QString cursor, int max, QString type);
+
   public:
 
     enum StatusCode{SC_ERROR=0,SC_SUCCESS=1,SC_WARNING=2}; // SC_WARNING should be treated as SC_SUCCESS
 
+    enum SendStatusCode{SC_MESSAGE_TOO_LARGE=-5,SC_RATE_LIMITED=-4,SC_DELAYED=4}; // message sent notify: rejected or delayed by server
+
+    enum SessionStatusCode{SC_RESUMED=3}; // session resume notify: subscriptions of the previous connection resumed
+
+    enum LatencyHop{LH_PUBLISH=0,LH_SERVER=1,LH_DELIVERY=2,LH_TOTAL=3}; // publisher to server, server receive to dispatch, server dispatch to subscriber, end to end
+
     SCDTopicClient();
 
     ~SCDTopicClient();
 
   public slots:
 
-    int  connectToHost(QString host, quint16 port);
+    int  connectToHost(QString host, quint16 port, bool secure=false);
+
+    void setTlsConfiguration(const QSslConfiguration &configuration);
 
-    int sendMessageToTopic(QString msg, QString topic);
-    int registerToTopic(QString topic, bool createNewTopic=true);
+    void setChunkSize(int size);
+    void setReassembleChunks(bool reassemble);
+
+    int sendMessageToTopic(QString msg, QString topic, QString priority="", int ttl=0);
+    void setClientId(QString id);
+    QString getClientId() const { return clientId; }
+
+    void setSessionResume(bool enabled);
+    QString getResumeToken() const { return resumeToken; }
+
+    void setPublishBatching(int linger, int maxBytes=65536);
+    int  flushBatch();
+
+    void setLatencyTracing(bool enabled);
+    bool isLatencyTracing() const { return latencyTracing; }
+
+    SCDLatencyHistogram getLatency(LatencyHop hop) const { return latency[hop]; }
+    QStringList getLatencyReport() const;
+    void resetLatency();
+
+    void setMulticastInterface(const QNetworkInterface &iface);
+
+    int registerToTopic(QString topic, bool createNewTopic=true, QString priority="", QString filter="", bool reliable=false, bool durable=false, bool multicast=false);
     int unregisterToTopic(QString topic);
-    int makeTopic(QString topic);
+    int makeTopic(QString topic, QString priority="", bool delta=false, bool multicast=false);
     int deleteTopic(QString topic);
 
     int getAllTopics();
+    int listTopics(QString prefix="", QString cursor="", int max=0, QString type="");
+    int getTopicStats(QString prefix="", QString cursor="", int max=0);
+    int getDurableStats(QString name="");
 
   private slots:
 
     void onTextMessageReceived(const QString &message);
+    void onConnected();
+    void onAckTimeout();
+    void onBatchTimeout();
+    void onDatagramReceived();
     // void onBinaryMessageReceived(const QByteArray &message);
 
   signals:
 
     void topicMessageReceived(QString topic, QString message);    
+    void topicChunkReceived(QString topic, QString chunk, bool last);
     void notifyMessage(QString message, QString topic, int statusCode, QString errMess);
 
     void notifyNewTopic(QString topic, int statusCode, QString errMsg);
@@ -59,6 +173,14 @@ class SCDTopicClient : public QWebSocket
     void notifyTopicSubscription(QString topic, int statusCode, QString errMsg);
     void notifyTopicUnscribe(QString topic, int statusCode, QString errMsg);
     void notifyMessageSent(QString topic, int statusCode, QString errMsg);
+    void notifyBatchSent(int messages, int statusCode, QString errMsg);
+    void notifySessionResume(int statusCode, QString errMsg);
+
+    void topicListReceived(QStringList topics);
+    void notifyTopicList(QString prefix, int statusCode, QString cursor);
+
+    void topicStatsReceived(QStringList stats);
+    void notifyTopicStats(QString prefix, int statusCode, QString cursor);
 };
 
 #endif // SCDTOPICCLIENT_H
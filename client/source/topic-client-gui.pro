@@ -5,6 +5,7 @@
 #-------------------------------------------------
 
 QT += core gui
+QT += network
 QT += websockets
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
@@ -34,7 +35,8 @@ SOURCES += \
 
 HEADERS += \
         mainwindow.h \
-    scdtopicclient.h
+    scdtopicclient.h \
+    scdlatency.h
 
 FORMS += \
         mainwindow.ui
@@ -0,0 +1,1801 @@
+/**
+ * @brief SCD Topic Server benchmarks
+ *
+ *        Benchmarks of server hot paths. The server is driven in-process thru the transport interface, using fake
+ *        connections which only count the frames written: no network is needed. Header parsing, topic lookup,
+ *        subscribe/unscribe and disconnect cleanup are measured calling the server functions directly.
+ *
+ *        The publishAllocations test counts the heap allocations of a publish, from the frame received to the frames
+ *        handed to the subscribers, once the server buffers are warmed up: it fails if a publish allocates (glibc
+ *        only: malloc is interposed by this executable, so the allocations made by Qt are counted too).
+ *
+ *        The filter test compiles content filter expressions (SCDFilter) and evaluates them on JSON messages: value
+ *        sets, negation, and/or precedence, nested fields, string/bool/null comparisons, type mismatches and the
+ *        syntax errors.
+ *
+ *        The bufferPool test checks the recycling of the frame buffers of the epoll backend (SCDBufferPool): a buffer
+ *        goes back to the pool only when its last holder releases it.
+ *
+ *        The durableSpill benchmark publishes to a durable subscription whose client is offline (messages over the
+ *        memory queue are spilled to disk), then checks that the reconnected client drains them all.
+ *
+ *        The hierarchicalWheel test checks that the expiry wheel (SCDHierarchicalWheel) expires each timeout at its
+ *        tick, from a tick to beyond its range. The messageExpiry test publishes messages having a TTL to a subscriber
+ *        whose transport window is full, to a QoS 1 subscriber, to an offline durable subscriber (memory queue and
+ *        spool) and to a delta encoded topic: the expiry sweep must drop them all and count them.
+ *
+ *        The largeFanOut test publishes two messages to a topic delivered in chunks (SCDTopicServer::startFanOut),
+ *        changing its subscriptions between them: each message must reach the subscribers of its snapshot, in order,
+ *        and the parked subscriptions deleted meanwhile (expired or resumed) must be skipped.
+ *        The fanOut benchmark delivers all chunks of the large topics into the measure.
+ *
+ *        The sessionResume benchmark disconnects a client subscribed to n dynamic topics and resumes its subscriptions
+ *        on a new connection with its resume token: no topic must be removed meanwhile, and an expired token must
+ *        get a new one.
+ *
+ *        The multicastLoopback test publishes to a multicast topic having 100 receivers, on loopback multicast: each
+ *        message must be sent once to the group and never thru the receivers connections, the missing messages must
+ *        be sent again on request, a message too large for the group is not kept for repairs, and the last sequence
+ *        number is announced to the group (skipped if loopback multicast is not available).
+ *
+ *        The loopback benchmark drives the server thru real web socket clients over the loopback interface, for each
+ *        web socket backend (Qt, and epoll when built with qmake CONFIG+=epoll): it checks the protocol replies too.
+ *
+ *        The tlsHandshake benchmark measures the TLS handshakes on loopback, full and resumed (session ticket of the
+ *        previous connection, checked on the server resumption count), with a self-signed certificate made by openssl
+ *        command (skipped if not available; the resumed row is skipped if Qt loads another OpenSSL library than the
+ *        server is linked to).
+ *
+ *        The wssLoopback test connects secure web socket clients thru the TLS acceptor, and checks that each one makes
+ *        a topic and gets the server notify (skipped if openssl command is not available).
+ *
+ *        Run: ./scdtopicbench [-iterations n] [-callgrind]
+ *
+ *        To compare two builds run the in-process benchmarks only, with a fixed iteration count and the median of
+ *        some runs, e.g. ./scdtopicbench -median 9 -iterations 10000 readHeader topicExists subscribe fanOut disconnect
+ *        or with -callgrind: instruction counts do not depend on machine load, so a 10% regression is well above noise.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QWebSocket>
+#include <QSslSocket>
+#include <QProcess>
+#include <QUdpSocket>
+#include <QNetworkInterface>
+#include <QJsonDocument>
+
+#include "scdtopicserver.h"
+#include "scdbufferpool.h"
+#include "scdtlsacceptor.h"
+#ifdef SCD_EPOLL_BACKEND
+#include "scdepollserver.h"
+#endif
+
+#include <atomic>
+
+#ifdef __GLIBC__
+
+// allocation counting: the glibc allocator is wrapped, allocations are counted while countAllocations is set
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+extern "C" void  __libc_free(void *pointer);
+
+static std::atomic<bool>    countAllocations(false);
+static std::atomic<quint64> allocations(0);
+
+extern "C" void *malloc(size_t size)
+{
+   if (countAllocations.load(std::memory_order_relaxed))
+   {
+      allocations++;
+   }
+
+   return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+   if (countAllocations.load(std::memory_order_relaxed))
+   {
+      allocations++;
+   }
+
+   return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+   if (countAllocations.load(std::memory_order_relaxed))
+   {
+      allocations++;
+   }
+
+   return __libc_realloc(pointer, size);
+}
+
+extern "C" void free(void *pointer)
+{
+   __libc_free(pointer);
+}
+
+#endif
+
+/**
+ * @brief The SCDBenchConnection class in-process fake connection: counts the frames written and keeps the sequence
+ *                                     number of the last QoS 1 message
+ */
+class SCDBenchConnection : public SCDConnection
+{
+   public:
+
+     int     frames;
+     quint64 sequence;
+
+     bool    keepLast; // keep the last frame: it shares the server frame buffer, so the next publish allocates
+     QString last;
+
+     SCDBenchConnection() : frames(0), sequence(0), keepLast(false) {}
+
+     bool isValid() const { return true; }
+
+     void sendText(const QString &message)
+     {
+        frames++;
+
+        if (keepLast)
+        {
+           last = message;
+        }
+
+        if (message.at(0).isDigit())
+        {
+           sequence = message.left(message.indexOf('[')).toULongLong();
+        }
+     }
+
+     void ping() {}
+
+     void abort() {}
+};
+
+/**
+ * @brief The SCDTopicBench class
+ */
+class SCDTopicBench : public QObject
+{
+   Q_OBJECT
+
+   private:
+
+     QTemporaryDir dir;
+
+     static void makeTopics(SCDTopicServer &server, int count);
+
+     bool makeCertificate(QString &certificate, QString &privateKey);
+
+   private slots:
+
+     void initTestCase();
+
+     void readHeader_data();
+     void readHeader();
+
+     void topicExists_data();
+     void topicExists();
+
+     void subscribe_data();
+     void subscribe();
+
+     void disconnect_data();
+     void disconnect();
+
+     void fanOut_data();
+     void fanOut();
+
+     void filter_data();
+     void filter();
+
+     void publishBatch_data();
+     void publishBatch();
+
+     void publishAllocations_data();
+     void publishAllocations();
+
+     void bufferPool();
+
+     void durableSpill();
+
+     void hierarchicalWheel();
+     void messageExpiry();
+
+     void largeFanOut();
+
+     void sessionResume_data();
+     void sessionResume();
+
+     void multicastLoopback();
+
+     void loopback_data();
+     void loopback();
+
+     void tlsHandshake_data();
+     void tlsHandshake();
+
+     void wssLoopback();
+};
+
+/**
+ * @brief SCDTopicBench::initTestCase the server saves the topics file into current dir: use a temporary dir
+ */
+void SCDTopicBench::initTestCase()
+{
+   QVERIFY(dir.isValid());
+
+   QDir::setCurrent(dir.path());
+}
+
+/**
+ * @brief SCDTopicBench::makeTopics load static topics bench/0 ... bench/<count-1> at once, without writing the topics
+ *                                  file for each topic
+ * @param server
+ * @param count
+ */
+void SCDTopicBench::makeTopics(SCDTopicServer &server, int count)
+{
+   QStringList items;
+
+   items.reserve(count);
+
+   for (int n=0; n<count; n++)
+   {
+      items.append("bench/" + QString::number(n) + ":static");
+   }
+
+   QByteArray state;
+
+   QDataStream stream(&state, QIODevice::WriteOnly);
+
+   stream << items << QStringList(); // handover state: topics, no documents
+
+   server.restoreTopics(state);
+}
+
+/**
+ * @brief SCDTopicBench::makeCertificate make a self-signed certificate for localhost into the temporary dir (once)
+ * @param certificate
+ * @param privateKey
+ * @return false if openssl command is not available
+ */
+bool SCDTopicBench::makeCertificate(QString &certificate, QString &privateKey)
+{
+   certificate = dir.filePath("tls.crt");
+   privateKey  = dir.filePath("tls.key");
+
+   if (QFile::exists(certificate))
+   {
+      return true;
+   }
+
+   return QProcess::execute("openssl", QStringList() << "req" << "-x509" << "-newkey" << "rsa:2048" << "-nodes" << "-days" << "1"
+                                                     << "-subj" << "/CN=localhost" << "-keyout" << privateKey << "-out" << certificate) == 0;
+}
+
+/**
+ * @brief SCDTopicBench::readHeader_data
+ */
+void SCDTopicBench::readHeader_data()
+{
+   QTest::addColumn<QString>("message");
+
+   QTest::newRow("publish")   << "SCDTMH:1.0\tTSM:sensors/temperature\n" + QString(64,'x');
+   QTest::newRow("subscribe") << "SCDTMH:1.0\tTRN:sensors/temperature\tPRI:high\tFLT:value > 10\tQOS:1\tCID:0f8fad5b-d9cb-469f-a165-70867728950e\n";
+}
+
+/**
+ * @brief SCDTopicBench::readHeader parse the header of a message
+ */
+void SCDTopicBench::readHeader()
+{
+   QFETCH(QString, message);
+
+   SCDTopicServer server;
+
+   SCDTopicServer::Command command = SCDTopicServer::TMK;
+
+   int size = 0;
+
+   QBENCHMARK
+   {
+      size = server.readHeader(message, command);
+   }
+
+   QCOMPARE(size, message.indexOf('\n'));
+}
+
+/**
+ * @brief SCDTopicBench::topicExists_data
+ */
+void SCDTopicBench::topicExists_data()
+{
+   QTest::addColumn<int>("topics");
+   QTest::addColumn<bool>("hit");
+
+   QTest::newRow("100")      << 100    << true;
+   QTest::newRow("10k")      << 10000  << true;
+   QTest::newRow("100k")     << 100000 << true;
+   QTest::newRow("10k/miss") << 10000  << false;
+}
+
+/**
+ * @brief SCDTopicBench::topicExists look up a topic into the topic index
+ */
+void SCDTopicBench::topicExists()
+{
+   QFETCH(int, topics);
+   QFETCH(bool, hit);
+
+   SCDTopicServer server;
+
+   makeTopics(server, topics);
+
+   QString name = hit ? "bench/" + QString::number(topics/2) : QString("bench/missing");
+
+   bool found = false;
+
+   QBENCHMARK
+   {
+      found = server.topicExists(name);
+   }
+
+   QCOMPARE(found, hit);
+}
+
+/**
+ * @brief SCDTopicBench::subscribe_data
+ */
+void SCDTopicBench::subscribe_data()
+{
+   QTest::addColumn<int>("subscribers");
+
+   QTest::newRow("1")   << 1;
+   QTest::newRow("100") << 100;
+   QTest::newRow("10k") << 10000;
+}
+
+/**
+ * @brief SCDTopicBench::subscribe subscribe a client to a topic having n subscribers, and unscribe it
+ */
+void SCDTopicBench::subscribe()
+{
+   QFETCH(int, subscribers);
+
+   SCDTopicServer server;
+
+   makeTopics(server, 1);
+
+   QString topic = "bench/0";
+
+   QVector<SCDBenchConnection *> clients;
+
+   for (int n=0; n<subscribers; n++)
+   {
+      SCDBenchConnection *client = new SCDBenchConnection();
+
+      clients.append(client);
+
+      server.openConnection(client);
+      server.subscribeToTopic(topic, client, false);
+   }
+
+   SCDBenchConnection client;
+
+   server.openConnection(&client);
+
+   QBENCHMARK
+   {
+      server.subscribeToTopic(topic, &client, false);
+      server.unscribeFromTopic(topic, &client);
+   }
+
+   QCOMPARE(server.topics.value(topic)->subscribers.size(), subscribers);
+
+   server.closeConnection(&client);
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      server.closeConnection(clients.at(n));
+   }
+
+   qDeleteAll(clients);
+}
+
+/**
+ * @brief SCDTopicBench::disconnect_data
+ */
+void SCDTopicBench::disconnect_data()
+{
+   QTest::addColumn<int>("topics");
+
+   QTest::newRow("1")   << 1;
+   QTest::newRow("10")  << 10;
+   QTest::newRow("100") << 100;
+}
+
+/**
+ * @brief SCDTopicBench::disconnect open a connection, subscribe it to n topics having 100 subscribers each, then
+ *                                  close it (disconnect cleanup): the subscribe benchmark gives the cost of the
+ *                                  subscriptions alone
+ */
+void SCDTopicBench::disconnect()
+{
+   QFETCH(int, topics);
+
+   SCDTopicServer server;
+
+   server.setHeartbeat(0, 0); // no heartbeat wheel entry for each connection opened
+
+   makeTopics(server, topics);
+
+   QStringList names;
+
+   for (int n=0; n<topics; n++)
+   {
+      names.append("bench/" + QString::number(n));
+   }
+
+   QVector<SCDBenchConnection *> clients;
+
+   for (int n=0; n<100; n++)
+   {
+      SCDBenchConnection *client = new SCDBenchConnection();
+
+      clients.append(client);
+
+      server.openConnection(client);
+
+      for (int i=0; i<topics; i++)
+      {
+         server.subscribeToTopic(names.at(i), client, false);
+      }
+   }
+
+   SCDBenchConnection client;
+
+   QBENCHMARK
+   {
+      client.resetState(); // connection record reused, as the epoll backend does
+
+      server.openConnection(&client);
+
+      for (int i=0; i<topics; i++)
+      {
+         server.subscribeToTopic(names.at(i), &client, false);
+      }
+
+      server.closeConnection(&client);
+   }
+
+   QVERIFY(client.topics.isEmpty());
+   QCOMPARE(server.topics.value(names.last())->subscribers.size(), clients.size());
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      server.closeConnection(clients.at(n));
+   }
+
+   qDeleteAll(clients);
+}
+
+/**
+ * @brief SCDTopicBench::fanOut_data
+ */
+void SCDTopicBench::fanOut_data()
+{
+   QTest::addColumn<int>("subscribers");
+   QTest::addColumn<int>("qos");
+   QTest::addColumn<bool>("traced");
+
+   QTest::newRow("1")   << 1     << 0 << false;
+   QTest::newRow("100") << 100   << 0 << false;
+   QTest::newRow("10k") << 10000 << 0 << false;
+
+   QTest::newRow("qos1/100") << 100   << 1 << false;
+   QTest::newRow("qos1/10k") << 10000 << 1 << false;
+
+   QTest::newRow("traced/100") << 100   << 0 << true;
+   QTest::newRow("traced/10k") << 10000 << 0 << true;
+}
+
+/**
+ * @brief SCDTopicBench::fanOut publish a message to a topic having n subscribers (sendMessageToTopic thru
+ *                              processMessage). QoS 1 rows: each subscriber acknowledges each message, so the
+ *                              in-flight window never fills. Traced rows: the message carries the TRA field, so
+ *                              the queue-to-write time is counted for each subscriber
+ */
+void SCDTopicBench::fanOut()
+{
+   QFETCH(int, subscribers);
+   QFETCH(int, qos);
+   QFETCH(bool, traced);
+
+   SCDTopicServer server;
+
+   SCDBenchConnection publisher;
+
+   QVector<SCDBenchConnection *> clients;
+
+   server.openConnection(&publisher);
+   server.processMessage(&publisher, "SCDTMH:1.0\tTMK:bench\n");
+
+   for (int n=0; n<subscribers; n++)
+   {
+      SCDBenchConnection *client = new SCDBenchConnection();
+
+      clients.append(client);
+
+      server.openConnection(client);
+      server.processMessage(client, qos ? "SCDTMH:1.0\tTRC:bench\tQOS:1\n" : "SCDTMH:1.0\tTRC:bench\n");
+   }
+
+   QString message = "SCDTMH:1.0\tTSM:bench" + QString(traced ? "\tTRA:1" : "") + "\n" + QString(64,'x');
+
+   QBENCHMARK
+   {
+      server.processMessage(&publisher, message);
+
+      while (!server.fanOutJobs.isEmpty()) // large topic: the chunks are delivered from the event loop
+      {
+         server.onFanOutTimeout();
+      }
+
+      for (int n=0; qos && n<clients.size(); n++)
+      {
+         server.processMessage(clients.at(n), "SCDTMH:1.0\tTAK:" + QString::number(clients.at(n)->sequence) + "\n");
+      }
+   }
+
+   QVERIFY(clients.last()->frames > 1); // subscription notify + messages
+
+   if (qos)
+   {
+      QVERIFY(clients.last()->sequence > 0);
+   }
+
+   if (traced)
+   {
+      QVERIFY(server.topics.value("bench")->latency->count >= quint64(subscribers));
+   }
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      server.closeConnection(clients.at(n));
+   }
+
+   server.closeConnection(&publisher);
+
+   qDeleteAll(clients);
+}
+
+/**
+ * @brief SCDTopicBench::filter_data
+ */
+void SCDTopicBench::filter_data()
+{
+   QTest::addColumn<QString>("expression");
+   QTest::addColumn<QString>("message");
+   QTest::addColumn<bool>("valid");
+   QTest::addColumn<bool>("matches");
+
+   // comparisons
+
+   QTest::newRow("gt")       << "value > 10" << "{\"value\":20}" << true << true;
+   QTest::newRow("gt/false") << "value > 10" << "{\"value\":5}"  << true << false;
+   QTest::newRow("range")    << "value >= 10 && value <= 20" << "{\"value\":10}" << true << true;
+   QTest::newRow("eq/=")     << "value = 3"  << "{\"value\":3}"  << true << true;
+   QTest::newRow("negative") << "value < -5" << "{\"value\":-6}" << true << true;
+
+   // value sets
+
+   QTest::newRow("in/string")       << "sensor in {'s1', \"s2\"}" << "{\"sensor\":\"s2\"}" << true << true;
+   QTest::newRow("in/string/false") << "sensor in {'s1', \"s2\"}" << "{\"sensor\":\"s3\"}" << true << false;
+   QTest::newRow("in/number")       << "code in {1, 2, 3}"      << "{\"code\":2}"      << true << true;
+   QTest::newRow("in/mismatch")     << "code in {'2'}"          << "{\"code\":2}"      << true << false;
+
+   // negation
+
+   QTest::newRow("not/!")       << "!(value > 10)"    << "{\"value\":5}" << true << true;
+   QTest::newRow("not/word")    << "not value > 10"   << "{\"value\":5}" << true << true;
+   QTest::newRow("not/not")     << "not not value > 10" << "{\"value\":5}" << true << false;
+   QTest::newRow("not/exists")  << "!missing"         << "{\"value\":5}" << true << true;
+   QTest::newRow("not/prefix")  << "notes"            << "{\"notes\":1}" << true << true; // not a keyword
+
+   // precedence: and binds tighter than or
+
+   QTest::newRow("or-and")       << "a == 1 or b == 1 and c == 1"   << "{\"a\":1,\"b\":0,\"c\":0}" << true << true;
+   QTest::newRow("(or)-and")     << "(a == 1 or b == 1) and c == 1" << "{\"a\":1,\"b\":0,\"c\":0}" << true << false;
+   QTest::newRow("and-or")       << "a == 1 && b == 1 || c == 1"    << "{\"a\":0,\"b\":1,\"c\":1}" << true << true;
+   QTest::newRow("and-(or)")     << "a == 1 && (b == 1 || c == 1)"  << "{\"a\":0,\"b\":1,\"c\":1}" << true << false;
+   QTest::newRow("not-and")      << "!a == 1 and b == 1"            << "{\"a\":0,\"b\":1}"         << true << true;
+   QTest::newRow("keyword case") << "value > 1 AND value < 3 OR false_field" << "{\"value\":2}"     << true << true;
+
+   // nested fields
+
+   QTest::newRow("nested")          << "sensor.id == 's1'"        << "{\"sensor\":{\"id\":\"s1\"}}"          << true << true;
+   QTest::newRow("nested/deep")     << "sensor.room.floor >= 2"   << "{\"sensor\":{\"room\":{\"floor\":3}}}" << true << true;
+   QTest::newRow("nested/scalar")   << "sensor.id == 's1'"        << "{\"sensor\":\"s1\"}"                   << true << false;
+   QTest::newRow("nested/missing")  << "sensor.id"                << "{\"sensor\":{\"name\":\"s1\"}}"        << true << false;
+   QTest::newRow("nested/exists")   << "sensor.id"                << "{\"sensor\":{\"id\":null}}"            << true << true;
+
+   // strings, booleans, null
+
+   QTest::newRow("string/eq")    << "name == \"alpha\"" << "{\"name\":\"alpha\"}" << true << true;
+   QTest::newRow("string/lt")    << "name < 'b'"        << "{\"name\":\"alpha\"}" << true << true;
+   QTest::newRow("string/ge")    << "name >= 'b'"       << "{\"name\":\"alpha\"}" << true << false;
+   QTest::newRow("bool/eq")      << "active == true"    << "{\"active\":true}"    << true << true;
+   QTest::newRow("bool/ne")      << "active != true"    << "{\"active\":false}"   << true << true;
+   QTest::newRow("bool/ordered") << "active > false"    << "{\"active\":true}"    << true << false;
+   QTest::newRow("null")         << "owner == null"     << "{\"owner\":null}"     << true << true;
+
+   // type mismatch: false, except != on an existing field
+
+   QTest::newRow("mismatch/eq")      << "value == '10'" << "{\"value\":10}" << true << false;
+   QTest::newRow("mismatch/ne")      << "value != '10'" << "{\"value\":10}" << true << true;
+   QTest::newRow("mismatch/lt")      << "value < '10'"  << "{\"value\":10}" << true << false;
+   QTest::newRow("missing/ne")       << "value != 10"   << "{\"other\":1}"  << true << false;
+   QTest::newRow("missing/exists")   << "value"         << "{\"other\":1}"  << true << false;
+
+   // compile errors
+
+   QTest::newRow("error/empty")        << ""                 << "{}" << false << false;
+   QTest::newRow("error/value")        << "value >"          << "{}" << false << false;
+   QTest::newRow("error/set")          << "value in {1, 2"   << "{}" << false << false;
+   QTest::newRow("error/set brace")    << "value in 1"       << "{}" << false << false;
+   QTest::newRow("error/paren")        << "(value > 1"       << "{}" << false << false;
+   QTest::newRow("error/string")       << "name == 'abc"     << "{}" << false << false;
+   QTest::newRow("error/trailing")     << "value > 1 extra"  << "{}" << false << false;
+   QTest::newRow("error/field")        << "a..b == 1"        << "{}" << false << false;
+   QTest::newRow("error/operand")      << "&& value"         << "{}" << false << false;
+   QTest::newRow("error/and operand")  << "value > 1 and"    << "{}" << false << false;
+}
+
+/**
+ * @brief SCDTopicBench::filter compile a content filter and evaluate it on a JSON object message: an invalid
+ *                              expression must report an error and never match
+ */
+void SCDTopicBench::filter()
+{
+   QFETCH(QString, expression);
+   QFETCH(QString, message);
+   QFETCH(bool, valid);
+   QFETCH(bool, matches);
+
+   SCDFilter filter;
+
+   QCOMPARE(filter.compile(expression), valid);
+   QCOMPARE(filter.lastError().isEmpty(), valid);
+
+   QJsonDocument document = QJsonDocument::fromJson(message.toUtf8());
+
+   QVERIFY(document.isObject());
+
+   QCOMPARE(filter.matches(document.object()), matches);
+}
+
+/**
+ * @brief SCDTopicBench::publishBatch_data
+ */
+void SCDTopicBench::publishBatch_data()
+{
+   QTest::addColumn<bool>("batched");
+
+   QTest::newRow("single") << false;
+   QTest::newRow("batch")  << true;
+}
+
+/**
+ * @brief SCDTopicBench::publishBatch publish 16 small messages to a topic having 10 subscribers: one TSM frame each,
+ *                                    or a single TBM frame coalescing them (one notify instead of 16)
+ */
+void SCDTopicBench::publishBatch()
+{
+   QFETCH(bool, batched);
+
+   SCDTopicServer server;
+
+   SCDBenchConnection publisher;
+
+   QVector<SCDBenchConnection *> clients;
+
+   server.openConnection(&publisher);
+   server.processMessage(&publisher, "SCDTMH:1.0\tTMK:bench\n");
+
+   for (int n=0; n<10; n++)
+   {
+      SCDBenchConnection *client = new SCDBenchConnection();
+
+      clients.append(client);
+
+      server.openConnection(client);
+      server.processMessage(client, "SCDTMH:1.0\tTRC:bench\n");
+   }
+
+   QStringList messages;
+   QString     batch;
+
+   for (int n=0; n<16; n++)
+   {
+      messages << "SCDTMH:1.0\tTSM:bench\n{\"value\":" + QString::number(n) + "}";
+
+      batch += QString::number(messages.last().size()) + "\n" + messages.last();
+   }
+
+   batch = "SCDTMH:1.0\tTBM:16\n" + batch;
+
+   QBENCHMARK
+   {
+      if (batched)
+      {
+         server.processMessage(&publisher, batch);
+      }
+      else
+      {
+         for (int n=0; n<messages.size(); n++)
+         {
+            server.processMessage(&publisher, messages.at(n));
+         }
+      }
+   }
+
+   QVERIFY(clients.last()->frames >= 17); // subscription notify + messages
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      server.closeConnection(clients.at(n));
+   }
+
+   server.closeConnection(&publisher);
+
+   qDeleteAll(clients);
+}
+
+/**
+ * @brief SCDTopicBench::publishAllocations_data
+ */
+void SCDTopicBench::publishAllocations_data()
+{
+   QTest::addColumn<int>("subscribers");
+   QTest::addColumn<QString>("fields"); // optional header fields of the publish
+   QTest::addColumn<bool>("limited");   // rate limits set, high enough to admit all publishes
+
+   QTest::newRow("1")            << 1   << ""           << false;
+   QTest::newRow("100")          << 100 << ""           << false;
+   QTest::newRow("priority")     << 100 << "\tPRI:high" << false;
+   QTest::newRow("rate limited") << 100 << ""           << true;
+}
+
+/**
+ * @brief SCDTopicBench::publishAllocations a steady-state publish (QoS 0, no filter, not traced) must not allocate:
+ *                                          header parsing, topic lookup, rate limits check, frame and notify
+ *                                          formatting and fan-out reuse the server buffers
+ */
+void SCDTopicBench::publishAllocations()
+{
+#ifndef __GLIBC__
+   QSKIP("allocation counting needs glibc");
+#else
+   QFETCH(int, subscribers);
+   QFETCH(QString, fields);
+   QFETCH(bool, limited);
+
+   SCDTopicServer server;
+
+   if (limited) // the token buckets of publisher and topic admit each publish
+   {
+      server.setRateLimits(1000000, 1000000000, 1000000, 1000000000, false);
+   }
+
+   SCDBenchConnection publisher;
+
+   QVector<SCDBenchConnection *> clients;
+
+   server.openConnection(&publisher);
+   server.processMessage(&publisher, "SCDTMH:1.0\tTMK:bench\n");
+
+   for (int n=0; n<subscribers; n++)
+   {
+      SCDBenchConnection *client = new SCDBenchConnection();
+
+      clients.append(client);
+
+      server.openConnection(client);
+      server.processMessage(client, "SCDTMH:1.0\tTRC:bench\n");
+   }
+
+   QString message = "SCDTMH:1.0\tTSM:bench" + fields + "\n" + QString(64,'x');
+
+   for (int n=0; n<16; n++) // warm up: the buffers grow to the frame size
+   {
+      server.processMessage(&publisher, message);
+   }
+
+   const int publishes = 1000;
+
+   allocations = 0;
+   countAllocations = true;
+
+   for (int n=0; n<publishes; n++)
+   {
+      server.processMessage(&publisher, message);
+   }
+
+   countAllocations = false;
+
+   quint64 counted = allocations;
+
+   QVERIFY2(counted==0, qPrintable(QString::number(double(counted)/publishes) + " allocations for each publish"));
+
+   QVERIFY(clients.last()->frames > publishes);
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      server.closeConnection(clients.at(n));
+   }
+
+   server.closeConnection(&publisher);
+
+   qDeleteAll(clients);
+#endif
+}
+
+/**
+ * @brief SCDTopicBench::bufferPool a frame shared by two write queues is recycled when the second one releases it,
+ *                                  then reused for the next frame of its size class; oversized buffers are not pooled
+ */
+void SCDTopicBench::bufferPool()
+{
+   SCDBufferPool pool(4*1024);
+
+   QByteArray frame = pool.acquire(100);
+
+   QCOMPARE(frame.capacity(), SCDBufferPool::smallestClass);
+   QVERIFY(frame.isEmpty());
+
+   frame.append(QByteArray(100, 'x'));
+
+   const char *storage = frame.constData();
+
+   QByteArray queued = frame; // another connection queue
+
+   pool.release(frame);
+
+   QVERIFY(frame.isNull());
+   QCOMPARE(pool.freeBytes(), qint64(0)); // still queued
+
+   pool.release(queued);
+
+   QCOMPARE(pool.freeBytes(), qint64(SCDBufferPool::smallestClass));
+
+   QByteArray next = pool.acquire(200);
+
+   QVERIFY(next.isEmpty());
+   QVERIFY(next.constData() == storage);
+   QCOMPARE(pool.reused(), quint64(1));
+
+   next.append(QByteArray(1000, 'x')); // grown beyond its class
+
+   pool.release(next);
+
+   QCOMPARE(pool.freeBytes(), qint64(0));
+
+   QByteArray large = pool.acquire(1024*1024);
+
+   QVERIFY(large.capacity() >= 1024*1024);
+
+   pool.release(large);
+
+   QCOMPARE(pool.freeBytes(), qint64(0));
+
+   QVector<QByteArray> frames; // over the limit of the class: not kept
+
+   for (int n=0; n<32; n++)
+   {
+      frames.append(pool.acquire(10));
+   }
+
+   for (int n=0; n<frames.size(); n++)
+   {
+      pool.release(frames[n]);
+   }
+
+   QCOMPARE(pool.freeBytes(), qint64(4*1024));
+}
+
+/**
+ * @brief SCDTopicBench::durableSpill publish to a topic having an offline durable subscriber: the messages over the
+ *                                    memory queue (1000) are appended to the spool segments
+ */
+void SCDTopicBench::durableSpill()
+{
+   SCDTopicServer server;
+
+   server.setReliableDelivery(100, 1000, 5000, 60000);
+   server.setDurableSpool(dir.path() + "/spool", 1024*1024, 0);
+
+   SCDBenchConnection publisher;
+   SCDBenchConnection subscriber;
+
+   server.openConnection(&publisher);
+   server.processMessage(&publisher, "SCDTMH:1.0\tTMK:bench\n");
+
+   server.openConnection(&subscriber);
+   server.processMessage(&subscriber, "SCDTMH:1.0\tTRC:bench\tDUR:bench\n");
+   server.closeConnection(&subscriber); // offline: the subscription is kept
+
+   QString message = "SCDTMH:1.0\tTSM:bench\n" + QString(64,'x');
+
+   QBENCHMARK
+   {
+      server.processMessage(&publisher, message);
+   }
+
+   QStringList stats = server.durableStats("bench").split('|'); // <name>|<online>|<memory>|<disk>|<disk bytes>|<limit>|<drops>|<expired>
+
+   QCOMPARE(stats.size(), 8);
+   QCOMPARE(stats.at(1), QString("0"));
+
+   SCDBenchConnection client; // back online: drain the queue, acknowledging each window
+
+   server.openConnection(&client);
+   server.processMessage(&client, "SCDTMH:1.0\tTRC:bench\tDUR:bench\n");
+
+   quint64 acked = 0;
+
+   while (client.sequence > acked)
+   {
+      acked = client.sequence;
+
+      server.processMessage(&client, "SCDTMH:1.0\tTAK:" + QString::number(acked) + "\n");
+   }
+
+   stats = server.durableStats("bench").split('|');
+
+   QCOMPARE(stats.at(1), QString("1"));
+   QCOMPARE(stats.at(2), QString("0"));
+   QCOMPARE(stats.at(3), QString("0"));
+   QCOMPARE(stats.at(6), QString("0"));
+
+   server.closeConnection(&client);
+   server.closeConnection(&publisher);
+}
+
+/**
+ * @brief SCDTopicBench::hierarchicalWheel timeouts from a tick to beyond the wheel range expire at their tick, never
+ *                                         earlier, whatever the steps the wheel is advanced by
+ */
+void SCDTopicBench::hierarchicalWheel()
+{
+   SCDHierarchicalWheel<int> wheel(10);
+
+   wheel.start(0);
+
+   QList<qint64> timeouts;
+
+   timeouts << 5 << 10 << 639 << 640 << 41000 << 41005 << 3000000 << 200000000; // the last one beyond 64^4 ticks
+
+   for (int n=0; n<timeouts.size(); n++)
+   {
+      wheel.schedule(n, timeouts.at(n));
+   }
+
+   QCOMPARE(wheel.size(), timeouts.size());
+
+   qint64 now = 0;
+
+   int expiredCount = 0;
+
+   while (wheel.size()>0)
+   {
+      qint64 last = now;
+
+      now += (now<100000) ? 7 : 99991; // fine steps, then long ones
+
+      QList<int> expired;
+
+      expiredCount += wheel.advance(now, expired);
+
+      for (int n=0; n<expired.size(); n++)
+      {
+         qint64 tick = qMax(timeouts.at(expired.at(n))/10, qint64(1)); // an item already due expires at next tick
+
+         QVERIFY2(tick <= now/10 && tick > last/10, qPrintable("timeout " + QString::number(timeouts.at(expired.at(n))) + " expired at " + QString::number(now)));
+      }
+   }
+
+   QCOMPARE(expiredCount, timeouts.size());
+}
+
+/**
+ * @brief SCDTopicBench::messageExpiry publish 150 messages having a TTL of 50 msec to a topic having a subscriber
+ *                                     whose transport window is full, an anonymous QoS 1 subscriber (queue of 100)
+ *                                     and an offline durable subscriber (100 messages in memory, 50 spilled), and a
+ *                                     document to a delta encoded topic: the expiry sweep drops the frames waiting into
+ *                                     lanes and the QoS 1 messages, clears the document, and the spilled messages are
+ *                                     dropped when read back
+ */
+void SCDTopicBench::messageExpiry()
+{
+   SCDTopicServer server;
+
+   server.setHeartbeat(0, 0);
+   server.setOutboundLimits(1024, 10000);
+   server.setReliableDelivery(10, 100, 5000, 60000);
+   server.setDurableSpool(dir.path() + "/expiry", 1024*1024, 0);
+
+   SCDBenchConnection publisher;
+   SCDBenchConnection slow;     // transport window full: frames wait into lanes
+   SCDBenchConnection reliable; // QoS 1
+   SCDBenchConnection durable;  // offline
+
+   server.openConnection(&publisher);
+   server.processMessage(&publisher, "SCDTMH:1.0\tTMK:expiry\n");
+   server.processMessage(&publisher, "SCDTMH:1.0\tTMK:expiry/state\tDLT:1\n");
+
+   server.openConnection(&slow, true);
+   server.processMessage(&slow, "SCDTMH:1.0\tTRC:expiry\n");
+
+   server.openConnection(&reliable);
+   server.processMessage(&reliable, "SCDTMH:1.0\tTRC:expiry\tQOS:1\n");
+
+   server.openConnection(&durable);
+   server.processMessage(&durable, "SCDTMH:1.0\tTRC:expiry\tDUR:expiry\n");
+   server.closeConnection(&durable);
+
+   QString message = "SCDTMH:1.0\tTSM:expiry\tTTL:50\n" + QString(64,'x');
+
+   for (int n=0; n<150; n++)
+   {
+      server.processMessage(&publisher, message);
+   }
+
+   server.processMessage(&publisher, "SCDTMH:1.0\tTSM:expiry/state\tTTL:50\n{\"value\":1}");
+
+   int queued = slow.queued;
+
+   QVERIFY(queued>0);
+   QCOMPARE(reliable.session->messages.size(), 100);
+   QVERIFY(server.topics.value("expiry/state")->hasState);
+   QVERIFY(server.expiryTimer.isActive());
+
+   QTest::qWait(400); // expiry wheel ticks
+
+   QCOMPARE(slow.queued, 0);
+   QCOMPARE(slow.expired, quint64(queued));
+   QCOMPARE(reliable.session->expired, quint64(100));
+   QVERIFY(!server.topics.value("expiry/state")->hasState);
+
+   QStringList stats = server.durableStats("expiry").split('|');
+
+   QCOMPARE(stats.size(), 8);
+   QCOMPARE(stats.at(3), QString("50"));   // on disk: dropped when read back
+   QCOMPARE(stats.at(7), QString("100"));
+
+   SCDBenchConnection client; // back online: the expired messages are sent as markers, acknowledged as any message
+
+   server.openConnection(&client);
+   server.processMessage(&client, "SCDTMH:1.0\tTRC:expiry\tDUR:expiry\n");
+
+   quint64 acked = 0;
+
+   while (client.sequence > acked)
+   {
+      acked = client.sequence;
+
+      server.processMessage(&client, "SCDTMH:1.0\tTAK:" + QString::number(acked) + "\n");
+   }
+
+   QCOMPARE(acked, quint64(150));
+
+   stats = server.durableStats("expiry").split('|');
+
+   QCOMPARE(stats.at(2), QString("0"));
+   QCOMPARE(stats.at(3), QString("0"));
+   QCOMPARE(stats.at(7), QString("150"));
+
+   stats = server.topicStats("expiry").split('|');
+
+   QCOMPARE(stats.last(), QString::number(queued + 100 + 150));
+   QCOMPARE(server.topicStats("expiry/state").split('|').last(), QString("1"));
+
+   QVERIFY(!server.expiryTimer.isActive());
+
+   server.closeConnection(&client);
+   server.closeConnection(&reliable);
+   server.closeConnection(&slow);
+   server.closeConnection(&publisher);
+}
+
+/**
+ * @brief SCDTopicBench::largeFanOut publish two messages to a topic having 200 subscribers, half of them filtered,
+ *                                   delivered in chunks of 25 with 2 filter workers, which evaluate the filters after
+ *                                   the publish has returned: the subscriptions changed between the publishes must
+ *                                   not change the snapshot of the first message, and each subscriber must receive
+ *                                   the messages in order. Two parked subscriptions held by the snapshot of the
+ *                                   second message are deleted meanwhile: they must be skipped. A filter unscribed
+ *                                   while the workers evaluate it is freed once they are done
+ */
+void SCDTopicBench::largeFanOut()
+{
+   SCDTopicServer server;
+
+   server.setHeartbeat(0, 0);
+   server.setFanOut(100, 25, 2);
+
+   SCDBenchConnection publisher;
+
+   QVector<SCDBenchConnection *> clients;
+
+   server.openConnection(&publisher);
+   server.processMessage(&publisher, "SCDTMH:1.0\tTMK:fanout\n");
+
+   for (int n=0; n<200; n++)
+   {
+      SCDBenchConnection *client = new SCDBenchConnection();
+
+      client->keepLast = true;
+
+      clients.append(client);
+
+      server.openConnection(client);
+      server.processMessage(client, (n%2) ? "SCDTMH:1.0\tTRC:fanout\tFLT:value > 10\n" : "SCDTMH:1.0\tTRC:fanout\n");
+   }
+
+   server.processMessage(clients.at(190), "SCDTMH:1.0\tTSR:\n"); // parked on close
+   server.processMessage(clients.at(192), "SCDTMH:1.0\tTSR:\n");
+
+   QString expiring = clients.at(190)->resumeToken;
+   QString resuming = clients.at(192)->resumeToken;
+
+   SCDTopic *entry = server.topics.value("fanout");
+
+   server.processMessage(&publisher, "SCDTMH:1.0\tTSM:fanout\n{\"value\":20}");
+
+   QCOMPARE(server.fanOutJobs.size(), 1);
+   QCOMPARE(server.fanOutJobs.first().filters->tasks, 2); // evaluated by the workers: publish returned meanwhile
+   QCOMPARE(clients.at(0)->frames, 1);
+
+   server.fanOutPool.waitForDone();
+   server.onFanOutTimeout();
+
+   QCOMPARE(clients.at(24)->frames, 2); // subscription notify + first chunk
+   QCOMPARE(clients.at(25)->frames, 1);
+
+   SCDBenchConnection late; // subscribed after the first message
+
+   late.keepLast = true;
+
+   server.openConnection(&late);
+   server.processMessage(&late, "SCDTMH:1.0\tTRC:fanout\n");
+   server.processMessage(clients.at(198), "SCDTMH:1.0\tTUC:fanout\n"); // still into the snapshot
+   server.closeConnection(clients.at(196));                             // skipped
+
+   QCOMPARE(entry->subscribers.size(), 199);
+   QCOMPARE(server.fanOutJobs.first().subscribers.size(), 200);
+   QVERIFY(server.fanOutJobs.first().subscribers.constData() != entry->subscribers.constData()); // copied on write
+
+   server.closeConnection(clients.at(190)); // skipped, then parked into the snapshot of the second message
+   server.closeConnection(clients.at(192));
+
+   SCDConnection *expired = server.parkedSessions.value(expiring);
+   SCDConnection *resumed = server.parkedSessions.value(resuming);
+
+   QVERIFY(expired && resumed);
+
+   server.processMessage(&publisher, "SCDTMH:1.0\tTSM:fanout\n{\"value\":5}");
+
+   QCOMPARE(server.fanOutJobs.size(), 2);
+   QCOMPARE(clients.at(0)->frames, 2); // after the first message
+   QVERIFY(server.fanOutJobs.last().subscribers.contains(expired));
+   QVERIFY(server.fanOutJobs.last().subscribers.contains(resumed));
+
+   server.processMessage(clients.at(197), "SCDTMH:1.0\tTUC:fanout\n"); // filtered: read by the workers
+
+   QCOMPARE(server.retiredFilters.size(), 1);
+
+   server.parkedSessions.value(expiring)->detached -= server.resumeGrace; // grace period expired: deleted
+   server.lastExpiryCheck = -1000;
+
+   server.onRedeliveryTimeout();
+
+   SCDBenchConnection next; // resumed: the parked record is deleted
+
+   next.keepLast = true;
+
+   server.openConnection(&next);
+   server.processMessage(&next, "SCDTMH:1.0\tTSR:" + resuming + "\n");
+
+   QVERIFY(server.parkedSessions.isEmpty());
+   QVERIFY(server.fanOutClosed.contains(expired)); // their addresses may be reused meanwhile: skipped
+   QVERIFY(server.fanOutClosed.contains(resumed));
+   QCOMPARE(next.topics.size(), 1);
+
+   while (!server.fanOutJobs.isEmpty())
+   {
+      server.onFanOutTimeout();
+   }
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      if (n==190 || n==192 || n==196 || n==197 || n==198)
+      {
+         continue;
+      }
+
+      QCOMPARE(clients.at(n)->frames, (n%2) ? 2 : 3); // the filtered ones do not receive the second message
+      QVERIFY(clients.at(n)->last.endsWith((n%2) ? "{\"value\":20}" : "{\"value\":5}"));
+   }
+
+   QCOMPARE(clients.at(190)->frames, 2); // notify, token notify: closed before their chunk
+   QCOMPARE(clients.at(192)->frames, 2);
+   QCOMPARE(clients.at(196)->frames, 1);
+   QCOMPARE(clients.at(197)->frames, 3); // notify, first message, unscribe notify
+   QCOMPARE(clients.at(198)->frames, 3); // notify, unscribe notify, first message
+   QVERIFY(clients.at(198)->last.endsWith("{\"value\":20}"));
+   QCOMPARE(late.frames, 2);
+   QVERIFY(late.last.endsWith("{\"value\":5}"));
+   QCOMPARE(next.frames, 1); // token notify: the message published while parked is lost
+
+   QCOMPARE(entry->fanOuts, 0);
+   QCOMPARE(entry->drops, quint64(0));
+   QVERIFY(server.fanOutClosed.isEmpty());
+   QVERIFY(server.filterBatches.isEmpty());
+   QVERIFY(server.retiredFilters.isEmpty()); // freed
+   QVERIFY(!server.fanOutTimer.isActive());
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      if (n!=190 && n!=192 && n!=196)
+      {
+         server.closeConnection(clients.at(n));
+      }
+   }
+
+   server.closeConnection(&late);
+   server.closeConnection(&next);
+   server.closeConnection(&publisher);
+
+   qDeleteAll(clients);
+}
+
+/**
+ * @brief SCDTopicBench::sessionResume_data
+ */
+void SCDTopicBench::sessionResume_data()
+{
+   QTest::addColumn<int>("topics");
+
+   QTest::newRow("10")   << 10;
+   QTest::newRow("1000") << 1000;
+}
+
+/**
+ * @brief SCDTopicBench::sessionResume a client subscribed to n dynamic topics disconnects and reconnects with its
+ *                                     resume token: the subscriptions are parked and resumed, the dynamic topics are
+ *                                     never removed (the disconnect benchmark gives the cost of dropping them)
+ */
+void SCDTopicBench::sessionResume()
+{
+   QFETCH(int, topics);
+
+   SCDTopicServer server;
+
+   server.setHeartbeat(0, 0);
+
+   SCDBenchConnection clients[2]; // connection records reused, as the epoll backend does
+
+   int current = 0;
+
+   server.openConnection(&clients[0]);
+   server.processMessage(&clients[0], "SCDTMH:1.0\tTSR:\n");
+
+   QString token = clients[0].resumeToken;
+
+   QVERIFY(!token.isEmpty());
+
+   for (int n=0; n<topics; n++)
+   {
+      server.processMessage(&clients[0], "SCDTMH:1.0\tTRN:resume/" + QString::number(n) + "\n");
+   }
+
+   QString resume = "SCDTMH:1.0\tTSR:" + token + "\n";
+
+   QBENCHMARK
+   {
+      SCDBenchConnection &next = clients[1-current];
+
+      server.closeConnection(&clients[current]);
+
+      next.resetState();
+
+      server.openConnection(&next);
+      server.processMessage(&next, resume);
+
+      current = 1-current;
+   }
+
+   SCDBenchConnection &client = clients[current];
+
+   QCOMPARE(client.topics.size(), topics);
+   QCOMPARE(server.topics.size(), topics);
+   QCOMPARE(client.resumeToken, token);
+   QVERIFY(server.parkedSessions.isEmpty());
+
+   server.closeConnection(&client); // grace period expired: the subscriptions are dropped
+
+   QCOMPARE(server.parkedSessions.size(), 1);
+
+   server.parkedSessions.value(token)->detached -= server.resumeGrace;
+   server.lastExpiryCheck = -1000;
+
+   server.onRedeliveryTimeout();
+
+   QVERIFY(server.parkedSessions.isEmpty());
+   QVERIFY(server.topics.isEmpty());
+
+   SCDBenchConnection late;
+
+   server.openConnection(&late);
+   server.processMessage(&late, resume); // expired token: a new one
+
+   QVERIFY(!late.resumeToken.isEmpty());
+   QVERIFY(late.resumeToken != token);
+   QVERIFY(late.topics.isEmpty());
+
+   server.closeConnection(&late);
+}
+
+/**
+ * @brief SCDTopicBench::multicastLoopback publish 100 messages to a multicast topic having 100 receivers: the group
+ *                                         receives them once, in sequence, the receivers connections only get the
+ *                                         announce and the subscription notify. A receiver then asks all of them
+ *                                         again (TMR): the server keeps the last 64, the older ones are reported lost.
+ *                                         A message too large for the group is reported lost on repair, and the last
+ *                                         sequence announce carries the last datagram sent to the group
+ */
+void SCDTopicBench::multicastLoopback()
+{
+   QNetworkInterface loopback;
+
+   QList<QNetworkInterface> interfaces = QNetworkInterface::allInterfaces();
+
+   for (int n=0; n<interfaces.size(); n++)
+   {
+      if ((interfaces.at(n).flags() & QNetworkInterface::IsLoopBack) && (interfaces.at(n).flags() & QNetworkInterface::IsUp))
+      {
+         loopback = interfaces.at(n);
+      }
+   }
+
+   QHostAddress group("239.255.43.21");
+
+   QUdpSocket receiver;
+
+   if (!loopback.isValid() || !receiver.bind(QHostAddress::AnyIPv4, 0, QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)
+       || !receiver.joinMulticastGroup(group, loopback))
+   {
+      QSKIP("multicast not available on loopback");
+   }
+
+   SCDMulticast multicast;
+
+   multicast.setLimits(64, 1472);
+
+   QVERIFY2(multicast.start(group.toString(), receiver.localPort(), 1, loopback.name()), qPrintable(multicast.lastError()));
+
+   SCDTopicServer server;
+
+   server.setMulticast(&multicast);
+
+   SCDBenchConnection publisher;
+
+   QVector<SCDBenchConnection *> clients;
+
+   server.openConnection(&publisher);
+   server.processMessage(&publisher, "SCDTMH:1.0\tTMK:bench\tMCA:1\n");
+
+   for (int n=0; n<100; n++)
+   {
+      SCDBenchConnection *client = new SCDBenchConnection();
+
+      clients.append(client);
+
+      server.openConnection(client);
+      server.processMessage(client, "SCDTMH:1.0\tTRC:bench\tMCA:1\n");
+   }
+
+   QCOMPARE(server.topics.value("bench")->multicastReceivers, 100);
+   QCOMPARE(clients.last()->frames, 2); // announce, notify
+
+   const int messages = 100;
+
+   QString message = "SCDTMH:1.0\tTSM:bench\n" + QString(64,'x');
+
+   for (int n=0; n<messages; n++)
+   {
+      server.processMessage(&publisher, message);
+   }
+
+   QCOMPARE(multicast.sent(), quint64(messages)); // once for all receivers
+   QCOMPARE(clients.last()->frames, 2);
+
+   int received = 0;
+
+   while (received<messages && (receiver.hasPendingDatagrams() || receiver.waitForReadyRead(1000)))
+   {
+      while (receiver.hasPendingDatagrams())
+      {
+         QByteArray datagram;
+
+         datagram.resize(int(receiver.pendingDatagramSize()));
+
+         receiver.readDatagram(datagram.data(), datagram.size());
+
+         QStringList items = QString::fromUtf8(datagram).section('\n', 0, 0).split('\t'); // SCDMCA:1.0, source, topic, sequence
+
+         QCOMPARE(items.size(), 4);
+         QCOMPARE(items.at(2), QString("bench"));
+         QCOMPARE(items.at(3).toInt(), ++received);
+         QVERIFY(datagram.endsWith("@bench]:" + QByteArray(64,'x')));
+      }
+   }
+
+   QCOMPARE(received, messages);
+
+   SCDBenchConnection *client = clients.first();
+
+   server.processMessage(client, "SCDTMH:1.0\tTMR:bench\tSEQ:1\tEND:100\n");
+
+   QCOMPARE(client->frames, 2 + 1 + 64 + 1); // lost marker, messages 37...100, notify
+
+   server.processMessage(&publisher, "SCDTMH:1.0\tTSM:bench\n" + QString(2048,'x')); // too large for the group
+
+   QCOMPARE(multicast.sent(), quint64(messages));
+   QCOMPARE(clients.last()->frames, 3);
+
+   QVERIFY(server.topics.value("bench")->multicastHistory.at(101 % 64).isEmpty()); // not kept for repairs
+
+   client->keepLast = true;
+
+   server.processMessage(client, "SCDTMH:1.0\tTMR:bench\tSEQ:101\tEND:101\n");
+
+   QCOMPARE(client->frames, 2 + 1 + 64 + 1 + 1 + 2); // the large message, then its lost marker and the notify
+   QVERIFY(client->last.contains("|2|1 messages lost"));
+
+   QVERIFY(server.multicastTimer.isActive());
+
+   server.onMulticastTimeout(); // tail loss detection: last sequence sent to the group
+
+   QVERIFY(receiver.waitForReadyRead(1000));
+
+   QByteArray datagram;
+
+   datagram.resize(int(receiver.pendingDatagramSize()));
+
+   receiver.readDatagram(datagram.data(), datagram.size());
+
+   QStringList items = QString::fromUtf8(datagram).section('\n', 0, 0).split('\t');
+
+   QCOMPARE(items.size(), 5);
+   QCOMPARE(items.at(3), QString::number(messages)); // the large message is not announced
+   QCOMPARE(items.at(4), QString("LAST"));
+   QCOMPARE(multicast.sent(), quint64(messages));
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      server.closeConnection(clients.at(n));
+   }
+
+   server.closeConnection(&publisher);
+
+   qDeleteAll(clients);
+}
+
+/**
+ * @brief SCDTopicBench::loopback_data
+ */
+void SCDTopicBench::loopback_data()
+{
+   QTest::addColumn<QString>("backend");
+   QTest::addColumn<int>("subscribers");
+
+   QTest::newRow("qt/10")     << "qt" << 10;
+   QTest::newRow("qt/500")    << "qt" << 500;
+#ifdef SCD_EPOLL_BACKEND
+   QTest::newRow("epoll/10")  << "epoll" << 10;
+   QTest::newRow("epoll/500") << "epoll" << 500;
+#endif
+}
+
+/**
+ * @brief SCDTopicBench::loopback publish a message and wait until all subscribers received it
+ */
+void SCDTopicBench::loopback()
+{
+   QFETCH(QString, backend);
+   QFETCH(int, subscribers);
+
+   SCDTopicServer server(0,0); // any port
+
+   quint16 port = 0;
+
+#ifdef SCD_EPOLL_BACKEND
+   SCDEpollServer epoll(&server);
+
+   if (backend=="epoll")
+   {
+      QVERIFY(server.start(false));
+      QVERIFY2(epoll.listen(0), qPrintable(epoll.lastError()));
+
+      port = epoll.serverPort();
+   }
+   else
+#endif
+   {
+      QVERIFY(server.start());
+
+      port = server.serverPort();
+   }
+
+   QUrl url("ws://127.0.0.1:" + QString::number(port));
+
+   QVector<QWebSocket *> sockets;
+
+   int connected = 0;
+   int notifies  = 0;
+   int received  = 0;
+
+   QString lastNotify;
+
+   for (int n=0; n<=subscribers; n++) // the last one is the publisher
+   {
+      QWebSocket *socket = new QWebSocket();
+
+      connect(socket, &QWebSocket::connected, [&connected]() { connected++; });
+      connect(socket, &QWebSocket::textMessageReceived, [&](const QString &message)
+      {
+         if (message.startsWith("[server@notify]"))
+         {
+            notifies++;
+            lastNotify = message;
+         }
+         else
+         {
+            received++;
+         }
+      });
+
+      sockets.append(socket);
+
+      socket->open(url);
+   }
+
+   QTRY_COMPARE_WITH_TIMEOUT(connected, subscribers+1, 30000);
+
+   QWebSocket *publisher = sockets.last();
+
+   publisher->sendTextMessage("SCDTMH:1.0\tTMK:bench\n");
+
+   QTRY_COMPARE(notifies, 1);
+   QVERIFY(lastNotify.startsWith("[server@notify]:TMK|bench|"));
+
+   for (int n=0; n<subscribers; n++)
+   {
+      sockets.at(n)->sendTextMessage("SCDTMH:1.0\tTRC:bench\n");
+   }
+
+   QTRY_COMPARE_WITH_TIMEOUT(notifies, subscribers+1, 30000);
+
+   QString message = "SCDTMH:1.0\tTSM:bench\n" + QString(64,'x');
+
+   int expected = 0;
+
+   QBENCHMARK
+   {
+      publisher->sendTextMessage(message);
+
+      expected += subscribers; // the publisher is not a subscriber
+
+      while (received < expected)
+      {
+         QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+      }
+   }
+
+   QCOMPARE(received, expected);
+
+#ifdef SCD_EPOLL_BACKEND
+   if (backend=="epoll") // the frame buffers written are recycled
+   {
+      QVERIFY(epoll.bufferPool().reused() > 0);
+   }
+#endif
+
+   qDeleteAll(sockets);
+}
+
+/**
+ * @brief SCDTopicBench::tlsHandshake_data
+ */
+void SCDTopicBench::tlsHandshake_data()
+{
+   QTest::addColumn<bool>("resume");
+
+   QTest::newRow("full")    << false;
+   QTest::newRow("resumed") << true;
+}
+
+/**
+ * @brief SCDTopicBench::tlsHandshake connect a TLS client to the acceptor and wait until the session is encrypted
+ */
+void SCDTopicBench::tlsHandshake()
+{
+   QFETCH(bool, resume);
+
+   QString certificate;
+   QString privateKey;
+
+   if (!makeCertificate(certificate, privateKey))
+   {
+      QSKIP("openssl not available: cannot make a self-signed certificate");
+   }
+
+   SCDTopicServer server(0,0);
+   SCDTlsAcceptor tls(&server);
+
+   QVERIFY2(tls.configure(certificate, privateKey), qPrintable(tls.lastError()));
+   QVERIFY(server.start(false));
+   QVERIFY2(tls.start(0), qPrintable(tls.lastError()));
+
+   QSslConfiguration configuration = QSslConfiguration::defaultConfiguration();
+
+   configuration.setPeerVerifyMode(QSslSocket::VerifyNone); // self-signed
+   configuration.setProtocol(QSsl::TlsV1_2); // the ticket comes with the handshake
+   configuration.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+   configuration.setSslOption(QSsl::SslOptionDisableSessionPersistence, false); // keep the ticket
+
+   QByteArray ticket;
+
+   if (resume) // first connection: full handshake, the ticket is issued
+   {
+      QSslSocket socket;
+
+      socket.setSslConfiguration(configuration);
+      socket.connectToHostEncrypted("127.0.0.1", tls.serverPort());
+
+      QTRY_VERIFY(socket.isEncrypted());
+
+      ticket = socket.sslConfiguration().sessionTicket();
+
+      socket.disconnectFromHost();
+
+      if (tls.ticketContextCount()==0)
+      {
+         QSKIP("Qt loads another OpenSSL library: session tickets not shared");
+      }
+
+      QVERIFY(!ticket.isEmpty());
+   }
+
+   int resumptions = tls.resumptionCount();
+   int handshakes  = 0;
+
+   QBENCHMARK
+   {
+      QSslSocket socket;
+
+      configuration.setSessionTicket(ticket);
+
+      socket.setSslConfiguration(configuration);
+      socket.connectToHostEncrypted("127.0.0.1", tls.serverPort());
+
+      QTRY_VERIFY(socket.isEncrypted());
+
+      if (resume)
+      {
+         ticket = socket.sslConfiguration().sessionTicket();
+      }
+
+      socket.disconnectFromHost();
+
+      handshakes++;
+   }
+
+   QTRY_VERIFY(tls.handshakeCount() >= handshakes); // counted on the routing thread
+
+   QCOMPARE(tls.resumptionCount()-resumptions, resume ? handshakes : 0);
+}
+
+/**
+ * @brief SCDTopicBench::wssLoopback secure web socket clients connect thru the TLS acceptor, make a topic and get the
+ *                                   server notify: the upgrade request is sent as soon as the handshake is done, so it
+ *                                   may be read before the socket is handed to the routing thread
+ */
+void SCDTopicBench::wssLoopback()
+{
+   QString certificate;
+   QString privateKey;
+
+   if (!makeCertificate(certificate, privateKey))
+   {
+      QSKIP("openssl not available: cannot make a self-signed certificate");
+   }
+
+   SCDTopicServer server(0,0);
+   SCDTlsAcceptor tls(&server);
+
+   QVERIFY2(tls.configure(certificate, privateKey), qPrintable(tls.lastError()));
+   QVERIFY(server.start(false));
+   QVERIFY2(tls.start(0), qPrintable(tls.lastError()));
+
+   QSslConfiguration configuration = QSslConfiguration::defaultConfiguration();
+
+   configuration.setPeerVerifyMode(QSslSocket::VerifyNone); // self-signed
+
+   QUrl url("wss://127.0.0.1:" + QString::number(tls.serverPort()));
+
+   const int clients = 20;
+
+   QVector<QWebSocket *> sockets;
+
+   int connected = 0;
+
+   QStringList notifies;
+
+   for (int n=0; n<clients; n++)
+   {
+      QWebSocket *socket = new QWebSocket();
+
+      connect(socket, &QWebSocket::connected, [&connected]() { connected++; });
+      connect(socket, &QWebSocket::textMessageReceived, [&notifies](const QString &message)
+      {
+         if (message.startsWith("[server@notify]"))
+         {
+            notifies.append(message);
+         }
+      });
+
+      sockets.append(socket);
+
+      socket->setSslConfiguration(configuration);
+      socket->open(url);
+   }
+
+   QTRY_COMPARE_WITH_TIMEOUT(connected, clients, 30000);
+
+   for (int n=0; n<clients; n++)
+   {
+      sockets.at(n)->sendTextMessage("SCDTMH:1.0\tTMK:secure/" + QString::number(n) + "\n");
+   }
+
+   QTRY_COMPARE_WITH_TIMEOUT(notifies.size(), clients, 30000);
+
+   for (int n=0; n<clients; n++)
+   {
+      QVERIFY(notifies.at(n).startsWith("[server@notify]:TMK|secure/"));
+   }
+
+   QCOMPARE(tls.handshakeCount(), clients);
+   QCOMPARE(tls.failureCount(), 0);
+
+   qDeleteAll(sockets);
+}
+
+QTEST_GUILESS_MAIN(SCDTopicBench)
+
+#include "scdtopicbench.moc"
@@ -0,0 +1,58 @@
+QT += network
+QT += websockets
+QT += testlib
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = scdtopicbench
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which as been marked deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# Server debug output would be measured too
+DEFINES += QT_NO_DEBUG_OUTPUT
+
+INCLUDEPATH += ../source
+
+DESTDIR = ../bin
+
+# session ticket keys shared by the TLS contexts (scdtlsacceptor.cpp)
+LIBS += -lssl -lcrypto
+
+SOURCES += scdtopicbench.cpp \
+    ../source/scdtopicserver.cpp \
+    ../source/scdfilter.cpp \
+    ../source/scdtopicbus.cpp \
+    ../source/scdtlsacceptor.cpp \
+    ../source/scdspool.cpp \
+    ../source/scdmulticast.cpp
+
+HEADERS += \
+    ../source/scdtopicserver.h \
+    ../source/scdtopic.h \
+    ../source/scdconnection.h \
+    ../source/scdtimerwheel.h \
+    ../source/scdtokenbucket.h \
+    ../source/scdfilter.h \
+    ../source/scdmergepatch.h \
+    ../source/scdtopicbus.h \
+    ../source/scdtlsacceptor.h \
+    ../source/scdspool.h \
+    ../source/scdlatency.h \
+    ../source/scdheader.h \
+    ../source/scdmulticast.h \
+    ../source/scdbufferpool.h
+
+# epoll web socket backend (linux only): qmake CONFIG+=epoll
+epoll {
+    DEFINES += SCD_EPOLL_BACKEND
+
+    SOURCES += ../source/scdepollserver.cpp
+
+    HEADERS += ../source/scdepollserver.h
+}
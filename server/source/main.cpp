@@ -11,10 +11,159 @@
  */
 #include <QCoreApplication>
 #include "scdtopicserver.h"
+#include "scdtlsacceptor.h"
+#include "scdhandover.h"
+#ifdef SCD_EPOLL_BACKEND
+#include "scdepollserver.h"
+#endif
+#include <QDebug>
 #include <QSettings>
+#include <QDir>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 #define  echo QTextStream(stderr) <<
 
+#ifdef Q_OS_UNIX
+static sigset_t workerMask; // signal mask of the worker processes: the supervisor blocks the signals it waits for
+
+/**
+ * @brief spawnWorker start a server process sharing the port
+ * @param program
+ * @param argv
+ * @return worker pid, -1 on failure
+ */
+static pid_t spawnWorker(const QByteArray &program, char *argv[])
+{
+   pid_t pid = fork();
+
+   if (pid==0)
+   {
+      sigprocmask(SIG_SETMASK, &workerMask, 0); // the mask is inherited thru exec
+
+      execv(program.constData(), argv);
+      _exit(127);
+   }
+
+   return pid;
+}
+
+/**
+ * @brief superviseWorkers start the worker processes and restart the crashed ones: a worker crashing does not stop the
+ *                         others, which keep accepting connections on the shared port. The supervisor runs no server.
+ *                         SIGTERM and SIGINT are forwarded to the workers: the supervisor exits when all have exited,
+ *                         so that stopping the service leaves no worker holding the port.
+ * @param program
+ * @param processes
+ * @param argv
+ * @return
+ */
+static int superviseWorkers(const QString &program, int processes, char *argv[])
+{
+   QByteArray path = program.toLocal8Bit();
+
+   QVector<pid_t> workers;
+
+   sigset_t signals; // waited for by sigwait: blocked, so that none is lost between two waits
+
+   sigemptyset(&signals);
+   sigaddset(&signals, SIGCHLD);
+   sigaddset(&signals, SIGTERM);
+   sigaddset(&signals, SIGINT);
+
+   sigprocmask(SIG_BLOCK, &signals, &workerMask);
+
+   qputenv("SCD_TOPIC_WORKER","1");
+
+   for (int n=0; n<processes; n++)
+   {
+      workers.append(spawnWorker(path, argv));
+   }
+
+   echo "Started " << processes << " worker processes\n";
+
+   bool stopping = false;
+
+   while (!workers.isEmpty())
+   {
+      int sig = 0;
+
+      if (sigwait(&signals, &sig)!=0)
+      {
+         break;
+      }
+
+      if ((sig==SIGTERM || sig==SIGINT) && !stopping) // stop the workers, then exit
+      {
+         echo "Stopping " << workers.size() << " worker processes\n";
+
+         stopping = true;
+
+         for (int n=0; n<workers.size(); n++)
+         {
+            kill(workers.at(n), sig);
+         }
+      }
+
+      int status;
+
+      pid_t pid;
+
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) // SIGCHLD: more children may have exited
+      {
+         int n = workers.indexOf(pid);
+
+         if (n<0)
+         {
+            continue;
+         }
+
+         if (!stopping && WIFSIGNALED(status) && WTERMSIG(status)!=SIGTERM && WTERMSIG(status)!=SIGINT && WTERMSIG(status)!=SIGKILL) // crashed
+         {
+            echo "Worker " << pid << " crashed (signal " << WTERMSIG(status) << "), restarting\n";
+
+            sleep(1); // no restart loop if it crashes at once
+
+            workers[n] = spawnWorker(path, argv);
+         }
+         else
+         {
+            workers.remove(n);
+         }
+      }
+
+      if (pid<0 && errno==ECHILD) // no child left
+      {
+         break;
+      }
+   }
+
+   return 0;
+}
+#endif
+
+/**
+ * @brief closeDescriptors close the sockets handed over by the previous process and not adopted
+ * @param fds
+ */
+static void closeDescriptors(const QVector<int> &fds)
+{
+#ifdef Q_OS_UNIX
+   for (int n=0; n<fds.size(); n++)
+   {
+      ::close(fds.at(n));
+   }
+#else
+   Q_UNUSED(fds)
+#endif
+}
+
 /**
  * @brief main server main function
  * @param argc
@@ -35,14 +184,303 @@ int main(int argc, char *argv[])
 
    int port = cfg.value("port",22345).toInt();
 
+   int heartbeatInterval = cfg.value("heartbeatInterval",30000).toInt(); // msec, 0: disabled
+   int heartbeatTimeout  = cfg.value("heartbeatTimeout",90000).toInt();  // msec
+
+   int clientMessageRate = cfg.value("clientMessageRate",0).toInt(); // publish rate limits, 0: unlimited
+   int clientByteRate    = cfg.value("clientByteRate",0).toInt();
+   int topicMessageRate  = cfg.value("topicMessageRate",0).toInt();
+   int topicByteRate     = cfg.value("topicByteRate",0).toInt();
+
+   QString rateLimitMode = cfg.value("rateLimitMode","reject").toString(); // reject or delay over limit publishes
+
+   int  maxMessageSize  = cfg.value("maxMessageSize",16*1024*1024).toInt(); // 0: unlimited
+   int  maxStreamSize   = cfg.value("maxStreamSize",0).toInt();              // 0: unlimited
+   bool streamFragments = cfg.value("streamFragments",true).toBool();
+
+   int outboundWindow = cfg.value("outboundWindow",256*1024).toInt(); // bytes, 0: priority lanes disabled
+   int outboundQueue  = cfg.value("outboundQueue",10000).toInt();     // frames
+
+   int deltaKeyframe = cfg.value("deltaKeyframe",100).toInt(); // delta encoded topics: full document after this number of deltas
+
+   int fanOutThreshold = cfg.value("fanOutThreshold",4096).toInt(); // subscribers: larger topics are delivered in chunks, 0: always at once
+   int fanOutChunkSize = cfg.value("fanOutChunkSize",1024).toInt(); // subscribers delivered at each event loop iteration
+   int fanOutWorkers   = cfg.value("fanOutWorkers",0).toInt();      // content filter evaluation threads, 0: cores - 1
+
+   int qosWindow        = cfg.value("qosWindow",100).toInt();          // QoS 1 subscriptions: messages in flight for each client
+   int qosQueue         = cfg.value("qosQueue",10000).toInt();         // messages kept for each client until acknowledged
+   int qosTimeout       = cfg.value("qosTimeout",5000).toInt();        // msec: messages not acknowledged are sent again
+   int qosSessionExpiry = cfg.value("qosSessionExpiry",60000).toInt(); // msec: session of a disconnected client is kept
+
+   int sessionResumeGrace = cfg.value("sessionResumeGrace",30000).toInt(); // msec: subscriptions of a disconnected client are kept for its resume token, 0: disabled
+
+   QString durablePath        = cfg.value("durablePath",QDir::tempPath() + "/scdtopicspool-" + QString::number(port)).toString(); // durable subscriptions spool directory
+   qint64  durableSegmentSize = cfg.value("durableSegmentSize",4*1024*1024).toLongLong(); // bytes: spool segment files size
+   qint64  durableDiskLimit   = cfg.value("durableDiskLimit",256*1024*1024).toLongLong(); // bytes: disk usage of each durable subscription, 0: unlimited
+
+   QString backend     = cfg.value("backend","qt").toString(); // web socket backend: qt or epoll (built with CONFIG+=epoll)
+   int maxConnections  = cfg.value("maxConnections",10000).toInt(); // epoll backend pre-allocated connections
+
+   int  processes = cfg.value("processes",1).toInt();        // server processes sharing the port
+   bool reusePort = cfg.value("reusePort",false).toBool();   // share the port with other server processes
+   QString busPath = cfg.value("busPath",QDir::tempPath() + "/scdtopicbus-" + QString::number(port)).toString(); // inter-process bus directory
+
+   QString tlsCertificate    = cfg.value("tlsCertificate","").toString();    // PEM certificate (and chain): wss:// when set
+   QString tlsPrivateKey     = cfg.value("tlsPrivateKey","").toString();     // PEM private key
+   QString tlsCaCertificates = cfg.value("tlsCaCertificates","").toString(); // PEM client certificate authorities, empty: no client certificate
+   int     tlsThreads        = cfg.value("tlsThreads",0).toInt();            // handshake threads, 0: cores - 1
+
+   bool    handover     = cfg.value("handover",false).toBool(); // zero-downtime restart: a new process takes over from the running one
+   QString handoverPath = cfg.value("handoverPath",QDir::tempPath() + "/scdtopicserver-" + QString::number(port) + ".handover").toString();
+
+   QString multicastGroup     = cfg.value("multicastGroup","").toString();       // multicast topics egress group, e.g. 239.255.0.1, empty: disabled
+   int     multicastPort      = cfg.value("multicastPort",port+1).toInt();        // group port
+   int     multicastTtl       = cfg.value("multicastTtl",1).toInt();              // hops: 1 keeps the datagrams on the LAN
+   QString multicastInterface = cfg.value("multicastInterface","").toString();   // outgoing interface, empty: system default
+   int     multicastHistory   = cfg.value("multicastHistory",1024).toInt();       // datagrams kept for each topic, for repairs
+   int     multicastMaxSize   = cfg.value("multicastMaxSize",1472).toInt();       // bytes: larger datagrams are sent thru web socket
+   int     multicastAnnounce  = cfg.value("multicastAnnounce",1000).toInt();      // msec between the last sequence announces
+
    cfg.setValue("port",port);
+   cfg.setValue("heartbeatInterval",heartbeatInterval);
+   cfg.setValue("heartbeatTimeout",heartbeatTimeout);
+   cfg.setValue("clientMessageRate",clientMessageRate);
+   cfg.setValue("clientByteRate",clientByteRate);
+   cfg.setValue("topicMessageRate",topicMessageRate);
+   cfg.setValue("topicByteRate",topicByteRate);
+   cfg.setValue("rateLimitMode",rateLimitMode);
+   cfg.setValue("maxMessageSize",maxMessageSize);
+   cfg.setValue("maxStreamSize",maxStreamSize);
+   cfg.setValue("streamFragments",streamFragments);
+   cfg.setValue("outboundWindow",outboundWindow);
+   cfg.setValue("outboundQueue",outboundQueue);
+   cfg.setValue("deltaKeyframe",deltaKeyframe);
+   cfg.setValue("fanOutThreshold",fanOutThreshold);
+   cfg.setValue("fanOutChunkSize",fanOutChunkSize);
+   cfg.setValue("fanOutWorkers",fanOutWorkers);
+   cfg.setValue("qosWindow",qosWindow);
+   cfg.setValue("qosQueue",qosQueue);
+   cfg.setValue("qosTimeout",qosTimeout);
+   cfg.setValue("qosSessionExpiry",qosSessionExpiry);
+   cfg.setValue("sessionResumeGrace",sessionResumeGrace);
+   cfg.setValue("durablePath",durablePath);
+   cfg.setValue("durableSegmentSize",durableSegmentSize);
+   cfg.setValue("durableDiskLimit",durableDiskLimit);
+   cfg.setValue("backend",backend);
+   cfg.setValue("maxConnections",maxConnections);
+   cfg.setValue("processes",processes);
+   cfg.setValue("reusePort",reusePort);
+   cfg.setValue("busPath",busPath);
+   cfg.setValue("tlsCertificate",tlsCertificate);
+   cfg.setValue("tlsPrivateKey",tlsPrivateKey);
+   cfg.setValue("tlsCaCertificates",tlsCaCertificates);
+   cfg.setValue("tlsThreads",tlsThreads);
+   cfg.setValue("handover",handover);
+   cfg.setValue("handoverPath",handoverPath);
+   cfg.setValue("multicastGroup",multicastGroup);
+   cfg.setValue("multicastPort",multicastPort);
+   cfg.setValue("multicastTtl",multicastTtl);
+   cfg.setValue("multicastInterface",multicastInterface);
+   cfg.setValue("multicastHistory",multicastHistory);
+   cfg.setValue("multicastMaxSize",multicastMaxSize);
+   cfg.setValue("multicastAnnounce",multicastAnnounce);
 
    cfg.sync();
 
+#ifdef Q_OS_UNIX
+   if (processes>1 && qgetenv("SCD_TOPIC_WORKER").isEmpty())
+   {
+      return superviseWorkers(a.applicationFilePath(), processes, argv);
+   }
+#endif
+
+   reusePort = reusePort || processes>1;
+
    SCDTopicServer srv(0,port);
 
+   SCDTopicBus bus(&srv);
+
+   srv.setHeartbeat(heartbeatInterval,heartbeatTimeout);
+   srv.setMessageLimits(maxMessageSize,maxStreamSize,streamFragments);
+   srv.setOutboundLimits(outboundWindow,outboundQueue);
+   srv.setDeltaKeyframe(deltaKeyframe);
+   srv.setFanOut(fanOutThreshold,fanOutChunkSize,fanOutWorkers);
+   srv.setReliableDelivery(qosWindow,qosQueue,qosTimeout,qosSessionExpiry);
+   srv.setSessionResume(sessionResumeGrace);
+   srv.setDurableSpool(durablePath,durableSegmentSize,durableDiskLimit);
+   srv.setRateLimits(clientMessageRate,clientByteRate,topicMessageRate,topicByteRate,rateLimitMode=="delay");
+   srv.setReusePort(reusePort);
+
+   if (reusePort) // more processes share the port: publishes are routed thru the bus
+   {
+      if (!bus.start(busPath))
+      {
+         echo bus.lastError() << "\n";
+         return 1;
+      }
+
+      srv.setBus(&bus);
+   }
+
+   SCDMulticast multicast;
+
+   if (!multicastGroup.isEmpty()) // multicast topics: messages sent once to the group
+   {
+      multicast.setLimits(multicastHistory,multicastMaxSize,multicastAnnounce);
+
+      if (!multicast.start(multicastGroup,quint16(multicastPort),multicastTtl,multicastInterface))
+      {
+         echo multicast.lastError() << "\n";
+         return 1;
+      }
+
+      qDebug() << multicast.lastError();
+
+      srv.setMulticast(&multicast);
+   }
+
+   SCDHandover takeover(&srv); // restart: take over from the running process
+
+   QByteArray   routerState;
+   QByteArray   transportState;
+   QVector<int> handedFds; // listening socket, then live connections
+
+   bool takingOver = handover && !reusePort && takeover.takeOver(handoverPath,routerState,transportState,handedFds) > 0;
+
+   if (handover && reusePort)
+   {
+      echo "Handover not available in multi-process mode\n";
+   }
+
+   if (takingOver)
+   {
+      qDebug() << takeover.lastError();
+
+      srv.restoreTopics(routerState);
+   }
+
+   int listenFd = takingOver ? handedFds.takeFirst() : -1;
+
+   SCDHandover handoverServer(&srv); // wait for the next restart
+
+   QObject::connect(&handoverServer, SIGNAL(handedOver()), &a, SLOT(quit()));
+
+   if (!tlsCertificate.isEmpty()) // wss://: the TLS acceptor accepts the connections, handshakes run off the routing thread
+   {
+      SCDTlsAcceptor tls(&srv);
+
+      if (tlsThreads>0)
+      {
+         tls.setThreads(tlsThreads);
+      }
+
+      if (backend!="qt")
+      {
+         echo "TLS is served by qt backend only\n";
+      }
+
+      if (tls.configure(tlsCertificate,tlsPrivateKey,tlsCaCertificates) && srv.start(false) && tls.start(port,reusePort,listenFd))
+      {
+         qDebug() << tls.lastError();
+
+         if (takingOver)
+         {
+            srv.restoreConnections(routerState, QVector<SCDConnection *>());
+
+            closeDescriptors(handedFds); // live connections are not adopted by Qt backend: clients reconnect
+
+            if (!takeover.acknowledge()) // the previous process keeps running
+            {
+               qDebug() << "Handover not acknowledged, previous process keeps running";
+               return 1;
+            }
+         }
+
+         if (handover && !reusePort && handoverServer.listen(handoverPath))
+         {
+            handoverServer.setListenDescriptor(int(tls.socketDescriptor()));
+         }
+
+         a.exec();
+      }
+      else
+      {
+         qDebug() << tls.lastError();
+      }
+
+      return 0;
+   }
+
+#ifdef SCD_EPOLL_BACKEND
+   if (backend=="epoll")
+   {
+      SCDEpollServer epoll(&srv);
+
+      epoll.setMaxConnections(maxConnections);
+      epoll.setMaxMessageSize(maxMessageSize>0 ? maxMessageSize + 1024 : 0); // header too
+      epoll.setReusePort(reusePort);
+
+      if (srv.start(false) && (takingOver ? epoll.listenOn(listenFd) : epoll.listen(port)))
+      {
+         qDebug() << epoll.lastError();
+
+         if (takingOver) // live connections keep their clients
+         {
+            srv.restoreConnections(routerState, epoll.adoptConnections(transportState, handedFds));
+
+            if (!takeover.acknowledge()) // the previous process keeps running: close the sockets without writing
+            {
+               qDebug() << "Handover not acknowledged, previous process keeps running";
+
+               epoll.releaseHandedOver();
+               return 1;
+            }
+         }
+
+         if (handover && !reusePort && handoverServer.listen(handoverPath))
+         {
+            handoverServer.setListenDescriptor(epoll.listenDescriptor());
+            handoverServer.setEpollServer(&epoll);
+         }
+
+         a.exec();
+      }
+      else
+      {
+         qDebug() << epoll.lastError();
+      }
+
+      return 0;
+   }
+#else
+   if (backend=="epoll")
+   {
+      echo "epoll backend not available: rebuild with qmake CONFIG+=epoll\n";
+   }
+#endif
+
+   srv.setListenDescriptor(listenFd);
+
    if (srv.start())
    {
+      if (takingOver)
+      {
+         srv.restoreConnections(routerState, QVector<SCDConnection *>());
+
+         closeDescriptors(handedFds); // live connections are not adopted by Qt backend: clients reconnect
+
+         if (!takeover.acknowledge()) // the previous process keeps running
+         {
+            qDebug() << "Handover not acknowledged, previous process keeps running";
+            return 1;
+         }
+      }
+
+      if (handover && !reusePort && handoverServer.listen(handoverPath))
+      {
+         handoverServer.setListenDescriptor(int(srv.socketDescriptor()));
+      }
+
       a.exec();
    }
 
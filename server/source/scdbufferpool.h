@@ -0,0 +1,166 @@
+/**
+ * @class SCDBufferPool https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server size-classed byte buffer pool
+ *
+ *        Frame buffers are taken from a free list of their size class (256 bytes ... 64KB, x4 each class) and given
+ *        back when no longer referenced, so that a long running server reuses the same blocks instead of allocating
+ *        and freeing one for each frame (allocator churn, heap fragmentation, RSS creep).
+ *
+ *        A buffer is a QByteArray with reserved capacity: it can be shared (implicitly) by many connection queues,
+ *        as a frame fanned out to many subscribers. release is called by each holder when it drops the buffer: only
+ *        the last holder gives the storage back, a buffer still shared is just dropped. Buffers larger than the
+ *        largest class, or grown beyond their class, are not pooled.
+ *
+ *        Each class keeps at most maxBytes of free buffers.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDBUFFERPOOL_H
+#define SCDBUFFERPOOL_H
+
+#include <QByteArray>
+#include <QVector>
+
+class SCDBufferPool
+{
+   public:
+
+     static const int classCount    = 5;   // 256, 1K, 4K, 16K, 64K
+     static const int smallestClass = 256;
+
+   private:
+
+     QVector<QByteArray> free[classCount]; // free buffers of each size class
+
+     int maxFree[classCount]; // max free buffers of each class
+
+     quint64 hits;   // buffers reused
+     quint64 misses; // buffers allocated
+
+     static int classSize(int index) { return smallestClass << (2*index); }
+
+     /**
+      * @brief classOf
+      * @param size
+      * @return index of the smallest class holding size bytes, classCount if too large
+      */
+     static int classOf(int size)
+     {
+        int index = 0;
+
+        while (index<classCount && classSize(index)<size)
+        {
+           index++;
+        }
+
+        return index;
+     }
+
+   public:
+
+     explicit SCDBufferPool(int maxBytes=1024*1024) : hits(0), misses(0)
+     {
+        setLimit(maxBytes);
+     }
+
+     /**
+      * @brief setLimit
+      * @param maxBytes max bytes of free buffers kept for each size class, 0: no buffer kept
+      */
+     void setLimit(int maxBytes)
+     {
+        for (int n=0; n<classCount; n++)
+        {
+           maxFree[n] = qMax(maxBytes,0) / classSize(n);
+
+           while (free[n].size() > maxFree[n])
+           {
+              free[n].removeLast();
+           }
+
+           free[n].reserve(maxFree[n]); // released buffers never grow the free list storage
+        }
+     }
+
+     /**
+      * @brief acquire take an empty buffer of at least size bytes capacity
+      * @param size
+      * @return
+      */
+     QByteArray acquire(int size)
+     {
+        int index = classOf(size);
+
+        QByteArray buffer;
+
+        if (index==classCount) // too large: not pooled
+        {
+           buffer.reserve(size);
+
+           misses++;
+
+           return buffer;
+        }
+
+        if (!free[index].isEmpty())
+        {
+           buffer = free[index].last(); // shares the storage: detached when the free list entry is removed
+
+           free[index].removeLast();
+
+           hits++;
+
+           return buffer;
+        }
+
+        buffer.reserve(classSize(index));
+
+        misses++;
+
+        return buffer;
+     }
+
+     /**
+      * @brief release drop a buffer: its storage is kept for reuse if no one else refers to it and it has the
+      *                capacity of its class
+      * @param buffer left null
+      */
+     void release(QByteArray &buffer)
+     {
+        int index = classOf(buffer.capacity());
+
+        if (index<classCount && buffer.capacity()==classSize(index) && buffer.isDetached() && free[index].size()<maxFree[index])
+        {
+           buffer.resize(0); // capacity reserved: the storage is kept
+
+           free[index].append(buffer);
+        }
+
+        buffer = QByteArray();
+     }
+
+     quint64 reused() const { return hits; }
+     quint64 allocated() const { return misses; }
+
+     /**
+      * @brief freeBytes
+      * @return bytes of free buffers kept
+      */
+     qint64 freeBytes() const
+     {
+        qint64 bytes = 0;
+
+        for (int n=0; n<classCount; n++)
+        {
+           bytes += qint64(free[n].size()) * classSize(n);
+        }
+
+        return bytes;
+     }
+};
+
+#endif // SCDBUFFERPOOL_H
@@ -0,0 +1,533 @@
+/**
+ * @class SCDConnection https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server client connection record
+ *
+ *        Each client connection gets an opaque integer id when accepted: the id (and not the peer address) identifies
+ *        the client, so that two clients never collide (e.g. IPv6 peers) and no address string is formatted or hashed
+ *        while routing messages.
+ *
+ *        The connection keeps the subscribed topics, each one with the position of the connection into the topic
+ *        subscribers array, so that a subscriber can be removed from a topic in O(1).
+ *
+ *        SCDConnection is the transport independent part of connection: the transport (e.g. SCDWebSocketConnection)
+ *        implements frames writing. The connection record is owned by the transport which created it.
+ *
+ *        Outbound frames are posted with a priority class. When the transport reports the bytes actually sent (see
+ *        written), at most 'window' bytes are handed to the transport: the others wait into a FIFO lane for each class
+ *        and higher classes are sent first, so that an alarm never waits behind a queue of bulk messages. A lower
+ *        class frame is sent after starvationLimit higher class frames sent ahead of it.
+ *
+ *        A client subscribing with QoS 1 (at-least-once) gets a session (SCDSession): the messages of its QoS 1
+ *        subscriptions get a sequence number and are kept until the client acknowledges them, and redelivered on
+ *        timeout or when the client reconnects with the same client id.
+ *
+ *        A durable session (DUR header field) keeps its subscriptions while the client is offline: they are moved to
+ *        an offline subscriber record (SCDOfflineSubscriber), which queues the messages into the session, and moved
+ *        back when the client reconnects with the same name. Messages over the memory queue are spilled to disk
+ *        (SCDSpool).
+ *
+ *        A message published with a TTL (TTL header field) carries its expiry time (SCDExpiry) wherever the server keeps
+ *        it: it is dropped when found expired as it is dequeued (lanes, QoS 1 queues), and the holders are swept in bulk
+ *        by the server expiry wheel, so that stale messages do not pile up for slow or offline subscribers.
+ *
+ *        A client asking a resume token (TSR command) gets its whole subscription set parked on a subscriber record
+ *        (SCDParkedSubscriber) when it disconnects: a client reconnecting with the token within the grace period gets
+ *        it back in one step (see SCDTopicServer::resumeSession).
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDCONNECTION_H
+#define SCDCONNECTION_H
+
+#include <QString>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QWebSocket>
+
+#include "scdtokenbucket.h"
+#include "scdlatency.h"
+
+struct SCDTopic;
+
+class SCDConnection;
+class SCDSpool;
+
+/**
+ * @brief The SCDExpiry struct expiry of a message published with a TTL: a frame kept by the server (priority lanes,
+ *                             QoS 1 queues) is dropped when it expires, and counted into the expired messages of its
+ *                             topic
+ */
+struct SCDExpiry
+{
+   qint64 expires; // monotonic time (msec, see now), 0: never expires
+
+   QSharedPointer<quint64> count; // expired messages of the message topic, kept alive while frames wait
+
+   SCDExpiry() : expires(0) {}
+
+   bool isExpired(qint64 now) const { return expires>0 && now>=expires; }
+
+   void expired() const
+   {
+      if (count)
+      {
+         (*count)++;
+      }
+   }
+
+   /**
+    * @brief now
+    * @return monotonic time (msec) of expiry times
+    */
+   static qint64 now() { return SCDLatencyHistogram::now()/1000; }
+};
+
+/**
+ * @brief The SCDReliableMessage struct a message to a QoS 1 subscription, kept until acknowledged
+ */
+struct SCDReliableMessage
+{
+   quint64 sequence; // sequence number into the session
+   QString frame;    // frame as sent to QoS 0 subscribers: the sequence is prepended when sent
+   int     priority; // SCDConnection::Priority
+   qint64  sent;     // monotonic time of last send (msec)
+
+   SCDTraceStamp trace; // traced message: queue-to-write time counted at first send
+
+   SCDExpiry expiry; // TTL message: an expired message is sent as an expired marker, keeping the sequence contiguous
+   bool      dropped; // expired: the frame is released
+};
+
+/**
+ * @brief The SCDSession struct at-least-once delivery state of a client: it outlives the connection when the client
+ *                              has an id (CID header field), so that the unacknowledged messages are redelivered
+ *                              when the client reconnects
+ */
+struct SCDSession
+{
+   QString        id;     // client id, empty: anonymous session, deleted with its connection
+   SCDConnection *client; // connection the messages are sent to, 0 while the client is disconnected
+
+   quint64 sequence; // sequence number of last message
+   quint64 acked;    // last sequence number acknowledged (cumulative)
+
+   QQueue <SCDReliableMessage> messages; // unacknowledged messages, in sequence order
+   int sentCount;                        // messages at the head of the queue sent and waiting for acknowledge (in flight)
+
+   bool    scheduled; // redelivery check scheduled
+   qint64  detached;  // monotonic time the client disconnected (msec)
+   quint64 drops;     // messages dropped because the queue is full
+   quint64 expired;   // messages expired before delivery (TTL)
+
+   qint64 expiryScheduled; // earliest expiry time scheduled into the server expiry wheel (monotonic msec), 0: none
+
+   // durable subscriptions: never expire, kept by server until the client unscribes them
+
+   bool           durable; // durable session: id is the durable subscription name
+   SCDConnection *offline; // subscriber record holding the subscriptions while the client is offline, owned
+   SCDSpool      *spool;   // messages over the memory queue, in sequence order after it (0: disk spill not available), owned
+
+   explicit SCDSession(const QString &id) : id(id), client(0), sequence(0), acked(0), sentCount(0), scheduled(false), detached(0), drops(0),
+                                            expired(0), expiryScheduled(0), durable(false), offline(0), spool(0) {}
+
+   /**
+    * @brief expire drop an expired message: its frame is released, it is sent as an expired marker
+    * @param message
+    */
+   void expire(SCDReliableMessage &message)
+   {
+      message.dropped = true;
+      message.frame   = QString();
+
+      message.trace.latency.clear();
+      message.expiry.expired();
+
+      expired++;
+   }
+};
+
+/**
+ * @brief The SCDDelayedMessage struct a publish delayed by rate limits
+ */
+struct SCDDelayedMessage
+{
+   QString topic;
+   QString message;
+   QString tag;      // chunk tag, empty for a whole message
+   int     priority; // SCDConnection::Priority
+   bool    traced;   // TRA header field: trace holds the message timestamps
+   SCDTrace trace;
+   qint64  expires;  // TTL header field: expiry time (monotonic msec, SCDExpiry::now), 0: never expires
+};
+
+/**
+ * @brief The SCDLaneFrame struct a frame waiting into a priority lane
+ */
+struct SCDLaneFrame
+{
+   QString       frame;
+   SCDTraceStamp trace;
+   SCDExpiry     expiry;
+
+   SCDLaneFrame() {}
+   SCDLaneFrame(const QString &frame, const SCDTraceStamp *trace, const SCDExpiry *expiry) : frame(frame)
+   {
+      if (trace) this->trace = *trace;
+      if (expiry) this->expiry = *expiry;
+   }
+};
+
+class SCDConnection
+{
+   public:
+
+     enum Priority {PR_HIGH=0,PR_NORMAL=1,PR_BULK=2,PR_COUNT=3}; // outbound priority classes
+
+     static const int starvationLimit = 16; // higher class frames sent in a row ahead of a waiting lower class frame
+
+     quint32 id;       // connection id, unique for server lifetime (0 is never used)
+     QString name;     // sender name of messages from this client: <hex address>:<hex port>
+     QString peer;     // <address>:<port> for logging
+     qint64  lastSeen; // monotonic time of last frame received (msec)
+     bool    closed;   // connection closed: unscribed from all topics, waiting for the transport to delete it
+
+     SCDSession *session; // at-least-once delivery state, 0: no QoS 1 subscription
+
+     QString resumeToken; // session resume token (TSR command), empty: subscriptions dropped on disconnect
+
+     QHash <SCDTopic *, int> topics; // subscribed topic => index of this connection into topic subscribers array
+
+     SCDTokenBucket messageBucket; // publish rate limits (messages/sec, bytes/sec)
+     SCDTokenBucket byteBucket;
+
+     QList <SCDDelayedMessage> delayed; // publishes delayed by rate limits, in arrival order
+
+     // large messages streaming
+
+     QHash <QString, qint64> streams; // chunked publishes in progress: stream id => size received (-1: aborted)
+
+     bool    inFragments;    // receiving a message fragmented into more web socket frames
+     bool    streaming;      // the fragments of current message are forwarded as they arrive
+     bool    skipMessage;    // the next message assembled by transport has been already streamed
+     QString fragmentTopic;  // topic of the streamed message
+     QString fragmentStream; // stream id of the streamed message
+     qint64  fragmentSize;   // streamed message size so far
+     quint32 lastStreamId;
+
+     // outbound priority lanes
+
+     QQueue <SCDLaneFrame> lanes[PR_COUNT]; // frames waiting for the transport, a FIFO for each priority class
+
+     int     queued;     // frames waiting into lanes
+     int     maxQueued;  // over this limit lower class frames are dropped
+     qint64  window;     // max bytes handed to transport and not yet sent, 0: no flow control (frames are written at once)
+     qint64  inFlight;   // bytes handed to transport and not yet sent
+     int     starvation; // higher class frames sent in a row while lower class frames wait
+     quint64 drops;      // frames dropped because lanes are full
+     quint64 expired;    // frames expired into lanes (TTL)
+
+     qint64 expiryScheduled; // earliest expiry time scheduled into the server expiry wheel (monotonic msec), 0: none
+
+     SCDConnection() : id(0), lastSeen(0), closed(false), session(0), inFragments(false), streaming(false), skipMessage(false), fragmentSize(0), lastStreamId(0),
+                       queued(0), maxQueued(10000), window(0), inFlight(0), starvation(0), drops(0), expired(0), expiryScheduled(0) {}
+
+     virtual ~SCDConnection() {}
+
+     virtual bool isValid() const = 0;                 // true if frames can be written
+     virtual void sendText(const QString &message) = 0; // write a text frame
+     virtual void ping() = 0;                          // send a ping frame
+     virtual void abort() = 0;                         // abort the connection
+
+     /**
+      * @brief post write a frame, or queue it into the lane of its priority class when the transport window is full.
+      *             When lanes are full the oldest frame of a lower class is dropped to make room.
+      * @param frame
+      * @param priority Priority
+      * @param trace traced message: its queue-to-write time is counted when the frame is written, 0: not traced
+      * @param expiry TTL message: the frame is dropped if it expires into its lane, 0: never expires
+      * @return false if the frame is dropped
+      */
+     bool post(const QString &frame, int priority, const SCDTraceStamp *trace=0, const SCDExpiry *expiry=0)
+     {
+        if (window<=0 || (queued==0 && inFlight<window))
+        {
+           write(frame);
+
+           if (trace)
+           {
+              trace->written();
+           }
+
+           return true;
+        }
+
+        if (queued >= maxQueued)
+        {
+           int lane = PR_COUNT-1;
+
+           while (lane>priority && lanes[lane].isEmpty())
+           {
+              lane--;
+           }
+
+           drops++;
+
+           if (lane<=priority)
+           {
+              return false; // nothing of lower class to drop
+           }
+
+           lanes[lane].dequeue();
+           queued--;
+        }
+
+        lanes[priority].enqueue(SCDLaneFrame(frame, trace, expiry));
+        queued++;
+
+        return true;
+     }
+
+     /**
+      * @brief written the transport has sent bytes: write the queued frames allowed by window, the expired ones are
+      *                dropped
+      * @param bytes
+      */
+     void written(qint64 bytes)
+     {
+        inFlight = qMax(qint64(0), inFlight - bytes);
+
+        while (queued>0 && inFlight<window)
+        {
+           int lane = 0;
+
+           while (lanes[lane].isEmpty())
+           {
+              lane++;
+           }
+
+           int lower = lane+1;
+
+           while (lower<PR_COUNT && lanes[lower].isEmpty())
+           {
+              lower++;
+           }
+
+           if (lower==PR_COUNT)
+           {
+              starvation = 0;
+           }
+           else
+           if (++starvation > starvationLimit) // let a lower class frame pass
+           {
+              starvation = 0;
+              lane = lower;
+           }
+
+           queued--;
+
+           SCDLaneFrame next = lanes[lane].dequeue();
+
+           if (next.expiry.expires>0 && next.expiry.isExpired(SCDExpiry::now()))
+           {
+              next.expiry.expired();
+              expired++;
+              continue;
+           }
+
+           write(next.frame);
+
+           next.trace.written();
+        }
+     }
+
+     /**
+      * @brief purgeExpired drop the expired frames waiting into lanes, in one pass over each lane
+      * @param now SCDExpiry::now()
+      * @return earliest expiry time of the frames left, 0: none
+      */
+     qint64 purgeExpired(qint64 now)
+     {
+        qint64 next = 0;
+
+        for (int n=0; n<PR_COUNT; n++)
+        {
+           QQueue<SCDLaneFrame> &lane = lanes[n];
+
+           int kept = 0;
+
+           for (int i=0; i<lane.size(); i++)
+           {
+              const SCDExpiry &expiry = lane.at(i).expiry;
+
+              if (expiry.isExpired(now))
+              {
+                 expiry.expired();
+                 expired++;
+                 continue;
+              }
+
+              if (expiry.expires>0 && (next==0 || expiry.expires<next))
+              {
+                 next = expiry.expires;
+              }
+
+              if (kept<i)
+              {
+                 lane[kept] = lane.at(i); // compacted in order
+              }
+
+              kept++;
+           }
+
+           queued -= lane.size() - kept;
+
+           lane.erase(lane.begin() + kept, lane.end());
+        }
+
+        return next;
+     }
+
+     /**
+      * @brief resetState reset the connection record, for transports reusing connection records
+      */
+     void resetState()
+     {
+        id       = 0;
+        lastSeen = 0;
+        closed   = false;
+        session  = 0;
+
+        name.clear();
+        peer.clear();
+        resumeToken.clear();
+        topics.clear();
+        delayed.clear();
+        streams.clear();
+
+        inFragments  = false;
+        streaming    = false;
+        skipMessage  = false;
+        fragmentSize = 0;
+
+        fragmentTopic.clear();
+        fragmentStream.clear();
+
+        clearLanes();
+
+        window     = 0;
+        maxQueued  = 10000;
+        inFlight   = 0;
+        starvation = 0;
+        drops      = 0;
+        expired    = 0;
+
+        expiryScheduled = 0;
+     }
+
+     /**
+      * @brief clearLanes discard the queued frames
+      */
+     void clearLanes()
+     {
+        for (int n=0; n<PR_COUNT; n++)
+        {
+           lanes[n].clear();
+        }
+
+        queued = 0;
+     }
+
+     static int priorityFromName(const QStringRef &name)
+     {
+        return (name==QLatin1String("high")) ? PR_HIGH : (name==QLatin1String("normal")) ? PR_NORMAL : (name==QLatin1String("bulk")) ? PR_BULK : -1;
+     }
+
+     static int priorityFromName(const QString &name) { return priorityFromName(QStringRef(&name)); }
+
+     static QString priorityName(int priority)
+     {
+        return (priority==PR_HIGH) ? "high" : (priority==PR_BULK) ? "bulk" : "normal";
+     }
+
+   private:
+
+     void write(const QString &frame)
+     {
+        inFlight += frame.size(); // approximated: the transport reports encoded bytes
+
+        sendText(frame);
+     }
+};
+
+/**
+ * @brief The SCDWebSocketConnection class Qt web socket transport
+ */
+class SCDWebSocketConnection : public SCDConnection
+{
+   public:
+
+     QWebSocket *socket;
+
+     explicit SCDWebSocketConnection(QWebSocket *socket) : socket(socket) {}
+
+     bool isValid() const { return socket->isValid(); }
+
+     void sendText(const QString &message) { socket->sendTextMessage(message); }
+
+     void ping() { socket->ping(); }
+
+     void abort() { socket->abort(); }
+};
+
+/**
+ * @brief The SCDOfflineSubscriber class subscriber record of a durable session while its client is offline: it is
+ *                                       never writable, the messages to its QoS 1 subscriptions are queued into the
+ *                                       session
+ */
+class SCDOfflineSubscriber : public SCDConnection
+{
+   public:
+
+     explicit SCDOfflineSubscriber(SCDSession *session) { this->session = session; peer = "durable:" + session->id; }
+
+     bool isValid() const { return false; }
+
+     void sendText(const QString &message) { Q_UNUSED(message) }
+
+     void ping() {}
+
+     void abort() {}
+};
+
+/**
+ * @brief The SCDParkedSubscriber class subscriber record of a disconnected client having a resume token: it holds
+ *                                      all the subscriptions of the client for the resume grace period, it is never
+ *                                      writable (the messages published meanwhile are not kept)
+ */
+class SCDParkedSubscriber : public SCDConnection
+{
+   public:
+
+     QString token;     // resume token
+     QString sessionId; // client id or durable name of the client session, reopened on resume
+     bool    durable;   // durable session: its QoS 1 subscriptions are kept by the session offline record
+     bool    reliable;  // the client had a session: QoS 1 subscriptions are resumed with a session
+     qint64  detached;  // monotonic time the client disconnected (msec)
+
+     explicit SCDParkedSubscriber(const QString &token) : token(token), durable(false), reliable(false), detached(0) {}
+
+     bool isValid() const { return false; }
+
+     void sendText(const QString &message) { Q_UNUSED(message) }
+
+     void ping() {}
+
+     void abort() {}
+};
+
+#endif // SCDCONNECTION_H
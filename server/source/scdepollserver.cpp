@@ -0,0 +1,1271 @@
+/**
+ * @class SCDEpollServer https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server epoll web socket backend
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+
+#include "scdepollserver.h"
+#include "scdtopicserver.h"
+
+#include <QDebug>
+#include <QHostAddress>
+#include <QCryptographicHash>
+#include <QDataStream>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <climits>
+
+/**
+ * @brief SCDEpollConnection::sendText queue a text frame: frames are written at the end of event loop iteration
+ * @param message
+ */
+void SCDEpollConnection::sendText(const QString &message)
+{
+   transport->queueText(this, message);
+}
+
+/**
+ * @brief SCDEpollConnection::ping
+ */
+void SCDEpollConnection::ping()
+{
+   transport->queueFrame(this, SCDEpollServer::OP_PING, QByteArray());
+}
+
+/**
+ * @brief SCDEpollConnection::abort close the connection, queued frames are written if the socket allows it
+ */
+void SCDEpollConnection::abort()
+{
+   transport->closeConnection(this);
+}
+
+/**
+ * @brief SCDEpollServer::SCDEpollServer
+ * @param router topic server routing the messages received by this transport
+ * @param parent
+ */
+SCDEpollServer::SCDEpollServer(SCDTopicServer *router, QObject *parent) : QObject(parent), router(router)
+{
+   listenFd = -1;
+   epollFd  = -1;
+
+   notifier = 0;
+
+   dispatching    = false;
+   flushScheduled = false;
+
+   maxConnections = 10000;
+   readBufferSize = 2048;
+   maxMessageSize = 16*1024*1024 + 1024;
+
+   reusePort = false;
+
+   lastSource = 0;
+
+   payloadBuffer.reserve(readBufferSize); // capacity reserved: kept when emptied
+   textBuffer.reserve(readBufferSize);
+   lastText.reserve(readBufferSize);
+}
+
+/**
+ * @brief SCDEpollServer::~SCDEpollServer
+ */
+SCDEpollServer::~SCDEpollServer()
+{
+   close();
+
+   qDeleteAll(pool);
+}
+
+/**
+ * @brief SCDEpollServer::setMaxConnections set the number of pre-allocated connection states: set before listen
+ * @param max
+ */
+void SCDEpollServer::setMaxConnections(int max)
+{
+   maxConnections = qMax(max,1);
+}
+
+/**
+ * @brief SCDEpollServer::setMaxMessageSize max size of a received message (header included), larger messages close the connection
+ * @param size
+ */
+void SCDEpollServer::setMaxMessageSize(int size)
+{
+   maxMessageSize = (size>0) ? size : INT_MAX;
+}
+
+/**
+ * @brief SCDEpollServer::listen listen on all addresses (IPv6 and IPv4) and allocate the connection states
+ * @param port 0 for any port, see serverPort
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDEpollServer::listen(quint16 port)
+{
+   if (listenFd>=0)
+   {
+      lastErrorMsg = "already listening";
+      return 0;
+   }
+
+   int on  = 1;
+   int off = 0;
+
+   listenFd = ::socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+   if (listenFd>=0)
+   {
+      sockaddr_in6 addr = sockaddr_in6();
+
+      addr.sin6_family = AF_INET6;
+      addr.sin6_addr   = in6addr_any;
+      addr.sin6_port   = htons(port);
+
+      ::setsockopt(listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)); // IPv4 too
+      ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+      if (reusePort) // the kernel balances the connections among the processes sharing the port
+      {
+         ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+      }
+
+      if (::bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+      {
+         ::close(listenFd);
+         listenFd = -1;
+      }
+   }
+
+   if (listenFd<0) // IPv6 not available
+   {
+      listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+      sockaddr_in addr = sockaddr_in();
+
+      addr.sin_family      = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_ANY);
+      addr.sin_port        = htons(port);
+
+      ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+      if (reusePort)
+      {
+         ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+      }
+
+      if (listenFd<0 || ::bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+      {
+         lastErrorMsg = "Unable to bind port " + QString::number(port) + ": " + QString::fromLocal8Bit(strerror(errno));
+         close();
+         return 0;
+      }
+   }
+
+   if (::listen(listenFd, SOMAXCONN) < 0)
+   {
+      lastErrorMsg = "Unable to listen on port " + QString::number(port) + ": " + QString::fromLocal8Bit(strerror(errno));
+      close();
+      return 0;
+   }
+
+   return startEpoll();
+}
+
+/**
+ * @brief SCDEpollServer::listenOn listen on a socket already listening, handed over by the previous process
+ * @param fd
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDEpollServer::listenOn(int fd)
+{
+   if (listenFd>=0)
+   {
+      lastErrorMsg = "already listening";
+      return 0;
+   }
+
+   listenFd = fd;
+
+   ::fcntl(listenFd, F_SETFL, ::fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+   ::fcntl(listenFd, F_SETFD, FD_CLOEXEC);
+
+   return startEpoll();
+}
+
+/**
+ * @brief SCDEpollServer::startEpoll create the epoll set watching the listening socket and allocate the connection states
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDEpollServer::startEpoll()
+{
+   epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+
+   epoll_event event = epoll_event();
+
+   event.events   = EPOLLIN | EPOLLET;
+   event.data.ptr = 0; // listening socket
+
+   if (epollFd<0 || ::epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event) < 0)
+   {
+      lastErrorMsg = "Unable to create epoll set: " + QString::fromLocal8Bit(strerror(errno));
+      close();
+      return 0;
+   }
+
+   while (pool.size() < maxConnections) // pre-allocated connection states
+   {
+      SCDEpollConnection *client = new SCDEpollConnection(this);
+
+      client->in.reserve(readBufferSize);
+      client->out.reserve(64);
+
+      pool.append(client);
+      freeList.append(client);
+   }
+
+   dirtyList.reserve(maxConnections);
+   closingList.reserve(64);
+
+   notifier = new QSocketNotifier(epollFd, QSocketNotifier::Read, this); // the epoll set is readable when events are ready
+
+   connect(notifier, SIGNAL(activated(int)), this, SLOT(onEvents()));
+
+   lastErrorMsg = "Server (epoll) is listening on port " + QString::number(serverPort()) + " for incoming connections...";
+
+   return 1;
+}
+
+/**
+ * @brief SCDEpollServer::handoverConnections collect the upgraded connections to hand over: queued frames are written
+ *                                            first, as the socket allows. The connections keep being served until
+ *                                            releaseHandedOver, so the handover can fail without dropping them.
+ *
+ *                                            State: {<in><message><message opcode:qint32><out>} (QDataStream)
+ * @param state transport state of the connections, in the order of the returned list
+ * @param fds sockets of the connections, in the same order
+ * @return connections handed over
+ */
+QVector<SCDConnection *> SCDEpollServer::handoverConnections(QByteArray &state, QVector<int> &fds)
+{
+   QVector<SCDConnection *> clients;
+
+   QDataStream stream(&state, QIODevice::WriteOnly);
+
+   for (int n=0; n<pool.size(); n++)
+   {
+      SCDEpollConnection *client = pool.at(n);
+
+      if (client->fd>=0 && client->dirty)
+      {
+         flushConnection(client);
+      }
+
+      if (!client->isValid() || client->closed)
+      {
+         continue;
+      }
+
+      QByteArray out;
+
+      for (int i=0; i<client->out.size(); i++) // what the socket did not take
+      {
+         out.append(client->out.at(i).mid(i==0 ? client->outOffset : 0));
+      }
+
+      stream << client->in << client->message << qint32(client->messageOpcode) << out;
+
+      clients.append(client);
+      fds.append(client->fd);
+   }
+
+   return clients;
+}
+
+/**
+ * @brief SCDEpollServer::releaseHandedOver the process taking over adopted the connections: close the sockets of this
+ *                                          process without writing anything (the connections stay open into the new
+ *                                          process) and stop listening
+ */
+void SCDEpollServer::releaseHandedOver()
+{
+   delete notifier;
+
+   notifier = 0;
+
+   for (int n=0; n<pool.size(); n++)
+   {
+      SCDEpollConnection *client = pool.at(n);
+
+      if (client->fd>=0 && client->upgraded)
+      {
+         ::epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, 0);
+         ::close(client->fd);
+
+         client->fd = -1;
+      }
+   }
+
+   close(); // connections not yet upgraded: their clients retry
+}
+
+/**
+ * @brief SCDEpollServer::adoptConnections adopt the connections handed over by the previous process: the router
+ *                                         opens them (SCDTopicServer::restoreConnections) before their input is parsed
+ * @param state see handoverConnections
+ * @param fds
+ * @return connections adopted, aligned with fds: 0 for those not adopted (e.g. exceeding max connections), closed
+ */
+QVector<SCDConnection *> SCDEpollServer::adoptConnections(const QByteArray &state, const QVector<int> &fds)
+{
+   QVector<SCDConnection *> clients;
+
+   QDataStream stream(state);
+
+   for (int n=0; n<fds.size(); n++)
+   {
+      QByteArray in;
+      QByteArray message;
+      qint32     messageOpcode;
+      QByteArray out;
+
+      stream >> in >> message >> messageOpcode >> out;
+
+      if (stream.status() != QDataStream::Ok || freeList.isEmpty() || epollFd<0)
+      {
+         ::close(fds.at(n));
+
+         clients.append(0);
+         continue;
+      }
+
+      SCDEpollConnection *client = freeList.takeLast();
+
+      client->fd            = fds.at(n);
+      client->upgraded      = true;
+      client->in            = in;
+      client->message       = message;
+      client->messageOpcode = messageOpcode;
+
+      ::fcntl(client->fd, F_SETFL, ::fcntl(client->fd, F_GETFL) | O_NONBLOCK);
+      ::fcntl(client->fd, F_SETFD, FD_CLOEXEC);
+
+      epoll_event event = epoll_event();
+
+      event.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET; // bytes already received are reported at once
+      event.data.ptr = client;
+
+      if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, client->fd, &event) < 0)
+      {
+         client->upgraded = false;
+
+         releaseConnection(client);
+
+         clients.append(0);
+         continue;
+      }
+
+      if (!out.isEmpty())
+      {
+         queueRaw(client, out);
+      }
+
+      clients.append(client);
+   }
+
+   QMetaObject::invokeMethod(this, "onAdopted", Qt::QueuedConnection);
+
+   return clients;
+}
+
+/**
+ * @brief SCDEpollServer::onAdopted parse the input handed over with the adopted connections, now opened by the router
+ */
+void SCDEpollServer::onAdopted()
+{
+   dispatching = true;
+
+   for (int n=0; n<pool.size(); n++)
+   {
+      SCDEpollConnection *client = pool.at(n);
+
+      if (client->isValid() && !client->in.isEmpty())
+      {
+         parseFrames(client);
+      }
+   }
+
+   dispatching = false;
+
+   onFlush();
+}
+
+/**
+ * @brief SCDEpollServer::close close the listening socket and all connections
+ */
+void SCDEpollServer::close()
+{
+   delete notifier;
+
+   notifier = 0;
+
+   for (int n=0; n<pool.size(); n++)
+   {
+      releaseConnection(pool.at(n));
+   }
+
+   closingList.clear();
+   dirtyList.clear();
+
+   if (epollFd>=0)
+   {
+      ::close(epollFd);
+      epollFd = -1;
+   }
+
+   if (listenFd>=0)
+   {
+      ::close(listenFd);
+      listenFd = -1;
+   }
+}
+
+/**
+ * @brief SCDEpollServer::serverPort
+ * @return listening port, 0 if not listening
+ */
+quint16 SCDEpollServer::serverPort() const
+{
+   sockaddr_storage addr;
+
+   socklen_t size = sizeof(addr);
+
+   if (listenFd<0 || ::getsockname(listenFd, reinterpret_cast<sockaddr *>(&addr), &size) < 0)
+   {
+      return 0;
+   }
+
+   if (addr.ss_family == AF_INET6)
+   {
+      return ntohs(reinterpret_cast<sockaddr_in6 *>(&addr)->sin6_port);
+   }
+
+   return ntohs(reinterpret_cast<sockaddr_in *>(&addr)->sin_port);
+}
+
+/**
+ * @brief SCDEpollServer::onEvents dispatch the ready epoll events, then write the queued frames
+ */
+void SCDEpollServer::onEvents()
+{
+   epoll_event events[256];
+
+   int count;
+
+   dispatching = true;
+
+   do
+   {
+      count = ::epoll_wait(epollFd, events, 256, 0);
+
+      for (int n=0; n<count; n++)
+      {
+         SCDEpollConnection *client = static_cast<SCDEpollConnection *>(events[n].data.ptr);
+
+         if (!client)
+         {
+            acceptConnections();
+            continue;
+         }
+
+         if (client->fd<0 || client->closing)
+         {
+            continue;
+         }
+
+         if (events[n].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+         {
+            readConnection(client); // reads until EOF or error too
+         }
+
+         if ((events[n].events & EPOLLOUT) && client->fd>=0 && !client->out.isEmpty())
+         {
+            flushConnection(client);
+         }
+      }
+   }
+   while (count == 256);
+
+   dispatching = false;
+
+   onFlush();
+}
+
+/**
+ * @brief SCDEpollServer::onFlush write the frames queued for each connection, release the closed connections
+ */
+void SCDEpollServer::onFlush()
+{
+   flushScheduled = false;
+
+   for (int n=0; n<dirtyList.size(); n++)
+   {
+      SCDEpollConnection *client = dirtyList.at(n);
+
+      if (client->fd>=0 && client->dirty)
+      {
+         flushConnection(client);
+      }
+   }
+
+   dirtyList.resize(0);
+
+   for (int n=0; n<closingList.size(); n++)
+   {
+      releaseConnection(closingList.at(n));
+   }
+
+   closingList.resize(0);
+}
+
+/**
+ * @brief SCDEpollServer::scheduleFlush frames queued out of event dispatching (e.g. by timers or by another
+ *                                      transport clients): write them at next event loop iteration
+ */
+void SCDEpollServer::scheduleFlush()
+{
+   if (!dispatching && !flushScheduled)
+   {
+      flushScheduled = true;
+
+      QMetaObject::invokeMethod(this, "onFlush", Qt::QueuedConnection);
+   }
+}
+
+/**
+ * @brief SCDEpollServer::acceptConnections accept all pending connections (edge triggered)
+ */
+void SCDEpollServer::acceptConnections()
+{
+   for (;;)
+   {
+      sockaddr_storage addr;
+
+      socklen_t size = sizeof(addr);
+
+      int fd = ::accept4(listenFd, reinterpret_cast<sockaddr *>(&addr), &size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+      if (fd<0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+
+         if (errno != EAGAIN && errno != EWOULDBLOCK)
+         {
+            qDebug() << "epoll accept error:" << strerror(errno);
+         }
+
+         return;
+      }
+
+      if (freeList.isEmpty())
+      {
+         qDebug() << "epoll connection refused: max connections reached";
+
+         ::close(fd);
+         continue;
+      }
+
+      int on = 1;
+
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+      SCDEpollConnection *client = freeList.takeLast();
+
+      client->fd = fd;
+
+      QHostAddress address(reinterpret_cast<sockaddr *>(&addr));
+
+      int port = (addr.ss_family == AF_INET6) ? ntohs(reinterpret_cast<sockaddr_in6 *>(&addr)->sin6_port) :
+                                                ntohs(reinterpret_cast<sockaddr_in *>(&addr)->sin_port);
+
+      client->name = router->addressToHex(address, port);    // formatted once for connection lifetime
+      client->peer = router->addressToString(address, port);
+
+      epoll_event event = epoll_event();
+
+      event.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+      event.data.ptr = client;
+
+      if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+      {
+         releaseConnection(client);
+      }
+   }
+}
+
+/**
+ * @brief SCDEpollServer::readConnection read all available bytes (edge triggered), then parse them
+ * @param client
+ */
+void SCDEpollServer::readConnection(SCDEpollConnection *client)
+{
+   char buffer[16384];
+
+   for (;;)
+   {
+      ssize_t size = ::read(client->fd, buffer, sizeof(buffer));
+
+      if (size>0)
+      {
+         client->in.append(buffer, int(size));
+         continue;
+      }
+
+      if (size<0 && errno == EINTR)
+      {
+         continue;
+      }
+
+      if (size<0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+         break;
+      }
+
+      if (!client->in.isEmpty() && client->upgraded)
+      {
+         parseFrames(client); // last frames before EOF
+      }
+
+      closeConnection(client); // EOF or error
+
+      return;
+   }
+
+   if (!client->upgraded && !handshake(client))
+   {
+      return;
+   }
+
+   parseFrames(client);
+}
+
+/**
+ * @brief SCDEpollServer::handshake web socket opening handshake (RFC 6455)
+ * @param client
+ * @return true if the connection has been upgraded
+ */
+bool SCDEpollServer::handshake(SCDEpollConnection *client)
+{
+   int end = client->in.indexOf("\r\n\r\n");
+
+   if (end<0)
+   {
+      if (client->in.size() > 8192)
+      {
+         closeConnection(client);
+      }
+
+      return false;
+   }
+
+   QList<QByteArray> lines = client->in.left(end).split('\n');
+
+   QByteArray key;
+
+   bool upgrade = false;
+
+   for (int n=1; n<lines.size(); n++)
+   {
+      int pos = lines.at(n).indexOf(':');
+
+      if (pos<0)
+      {
+         continue;
+      }
+
+      QByteArray name  = lines.at(n).left(pos).trimmed().toLower();
+      QByteArray value = lines.at(n).mid(pos+1).trimmed();
+
+      if (name == "sec-websocket-key")
+      {
+         key = value;
+      }
+      else
+      if (name == "upgrade")
+      {
+         upgrade = (value.toLower() == "websocket");
+      }
+   }
+
+   if (!lines.first().startsWith("GET ") || !upgrade || key.isEmpty())
+   {
+      queueRaw(client, "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+
+      closeConnection(client);
+
+      return false;
+   }
+
+   QByteArray accept = QCryptographicHash::hash(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", QCryptographicHash::Sha1).toBase64();
+
+   queueRaw(client, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: " + accept + "\r\n\r\n");
+
+   client->in.remove(0, end+4);
+
+   client->upgraded = true;
+
+   router->openConnection(client, true); // writes are reported: priority lanes enabled
+
+   qDebug() << "New Web Socket Connection (epoll): " << client->peer << client->name << "id:" << client->id;
+
+   return true;
+}
+
+/**
+ * @brief SCDEpollServer::parseFrames parse the complete frames received, the incomplete one waits for more bytes
+ * @param client
+ */
+void SCDEpollServer::parseFrames(SCDEpollConnection *client)
+{
+   const uchar *data = reinterpret_cast<const uchar *>(client->in.constData());
+
+   qint64 size = client->in.size();
+   qint64 pos  = 0;
+
+   while (size-pos >= 2)
+   {
+      bool fin    = data[pos] & 0x80;
+      int  opcode = data[pos] & 0x0F;
+      bool masked = data[pos+1] & 0x80;
+
+      quint64 length = data[pos+1] & 0x7F;
+
+      int header = 2;
+
+      if (length == 126)
+      {
+         if (size-pos < 4)
+         {
+            break;
+         }
+
+         length = (quint64(data[pos+2]) << 8) | data[pos+3];
+         header = 4;
+      }
+      else
+      if (length == 127)
+      {
+         if (size-pos < 10)
+         {
+            break;
+         }
+
+         length = 0;
+
+         for (int n=0; n<8; n++)
+         {
+            length = (length << 8) | data[pos+2+n];
+         }
+
+         header = 10;
+      }
+
+      if (!masked || (data[pos] & 0x70) || length > quint64(maxMessageSize)) // client frames are masked, no extension
+      {
+         queueFrame(client, OP_CLOSE, QByteArray("\x03\xEA", 2)); // 1002: protocol error
+
+         closeConnection(client);
+
+         return;
+      }
+
+      if (quint64(size-pos) < header + 4 + length)
+      {
+         break;
+      }
+
+      const uchar *mask   = data + pos + header;
+      const uchar *masked = mask + 4;
+
+      payloadBuffer.resize(int(length)); // reused: no allocation once it has grown
+
+      char *bytes = payloadBuffer.data();
+
+      for (int n=0; n<int(length); n++)
+      {
+         bytes[n] = char(masked[n] ^ mask[n & 3]);
+      }
+
+      pos += header + 4 + length;
+
+      processFrame(client, opcode, fin, payloadBuffer);
+
+      if (client->closing || client->fd<0)
+      {
+         return;
+      }
+   }
+
+   client->in.remove(0, int(pos));
+}
+
+/**
+ * @brief SCDEpollServer::processFrame
+ * @param client
+ * @param opcode
+ * @param fin
+ * @param payload
+ */
+void SCDEpollServer::processFrame(SCDEpollConnection *client, int opcode, bool fin, QByteArray &payload)
+{
+   switch (opcode)
+   {
+      case OP_TEXT:
+      case OP_BINARY:
+
+        if (client->messageOpcode>=0) // a fragmented message is in progress
+        {
+           closeConnection(client);
+           return;
+        }
+
+        if (!fin)
+        {
+           client->messageOpcode = opcode;
+           client->message       = buffers.acquire(payload.size()); // the payload buffer is reused by next frame
+
+           client->message.append(payload);
+           return;
+        }
+
+        if (opcode==OP_TEXT && !client->closed)
+        {
+           router->processMessage(client, decodeText(payload)); // binary messages are not used by protocol
+        }
+
+      break;
+
+      case OP_CONTINUATION:
+
+        if (client->messageOpcode<0 || client->message.size() + payload.size() > maxMessageSize)
+        {
+           closeConnection(client);
+           return;
+        }
+
+        client->message.append(payload);
+
+        if (fin)
+        {
+           if (client->messageOpcode==OP_TEXT && !client->closed)
+           {
+              router->processMessage(client, decodeText(client->message));
+           }
+
+           client->messageOpcode = -1;
+
+           buffers.release(client->message);
+        }
+
+      break;
+
+      case OP_PING:
+
+        queueFrame(client, OP_PONG, payload);
+
+        router->touchConnection(client);
+
+      break;
+
+      case OP_PONG:
+
+        router->touchConnection(client);
+
+      break;
+
+      case OP_CLOSE:
+
+        queueFrame(client, OP_CLOSE, payload.left(2)); // echo the status code
+
+        closeConnection(client);
+
+      break;
+
+      default:
+
+        closeConnection(client);
+   }
+}
+
+/**
+ * @brief SCDEpollServer::decodeText decode a text message: ASCII text (the protocol headers and most messages) is
+ *                                   widened into a buffer reused for each message, other text is decoded from UTF-8
+ * @param payload
+ * @return text valid until next message
+ */
+const QString &SCDEpollServer::decodeText(const QByteArray &payload)
+{
+   const char *bytes = payload.constData();
+
+   int size = payload.size();
+   int n    = 0;
+
+   while (n<size && uchar(bytes[n]) < 0x80)
+   {
+      n++;
+   }
+
+   if (n<size)
+   {
+      utf8Text = QString::fromUtf8(payload);
+
+      return utf8Text;
+   }
+
+   textBuffer.resize(size); // detached if the router kept the previous message (e.g. a delayed publish)
+
+   QChar *text = textBuffer.data();
+
+   for (n=0; n<size; n++)
+   {
+      text[n] = QChar(ushort(uchar(bytes[n])));
+   }
+
+   return textBuffer;
+}
+
+/**
+ * @brief SCDEpollServer::encodeFrame encode a server frame (not masked) into a pooled buffer
+ * @param opcode
+ * @param payload
+ * @return
+ */
+QByteArray SCDEpollServer::encodeFrame(int opcode, const QByteArray &payload)
+{
+   QByteArray frame = buffers.acquire(payload.size() + 10);
+
+   appendFrameHeader(frame, opcode, payload.size());
+
+   frame.append(payload);
+
+   return frame;
+}
+
+/**
+ * @brief SCDEpollServer::encodeText encode a text frame into a pooled buffer: ASCII text is narrowed in place,
+ *                                   without the intermediate UTF-8 copy
+ * @param message
+ * @return
+ */
+QByteArray SCDEpollServer::encodeText(const QString &message)
+{
+   const QChar *text = message.constData();
+
+   int size = message.size();
+   int n    = 0;
+
+   while (n<size && text[n].unicode() < 0x80)
+   {
+      n++;
+   }
+
+   if (n<size)
+   {
+      return encodeFrame(OP_TEXT, message.toUtf8());
+   }
+
+   QByteArray frame = buffers.acquire(size + 10);
+
+   appendFrameHeader(frame, OP_TEXT, size);
+
+   int header = frame.size();
+
+   frame.resize(header + size);
+
+   char *bytes = frame.data() + header;
+
+   for (n=0; n<size; n++)
+   {
+      bytes[n] = char(text[n].unicode());
+   }
+
+   return frame;
+}
+
+/**
+ * @brief SCDEpollServer::appendFrameHeader
+ * @param frame
+ * @param opcode
+ * @param size payload size
+ */
+void SCDEpollServer::appendFrameHeader(QByteArray &frame, int opcode, int size)
+{
+   frame.append(char(0x80 | opcode));
+
+   if (size < 126)
+   {
+      frame.append(char(size));
+   }
+   else
+   if (size < 65536)
+   {
+      frame.append(char(126));
+      frame.append(char(size >> 8));
+      frame.append(char(size));
+   }
+   else
+   {
+      frame.append(char(127));
+
+      for (int n=7; n>=0; n--)
+      {
+         frame.append(char((quint64(size) >> (8*n)) & 0xFF));
+      }
+   }
+}
+
+/**
+ * @brief SCDEpollServer::queueFrame
+ * @param client
+ * @param opcode
+ * @param payload
+ */
+void SCDEpollServer::queueFrame(SCDEpollConnection *client, int opcode, const QByteArray &payload)
+{
+   queueRaw(client, encodeFrame(opcode, payload));
+}
+
+/**
+ * @brief SCDEpollServer::queueText queue a text frame: the frame of a message sent to many subscribers is encoded once
+ *                                  and shared (implicitly) by all connection queues. The text is compared with a copy
+ *                                  of the last one, instead of keeping a reference to it: the router reuses its frame
+ *                                  buffers, and a reference kept here would make it allocate a new one each message.
+ * @param client
+ * @param message
+ */
+void SCDEpollServer::queueText(SCDEpollConnection *client, const QString &message)
+{
+   if (message.constData()!=lastSource || message.size()!=lastText.size() ||
+       memcmp(message.constData(), lastText.constData(), size_t(message.size())*sizeof(QChar))!=0)
+   {
+      lastText.resize(message.size()); // reused: no allocation once it has grown
+
+      memcpy(lastText.data(), message.constData(), size_t(message.size())*sizeof(QChar));
+
+      lastSource = message.constData();
+
+      buffers.release(lastFrame); // recycled if no queue holds it any more
+
+      lastFrame = encodeText(message);
+   }
+
+   queueRaw(client, lastFrame);
+}
+
+/**
+ * @brief SCDEpollServer::queueRaw
+ * @param client
+ * @param data
+ */
+void SCDEpollServer::queueRaw(SCDEpollConnection *client, const QByteArray &data)
+{
+   if (client->fd<0)
+   {
+      return;
+   }
+
+   client->out.append(data);
+   client->outBytes += data.size();
+
+   if (!client->dirty)
+   {
+      client->dirty = true;
+
+      dirtyList.append(client);
+
+      scheduleFlush();
+   }
+}
+
+/**
+ * @brief SCDEpollServer::flushConnection write the queued frames with writev, until the socket is full
+ * @param client
+ */
+void SCDEpollServer::flushConnection(SCDEpollConnection *client)
+{
+   client->dirty = false;
+
+   while (!client->out.isEmpty() && client->fd>=0)
+   {
+      iovec vector[64];
+
+      int count = qMin(client->out.size(), 64);
+
+      for (int n=0; n<count; n++)
+      {
+         int offset = (n==0) ? client->outOffset : 0;
+
+         vector[n].iov_base = const_cast<char *>(client->out.at(n).constData()) + offset;
+         vector[n].iov_len  = size_t(client->out.at(n).size() - offset);
+      }
+
+      ssize_t size = ::writev(client->fd, vector, count);
+
+      if (size<0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+
+         if (errno != EAGAIN && errno != EWOULDBLOCK)
+         {
+            dropFrames(client, client->out.size());
+
+            client->outOffset = 0;
+            client->outBytes  = 0;
+
+            closeConnection(client);
+         }
+
+         return; // socket full: EPOLLOUT will resume
+      }
+
+      qint64 left = size;
+      int    done = 0;
+
+      while (left>0)
+      {
+         qint64 remaining = client->out.at(done).size() - client->outOffset;
+
+         if (left >= remaining)
+         {
+            left -= remaining;
+
+            client->outOffset = 0;
+
+            done++;
+         }
+         else
+         {
+            client->outOffset += int(left);
+
+            left = 0;
+         }
+      }
+
+      dropFrames(client, done);
+
+      client->outBytes -= size;
+
+      client->written(size); // may post the frames waiting into priority lanes
+   }
+}
+
+/**
+ * @brief SCDEpollServer::dropFrames remove the frames at the head of the write queue: their buffers go back to the
+ *                                   pool when no other queue holds them
+ * @param client
+ * @param count
+ */
+void SCDEpollServer::dropFrames(SCDEpollConnection *client, int count)
+{
+   for (int n=0; n<count; n++)
+   {
+      buffers.release(client->out[n]);
+   }
+
+   client->out.remove(0, count);
+}
+
+/**
+ * @brief SCDEpollServer::closeConnection close a connection: during event dispatching the connection is released
+ *                                        at the end, so that pending events never refer to a reused connection state
+ * @param client
+ */
+void SCDEpollServer::closeConnection(SCDEpollConnection *client)
+{
+   if (client->fd<0 || client->closing)
+   {
+      return;
+   }
+
+   if (dispatching)
+   {
+      client->closing = true;
+
+      closingList.append(client);
+
+      return;
+   }
+
+   releaseConnection(client);
+}
+
+/**
+ * @brief SCDEpollServer::releaseConnection write what the socket allows, close it and return the connection state to pool
+ * @param client
+ */
+void SCDEpollServer::releaseConnection(SCDEpollConnection *client)
+{
+   if (client->fd<0)
+   {
+      return;
+   }
+
+   if (!client->out.isEmpty())
+   {
+      client->closing = false;
+
+      flushConnection(client); // best effort: close frame, handshake error
+   }
+
+   if (client->fd<0) // released by flush error
+   {
+      return;
+   }
+
+   if (client->upgraded && !client->closed)
+   {
+      qDebug() << "Client disconnected (epoll):" + client->peer;
+
+      router->closeConnection(client);
+   }
+
+   ::epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, 0);
+   ::close(client->fd);
+
+   client->fd            = -1;
+   client->upgraded      = false;
+   client->closing       = false;
+   client->dirty         = false;
+   client->messageOpcode = -1;
+   client->outOffset     = 0;
+   client->outBytes      = 0;
+
+   client->in.resize(0); // capacity reserved: kept for next connection
+
+   dropFrames(client, client->out.size());
+
+   buffers.release(client->message);
+
+   client->resetState();
+
+   freeList.append(client);
+}
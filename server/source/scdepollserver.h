@@ -0,0 +1,190 @@
+/**
+ * @class SCDEpollServer https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server epoll web socket backend (linux only, build with qmake CONFIG+=epoll)
+ *
+ *        A web socket transport implemented directly on non blocking sockets and an edge triggered epoll set, for
+ *        many thousands of connections: no QObject is created for each connection and frames are not dispatched
+ *        thru signals. The epoll set is watched by a single socket notifier of the Qt event loop, so the topic
+ *        routing (SCDTopicServer) runs into the same thread of the Qt web socket backend, and both can run together.
+ *
+ *        Connection states are pre-allocated when listening starts (read buffer and write queue included) and reused.
+ *        Frames written to a connection are queued and written with a single writev for each connection at the end
+ *        of current event loop iteration.
+ *
+ *        Frame buffers are recycled: received payloads are unmasked and decoded into buffers reused for each frame,
+ *        and outbound frames (messages, notifies) are encoded into pooled buffers (SCDBufferPool), given back to the
+ *        pool once all the sockets they were queued to have written them.
+ *
+ *        On a zero-downtime restart the upgraded connections are handed over to the new process with their socket,
+ *        unparsed input and unwritten output: clients keep their connection (see SCDHandover).
+ *
+ *        Fragmented messages are assembled before routing: large messages are not streamed fragment by fragment
+ *        as with Qt backend (chunked publishes are).
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDEPOLLSERVER_H
+#define SCDEPOLLSERVER_H
+
+#include <QObject>
+#include <QSocketNotifier>
+#include <QByteArray>
+#include <QVector>
+
+#include "scdconnection.h"
+#include "scdbufferpool.h"
+
+class SCDTopicServer;
+class SCDEpollServer;
+
+/**
+ * @brief The SCDEpollConnection class epoll transport connection state
+ */
+class SCDEpollConnection : public SCDConnection
+{
+   public:
+
+     SCDEpollServer *transport;
+
+     int  fd;        // socket, -1: free slot
+     bool upgraded;  // web socket handshake done
+     bool closing;   // close frame sent or connection aborted: released at the end of event dispatching
+     bool dirty;     // frames waiting for writev
+
+     QByteArray in;  // received bytes not yet parsed
+
+     QByteArray message;       // fragmented message being assembled
+     int        messageOpcode; // opcode of first fragment, -1: no message being assembled
+
+     QVector<QByteArray> out; // frames waiting for writev
+     int    outOffset;        // bytes of first frame already written
+     qint64 outBytes;         // bytes waiting for writev
+
+     explicit SCDEpollConnection(SCDEpollServer *transport) : transport(transport), fd(-1), upgraded(false), closing(false), dirty(false),
+                                                              messageOpcode(-1), outOffset(0), outBytes(0) {}
+
+     bool isValid() const { return fd>=0 && upgraded && !closing; }
+
+     void sendText(const QString &message);
+
+     void ping();
+
+     void abort();
+};
+
+class SCDEpollServer : public QObject
+{
+   Q_OBJECT
+
+   friend class SCDEpollConnection;
+
+   private:
+
+     enum Opcode {OP_CONTINUATION=0x0,OP_TEXT=0x1,OP_BINARY=0x2,OP_CLOSE=0x8,OP_PING=0x9,OP_PONG=0xA};
+
+     SCDTopicServer *router;
+
+     int listenFd;
+     int epollFd;
+
+     QSocketNotifier *notifier;
+
+     QVector<SCDEpollConnection *> pool;     // pre-allocated connection states
+     QVector<SCDEpollConnection *> freeList; // unused connection states
+
+     QVector<SCDEpollConnection *> dirtyList;   // connections having frames to write
+     QVector<SCDEpollConnection *> closingList; // connections to release
+
+     bool dispatching;    // processing epoll events: connections are released at the end
+     bool flushScheduled; // flush queued into event loop
+
+     int maxConnections;
+     int readBufferSize;
+     int maxMessageSize;
+
+     bool reusePort; // SO_REUSEPORT: more processes share the port
+
+     QString lastErrorMsg;
+
+     QString       lastText;   // copy of last text written and its frame: a message fanned out to many subscribers is encoded once
+     const QChar  *lastSource; // data of the string last text was copied from
+     QByteArray    lastFrame;
+
+     SCDBufferPool buffers; // outbound frames and fragmented messages
+
+     QByteArray payloadBuffer; // unmasked payload of the frame being processed, reused
+     QString    textBuffer;    // text message decoded from payload, reused
+     QString    utf8Text;      // non ASCII text message decoded from payload
+
+     int startEpoll();
+
+     void acceptConnections();
+
+     void readConnection(SCDEpollConnection *client);
+     bool handshake(SCDEpollConnection *client);
+     void parseFrames(SCDEpollConnection *client);
+     void processFrame(SCDEpollConnection *client, int opcode, bool fin, QByteArray &payload);
+
+     const QString &decodeText(const QByteArray &payload);
+
+     void queueFrame(SCDEpollConnection *client, int opcode, const QByteArray &payload);
+     void queueText(SCDEpollConnection *client, const QString &message);
+     void queueRaw(SCDEpollConnection *client, const QByteArray &data);
+
+     void flushConnection(SCDEpollConnection *client);
+     void dropFrames(SCDEpollConnection *client, int count);
+     void scheduleFlush();
+
+     void closeConnection(SCDEpollConnection *client);
+     void releaseConnection(SCDEpollConnection *client);
+
+     QByteArray encodeFrame(int opcode, const QByteArray &payload);
+     QByteArray encodeText(const QString &message);
+
+     static void appendFrameHeader(QByteArray &frame, int opcode, int size);
+
+   public:
+
+     explicit SCDEpollServer(SCDTopicServer *router, QObject *parent = 0);
+
+     ~SCDEpollServer();
+
+     int listen(quint16 port);
+     int listenOn(int fd);
+     void close();
+
+     bool isListening() const { return listenFd>=0; }
+
+     int listenDescriptor() const { return listenFd; }
+
+     // handover (see SCDHandover): the live connections are passed to the process taking over
+
+     QVector<SCDConnection *> handoverConnections(QByteArray &state, QVector<int> &fds);
+     void releaseHandedOver();
+
+     QVector<SCDConnection *> adoptConnections(const QByteArray &state, const QVector<int> &fds);
+
+     quint16 serverPort() const;
+
+     void setMaxConnections(int max);
+     void setMaxMessageSize(int size);
+     void setReusePort(bool reusePort) { this->reusePort = reusePort; }
+
+     int connectionCount() const { return pool.size() - freeList.size(); }
+
+     const SCDBufferPool &bufferPool() const { return buffers; }
+
+     QString lastError() const { return lastErrorMsg; }
+
+   private slots:
+
+     void onEvents();
+     void onFlush();
+     void onAdopted();
+};
+
+#endif // SCDEPOLLSERVER_H
@@ -0,0 +1,480 @@
+/**
+ * @class SCDFilter https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server subscription content filter
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+
+#include "scdfilter.h"
+
+/**
+ * @brief SCDFilter::SCDFilter an empty filter matches nothing until compiled
+ */
+SCDFilter::SCDFilter() : root(-1), pos(0)
+{
+}
+
+/**
+ * @brief SCDFilter::compile parse the expression into the nodes array
+ * @param expression
+ * @return false on syntax error, see lastError
+ */
+bool SCDFilter::compile(const QString &expression)
+{
+   expr = expression;
+
+   nodes.clear();
+
+   pos   = 0;
+   error = QString();
+   root  = parseOr();
+
+   skipSpaces();
+
+   if (root>=0 && pos < expr.size())
+   {
+      error = "unexpected '" + expr.mid(pos) + "'";
+      root  = -1;
+   }
+
+   if (root<0)
+   {
+      error = "invalid filter at " + QString::number(pos) + ": " + error;
+      nodes.clear();
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDFilter::matches evaluate the filter on a message
+ * @param document message parsed as JSON object
+ * @return
+ */
+bool SCDFilter::matches(const QJsonObject &document) const
+{
+   return root>=0 && evaluate(root, document);
+}
+
+int SCDFilter::addNode(NodeType type, int left, int right)
+{
+   Node node;
+
+   node.type  = type;
+   node.op    = OP_EQ;
+   node.left  = left;
+   node.right = right;
+
+   nodes.append(node);
+
+   return nodes.size()-1;
+}
+
+int SCDFilter::parseOr()
+{
+   int left = parseAnd();
+
+   while (left>=0 && (accept("||") || acceptWord("or")))
+   {
+      int right = parseAnd();
+
+      if (right<0)
+      {
+         return -1;
+      }
+
+      left = addNode(NT_OR, left, right);
+   }
+
+   return left;
+}
+
+int SCDFilter::parseAnd()
+{
+   int left = parseNot();
+
+   while (left>=0 && (accept("&&") || acceptWord("and")))
+   {
+      int right = parseNot();
+
+      if (right<0)
+      {
+         return -1;
+      }
+
+      left = addNode(NT_AND, left, right);
+   }
+
+   return left;
+}
+
+int SCDFilter::parseNot()
+{
+   skipSpaces();
+
+   if (accept("!") || acceptWord("not"))
+   {
+      int operand = parseNot();
+
+      return (operand<0) ? -1 : addNode(NT_NOT, operand);
+   }
+
+   return parsePrimary();
+}
+
+int SCDFilter::parsePrimary()
+{
+   if (accept("("))
+   {
+      int node = parseOr();
+
+      if (node>=0 && !accept(")"))
+      {
+         error = "')' expected";
+         return -1;
+      }
+
+      return node;
+   }
+
+   QStringList path;
+
+   if (!parseField(path))
+   {
+      return -1;
+   }
+
+   Operator op;
+
+   if (parseOperator(op))
+   {
+      QJsonValue value;
+
+      if (!parseValue(value))
+      {
+         return -1;
+      }
+
+      int node = addNode(NT_COMPARE);
+
+      nodes[node].op   = op;
+      nodes[node].path = path;
+      nodes[node].values.append(value);
+
+      return node;
+   }
+
+   if (acceptWord("in"))
+   {
+      if (!accept("{"))
+      {
+         error = "'{' expected";
+         return -1;
+      }
+
+      QVector<QJsonValue> values;
+
+      do
+      {
+         QJsonValue value;
+
+         if (!parseValue(value))
+         {
+            return -1;
+         }
+
+         values.append(value);
+      }
+      while (accept(","));
+
+      if (!accept("}"))
+      {
+         error = "'}' expected";
+         return -1;
+      }
+
+      int node = addNode(NT_IN);
+
+      nodes[node].path   = path;
+      nodes[node].values = values;
+
+      return node;
+   }
+
+   int node = addNode(NT_EXISTS);
+
+   nodes[node].path = path;
+
+   return node;
+}
+
+bool SCDFilter::parseField(QStringList &path)
+{
+   skipSpaces();
+
+   int start = pos;
+
+   while (pos < expr.size() && (expr.at(pos).isLetterOrNumber() || expr.at(pos)=='_' || expr.at(pos)=='.' || expr.at(pos)=='-'))
+   {
+      pos++;
+   }
+
+   path = expr.mid(start, pos-start).split('.');
+
+   if (start==pos || path.contains(QString()))
+   {
+      error = "field name expected";
+      return false;
+   }
+
+   return true;
+}
+
+bool SCDFilter::parseOperator(Operator &op)
+{
+   static const char *tokens[]    = {"==", "!=", "<=", ">=", "<", ">", "="};
+   static const Operator values[] = {OP_EQ, OP_NE, OP_LE, OP_GE, OP_LT, OP_GT, OP_EQ};
+
+   for (int n=0; n<7; n++)
+   {
+      if (accept(tokens[n]))
+      {
+         op = values[n];
+         return true;
+      }
+   }
+
+   return false;
+}
+
+bool SCDFilter::parseValue(QJsonValue &value)
+{
+   skipSpaces();
+
+   if (pos >= expr.size())
+   {
+      error = "value expected";
+      return false;
+   }
+
+   QChar quote = expr.at(pos);
+
+   if (quote=='\'' || quote=='"')
+   {
+      int end = expr.indexOf(quote, pos+1);
+
+      if (end<0)
+      {
+         error = "unterminated string";
+         return false;
+      }
+
+      value = expr.mid(pos+1, end-pos-1);
+      pos   = end+1;
+
+      return true;
+   }
+
+   if (acceptWord("true"))
+   {
+      value = true;
+      return true;
+   }
+
+   if (acceptWord("false"))
+   {
+      value = false;
+      return true;
+   }
+
+   if (acceptWord("null"))
+   {
+      value = QJsonValue(QJsonValue::Null);
+      return true;
+   }
+
+   int start = pos;
+
+   while (pos < expr.size() && (expr.at(pos).isDigit() || QString("+-.eE").contains(expr.at(pos))))
+   {
+      pos++;
+   }
+
+   bool ok = false;
+
+   double number = expr.mid(start, pos-start).toDouble(&ok);
+
+   if (!ok)
+   {
+      pos   = start;
+      error = "value expected";
+      return false;
+   }
+
+   value = number;
+
+   return true;
+}
+
+/**
+ * @brief SCDFilter::acceptWord accept a keyword not followed by a name char
+ * @param word
+ * @return
+ */
+bool SCDFilter::acceptWord(const QString &word)
+{
+   skipSpaces();
+
+   if (!expr.midRef(pos).startsWith(word, Qt::CaseInsensitive))
+   {
+      return false;
+   }
+
+   int end = pos + word.size();
+
+   if (end < expr.size() && (expr.at(end).isLetterOrNumber() || expr.at(end)=='_'))
+   {
+      return false;
+   }
+
+   pos = end;
+
+   return true;
+}
+
+bool SCDFilter::accept(const QString &token)
+{
+   skipSpaces();
+
+   if (expr.midRef(pos).startsWith(token))
+   {
+      pos += token.size();
+      return true;
+   }
+
+   return false;
+}
+
+void SCDFilter::skipSpaces()
+{
+   while (pos < expr.size() && expr.at(pos).isSpace())
+   {
+      pos++;
+   }
+}
+
+bool SCDFilter::evaluate(int node, const QJsonObject &document) const
+{
+   const Node &n = nodes.at(node);
+
+   switch (n.type)
+   {
+      case NT_OR:  return evaluate(n.left, document) || evaluate(n.right, document);
+      case NT_AND: return evaluate(n.left, document) && evaluate(n.right, document);
+      case NT_NOT: return !evaluate(n.left, document);
+
+      case NT_COMPARE:
+
+         return compare(fieldValue(document, n.path), n.op, n.values.at(0));
+
+      case NT_IN:
+      {
+         QJsonValue field = fieldValue(document, n.path);
+
+         for (int i=0; i<n.values.size(); i++)
+         {
+            if (compare(field, OP_EQ, n.values.at(i)))
+            {
+               return true;
+            }
+         }
+
+         return false;
+      }
+
+      case NT_EXISTS:
+
+         return !fieldValue(document, n.path).isUndefined();
+   }
+
+   return false;
+}
+
+/**
+ * @brief SCDFilter::fieldValue
+ * @param document
+ * @param path
+ * @return the field value, undefined if not found
+ */
+QJsonValue SCDFilter::fieldValue(const QJsonObject &document, const QStringList &path)
+{
+   QJsonValue value = document.value(path.at(0));
+
+   for (int n=1; n<path.size(); n++)
+   {
+      if (!value.isObject()) // a.b of a not object: not found
+      {
+         return QJsonValue(QJsonValue::Undefined);
+      }
+
+      value = value.toObject().value(path.at(n));
+   }
+
+   return value;
+}
+
+bool SCDFilter::compare(const QJsonValue &field, Operator op, const QJsonValue &value)
+{
+   if (field.type() != value.type())
+   {
+      return op==OP_NE && !field.isUndefined();
+   }
+
+   if (field.isDouble())
+   {
+      double a = field.toDouble();
+      double b = value.toDouble();
+
+      switch (op)
+      {
+         case OP_EQ: return a == b;
+         case OP_NE: return a != b;
+         case OP_LT: return a <  b;
+         case OP_LE: return a <= b;
+         case OP_GT: return a >  b;
+         case OP_GE: return a >= b;
+      }
+   }
+
+   if (field.isString())
+   {
+      int cmp = QString::compare(field.toString(), value.toString());
+
+      switch (op)
+      {
+         case OP_EQ: return cmp == 0;
+         case OP_NE: return cmp != 0;
+         case OP_LT: return cmp <  0;
+         case OP_LE: return cmp <= 0;
+         case OP_GT: return cmp >  0;
+         case OP_GE: return cmp >= 0;
+      }
+   }
+
+   if (op==OP_EQ)
+   {
+      return field == value;
+   }
+
+   if (op==OP_NE)
+   {
+      return field != value;
+   }
+
+   return false; // booleans, null: not ordered
+}
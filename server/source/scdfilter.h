@@ -0,0 +1,180 @@
+/**
+ * @class SCDFilter https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server subscription content filter
+ *
+ *        A filter expression over the fields of a JSON object message, compiled once when the client subscribes and
+ *        evaluated for each message during fan-out:
+ *
+ *          expr    := and { ('||' | 'or') and }
+ *          and     := not { ('&&' | 'and') not }
+ *          not     := ('!' | 'not') not | primary
+ *          primary := '(' expr ')'
+ *                   | field ('==' | '!=' | '<' | '<=' | '>' | '>=') value
+ *                   | field 'in' '{' value { ',' value } '}'
+ *                   | field                                         // field exists
+ *          field   := name { '.' name }                             // e.g. sensor.id
+ *          value   := number | 'string' | "string" | true | false | null
+ *
+ *        e.g. value > 10 && sensorId in {'s1','s2'}
+ *
+ *        A message which is not a JSON object never matches. Comparing values of different types is false
+ *        (except '!=' which is true).
+ *
+ *        A compiled filter is only read by matches: the filters of a large topic are evaluated by worker threads
+ *        (see SCDFilterTask) while the event loop goes on, so a filter is deleted only once the evaluations reading
+ *        it are complete (see SCDTopicServer::deleteFilter).
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDFILTER_H
+#define SCDFILTER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QSharedPointer>
+
+class SCDFilter
+{
+   private:
+
+     enum NodeType {NT_OR=0,NT_AND=1,NT_NOT=2,NT_COMPARE=3,NT_IN=4,NT_EXISTS=5};
+
+     enum Operator {OP_EQ=0,OP_NE=1,OP_LT=2,OP_LE=3,OP_GT=4,OP_GE=5};
+
+     /**
+      * @brief The Node struct compiled expression node, children are referenced by index into nodes array
+      */
+     struct Node
+     {
+        NodeType             type;
+        Operator             op;
+        int                  left;   // NT_OR, NT_AND, NT_NOT operand
+        int                  right;  // NT_OR, NT_AND second operand
+        QStringList          path;   // field path
+        QVector<QJsonValue>  values; // NT_COMPARE: one value, NT_IN: value set
+     };
+
+     QString expr;
+
+     QVector<Node> nodes;
+
+     int root;
+
+     // parser state
+
+     int     pos;
+     QString error;
+
+     int addNode(NodeType type, int left=-1, int right=-1);
+
+     int parseOr();
+     int parseAnd();
+     int parseNot();
+     int parsePrimary();
+
+     bool parseField(QStringList &path);
+     bool parseValue(QJsonValue &value);
+     bool parseOperator(Operator &op);
+
+     bool acceptWord(const QString &word);
+     bool accept(const QString &token);
+     void skipSpaces();
+
+     bool evaluate(int node, const QJsonObject &document) const;
+
+     static QJsonValue fieldValue(const QJsonObject &document, const QStringList &path);
+     static bool compare(const QJsonValue &field, Operator op, const QJsonValue &value);
+
+   public:
+
+     SCDFilter();
+
+     bool compile(const QString &expression);
+
+     bool matches(const QJsonObject &document) const;
+
+     QString expression() const { return expr; }
+     QString lastError() const { return error; }
+};
+
+/**
+ * @brief The SCDFilterBatch struct content filters of a large topic evaluated for a message: shared by the fan-out and
+ *        by the tasks evaluating it, the last one releasing it deletes it
+ */
+struct SCDFilterBatch
+{
+   QVector<SCDFilter *> filters;  // snapshot of topic filters (0: no filter): shared with the topic until it changes
+   QJsonObject          document; // message parsed once for all filters
+   bool                 object;   // the message is a JSON object, otherwise the filters never match
+   QVector<quint8>      matches;  // SCDFilterTask::Match of each subscriber, read once pending is 0
+   int                  tasks;    // tasks started into the worker threads, 0: evaluated at once
+   QAtomicInt           pending;  // tasks not yet complete
+
+   SCDFilterBatch() : object(false), tasks(0) {}
+};
+
+/**
+ * @brief The SCDFilterTask class evaluates the content filters of a range of subscribers for a message, into a worker
+ *        thread (see SCDTopicServer::evaluateFilters)
+ */
+class SCDFilterTask : public QRunnable
+{
+   public:
+
+     enum Match {FM_SKIP=0,FM_FRAME=1,FM_FILTERED=2}; // filtered out, no filter, matching filter
+
+   private:
+
+     QSharedPointer<SCDFilterBatch> batch;
+
+     SCDFilter * const *filters;
+     const QJsonObject *document;
+
+     quint8 *matches;
+
+     int count;
+
+   public:
+
+     /**
+      * @brief SCDFilterTask make the task into the event loop thread
+      * @param batch
+      * @param from first subscriber of range
+      * @param count subscribers of range: the ranges of the tasks of a batch do not overlap
+      */
+     SCDFilterTask(const QSharedPointer<SCDFilterBatch> &batch, int from, int count) :
+        batch(batch), filters(batch->filters.constData() + from), document(batch->object ? &batch->document : 0),
+        matches(batch->matches.data() + from), count(count) {}
+
+     /**
+      * @brief match evaluate a filter
+      * @param filter 0: no filter
+      * @param document 0 if the message is not a JSON object
+      * @return Match
+      */
+     static quint8 match(const SCDFilter *filter, const QJsonObject *document)
+     {
+        return !filter ? FM_FRAME : (document && filter->matches(*document)) ? FM_FILTERED : FM_SKIP;
+     }
+
+     void run()
+     {
+        for (int n=0; n<count; n++)
+        {
+           matches[n] = match(filters[n], document);
+        }
+
+        batch->pending.deref(); // ordered: the matches are visible to the thread seeing 0
+     }
+};
+
+#endif // SCDFILTER_H
@@ -0,0 +1,545 @@
+/**
+ * @class SCDHandover https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server zero-downtime restart
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+
+#include "scdhandover.h"
+#include "scdtopicserver.h"
+#ifdef SCD_EPOLL_BACKEND
+#include "scdepollserver.h"
+#endif
+
+#include <QDebug>
+#include <QDataStream>
+#include <QFile>
+#include <QtEndian>
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+#define HANDOVER_VERSION 3
+#define HANDOVER_BATCH   250 // sockets passed with each message (SCM_MAX_FD is 253)
+#define HANDOVER_ACK     'A'
+
+/**
+ * @brief SCDHandover::SCDHandover
+ * @param router topic server whose state is handed over
+ * @param parent
+ */
+SCDHandover::SCDHandover(SCDTopicServer *router, QObject *parent) : QObject(parent), router(router)
+{
+   epoll = 0;
+
+   listenDescriptor = -1;
+
+   serverFd = -1;
+   peerFd   = -1;
+
+   timeout = 10000;
+
+   notifier = 0;
+}
+
+/**
+ * @brief SCDHandover::~SCDHandover
+ */
+SCDHandover::~SCDHandover()
+{
+   close();
+
+#ifdef Q_OS_UNIX
+   if (peerFd>=0)
+   {
+      ::close(peerFd);
+   }
+#endif
+}
+
+/**
+ * @brief SCDHandover::listen running process: wait for a new process on the handover socket
+ * @param path handover socket path
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDHandover::listen(const QString &path)
+{
+#ifdef Q_OS_UNIX
+   QByteArray name = QFile::encodeName(path);
+
+   sockaddr_un addr = sockaddr_un();
+
+   if (name.size() >= int(sizeof(addr.sun_path)))
+   {
+      lastErrorMsg = "Handover socket path too long: " + path;
+      return 0;
+   }
+
+   addr.sun_family = AF_UNIX;
+
+   memcpy(addr.sun_path, name.constData(), size_t(name.size()));
+
+   serverFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+   ::unlink(name.constData()); // socket of a previous process, already handed over or crashed
+
+   if (serverFd<0 || ::bind(serverFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(serverFd, 1) < 0)
+   {
+      lastErrorMsg = "Unable to listen on handover socket " + path + ": " + QString::fromLocal8Bit(strerror(errno));
+      close();
+      return 0;
+   }
+
+   notifier = new QSocketNotifier(serverFd, QSocketNotifier::Read, this);
+
+   connect(notifier, SIGNAL(activated(int)), this, SLOT(onConnection()));
+
+   lastErrorMsg = "Handover socket " + path + " ready for restart";
+
+   return 1;
+#else
+   Q_UNUSED(path)
+
+   lastErrorMsg = "Handover not available";
+
+   return 0;
+#endif
+}
+
+/**
+ * @brief SCDHandover::close stop waiting for a new process: the socket file is left to the process taking over
+ */
+void SCDHandover::close()
+{
+   delete notifier;
+
+   notifier = 0;
+
+#ifdef Q_OS_UNIX
+   if (serverFd>=0)
+   {
+      ::close(serverFd);
+      serverFd = -1;
+   }
+#endif
+}
+
+/**
+ * @brief SCDHandover::onConnection a new process connected: hand over
+ */
+void SCDHandover::onConnection()
+{
+#ifdef Q_OS_UNIX
+   int fd = ::accept4(serverFd, 0, 0, SOCK_CLOEXEC);
+
+   if (fd<0)
+   {
+      return;
+   }
+
+   handOver(fd);
+
+   ::close(fd);
+#endif
+}
+
+/**
+ * @brief SCDHandover::handOver send listening socket, state and live connections to the new process, then wait for its
+ *                              acknowledge. The event loop is blocked meanwhile: nothing changes while the state is sent.
+ * @param fd link to new process
+ */
+void SCDHandover::handOver(int fd)
+{
+#ifdef Q_OS_UNIX
+   setTimeout(fd, timeout);
+
+   QVector<SCDConnection *> clients;
+   QVector<int>             fds;
+
+   QByteArray transportState;
+
+   fds.append(listenDescriptor);
+
+#ifdef SCD_EPOLL_BACKEND
+   if (epoll)
+   {
+      clients = epoll->handoverConnections(transportState, fds);
+   }
+#endif
+
+   QByteArray data;
+
+   QDataStream stream(&data, QIODevice::WriteOnly);
+
+   stream << quint32(0) << quint32(HANDOVER_VERSION) << router->saveState(clients) << transportState << quint32(fds.size());
+
+   stream.device()->seek(0);
+
+   stream << quint32(data.size() - sizeof(quint32));
+
+   char ack = 0;
+
+   if (!sendAll(fd, data.constData(), data.size()) || !sendDescriptors(fd, fds) || !receiveAll(fd, &ack, 1) || ack!=HANDOVER_ACK)
+   {
+      qDebug() << "Handover failed, server keeps running:" << strerror(errno);
+      return;
+   }
+
+   qDebug() << "Handed over to new process:" << clients.size() << "live connections";
+
+   close();
+
+   router->close(); // Qt backend: stop accepting, its connections are closed on quit
+
+#ifdef SCD_EPOLL_BACKEND
+   if (epoll)
+   {
+      epoll->releaseHandedOver();
+   }
+#endif
+
+   emit handedOver();
+#else
+   Q_UNUSED(fd)
+#endif
+}
+
+/**
+ * @brief SCDHandover::takeOver new process: take over from the process listening on the handover socket, if any.
+ *                              Call before starting the server, then acknowledge once the state has been restored.
+ * @param path handover socket path
+ * @param routerState see SCDTopicServer::restoreTopics
+ * @param transportState see SCDEpollServer::adoptConnections
+ * @param fds listening socket, followed by the sockets of the live connections
+ * @return 1 on success, 0 if no process is running, -1 on failure (see lastError)
+ */
+int SCDHandover::takeOver(const QString &path, QByteArray &routerState, QByteArray &transportState, QVector<int> &fds)
+{
+#ifdef Q_OS_UNIX
+   QByteArray name = QFile::encodeName(path);
+
+   sockaddr_un addr = sockaddr_un();
+
+   if (name.size() >= int(sizeof(addr.sun_path)))
+   {
+      return 0;
+   }
+
+   addr.sun_family = AF_UNIX;
+
+   memcpy(addr.sun_path, name.constData(), size_t(name.size()));
+
+   int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+   if (fd<0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) // no process running
+   {
+      if (fd>=0)
+      {
+         ::close(fd);
+      }
+
+      return 0;
+   }
+
+   setTimeout(fd, timeout);
+
+   quint32 size = 0;
+
+   QByteArray data;
+
+   if (receiveAll(fd, reinterpret_cast<char *>(&size), sizeof(size)))
+   {
+      size = qFromBigEndian(size); // QDataStream byte order
+
+      data.resize(int(size));
+
+      if (!receiveAll(fd, data.data(), size))
+      {
+         data.clear();
+      }
+   }
+
+   QDataStream stream(data);
+
+   quint32 version = 0;
+   quint32 count   = 0;
+
+   stream >> version >> routerState >> transportState >> count;
+
+   if (data.isEmpty() || stream.status()!=QDataStream::Ok || version!=HANDOVER_VERSION || count==0 || !receiveDescriptors(fd, int(count), fds))
+   {
+      lastErrorMsg = "Handover from running process failed: " + QString::fromLocal8Bit(strerror(errno));
+
+      for (int n=0; n<fds.size(); n++)
+      {
+         ::close(fds.at(n));
+      }
+
+      fds.clear();
+
+      ::close(fd);
+
+      return -1;
+   }
+
+   peerFd = fd;
+
+   lastErrorMsg = "Taking over from running process: " + QString::number(count-1) + " live connections";
+
+   return 1;
+#else
+   Q_UNUSED(path) Q_UNUSED(routerState) Q_UNUSED(transportState) Q_UNUSED(fds)
+
+   return 0;
+#endif
+}
+
+/**
+ * @brief SCDHandover::acknowledge new process: the state has been restored, the previous process can quit
+ * @return 1 on success, 0 on failure
+ */
+int SCDHandover::acknowledge()
+{
+#ifdef Q_OS_UNIX
+   if (peerFd<0)
+   {
+      return 0;
+   }
+
+   char ack = HANDOVER_ACK;
+
+   bool sent = sendAll(peerFd, &ack, 1);
+
+   ::close(peerFd);
+
+   peerFd = -1;
+
+   return sent ? 1 : 0;
+#else
+   return 0;
+#endif
+}
+
+bool SCDHandover::sendAll(int fd, const char *data, qint64 size)
+{
+#ifdef Q_OS_UNIX
+   while (size>0)
+   {
+      ssize_t sent = ::send(fd, data, size_t(size), MSG_NOSIGNAL);
+
+      if (sent<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (sent<=0)
+      {
+         return false;
+      }
+
+      data += sent;
+      size -= sent;
+   }
+
+   return true;
+#else
+   Q_UNUSED(fd) Q_UNUSED(data) Q_UNUSED(size)
+
+   return false;
+#endif
+}
+
+bool SCDHandover::receiveAll(int fd, char *data, qint64 size)
+{
+#ifdef Q_OS_UNIX
+   while (size>0)
+   {
+      ssize_t received = ::recv(fd, data, size_t(size), 0);
+
+      if (received<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (received<=0)
+      {
+         return false;
+      }
+
+      data += received;
+      size -= received;
+   }
+
+   return true;
+#else
+   Q_UNUSED(fd) Q_UNUSED(data) Q_UNUSED(size)
+
+   return false;
+#endif
+}
+
+/**
+ * @brief SCDHandover::sendDescriptors pass the sockets to the peer process (SCM_RIGHTS), one byte carrying each batch
+ * @param fd
+ * @param fds
+ * @return
+ */
+bool SCDHandover::sendDescriptors(int fd, const QVector<int> &fds)
+{
+#ifdef Q_OS_UNIX
+   for (int pos=0; pos<fds.size(); pos+=HANDOVER_BATCH)
+   {
+      int count = qMin(fds.size()-pos, HANDOVER_BATCH);
+
+      union
+      {
+         char    buffer[CMSG_SPACE(sizeof(int) * HANDOVER_BATCH)];
+         cmsghdr align;
+      } control;
+
+      char byte = 0;
+
+      iovec vector;
+
+      vector.iov_base = &byte;
+      vector.iov_len  = 1;
+
+      msghdr message = msghdr();
+
+      message.msg_iov        = &vector;
+      message.msg_iovlen     = 1;
+      message.msg_control    = control.buffer;
+      message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+      cmsghdr *header = CMSG_FIRSTHDR(&message);
+
+      header->cmsg_level = SOL_SOCKET;
+      header->cmsg_type  = SCM_RIGHTS;
+      header->cmsg_len   = CMSG_LEN(sizeof(int) * count);
+
+      memcpy(CMSG_DATA(header), fds.constData() + pos, sizeof(int) * count);
+
+      ssize_t sent;
+
+      do
+      {
+         sent = ::sendmsg(fd, &message, MSG_NOSIGNAL);
+      }
+      while (sent<0 && errno==EINTR);
+
+      if (sent!=1)
+      {
+         return false;
+      }
+   }
+
+   return true;
+#else
+   Q_UNUSED(fd) Q_UNUSED(fds)
+
+   return false;
+#endif
+}
+
+/**
+ * @brief SCDHandover::receiveDescriptors receive the sockets passed by the peer process
+ * @param fd
+ * @param count sockets expected
+ * @param fds sockets received, appended also on failure (to be closed)
+ * @return
+ */
+bool SCDHandover::receiveDescriptors(int fd, int count, QVector<int> &fds)
+{
+#ifdef Q_OS_UNIX
+   while (fds.size() < count)
+   {
+      union
+      {
+         char    buffer[CMSG_SPACE(sizeof(int) * HANDOVER_BATCH)];
+         cmsghdr align;
+      } control;
+
+      char byte;
+
+      iovec vector;
+
+      vector.iov_base = &byte;
+      vector.iov_len  = 1;
+
+      msghdr message = msghdr();
+
+      message.msg_iov        = &vector;
+      message.msg_iovlen     = 1;
+      message.msg_control    = control.buffer;
+      message.msg_controllen = sizeof(control.buffer);
+
+      ssize_t received;
+
+      do
+      {
+         received = ::recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+      }
+      while (received<0 && errno==EINTR);
+
+      if (received!=1 || (message.msg_flags & MSG_CTRUNC))
+      {
+         return false;
+      }
+
+      int batch = 0;
+
+      for (cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+      {
+         if (header->cmsg_level==SOL_SOCKET && header->cmsg_type==SCM_RIGHTS)
+         {
+            int size = int((header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+
+            const int *data = reinterpret_cast<const int *>(CMSG_DATA(header));
+
+            for (int n=0; n<size; n++)
+            {
+               fds.append(data[n]);
+            }
+
+            batch += size;
+         }
+      }
+
+      if (batch==0)
+      {
+         return false;
+      }
+   }
+
+   return fds.size()==count;
+#else
+   Q_UNUSED(fd) Q_UNUSED(count) Q_UNUSED(fds)
+
+   return false;
+#endif
+}
+
+void SCDHandover::setTimeout(int fd, int timeout)
+{
+#ifdef Q_OS_UNIX
+   timeval time;
+
+   time.tv_sec  = timeout / 1000;
+   time.tv_usec = (timeout % 1000) * 1000;
+
+   ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &time, sizeof(time));
+   ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &time, sizeof(time));
+#else
+   Q_UNUSED(fd) Q_UNUSED(timeout)
+#endif
+}
@@ -0,0 +1,98 @@
+/**
+ * @class SCDHandover https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server zero-downtime restart (unix only)
+ *
+ *        The running process listens on a handover socket (unix domain). A new process started with the same
+ *        configuration connects to it before listening, and the running process passes it, over that socket:
+ *
+ *          - the listening socket (SCM_RIGHTS): connections keep being accepted, none is refused meanwhile
+ *          - topics and last documents of delta encoded topics (SCDTopicServer::saveState)
+ *          - the live connections of epoll backend: sockets, subscriptions and unparsed/unwritten bytes, so that
+ *            their clients do not notice the restart (SCDEpollServer::handoverConnections)
+ *
+ *        When the new process acknowledges, the running process closes its copies of the sockets and quits
+ *        (handedOver signal). The connections of Qt backend (and TLS) cannot be detached from QWebSocket: they are
+ *        closed and their clients reconnect to the new process, which is already accepting.
+ *
+ *        Messages: <size:quint32><version:quint32><router state:QByteArray><transport state:QByteArray><fds:quint32>
+ *                  (QDataStream), followed by the sockets in batches of up to 250 (one byte each batch), answered
+ *                  by one acknowledge byte.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDHANDOVER_H
+#define SCDHANDOVER_H
+
+#include <QObject>
+#include <QSocketNotifier>
+#include <QByteArray>
+#include <QVector>
+
+class SCDTopicServer;
+class SCDEpollServer;
+
+class SCDHandover : public QObject
+{
+   Q_OBJECT
+
+   private:
+
+     SCDTopicServer *router;
+     SCDEpollServer *epoll; // live connections handed over, 0: Qt backend
+
+     int listenDescriptor; // listening socket handed over
+
+     int serverFd; // handover socket of the running process
+     int peerFd;   // new process: link to the previous process until acknowledge
+
+     int timeout; // msec: a handover taking more is aborted
+
+     QSocketNotifier *notifier;
+
+     QString lastErrorMsg;
+
+     void handOver(int fd);
+
+     static bool sendAll(int fd, const char *data, qint64 size);
+     static bool receiveAll(int fd, char *data, qint64 size);
+
+     static bool sendDescriptors(int fd, const QVector<int> &fds);
+     static bool receiveDescriptors(int fd, int count, QVector<int> &fds);
+
+     static void setTimeout(int fd, int timeout);
+
+   public:
+
+     explicit SCDHandover(SCDTopicServer *router, QObject *parent = 0);
+
+     ~SCDHandover();
+
+     // running process
+
+     void setListenDescriptor(int fd) { listenDescriptor = fd; }
+     void setEpollServer(SCDEpollServer *epoll) { this->epoll = epoll; }
+
+     int listen(const QString &path);
+     void close();
+
+     // new process
+
+     int takeOver(const QString &path, QByteArray &routerState, QByteArray &transportState, QVector<int> &fds);
+     int acknowledge();
+
+     QString lastError() const { return lastErrorMsg; }
+
+   private slots:
+
+     void onConnection();
+
+   signals:
+
+     void handedOver(); // the new process took over: quit
+};
+
+#endif // SCDHANDOVER_H
@@ -0,0 +1,121 @@
+/**
+ * @struct SCDHeader https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server header of a received command (SCDTMH line, see SCDTopicServer::readHeader)
+ *
+ *        Field names and values are references into the received message: the header is parsed without copying,
+ *        so no allocation is done for each message, and it is valid as long as the message is.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDHEADER_H
+#define SCDHEADER_H
+
+#include <QString>
+#include <QStringRef>
+
+struct SCDHeader
+{
+   static const int maxFields = 16; // further fields are ignored
+
+   QStringRef names[maxFields];
+   QStringRef values[maxFields];
+
+   int count;
+
+   SCDHeader() : count(0) {}
+
+   void clear() { count = 0; }
+
+   /**
+    * @brief insert add a field, a field repeated replaces the previous one
+    * @param name
+    * @param value
+    */
+   void insert(const QStringRef &name, const QStringRef &value)
+   {
+      for (int n=0; n<count; n++)
+      {
+         if (names[n]==name)
+         {
+            values[n] = value;
+            return;
+         }
+      }
+
+      if (count<maxFields)
+      {
+         names[count]  = name;
+         values[count] = value;
+
+         count++;
+      }
+   }
+
+   bool contains(const char *name) const { return indexOf(QLatin1String(name))>=0; }
+
+   /**
+    * @brief value
+    * @param name
+    * @return field value, null if the field is missing
+    */
+   QStringRef value(const char *name) const
+   {
+      int n = indexOf(QLatin1String(name));
+
+      return (n<0) ? QStringRef() : values[n];
+   }
+
+   QStringRef value(const QString &name) const
+   {
+      for (int n=0; n<count; n++)
+      {
+         if (names[n]==name)
+         {
+            return values[n];
+         }
+      }
+
+      return QStringRef();
+   }
+
+   int indexOf(QLatin1String name) const
+   {
+      for (int n=0; n<count; n++)
+      {
+         if (names[n]==name)
+         {
+            return n;
+         }
+      }
+
+      return -1;
+   }
+
+   /**
+    * @brief trimmed reference to text[from,to) without leading and trailing spaces
+    * @param text
+    * @param from
+    * @param to
+    * @return
+    */
+   static QStringRef trimmed(const QString *text, int from, int to)
+   {
+      while (from<to && text->at(from).isSpace())
+      {
+         from++;
+      }
+
+      while (to>from && text->at(to-1).isSpace())
+      {
+         to--;
+      }
+
+      return QStringRef(text, from, to-from);
+   }
+};
+
+#endif // SCDHEADER_H
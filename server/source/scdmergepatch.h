@@ -0,0 +1,88 @@
+/**
+ * @struct SCDMergePatch https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server JSON merge patch (RFC 7386)
+ *
+ *        A merge patch is a JSON object carrying only the changed members of a document: a removed member is set to
+ *        null, a changed object member is patched recursively, any other changed member (arrays too) is replaced.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDMERGEPATCH_H
+#define SCDMERGEPATCH_H
+
+#include <QJsonObject>
+#include <QJsonValue>
+
+struct SCDMergePatch
+{
+   /**
+    * @brief diff compute the merge patch turning a document into another one
+    * @param from
+    * @param to
+    * @param patch the merge patch (members are inserted)
+    * @return false if the patch cannot represent the change: a null member in 'to' would be removed by patch
+    */
+   static bool diff(const QJsonObject &from, const QJsonObject &to, QJsonObject &patch)
+   {
+      for (QJsonObject::const_iterator it = from.constBegin(); it != from.constEnd(); ++it)
+      {
+         if (!to.contains(it.key()))
+         {
+            patch.insert(it.key(), QJsonValue(QJsonValue::Null)); // removed
+         }
+      }
+
+      for (QJsonObject::const_iterator it = to.constBegin(); it != to.constEnd(); ++it)
+      {
+         QJsonValue value = it.value();
+         QJsonValue old   = from.value(it.key());
+
+         if (value == old)
+         {
+            continue;
+         }
+
+         if (value.isObject() && old.isObject())
+         {
+            QJsonObject member;
+
+            if (!diff(old.toObject(), value.toObject(), member))
+            {
+               return false;
+            }
+
+            patch.insert(it.key(), member);
+         }
+         else
+         if (value.isNull() || (value.isObject() && containsNull(value.toObject())))
+         {
+            return false;
+         }
+         else
+         {
+            patch.insert(it.key(), value);
+         }
+      }
+
+      return true;
+   }
+
+   static bool containsNull(const QJsonObject &object)
+   {
+      for (QJsonObject::const_iterator it = object.constBegin(); it != object.constEnd(); ++it)
+      {
+         if (it.value().isNull() || (it.value().isObject() && containsNull(it.value().toObject())))
+         {
+            return true;
+         }
+      }
+
+      return false;
+   }
+};
+
+#endif // SCDMERGEPATCH_H
@@ -0,0 +1,291 @@
+/**
+ * @class SCDMulticast https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server UDP multicast egress
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+
+#include "scdmulticast.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QNetworkInterface>
+
+#include <climits>
+
+/**
+ * @brief SCDMulticast::SCDMulticast
+ */
+SCDMulticast::SCDMulticast() : port(0), historySize(1024), maxDatagramSize(1472), announceInterval(1000), datagrams(0), errors(0)
+{
+   // pid and start time: a restarted server (or another process) is a new source, with its own sequence numbers
+
+   source = QString::number(QCoreApplication::applicationPid(), 16) + "-" + QString::number(QDateTime::currentMSecsSinceEpoch(), 16);
+}
+
+/**
+ * @brief SCDMulticast::start open the socket sending to the multicast group
+ * @param group multicast group address, e.g. 239.255.0.1
+ * @param port group port
+ * @param ttl multicast hops: 1 keeps the datagrams on the local network
+ * @param interfaceName outgoing interface (e.g. eth0, lo), empty for the system default
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDMulticast::start(const QString &group, quint16 port, int ttl, const QString &interfaceName)
+{
+   this->group = QHostAddress(group);
+   this->port  = port;
+
+   if (!this->group.isMulticast())
+   {
+      lastErrorMsg = "Not a multicast group address: " + group;
+      return 0;
+   }
+
+   if (!socket.bind(QHostAddress(this->group.protocol()==QAbstractSocket::IPv6Protocol ? QHostAddress::AnyIPv6 : QHostAddress::AnyIPv4), 0))
+   {
+      lastErrorMsg = "Unable to open multicast socket: " + socket.errorString();
+      return 0;
+   }
+
+   socket.setSocketOption(QAbstractSocket::MulticastTtlOption, ttl);
+   socket.setSocketOption(QAbstractSocket::MulticastLoopbackOption, 1); // receivers on the server host too
+
+   if (!interfaceName.isEmpty())
+   {
+      QNetworkInterface iface = QNetworkInterface::interfaceFromName(interfaceName);
+
+      if (!iface.isValid())
+      {
+         lastErrorMsg = "Multicast interface not found: " + interfaceName;
+
+         socket.close();
+
+         return 0;
+      }
+
+      socket.setMulticastInterface(iface);
+   }
+
+   lastErrorMsg = "Multicast egress to " + group + ":" + QString::number(port);
+
+   return 1;
+}
+
+/**
+ * @brief SCDMulticast::stop
+ */
+void SCDMulticast::stop()
+{
+   socket.close();
+}
+
+/**
+ * @brief SCDMulticast::setLimits set before start
+ * @param historySize datagrams kept for each topic, for repairs
+ * @param maxDatagramSize larger datagrams are sent thru web socket (1472: no IP fragmentation on ethernet)
+ * @param announceInterval msec between the announces of the last sequence number of each topic (tail loss detection)
+ */
+void SCDMulticast::setLimits(int historySize, int maxDatagramSize, int announceInterval)
+{
+   this->historySize      = qMax(historySize, 1);
+   this->maxDatagramSize  = qMax(maxDatagramSize, 64);
+   this->announceInterval = qMax(announceInterval, 10);
+}
+
+/**
+ * @brief SCDMulticast::encode
+ * @param topic
+ * @param sequence
+ * @param frame
+ * @param marker LOST or LAST marker (no frame), 0: message
+ * @return datagram, see class description
+ */
+QByteArray SCDMulticast::encode(const QString &topic, quint64 sequence, const QString &frame, const char *marker) const
+{
+   return (QString("SCDMCA:1.0\t") + source + "\t" + topic + "\t" + QString::number(sequence) + (marker ? QString("\t") + marker : QString()) + "\n" + frame).toUtf8();
+}
+
+/**
+ * @brief SCDMulticast::publish send the frame of a message to the group, with the next sequence number of topic,
+ *                              and keep it for repairs (a datagram too large for the group is not kept)
+ * @param entry multicast topic
+ * @param frame
+ * @param datagram the datagram text
+ * @param expires expiry time of a message having a TTL (monotonic msec, SCDExpiry::now): no repair after it, 0: never
+ * @return false if the datagram is too large for the group: send it thru web socket
+ */
+bool SCDMulticast::publish(SCDTopic *entry, const QString &frame, QByteArray &datagram, qint64 expires)
+{
+   quint64 sequence = ++entry->multicastSequence;
+
+   datagram = encode(entry->name, sequence, frame);
+
+   if (entry->multicastHistory.size() != historySize) // allocated at first message
+   {
+      entry->multicastHistory.fill(QByteArray(), historySize);
+   }
+
+   bool tooLarge = datagram.size() > maxDatagramSize;
+
+   entry->multicastHistory[int(sequence % quint64(historySize))] = tooLarge ? QByteArray() : datagram; // empty: lost
+
+   if (expires>0 && entry->multicastExpires.size() != historySize) // allocated at first message having a TTL
+   {
+      entry->multicastExpires.fill(0, historySize);
+   }
+
+   if (!entry->multicastExpires.isEmpty())
+   {
+      entry->multicastExpires[int(sequence % quint64(historySize))] = expires;
+   }
+
+   if (tooLarge)
+   {
+      return false;
+   }
+
+   if (socket.writeDatagram(datagram, group, port) != datagram.size())
+   {
+      errors++; // as lost on the network: receivers repair it
+   }
+   else
+   {
+      datagrams++;
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDMulticast::repair get the datagrams of a topic to send again to a receiver
+ * @param entry multicast topic
+ * @param first first sequence number missing
+ * @param last last sequence number missing
+ * @param datagrams the datagrams still kept, in order, a lost marker before those no more kept, expired or too large
+ * @return number of messages lost
+ */
+int SCDMulticast::repair(const SCDTopic *entry, quint64 first, quint64 last, QList<QByteArray> &datagrams) const
+{
+   quint64 next = entry->multicastSequence + 1;
+
+   last = qMin(last, next - 1);
+
+   if (first==0 || first>last || entry->multicastHistory.size() != historySize)
+   {
+      return 0;
+   }
+
+   quint64 oldest = (next > quint64(historySize)) ? next - quint64(historySize) : 1;
+
+   quint64 lost = 0;
+
+   if (first < oldest) // no more kept: the receiver skips them
+   {
+      quint64 resume = qMin(oldest, last + 1);
+
+      datagrams.append(encode(entry->name, resume, QString(), "LOST"));
+
+      lost  = resume - first;
+      first = resume;
+   }
+
+   qint64 now = entry->multicastExpires.isEmpty() ? 0 : SCDExpiry::now();
+
+   for (quint64 sequence=first; sequence<=last; sequence++)
+   {
+      if (isLost(entry, sequence, now)) // skipped up to the next one kept
+      {
+         quint64 resume = sequence + 1;
+
+         while (resume<=last && isLost(entry, resume, now))
+         {
+            resume++;
+         }
+
+         datagrams.append(encode(entry->name, resume, QString(), "LOST"));
+
+         lost    += resume - sequence;
+         sequence = resume - 1;
+         continue;
+      }
+
+      datagrams.append(entry->multicastHistory.at(int(sequence % quint64(historySize))));
+   }
+
+   return int(qMin(lost, quint64(INT_MAX)));
+}
+
+/**
+ * @brief SCDMulticast::isLost
+ * @param entry multicast topic
+ * @param sequence sequence number kept into history
+ * @param now SCDExpiry::now(), 0 if no message of topic has a TTL
+ * @return true if the message was too large to be kept, or it has a TTL and it has expired
+ */
+bool SCDMulticast::isLost(const SCDTopic *entry, quint64 sequence, qint64 now) const
+{
+   if (entry->multicastHistory.at(int(sequence % quint64(historySize))).isEmpty())
+   {
+      return true;
+   }
+
+   if (now==0)
+   {
+      return false;
+   }
+
+   qint64 expires = entry->multicastExpires.at(int(sequence % quint64(historySize)));
+
+   return expires>0 && now>=expires;
+}
+
+/**
+ * @brief SCDMulticast::announce
+ * @param entry multicast topic
+ * @return announce sent to a new receiver: [server@multicast]:<topic>|<source>|<group>|<port>|<next sequence>\n
+ */
+QString SCDMulticast::announce(const SCDTopic *entry) const
+{
+   return "[server@multicast]:" + entry->name + "|" + source + "|" + group.toString() + "|" + QString::number(port)
+        + "|" + QString::number(entry->multicastSequence + 1) + "\n";
+}
+
+/**
+ * @brief SCDMulticast::announceSequence send to the group the sequence number of the last datagram of a topic sent to
+ *                                       the group: a receiver which lost the last ones asks them then (not counted as
+ *                                       sent). The last messages too large for the group are not announced: they
+ *                                       come thru web socket, maybe later than the announce.
+ * @param entry multicast topic having receivers
+ */
+void SCDMulticast::announceSequence(const SCDTopic *entry)
+{
+   if (entry->multicastHistory.size() != historySize)
+   {
+      return; // no message yet
+   }
+
+   quint64 sequence = entry->multicastSequence;
+   quint64 oldest   = (sequence >= quint64(historySize)) ? sequence - quint64(historySize) + 1 : 1;
+
+   while (sequence>=oldest && entry->multicastHistory.at(int(sequence % quint64(historySize))).isEmpty())
+   {
+      sequence--;
+   }
+
+   if (sequence<oldest)
+   {
+      return;
+   }
+
+   QByteArray datagram = encode(entry->name, sequence, QString(), "LAST");
+
+   if (socket.writeDatagram(datagram, group, port) != datagram.size())
+   {
+      errors++;
+   }
+}
@@ -0,0 +1,100 @@
+/**
+ * @class SCDMulticast https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server UDP multicast egress
+ *
+ *        The messages of a multicast topic are sent once to a multicast group, instead of once for each subscriber:
+ *        the subscribers on the same LAN which joined the group (MCA:1 subscription) receive them from there, so the
+ *        server egress of the topic does not grow with its subscribers.
+ *
+ *        Datagram: SCDMCA:1.0\t<source>\t<topic>\t<sequence>\n<frame>
+ *
+ *          source    identifies this server process: a client accepts only the datagrams of its own server
+ *          sequence  1, 2, 3 ... for each topic
+ *          frame     the frame sent to the TCP subscribers: [<sender>@<topic>]:<message> (see sendMessageToTopic)
+ *
+ *        Multicast is not reliable: a receiver detects the gaps from the sequence numbers and asks the server for the
+ *        missing messages (TMR command), which are sent again thru its web socket connection, as the same datagram
+ *        text. The server keeps the last historySize datagrams of each topic: older messages are lost, and reported by
+ *        a marker
+ *
+ *          SCDMCA:1.0\t<source>\t<topic>\t<sequence>\tLOST\n        the messages before sequence are lost
+ *
+ *        A message having a TTL is not repaired once expired: it is reported as lost.
+ *
+ *        Datagrams larger than maxDatagramSize are not sent to the group, but thru web socket to each receiver: they
+ *        are not kept (a repair reports them lost), so the history of a topic holds historySize * maxDatagramSize
+ *        bytes at most.
+ *
+ *        A gap is detected when the next datagram arrives: to detect the loss of the last ones, the sequence number of
+ *        the last datagram sent to the group is announced for each topic having receivers, every announceInterval msec
+ *
+ *          SCDMCA:1.0\t<source>\t<topic>\t<sequence>\tLAST\n        the last message sent has sequence
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDMULTICAST_H
+#define SCDMULTICAST_H
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QHostAddress>
+#include <QUdpSocket>
+
+#include "scdtopic.h"
+
+class SCDMulticast
+{
+   private:
+
+     QUdpSocket socket;
+
+     QHostAddress group;
+     quint16      port;
+
+     QString source; // source id of this process
+
+     int historySize;     // datagrams kept for each topic, for repairs
+     int maxDatagramSize; // larger datagrams are sent thru web socket
+     int announceInterval; // msec between the announces of the last sequence number of each topic
+
+     quint64 datagrams; // datagrams sent to the group
+     quint64 errors;    // datagrams not sent (socket errors)
+
+     QString lastErrorMsg;
+
+     QByteArray encode(const QString &topic, quint64 sequence, const QString &frame, const char *marker=0) const;
+
+     bool isLost(const SCDTopic *entry, quint64 sequence, qint64 now) const;
+
+   public:
+
+     SCDMulticast();
+
+     int start(const QString &group, quint16 port, int ttl=1, const QString &interfaceName=QString());
+     void stop();
+
+     void setLimits(int historySize, int maxDatagramSize, int announceInterval=1000);
+
+     int sequenceInterval() const { return announceInterval; } // msec between the last sequence announces
+
+     bool isActive() const { return socket.state()==QAbstractSocket::BoundState; }
+
+     bool publish(SCDTopic *entry, const QString &frame, QByteArray &datagram, qint64 expires=0);
+     int  repair(const SCDTopic *entry, quint64 first, quint64 last, QList<QByteArray> &datagrams) const;
+
+     QString announce(const SCDTopic *entry) const;
+
+     void announceSequence(const SCDTopic *entry);
+
+     quint64 sent() const { return datagrams; }
+     quint64 failed() const { return errors; }
+
+     QString lastError() const { return lastErrorMsg; }
+};
+
+#endif // SCDMULTICAST_H
@@ -0,0 +1,267 @@
+/**
+ * @class SCDSpool https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server disk queue of a durable subscription
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+
+#include "scdspool.h"
+
+#include <QDir>
+#include <QDataStream>
+
+/**
+ * @brief SCDSpool::SCDSpool
+ * @param path spool directory, one for each durable subscription
+ * @param segmentSize bytes: a new segment file is started over this size
+ * @param maxBytes disk usage limit (bytes), 0: unlimited
+ */
+SCDSpool::SCDSpool(const QString &path, qint64 segmentSize, qint64 maxBytes) : path(path), segmentSize(qMax(segmentSize,qint64(4096))), maxBytes(qMax(maxBytes,qint64(0))),
+                                                                              bytes(0), count(0), readSegment(0), writeSegment(0), readOffset(0), writeSize(0)
+{
+}
+
+/**
+ * @brief SCDSpool::~SCDSpool remove segment files and spool directory
+ */
+SCDSpool::~SCDSpool()
+{
+   reset();
+
+   QDir().rmdir(path);
+}
+
+/**
+ * @brief SCDSpool::open create the spool directory, removing the segments left there
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDSpool::open()
+{
+   QDir dir(path);
+
+   if (!dir.mkpath("."))
+   {
+      lastErrorMsg = "Unable to create spool directory " + path;
+      return 0;
+   }
+
+   QStringList segments = dir.entryList(QStringList() << "*.seg", QDir::Files);
+
+   for (int n=0; n<segments.size(); n++)
+   {
+      dir.remove(segments.at(n));
+   }
+
+   reset();
+
+   return 1;
+}
+
+/**
+ * @brief SCDSpool::segmentName
+ * @param segment
+ * @return segment file path
+ */
+QString SCDSpool::segmentName(quint32 segment) const
+{
+   return path + "/" + QString("%1.seg").arg(segment,8,16,QChar('0'));
+}
+
+/**
+ * @brief SCDSpool::openWriter start the write segment
+ * @return false on failure (see lastError)
+ */
+bool SCDSpool::openWriter()
+{
+   writer.setFileName(segmentName(writeSegment));
+
+   if (!writer.open(QIODevice::WriteOnly | QIODevice::Truncate))
+   {
+      lastErrorMsg = "error opening spool segment '" + writer.fileName() + "' => " + writer.errorString();
+      return false;
+   }
+
+   writeSize = 0;
+
+   return true;
+}
+
+/**
+ * @brief SCDSpool::reset close and remove all segments
+ */
+void SCDSpool::reset()
+{
+   reader.close();
+   writer.close();
+
+   for (quint32 segment=readSegment; segment<=writeSegment; segment++)
+   {
+      QFile::remove(segmentName(segment));
+   }
+
+   bytes = 0;
+   count = 0;
+
+   readSegment  = 0;
+   writeSegment = 0;
+   readOffset   = 0;
+   writeSize    = 0;
+}
+
+/**
+ * @brief SCDSpool::append append a message to the write segment
+ * @param message
+ * @return 1 on success, 0 if the disk usage limit is reached, -1 on write failure (see lastError)
+ */
+int SCDSpool::append(const SCDReliableMessage &message)
+{
+   QByteArray frame = message.frame.toUtf8();
+
+   qint64 size = recordHeaderSize + frame.size();
+
+   if (maxBytes>0 && bytes + size > maxBytes)
+   {
+      lastErrorMsg = "spool disk limit reached";
+      return 0;
+   }
+
+   if (writer.isOpen() && writeSize>0 && writeSize + size > segmentSize) // start a new segment
+   {
+      writer.close();
+      writeSegment++;
+   }
+
+   if (!writer.isOpen() && !openWriter())
+   {
+      return -1;
+   }
+
+   QByteArray record;
+
+   record.reserve(int(size));
+
+   QDataStream stream(&record, QIODevice::WriteOnly);
+
+   stream << quint32(frame.size()) << quint64(message.sequence) << quint8(message.priority) << qint64(message.expiry.expires);
+
+   record.append(frame);
+
+   if (writer.write(record) != record.size())
+   {
+      lastErrorMsg = "error writing spool segment '" + writer.fileName() + "' => " + writer.errorString();
+
+      writer.resize(writeSize); // drop the partial record
+
+      return -1;
+   }
+
+   writeSize += size;
+   bytes     += size;
+
+   count++;
+
+   return 1;
+}
+
+/**
+ * @brief SCDSpool::read read back the oldest messages, in order: the segments read entirely are removed
+ * @param messages queue the messages are appended to
+ * @param max max messages read
+ * @return messages read, -1 on read failure (see lastError)
+ */
+int SCDSpool::read(QQueue<SCDReliableMessage> &messages, int max)
+{
+   int n = 0;
+
+   if (writer.isOpen())
+   {
+      writer.flush(); // the write segment may be read back
+   }
+
+   while (n<max && count>0)
+   {
+      if (!reader.isOpen())
+      {
+         reader.setFileName(segmentName(readSegment));
+
+         if (!reader.open(QIODevice::ReadOnly) || !reader.seek(readOffset))
+         {
+            lastErrorMsg = "error opening spool segment '" + reader.fileName() + "' => " + reader.errorString();
+            return -1;
+         }
+      }
+
+      QByteArray header = reader.read(recordHeaderSize);
+
+      if (header.size() < recordHeaderSize) // end of segment
+      {
+         if (readSegment==writeSegment)
+         {
+            lastErrorMsg = "spool segment '" + reader.fileName() + "' truncated";
+            return -1;
+         }
+
+         bytes -= reader.size();
+
+         reader.close();
+
+         QFile::remove(segmentName(readSegment++));
+
+         readOffset = 0;
+         continue;
+      }
+
+      QDataStream stream(header);
+
+      quint32 size;
+      quint64 sequence;
+      quint8  priority;
+      qint64  expires;
+
+      stream >> size >> sequence >> priority >> expires;
+
+      QByteArray frame = reader.read(size);
+
+      if (frame.size() != int(size))
+      {
+         lastErrorMsg = "spool segment '" + reader.fileName() + "' truncated";
+         return -1;
+      }
+
+      SCDReliableMessage message;
+
+      message.sequence = sequence;
+      message.frame    = QString::fromUtf8(frame);
+      message.priority = priority;
+      message.sent     = 0;
+      message.dropped  = false;
+
+      message.expiry.expires = expires;
+
+      messages.enqueue(message);
+
+      readOffset += recordHeaderSize + size;
+
+      count--;
+      n++;
+   }
+
+   if (count==0) // all read back: start again from an empty segment
+   {
+      reset();
+   }
+
+   return n;
+}
+
+/**
+ * @brief SCDSpool::clear discard the spilled messages
+ */
+void SCDSpool::clear()
+{
+   reset();
+}
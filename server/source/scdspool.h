@@ -0,0 +1,87 @@
+/**
+ * @class SCDSpool https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server disk queue of a durable subscription
+ *
+ *        The messages of a durable subscription exceeding its memory queue are spilled to append-only segment files
+ *        into the spool directory of the subscription, and read back in order as the memory queue drains. A segment is
+ *        deleted as soon as it has been read back entirely, so the disk usage is the size of the segments still
+ *        holding unread messages: over maxBytes messages are refused.
+ *
+ *        Segment files: <segment number, 8 hex digits>.seg, records: <frame size:quint32><sequence:quint64>
+ *                       <priority:quint8><expires:qint64><frame:utf-8> (QDataStream, big endian)
+ *
+ *        expires is the expiry time of a message having a TTL (monotonic msec, 0: never expires): the expired messages
+ *        are dropped when read back (see SCDTopicServer::expireSpooled).
+ *
+ *        The spool is process state: its files are removed when the spool is deleted and do not survive a restart.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDSPOOL_H
+#define SCDSPOOL_H
+
+#include <QString>
+#include <QFile>
+#include <QQueue>
+
+#include "scdconnection.h"
+
+class SCDSpool
+{
+   private:
+
+     static const int recordHeaderSize = 21; // frame size, sequence, priority, expires
+
+     QString path; // spool directory
+
+     qint64 segmentSize; // a new segment is started when the current one exceeds this size
+     qint64 maxBytes;    // disk usage limit, 0: unlimited
+     qint64 bytes;       // disk usage: size of segment files
+
+     int count; // messages spilled and not yet read back
+
+     quint32 readSegment;  // segment being read back
+     quint32 writeSegment; // segment being appended
+     qint64  readOffset;   // next record into read segment
+     qint64  writeSize;    // size of write segment
+
+     QFile reader;
+     QFile writer;
+
+     QString lastErrorMsg;
+
+     QString segmentName(quint32 segment) const;
+
+     bool openWriter();
+     void reset();
+
+   public:
+
+     SCDSpool(const QString &path, qint64 segmentSize, qint64 maxBytes);
+
+     ~SCDSpool();
+
+     int open();
+
+     int append(const SCDReliableMessage &message);
+     int read(QQueue<SCDReliableMessage> &messages, int max);
+
+     void clear();
+
+     bool isEmpty() const { return count==0; }
+
+     int size() const { return count; }
+
+     qint64 diskUsage() const { return bytes; }
+     qint64 diskLimit() const { return maxBytes; }
+
+     QString directory() const { return path; }
+
+     QString lastError() const { return lastErrorMsg; }
+};
+
+#endif // SCDSPOOL_H
@@ -0,0 +1,281 @@
+/**
+ * @class SCDTimerWheel https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server hashed timer wheel
+ *
+ *        A single timer wheel shared by many timeouts (e.g. heartbeat of each connection), instead of a QTimer for each
+ *        of them. Items are scheduled into the slot of their expiration tick; an item expiring after more than a wheel
+ *        revolution stays into its slot until the right revolution comes. Scheduling and expiring are O(1) for each item.
+ *
+ *        Scheduled items cannot be cancelled: the owner should check the item is still alive when it expires.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDTIMERWHEEL_H
+#define SCDTIMERWHEEL_H
+
+#include <QVector>
+#include <QList>
+
+template <typename T>
+class SCDTimerWheel
+{
+   private:
+
+     struct Entry
+     {
+        T      item;
+        qint64 tick; // expiration tick
+     };
+
+     QVector< QVector<Entry> > wheel;
+
+     qint64 tickTime; // tick duration (msec)
+     qint64 current;  // last tick processed
+
+     int count; // scheduled items
+
+   public:
+
+     explicit SCDTimerWheel(int slotCount=512, int tickTime=250) : wheel(slotCount), tickTime(tickTime), current(0), count(0) {}
+
+     /**
+      * @brief start set the wheel current time
+      * @param now monotonic time (msec)
+      */
+     void start(qint64 now)
+     {
+        current = now/tickTime;
+     }
+
+     /**
+      * @brief schedule schedule an item
+      * @param item
+      * @param expire expiration monotonic time (msec), an item already expired will expire at next tick
+      */
+     void schedule(const T &item, qint64 expire)
+     {
+        Entry entry;
+
+        entry.item = item;
+        entry.tick = qMax(expire/tickTime, current+1);
+
+        wheel[entry.tick % wheel.size()].append(entry);
+
+        count++;
+     }
+
+     /**
+      * @brief advance move the wheel to current time and collect the expired items
+      * @param now monotonic time (msec)
+      * @param expired list of expired items (items are appended)
+      * @return number of expired items
+      */
+     int advance(qint64 now, QList<T> &expired)
+     {
+        qint64 last  = now/tickTime;
+        qint64 steps = qMin(last - current, qint64(wheel.size())); // a whole revolution visits every slot
+
+        int expiredCount = 0;
+
+        for (qint64 tick = current+1; tick <= current+steps; tick++)
+        {
+           QVector<Entry> &slot = wheel[tick % wheel.size()];
+
+           for (int n=0; n<slot.size(); )
+           {
+              if (slot.at(n).tick <= last)
+              {
+                 expired.append(slot.at(n).item);
+
+                 slot[n] = slot.last(); // swap remove: order into the slot doesn't matter
+                 slot.removeLast();
+
+                 expiredCount++;
+                 continue;
+              }
+
+              n++;
+           }
+        }
+
+        if (last > current)
+        {
+           current = last;
+        }
+
+        count -= expiredCount;
+
+        return expiredCount;
+     }
+
+     int size() const { return count; }
+
+     int tickInterval() const { return tickTime; }
+};
+
+/**
+ * @class SCDHierarchicalWheel https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server hierarchical timer wheel
+ *
+ *        Timer wheel for timeouts spread from a tick to days (e.g. message TTLs): levelCount wheels of slotCount slots,
+ *        a slot of each level covering a whole revolution of the level below. An item is scheduled into the level of
+ *        its distance from current tick, and moved down (cascaded) when the wheel reaches its slot, so that no item is
+ *        visited more than once for each level, whatever its timeout. Items beyond the top level range wait into its
+ *        last slot and are scheduled again.
+ *
+ *        Scheduled items cannot be cancelled: the owner should check the item is still alive when it expires.
+ */
+template <typename T>
+class SCDHierarchicalWheel
+{
+   public:
+
+     static const int levelBits  = 6;
+     static const int slotCount  = 1 << levelBits; // 64
+     static const int levelCount = 4;              // 64^4 ticks: 19 days at 100 msec
+
+   private:
+
+     struct Entry
+     {
+        T      item;
+        qint64 tick; // expiration tick
+     };
+
+     QVector< QVector<Entry> > wheel; // levelCount x slotCount slots
+
+     qint64 tickTime; // tick duration (msec)
+     qint64 current;  // last tick processed
+
+     int count; // scheduled items
+
+     QVector<Entry> &slot(int level, qint64 tick)
+     {
+        return wheel[level*slotCount + int((tick >> (levelBits*level)) & (slotCount-1))];
+     }
+
+     /**
+      * @brief insert put an entry into the slot of its level
+      * @param entry
+      */
+     void insert(const Entry &entry)
+     {
+        qint64 distance = entry.tick - current;
+
+        int level = 0;
+
+        while (level < levelCount-1 && distance >= (qint64(1) << (levelBits*(level+1))))
+        {
+           level++;
+        }
+
+        if (distance >= (qint64(1) << (levelBits*levelCount))) // beyond the wheel range: scheduled again at the end of it
+        {
+           slot(level, current + (qint64(slotCount-1) << (levelBits*level))).append(entry);
+           return;
+        }
+
+        slot(level, entry.tick).append(entry);
+     }
+
+     /**
+      * @brief cascade move the entries of the current slot of a level to the lower levels
+      * @param level
+      */
+     void cascade(int level)
+     {
+        QVector<Entry> entries;
+
+        entries.swap(slot(level, current));
+
+        for (int n=0; n<entries.size(); n++)
+        {
+           insert(entries.at(n));
+        }
+     }
+
+   public:
+
+     explicit SCDHierarchicalWheel(int tickTime=100) : wheel(levelCount*slotCount), tickTime(tickTime), current(0), count(0) {}
+
+     /**
+      * @brief start set the wheel current time
+      * @param now monotonic time (msec)
+      */
+     void start(qint64 now)
+     {
+        current = now/tickTime;
+     }
+
+     /**
+      * @brief schedule schedule an item
+      * @param item
+      * @param expire expiration monotonic time (msec), an item already expired will expire at next tick
+      */
+     void schedule(const T &item, qint64 expire)
+     {
+        Entry entry;
+
+        entry.item = item;
+        entry.tick = qMax(expire/tickTime, current+1);
+
+        insert(entry);
+
+        count++;
+     }
+
+     /**
+      * @brief advance move the wheel to current time and collect the expired items
+      * @param now monotonic time (msec)
+      * @param expired list of expired items (items are appended)
+      * @return number of expired items
+      */
+     int advance(qint64 now, QList<T> &expired)
+     {
+        qint64 last = now/tickTime;
+
+        if (count==0) // nothing to visit
+        {
+           current = qMax(current, last);
+           return 0;
+        }
+
+        int expiredCount = 0;
+
+        while (current < last)
+        {
+           current++;
+
+           for (int level=1; level<levelCount && ((current >> (levelBits*(level-1))) & (slotCount-1)) == 0; level++) // a lower level revolution is completed
+           {
+              cascade(level);
+           }
+
+           QVector<Entry> &due = slot(0, current);
+
+           for (int n=0; n<due.size(); n++)
+           {
+              expired.append(due.at(n).item);
+           }
+
+           expiredCount += due.size();
+
+           due.clear();
+        }
+
+        count -= expiredCount;
+
+        return expiredCount;
+     }
+
+     int size() const { return count; }
+
+     int tickInterval() const { return tickTime; }
+};
+
+#endif // SCDTIMERWHEEL_H
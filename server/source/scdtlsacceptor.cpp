@@ -0,0 +1,433 @@
+/**
+ * @class SCDTlsAcceptor https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server TLS acceptor (wss://)
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+
+#include "scdtlsacceptor.h"
+#include "scdtopicserver.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QTimer>
+#include <QSslKey>
+#include <QSslCertificate>
+
+#include <cstring>
+
+#define OPENSSL_SUPPRESS_DEPRECATED // the HMAC ticket key callback is the one of both OpenSSL 1.1 and 3
+
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+/*
+ * Session tickets shared by all handshakes: Qt makes an OpenSSL context for each socket, each one with its own random
+ * ticket keys, so the ticket issued by a connection could not be decrypted by the next one. An ex_data callback on the
+ * contexts is called by OpenSSL as each context is made, before Qt configures it, and installs on it the ticket key
+ * callback below: every context encrypts and decrypts the tickets with the same keys, made once for the process.
+ */
+static unsigned char ticketKeyName[16];
+static unsigned char ticketCipherKey[32];
+static unsigned char ticketHmacKey[32];
+
+static QAtomicInt ticketContexts;    // contexts using the shared ticket keys
+static QAtomicInt ticketResumptions; // tickets accepted: abbreviated handshakes
+
+static int ticketKeyCallback(SSL *, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cipher, HMAC_CTX *hmac, int encrypt)
+{
+   if (encrypt)
+   {
+      if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+      {
+         return -1;
+      }
+
+      memcpy(name, ticketKeyName, sizeof(ticketKeyName));
+
+      if (EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), 0, ticketCipherKey, iv) != 1 ||
+          HMAC_Init_ex(hmac, ticketHmacKey, sizeof(ticketHmacKey), EVP_sha256(), 0) != 1)
+      {
+         return -1;
+      }
+
+      return 1;
+   }
+
+   if (memcmp(name, ticketKeyName, sizeof(ticketKeyName)) != 0) // ticket of another process: full handshake
+   {
+      return 0;
+   }
+
+   if (HMAC_Init_ex(hmac, ticketHmacKey, sizeof(ticketHmacKey), EVP_sha256(), 0) != 1 ||
+       EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), 0, ticketCipherKey, iv) != 1)
+   {
+      return -1;
+   }
+
+   ticketResumptions.ref();
+
+   return 1;
+}
+
+static void onTlsContext(void *parent, void *, CRYPTO_EX_DATA *, int, long, void *)
+{
+   SSL_CTX *context = static_cast<SSL_CTX *>(parent);
+
+   static const unsigned char sessionContext[] = "scdtopicserver";
+
+   SSL_CTX_set_session_id_context(context, sessionContext, sizeof(sessionContext)-1); // required by verified peers
+   SSL_CTX_set_tlsext_ticket_key_cb(context, ticketKeyCallback);
+
+   ticketContexts.ref();
+}
+
+/**
+ * @brief shareSessionTickets make the ticket keys and hook the OpenSSL contexts made from now on (once a process)
+ * @return false if the keys cannot be made
+ */
+static bool shareSessionTickets()
+{
+   static const bool shared = []()
+   {
+      if (RAND_bytes(ticketKeyName, sizeof(ticketKeyName)) != 1 ||
+          RAND_bytes(ticketCipherKey, sizeof(ticketCipherKey)) != 1 ||
+          RAND_bytes(ticketHmacKey, sizeof(ticketHmacKey)) != 1)
+      {
+         return false;
+      }
+
+      return CRYPTO_get_ex_new_index(CRYPTO_EX_INDEX_SSL_CTX, 0, 0, onTlsContext, 0, 0) >= 0;
+   }();
+
+   return shared;
+}
+
+/**
+ * @brief SCDTlsHandshaker::SCDTlsHandshaker
+ * @param configuration TLS configuration shared by all handshakes
+ * @param routingThread thread the encrypted sockets are moved to
+ * @param timeout handshake timeout (msec)
+ * @param failures failed handshakes counter
+ */
+SCDTlsHandshaker::SCDTlsHandshaker(const QSslConfiguration &configuration, QThread *routingThread, int timeout, QAtomicInt *failures) :
+   configuration(configuration), routingThread(routingThread), timeout(timeout), failures(failures)
+{
+}
+
+/**
+ * @brief SCDTlsHandshaker::handshake start the server handshake of an accepted connection
+ * @param socketDescriptor
+ */
+void SCDTlsHandshaker::handshake(qintptr socketDescriptor)
+{
+   QSslSocket *socket = new QSslSocket();
+
+   if (!socket->setSocketDescriptor(socketDescriptor))
+   {
+      failures->ref();
+
+      delete socket;
+      return;
+   }
+
+   socket->setSslConfiguration(configuration);
+
+   connect(socket, SIGNAL(encrypted()), this, SLOT(onEncrypted()));
+   connect(socket, SIGNAL(disconnected()), this, SLOT(onFailed()));
+   connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(onFailed()));
+   connect(socket, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(onFailed()));
+
+   QTimer::singleShot(timeout, socket, [socket]() // slow or silent peer
+   {
+      if (!socket->isEncrypted())
+      {
+         socket->abort();
+      }
+   });
+
+   socket->startServerEncryption();
+}
+
+/**
+ * @brief SCDTlsHandshaker::onEncrypted handshake done: the socket is moved to the routing thread
+ */
+void SCDTlsHandshaker::onEncrypted()
+{
+   QSslSocket *socket = static_cast<QSslSocket *>(sender());
+
+   socket->disconnect(this);
+
+   socket->moveToThread(routingThread);
+
+   emit encrypted(socket);
+}
+
+/**
+ * @brief SCDTlsHandshaker::onFailed handshake failed, timed out or peer disconnected
+ */
+void SCDTlsHandshaker::onFailed()
+{
+   QSslSocket *socket = static_cast<QSslSocket *>(sender());
+
+   socket->disconnect(this);
+
+   socket->abort();
+   socket->deleteLater();
+
+   failures->ref();
+}
+
+/**
+ * @brief SCDTlsAcceptor::SCDTlsAcceptor
+ * @param router topic server the encrypted connections are handed to
+ * @param parent
+ */
+SCDTlsAcceptor::SCDTlsAcceptor(SCDTopicServer *router, QObject *parent) : QTcpServer(parent), router(router)
+{
+   threadCount = qMax(QThread::idealThreadCount()-1, 1);
+
+   next = 0;
+
+   handshakeTimeout = 10000;
+}
+
+/**
+ * @brief SCDTlsAcceptor::~SCDTlsAcceptor
+ */
+SCDTlsAcceptor::~SCDTlsAcceptor()
+{
+   stop();
+}
+
+/**
+ * @brief SCDTlsAcceptor::configure load server certificate and private key
+ * @param certificateFile PEM certificate, optionally followed by its chain
+ * @param privateKeyFile PEM private key (RSA or EC)
+ * @param caCertificatesFile PEM certificates of the authorities of client certificates, empty for none
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDTlsAcceptor::configure(const QString &certificateFile, const QString &privateKeyFile, const QString &caCertificatesFile)
+{
+   if (!QSslSocket::supportsSsl())
+   {
+      lastErrorMsg = "TLS not supported by Qt network library";
+      return 0;
+   }
+
+   QList<QSslCertificate> chain = QSslCertificate::fromPath(certificateFile, QSsl::Pem);
+
+   if (chain.isEmpty())
+   {
+      lastErrorMsg = "Unable to load certificate " + certificateFile;
+      return 0;
+   }
+
+   QFile file(privateKeyFile);
+
+   if (!file.open(QIODevice::ReadOnly))
+   {
+      lastErrorMsg = "Unable to read private key " + privateKeyFile;
+      return 0;
+   }
+
+   QByteArray pem = file.readAll();
+
+   QSslKey key(pem, QSsl::Rsa, QSsl::Pem, QSsl::PrivateKey);
+
+   if (key.isNull())
+   {
+      key = QSslKey(pem, QSsl::Ec, QSsl::Pem, QSsl::PrivateKey);
+   }
+
+   if (key.isNull())
+   {
+      lastErrorMsg = "Invalid private key " + privateKeyFile;
+      return 0;
+   }
+
+   configuration = QSslConfiguration::defaultConfiguration();
+
+   configuration.setLocalCertificate(chain.takeFirst());
+   configuration.setLocalCertificateChain(QList<QSslCertificate>() << configuration.localCertificate() << chain);
+   configuration.setPrivateKey(key);
+   configuration.setProtocol(QSsl::TlsV1_2OrLater);
+
+   if (!shareSessionTickets())
+   {
+      lastErrorMsg = "Unable to make the TLS session ticket keys";
+      return 0;
+   }
+
+   configuration.setSslOption(QSsl::SslOptionDisableSessionTickets, false); // redeemed by any handshake thread
+
+   if (caCertificatesFile.isEmpty())
+   {
+      configuration.setPeerVerifyMode(QSslSocket::VerifyNone);
+   }
+   else
+   {
+      configuration.setCaCertificates(QSslCertificate::fromPath(caCertificatesFile, QSsl::Pem));
+      configuration.setPeerVerifyMode(QSslSocket::VerifyPeer); // clients must present a certificate
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDTlsAcceptor::setThreads set the number of handshake threads: set before start
+ * @param count
+ */
+void SCDTlsAcceptor::setThreads(int count)
+{
+   threadCount = qMax(count,1);
+}
+
+/**
+ * @brief SCDTlsAcceptor::setHandshakeTimeout
+ * @param timeout msec
+ */
+void SCDTlsAcceptor::setHandshakeTimeout(int timeout)
+{
+   handshakeTimeout = qMax(timeout,100);
+}
+
+/**
+ * @brief SCDTlsAcceptor::start start the handshake threads and listen on all addresses
+ * @param port
+ * @param reusePort share the port with other server processes (SO_REUSEPORT)
+ * @param socketDescriptor socket already listening, handed over by the previous process, -1: none
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDTlsAcceptor::start(quint16 port, bool reusePort, int socketDescriptor)
+{
+   if (configuration.localCertificate().isNull())
+   {
+      lastErrorMsg = "TLS certificate not configured";
+      return 0;
+   }
+
+   int fd = (socketDescriptor>=0) ? socketDescriptor : reusePort ? SCDTopicServer::reusePortSocket(port, lastErrorMsg) : -2; // -2: plain listen
+
+   if (fd == -1)
+   {
+      return 0;
+   }
+
+   if (fd>=0 ? !setSocketDescriptor(fd) : !listen(QHostAddress::Any, port))
+   {
+      lastErrorMsg = "Unable to start TLS server on port " + QString::number(port) + ": " + errorString();
+      return 0;
+   }
+
+   startThreads();
+
+   lastErrorMsg = "TLS server is listening on port " + QString::number(serverPort()) + " for incoming connections...";
+
+   return 1;
+}
+
+/**
+ * @brief SCDTlsAcceptor::stop stop listening and the handshake threads
+ */
+void SCDTlsAcceptor::stop()
+{
+   close();
+
+   stopThreads();
+}
+
+/**
+ * @brief SCDTlsAcceptor::incomingConnection hand the connection to the next handshake thread
+ * @param socketDescriptor
+ */
+void SCDTlsAcceptor::incomingConnection(qintptr socketDescriptor)
+{
+   if (handshakers.isEmpty())
+   {
+      return;
+   }
+
+   SCDTlsHandshaker *handshaker = handshakers.at(next);
+
+   next = (next+1) % handshakers.size();
+
+   QMetaObject::invokeMethod(handshaker, "handshake", Qt::QueuedConnection, Q_ARG(qintptr, socketDescriptor));
+}
+
+/**
+ * @brief SCDTlsAcceptor::onEncrypted the socket is into the routing thread now: the topic server upgrades it to web socket
+ * @param socket
+ */
+void SCDTlsAcceptor::onEncrypted(QSslSocket *socket)
+{
+   handshakes.ref();
+
+   router->handleConnection(socket);
+
+   if (socket->bytesAvailable() > 0) // upgrade request read before the handover: its readyRead had no receiver
+   {
+      QMetaObject::invokeMethod(socket, "readyRead", Qt::QueuedConnection);
+   }
+}
+
+/**
+ * @brief SCDTlsAcceptor::resumptionCount sessions resumed from a ticket, by all the acceptors of the process
+ * @return
+ */
+int SCDTlsAcceptor::resumptionCount() const
+{
+   return ticketResumptions.load();
+}
+
+/**
+ * @brief SCDTlsAcceptor::ticketContextCount TLS contexts made with the shared ticket keys: 0 if Qt loaded another
+ *                                           OpenSSL library than the server is linked to, and tickets are not shared
+ * @return
+ */
+int SCDTlsAcceptor::ticketContextCount() const
+{
+   return ticketContexts.load();
+}
+
+void SCDTlsAcceptor::startThreads()
+{
+   qRegisterMetaType<qintptr>("qintptr");
+
+   for (int n=0; n<threadCount; n++)
+   {
+      QThread *thread = new QThread(this);
+
+      SCDTlsHandshaker *handshaker = new SCDTlsHandshaker(configuration, this->thread(), handshakeTimeout, &failures);
+
+      handshaker->moveToThread(thread);
+
+      connect(handshaker, SIGNAL(encrypted(QSslSocket*)), this, SLOT(onEncrypted(QSslSocket*)), Qt::QueuedConnection);
+
+      thread->start();
+
+      threads.append(thread);
+      handshakers.append(handshaker);
+   }
+}
+
+void SCDTlsAcceptor::stopThreads()
+{
+   for (int n=0; n<threads.size(); n++)
+   {
+      threads.at(n)->quit();
+      threads.at(n)->wait();
+   }
+
+   qDeleteAll(handshakers); // threads finished: no more events for them
+   qDeleteAll(threads);
+
+   threads.clear();
+   handshakers.clear();
+}
@@ -0,0 +1,128 @@
+/**
+ * @class SCDTlsAcceptor https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server TLS acceptor (wss://)
+ *
+ *        Accepts the TCP connections and runs their TLS handshakes into a pool of handshake threads, so that a
+ *        reconnect storm does not stall the topic routing: each encrypted socket is then moved to the routing thread
+ *        and handed to SCDTopicServer (QWebSocketServer::handleConnection), which performs the web socket upgrade
+ *        on it as on a plain socket.
+ *
+ *        All handshakes share the same TLS configuration and the same session ticket keys: the Qt 5 backend makes a
+ *        TLS context for each server socket, so the server hooks the OpenSSL contexts as they are made and installs
+ *        the process ticket keys on each of them. A reconnecting client presenting the ticket of its previous
+ *        connection resumes the session with an abbreviated handshake, whichever handshake thread runs it. The keys
+ *        live as long as the process: after a restart or a handover the first handshake of each client is a full one.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDTLSACCEPTOR_H
+#define SCDTLSACCEPTOR_H
+
+#include <QTcpServer>
+#include <QSslSocket>
+#include <QSslConfiguration>
+#include <QThread>
+#include <QVector>
+#include <QAtomicInt>
+
+class SCDTopicServer;
+
+/**
+ * @brief The SCDTlsHandshaker class runs the TLS handshakes of a handshake thread
+ */
+class SCDTlsHandshaker : public QObject
+{
+   Q_OBJECT
+
+   private:
+
+     QSslConfiguration configuration;
+
+     QThread *routingThread; // thread the encrypted sockets are moved to
+
+     int timeout; // msec: a handshake taking more is aborted
+
+     QAtomicInt *failures;
+
+   public:
+
+     SCDTlsHandshaker(const QSslConfiguration &configuration, QThread *routingThread, int timeout, QAtomicInt *failures);
+
+   public slots:
+
+     void handshake(qintptr socketDescriptor);
+
+   private slots:
+
+     void onEncrypted();
+     void onFailed();
+
+   signals:
+
+     void encrypted(QSslSocket *socket);
+};
+
+class SCDTlsAcceptor : public QTcpServer
+{
+   Q_OBJECT
+
+   private:
+
+     SCDTopicServer *router;
+
+     QSslConfiguration configuration;
+
+     QVector<QThread *>          threads;
+     QVector<SCDTlsHandshaker *> handshakers;
+
+     int threadCount;
+     int next; // handshaker of next connection (round robin)
+
+     int handshakeTimeout;
+
+     QAtomicInt handshakes; // completed handshakes
+     QAtomicInt failures;   // failed or timed out handshakes
+
+     QString lastErrorMsg;
+
+     void startThreads();
+     void stopThreads();
+
+   protected:
+
+     void incomingConnection(qintptr socketDescriptor);
+
+   public:
+
+     explicit SCDTlsAcceptor(SCDTopicServer *router, QObject *parent = 0);
+
+     ~SCDTlsAcceptor();
+
+     int configure(const QString &certificateFile, const QString &privateKeyFile, const QString &caCertificatesFile=QString());
+
+     void setThreads(int count);
+     void setHandshakeTimeout(int timeout);
+
+     int start(quint16 port, bool reusePort=false, int socketDescriptor=-1);
+     void stop();
+
+     QSslConfiguration sslConfiguration() const { return configuration; }
+
+     int handshakeCount() const { return handshakes.load(); }
+     int failureCount() const { return failures.load(); }
+
+     int resumptionCount() const;
+     int ticketContextCount() const;
+
+     QString lastError() const { return lastErrorMsg; }
+
+   private slots:
+
+     void onEncrypted(QSslSocket *socket);
+};
+
+#endif // SCDTLSACCEPTOR_H
@@ -0,0 +1,99 @@
+/**
+ * @struct SCDTokenBucket https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server token bucket rate limiter
+ *
+ *        The bucket is refilled at 'rate' tokens/sec up to 'burst' tokens; each operation takes its cost from bucket.
+ *        An operation costing more than burst is allowed when the bucket is full: the bucket goes in debt and
+ *        the following operations wait until the debt is refilled. All operations are O(1).
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDTOKENBUCKET_H
+#define SCDTOKENBUCKET_H
+
+#include <QtGlobal>
+#include <QtMath>
+
+struct SCDTokenBucket
+{
+   double rate;   // tokens/sec, 0: unlimited
+   double burst;  // bucket capacity
+   double tokens; // available tokens
+   qint64 stamp;  // monotonic time of last refill (msec)
+
+   SCDTokenBucket() : rate(0), burst(0), tokens(0), stamp(0) {}
+
+   /**
+    * @brief configure set the rate, the bucket is full
+    * @param rate tokens/sec, 0 for unlimited
+    * @param burst bucket capacity, 0 for one second of rate
+    * @param now monotonic time (msec)
+    */
+   void configure(double rate, double burst, qint64 now)
+   {
+      this->rate  = qMax(rate, 0.0);
+      this->burst = (burst>0) ? burst : this->rate;
+
+      tokens = this->burst;
+      stamp  = now;
+   }
+
+   bool isLimited() const { return rate>0; }
+
+   /**
+    * @brief available refill the bucket and check if the operation can be done
+    * @param cost
+    * @param now monotonic time (msec)
+    * @return true if available
+    */
+   bool available(double cost, qint64 now)
+   {
+      if (rate<=0)
+      {
+         return true;
+      }
+
+      if (now > stamp)
+      {
+         tokens = qMin(burst, tokens + (now - stamp)*rate/1000.0);
+         stamp  = now;
+      }
+
+      return tokens >= qMin(cost, burst);
+   }
+
+   /**
+    * @brief consume take the cost of an operation: call after available
+    * @param cost
+    */
+   void consume(double cost)
+   {
+      if (rate>0)
+      {
+         tokens -= cost;
+      }
+   }
+
+   /**
+    * @brief delay time to wait before the operation will be available: call after available
+    * @param cost
+    * @return msec
+    */
+   qint64 delay(double cost) const
+   {
+      double missing = qMin(cost, burst) - tokens;
+
+      if (rate<=0 || missing<=0)
+      {
+         return 0;
+      }
+
+      return qint64(qCeil(missing*1000.0/rate));
+   }
+};
+
+#endif // SCDTOKENBUCKET_H
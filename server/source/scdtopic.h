@@ -0,0 +1,167 @@
+/**
+ * @struct SCDTopic https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server topic registry entry
+ *
+ *        One entry for each topic known by server. Entries are kept into the sorted topic index of SCDTopicServer
+ *        (topic name => entry), so that topics can be listed in order and filtered by name prefix.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDTOPIC_H
+#define SCDTOPIC_H
+
+#include <QString>
+#include <QVector>
+#include <QJsonObject>
+#include <QtMath>
+
+#include "scdtokenbucket.h"
+#include "scdconnection.h"
+#include "scdfilter.h"
+
+struct SCDTopic
+{
+   static const int rateTimeConstant = 10000; // EWMA time constant of publish rate (msec)
+
+   QString name;
+
+   bool dynamic; // dynamic topic is removed when its subscribers list becomes empty
+
+   int priority; // outbound priority class of topic messages (SCDConnection::Priority)
+
+   // delta encoding of state topics: subscribers receive the changes of last document (JSON merge patch)
+
+   bool        delta;         // delta encoded topic
+   bool        hasState;      // last document is known
+   QJsonObject state;         // last document
+   QString     stateMessage;  // last document as published, sent in full to new subscribers
+   QString     stateSender;   // last document sender name
+   int         sinceKeyframe; // deltas sent since last full document
+   qint64      stateExpires;  // last document published with a TTL: expiry time (monotonic msec, SCDExpiry::now), 0: never
+
+   qint64 expiryScheduled; // earliest expiry time of last document scheduled into the server expiry wheel, 0: none
+
+   QVector<SCDConnection *> subscribers; // contiguous subscribers array scanned by fan-out (unordered), implicitly shared
+                                         // with the snapshots of the large fan-outs in progress: copied on subscribe churn
+
+   int fanOuts; // large fan-outs in progress, delivered in chunks from the event loop (see SCDTopicServer::startFanOut)
+
+   QVector<SCDFilter *> filters; // content filter of each subscriber (parallel to subscribers, 0: no filter), owned
+   int filtered;                 // subscribers having a content filter
+
+   enum Delivery {QOS_AT_MOST_ONCE=0,QOS_AT_LEAST_ONCE=1,QOS_MULTICAST=2};
+
+   QVector<quint8> qos; // delivery of each subscriber (parallel to subscribers): Delivery
+   int reliable;        // subscribers having QoS 1
+
+   // multicast egress: messages are sent once to the multicast group, subscribers joined to the group receive them there
+
+   bool    multicast;          // multicast topic
+   int     multicastReceivers; // subscribers receiving from the multicast group (QOS_MULTICAST)
+   quint64 multicastSequence;  // sequence number of last datagram, see SCDMulticast
+
+   QVector<QByteArray> multicastHistory; // last datagrams, by sequence number modulo size: kept for repairs (empty: too large)
+   QVector<qint64>     multicastExpires; // expiry time of each datagram (parallel to history, 0: never), empty until a TTL message
+
+   SCDTokenBucket messageBucket; // publish rate limits (messages/sec, bytes/sec)
+   SCDTokenBucket byteBucket;
+
+   // statistics
+
+   quint64 messages;      // messages published
+   quint64 bytes;         // payload bytes published
+   quint64 drops;         // deliveries dropped (subscriber socket not available or its queue full)
+   double  rate;          // recent publish rate (messages/sec), exponentially weighted moving average
+   qint64  rateStamp;     // monotonic time of last rate update (msec)
+   qint64  lastPublish;   // time of last publish (msec since epoch), 0 if never published
+
+   QSharedPointer<SCDLatencyHistogram> latency; // queue-to-write time of traced messages, 0 until the first one
+
+   QSharedPointer<quint64> expired; // messages and deliveries expired before delivery (TTL), 0 until the first TTL message
+
+   explicit SCDTopic(const QString &name, bool dynamic=false) : name(name), dynamic(dynamic), priority(SCDConnection::PR_NORMAL), delta(false), hasState(false), sinceKeyframe(0), stateExpires(0), expiryScheduled(0), fanOuts(0), filtered(0), reliable(0), multicast(false), multicastReceivers(0), multicastSequence(0), messages(0), bytes(0), drops(0), rate(0), rateStamp(0), lastPublish(0) {}
+
+   ~SCDTopic() { qDeleteAll(filters); }
+
+   void clearState()
+   {
+      hasState = false;
+
+      state        = QJsonObject();
+      stateMessage = QString();
+      stateExpires = 0;
+   }
+
+   /**
+    * @brief stateExpired
+    * @param now SCDExpiry::now()
+    * @return true if the last document has expired
+    */
+   bool stateExpired(qint64 now) const { return hasState && stateExpires>0 && now>=stateExpires; }
+
+   /**
+    * @brief expireState drop the last document, expired
+    */
+   void expireState()
+   {
+      clearState();
+
+      (*expiredCounter())++;
+   }
+
+   /**
+    * @brief expiredCounter
+    * @return counter of expired messages, shared by the frames of topic messages having a TTL
+    */
+   const QSharedPointer<quint64> &expiredCounter()
+   {
+      if (!expired)
+      {
+         expired = QSharedPointer<quint64>::create(0);
+      }
+
+      return expired;
+   }
+
+   QString typeName() const { return dynamic ? "dynamic" : "static"; }
+
+   /**
+    * @brief published update statistics for a message (or a chunk of message) published to topic
+    * @param size payload size
+    * @param now monotonic time (msec)
+    * @param epoch current time (msec since epoch)
+    * @param last false for a chunk of message which is not the last one: only bytes are counted
+    */
+   void published(int size, qint64 now, qint64 epoch, bool last=true)
+   {
+      bytes += size;
+
+      if (!last)
+      {
+         return;
+      }
+
+      rate = currentRate(now) + 1000.0/rateTimeConstant; // each message adds an impulse to the decayed rate
+
+      rateStamp   = now;
+      lastPublish = epoch;
+
+      messages++;
+   }
+
+   /**
+    * @brief currentRate publish rate decayed to current time
+    * @param now monotonic time (msec)
+    * @return messages/sec
+    */
+   double currentRate(qint64 now) const
+   {
+      return rate * qExp(-double(now - rateStamp)/rateTimeConstant);
+   }
+};
+
+#endif // SCDTOPIC_H
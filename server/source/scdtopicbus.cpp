@@ -0,0 +1,482 @@
+/**
+ * @class SCDTopicBus https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server inter-process routing bus
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+
+#include "scdtopicbus.h"
+#include "scdtopicserver.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QDataStream>
+#include <QFile>
+#include <QCoreApplication>
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <errno.h>
+#endif
+
+/**
+ * @brief SCDTopicBus::SCDTopicBus
+ * @param router topic server delivering the publishes received from peers
+ * @param parent
+ */
+SCDTopicBus::SCDTopicBus(SCDTopicServer *router, QObject *parent) : QObject(parent), router(router)
+{
+   pid = QCoreApplication::applicationPid();
+
+   connect(&server,SIGNAL(newConnection()),this,SLOT(onNewConnection()));
+}
+
+/**
+ * @brief SCDTopicBus::~SCDTopicBus
+ */
+SCDTopicBus::~SCDTopicBus()
+{
+   stop();
+}
+
+/**
+ * @brief SCDTopicBus::start listen on the local socket of this process and connect to the peers found into bus directory
+ * @param path bus directory, shared by all processes of the same server
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDTopicBus::start(const QString &path)
+{
+   this->path = path;
+
+   if (!QDir().mkpath(path))
+   {
+      lastErrorMsg = "Unable to create bus directory " + path;
+      return 0;
+   }
+
+   QString name = path + "/" + QString::number(pid);
+
+   QLocalServer::removeServer(name); // stale socket of a crashed process having the same pid
+
+   if (!server.listen(name))
+   {
+      lastErrorMsg = "Unable to listen on bus socket " + name + ": " + server.errorString();
+      return 0;
+   }
+
+   QStringList peers = QDir(path).entryList(QDir::System | QDir::Files);
+
+   for (int n=0; n<peers.size(); n++)
+   {
+      bool ok = false;
+
+      qint64 peer = peers.at(n).toLongLong(&ok);
+
+      if (!ok || peer==pid)
+      {
+         continue;
+      }
+
+#ifdef Q_OS_UNIX
+      if (::kill(pid_t(peer), 0) < 0 && errno == ESRCH) // crashed process
+      {
+         QFile::remove(path + "/" + peers.at(n));
+         continue;
+      }
+#endif
+
+      QLocalSocket *socket = new QLocalSocket(this);
+
+      addLink(socket, true);
+
+      socket->connectToServer(path + "/" + peers.at(n));
+   }
+
+   lastErrorMsg = "Bus started on " + name;
+
+   return 1;
+}
+
+/**
+ * @brief SCDTopicBus::stop close all links and the local socket
+ */
+void SCDTopicBus::stop()
+{
+   QList<Link *> list = links.values();
+
+   for (int n=0; n<list.size(); n++)
+   {
+      removeLink(list.at(n));
+   }
+
+   server.close();
+}
+
+/**
+ * @brief SCDTopicBus::peerCount
+ * @return number of peers linked
+ */
+int SCDTopicBus::peerCount() const
+{
+   int count = 0;
+
+   for (QHash<QLocalSocket *, Link *>::const_iterator it = links.constBegin(); it != links.constEnd(); ++it)
+   {
+      count += (it.value()->pid != 0);
+   }
+
+   return count;
+}
+
+/**
+ * @brief SCDTopicBus::subscribe a topic got its first local subscriber: tell the peers
+ * @param topic
+ */
+void SCDTopicBus::subscribe(const QString &topic)
+{
+   if (!localInterest.contains(topic))
+   {
+      localInterest.insert(topic);
+
+      broadcast(encodeFrame(FT_INTEREST, QStringList() << topic));
+   }
+}
+
+/**
+ * @brief SCDTopicBus::unsubscribe a topic lost its last local subscriber: tell the peers
+ * @param topic
+ */
+void SCDTopicBus::unsubscribe(const QString &topic)
+{
+   if (localInterest.remove(topic))
+   {
+      broadcast(encodeFrame(FT_UNINTEREST, QStringList() << topic));
+   }
+}
+
+/**
+ * @brief SCDTopicBus::publish forward a publish to the peers interested in its topic: the frame is encoded once
+ * @param topic
+ * @param sender sender name
+ * @param tag chunk tag, empty for a whole message
+ * @param priority outbound priority class, -1 for the topic priority
+ * @param message
+ * @return true if at least a peer is interested
+ */
+bool SCDTopicBus::publish(const QString &topic, const QString &sender, const QString &tag, int priority, const QStringRef &message)
+{
+   if (!remoteInterest.contains(topic)) // fast path: no remote subscribers
+   {
+      return false;
+   }
+
+   QByteArray frame = encodeFrame(FT_PUBLISH, QStringList() << topic << sender << tag << QString::number(priority) << message.toString());
+
+   for (QHash<QLocalSocket *, Link *>::const_iterator it = links.constBegin(); it != links.constEnd(); ++it)
+   {
+      if (it.value()->interest.contains(topic))
+      {
+         sendFrame(it.value(), frame);
+      }
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDTopicBus::topicChanged a static topic has been made or changed (priority, delta encoding)
+ * @param item topics file item: <topic name>:<static|dynamic>[:<high|bulk>][:delta]
+ */
+void SCDTopicBus::topicChanged(const QString &item)
+{
+   broadcast(encodeFrame(FT_TOPIC, QStringList() << item));
+}
+
+/**
+ * @brief SCDTopicBus::topicRemoved a static topic has been deleted
+ * @param topic
+ */
+void SCDTopicBus::topicRemoved(const QString &topic)
+{
+   broadcast(encodeFrame(FT_REMOVE, QStringList() << topic));
+}
+
+/**
+ * @brief SCDTopicBus::onNewConnection a peer connected: it sends its hello, this process sends its own
+ */
+void SCDTopicBus::onNewConnection()
+{
+   while (server.hasPendingConnections())
+   {
+      QLocalSocket *socket = server.nextPendingConnection();
+
+      addLink(socket, false);
+
+      sendHello(links.value(socket));
+   }
+}
+
+/**
+ * @brief SCDTopicBus::onConnected
+ */
+void SCDTopicBus::onConnected()
+{
+   Link *link = links.value(static_cast<QLocalSocket *>(sender()));
+
+   if (link)
+   {
+      sendHello(link);
+   }
+}
+
+/**
+ * @brief SCDTopicBus::onReadyRead process the complete frames received
+ */
+void SCDTopicBus::onReadyRead()
+{
+   QLocalSocket *socket = static_cast<QLocalSocket *>(sender());
+
+   Link *link = links.value(socket);
+
+   while (link)
+   {
+      if (link->size==0)
+      {
+         if (socket->bytesAvailable() < qint64(sizeof(quint32)))
+         {
+            return;
+         }
+
+         QDataStream stream(socket);
+
+         stream >> link->size;
+      }
+
+      if (socket->bytesAvailable() < link->size)
+      {
+         return;
+      }
+
+      QByteArray frame = socket->read(link->size);
+
+      link->size = 0;
+
+      processFrame(link, frame);
+
+      link = links.value(socket); // the link is removed when a duplicate link is preferred
+   }
+}
+
+/**
+ * @brief SCDTopicBus::onDisconnected a peer closed the link (or crashed): its interest is dropped
+ */
+void SCDTopicBus::onDisconnected()
+{
+   Link *link = links.value(static_cast<QLocalSocket *>(sender()));
+
+   if (link)
+   {
+      qDebug() << "Bus peer disconnected:" << link->pid;
+
+      removeLink(link);
+   }
+}
+
+/**
+ * @brief SCDTopicBus::onError a peer socket left by a crashed process is removed
+ * @param error
+ */
+void SCDTopicBus::onError(QLocalSocket::LocalSocketError error)
+{
+   QLocalSocket *socket = static_cast<QLocalSocket *>(sender());
+
+   Link *link = links.value(socket);
+
+   if (!link)
+   {
+      return;
+   }
+
+   if (link->outgoing && link->pid==0 && error==QLocalSocket::ConnectionRefusedError)
+   {
+      QFile::remove(socket->serverName());
+   }
+
+   removeLink(link);
+}
+
+void SCDTopicBus::addLink(QLocalSocket *socket, bool outgoing)
+{
+   Link *link = new Link();
+
+   link->socket   = socket;
+   link->pid      = 0;
+   link->outgoing = outgoing;
+   link->size     = 0;
+
+   links.insert(socket, link);
+
+   connect(socket,SIGNAL(connected()),this,SLOT(onConnected()));
+   connect(socket,SIGNAL(readyRead()),this,SLOT(onReadyRead()));
+   connect(socket,SIGNAL(disconnected()),this,SLOT(onDisconnected()));
+   connect(socket,SIGNAL(error(QLocalSocket::LocalSocketError)),this,SLOT(onError(QLocalSocket::LocalSocketError)));
+}
+
+void SCDTopicBus::removeLink(Link *link)
+{
+   links.remove(link->socket);
+
+   QStringList topics = link->interest.values();
+
+   for (int n=0; n<topics.size(); n++)
+   {
+      removeInterest(link, topics.at(n));
+   }
+
+   link->socket->disconnect(this);
+   link->socket->abort();
+   link->socket->deleteLater();
+
+   delete link;
+}
+
+void SCDTopicBus::sendHello(Link *link)
+{
+   sendFrame(link, encodeFrame(FT_HELLO, QStringList() << QString::number(pid) << localInterest.values()));
+}
+
+void SCDTopicBus::sendFrame(Link *link, const QByteArray &frame)
+{
+   if (link->socket->state() == QLocalSocket::ConnectedState)
+   {
+      link->socket->write(frame);
+   }
+}
+
+void SCDTopicBus::broadcast(const QByteArray &frame)
+{
+   for (QHash<QLocalSocket *, Link *>::const_iterator it = links.constBegin(); it != links.constEnd(); ++it)
+   {
+      sendFrame(it.value(), frame);
+   }
+}
+
+void SCDTopicBus::processFrame(Link *link, const QByteArray &frame)
+{
+   QDataStream stream(frame);
+
+   quint8      type;
+   QStringList fields;
+
+   stream >> type >> fields;
+
+   if (fields.isEmpty())
+   {
+      return;
+   }
+
+   switch (type)
+   {
+      case FT_HELLO:
+      {
+         link->pid = fields.takeFirst().toLongLong();
+
+         for (int n=0; n<fields.size(); n++)
+         {
+            addInterest(link, fields.at(n));
+         }
+
+         for (QHash<QLocalSocket *, Link *>::const_iterator it = links.constBegin(); it != links.constEnd(); ++it)
+         {
+            if (it.value() != link && it.value()->pid == link->pid) // duplicate link: both processes drop the same one
+            {
+               removeLink(isPreferred(link) ? it.value() : link);
+               return;
+            }
+         }
+
+         qDebug() << "Bus peer connected:" << link->pid;
+      }
+      break;
+
+      case FT_INTEREST:
+
+         addInterest(link, fields.at(0));
+
+      break;
+
+      case FT_UNINTEREST:
+
+         removeInterest(link, fields.at(0));
+
+      break;
+
+      case FT_PUBLISH:
+
+         if (fields.size()==5)
+         {
+            router->deliverRemoteMessage(fields.at(0), fields.at(1), fields.at(2), fields.at(3).toInt(), fields.at(4));
+         }
+
+      break;
+
+      case FT_TOPIC:
+
+         router->applyRemoteTopic(fields.at(0));
+
+      break;
+
+      case FT_REMOVE:
+
+         router->removeRemoteTopic(fields.at(0));
+
+      break;
+   }
+}
+
+void SCDTopicBus::addInterest(Link *link, const QString &topic)
+{
+   if (!link->interest.contains(topic))
+   {
+      link->interest.insert(topic);
+
+      remoteInterest[topic]++;
+   }
+}
+
+void SCDTopicBus::removeInterest(Link *link, const QString &topic)
+{
+   if (link->interest.remove(topic) && --remoteInterest[topic] <= 0)
+   {
+      remoteInterest.remove(topic);
+   }
+}
+
+/**
+ * @brief SCDTopicBus::isPreferred between two links of the same processes, the one made by the higher pid is kept
+ * @param link
+ * @return
+ */
+bool SCDTopicBus::isPreferred(const Link *link) const
+{
+   return link->outgoing ? (pid > link->pid) : (link->pid > pid);
+}
+
+QByteArray SCDTopicBus::encodeFrame(int type, const QStringList &fields)
+{
+   QByteArray frame;
+
+   QDataStream stream(&frame, QIODevice::WriteOnly);
+
+   stream << quint32(0) << quint8(type) << fields;
+
+   stream.device()->seek(0);
+
+   stream << quint32(frame.size() - sizeof(quint32));
+
+   return frame;
+}
@@ -0,0 +1,146 @@
+/**
+ * @class SCDTopicBus https://github.com/sc-develop/
+ *
+ * @brief SCD Topic Server inter-process routing bus
+ *
+ *        More server processes can share the same port (SO_REUSEPORT): the kernel balances the connections among them,
+ *        and the bus forwards the publishes, so that a subscriber connected to a process receives the messages
+ *        published thru another one.
+ *
+ *        Each process listens on a local socket named by its pid into the bus directory and connects to the sockets
+ *        found there: the processes are fully meshed, without a broker, so a process crashing only drops its links.
+ *        Each process tells its peers the topics having local subscribers (interest), and a publish is forwarded only
+ *        to the peers interested in its topic. The peers deliver it to their local subscribers (never forwarding it
+ *        again), applying their own content filters and delta encoding.
+ *
+ *        Frames: <size:quint32><type:quint8><fields:QStringList> (QDataStream)
+ *
+ *          FT_HELLO      <pid>{<topic>}                              first frame on each link, carrying the whole interest
+ *          FT_INTEREST   <topic>                                     a topic got its first local subscriber
+ *          FT_UNINTEREST <topic>                                     a topic lost its last local subscriber
+ *          FT_PUBLISH    <topic><sender><tag><priority><message>
+ *          FT_TOPIC      <item>                                      static topic made or changed (topics file item)
+ *          FT_REMOVE     <topic>                                     static topic deleted
+ *
+ *        Two processes starting together may connect to each other twice: the link made by the higher pid is kept.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ */
+#ifndef SCDTOPICBUS_H
+#define SCDTOPICBUS_H
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+#include "scdconnection.h"
+
+class SCDTopicServer;
+
+/**
+ * @brief The SCDRemoteSender class sender record of the messages published thru another process:
+ *                                  it is never a subscriber, only its name is used
+ */
+class SCDRemoteSender : public SCDConnection
+{
+   public:
+
+     bool isValid() const { return false; }
+
+     void sendText(const QString &message) { Q_UNUSED(message) }
+
+     void ping() {}
+
+     void abort() {}
+};
+
+class SCDTopicBus : public QObject
+{
+   Q_OBJECT
+
+   private:
+
+     enum FrameType {FT_HELLO=0,FT_INTEREST=1,FT_UNINTEREST=2,FT_PUBLISH=3,FT_TOPIC=4,FT_REMOVE=5};
+
+     /**
+      * @brief The Link struct link to a peer process
+      */
+     struct Link
+     {
+        QLocalSocket   *socket;
+        qint64          pid;      // peer pid, 0 until hello received
+        bool            outgoing; // link made by this process
+        quint32         size;     // size of the frame being received, 0: waiting for the size
+        QSet<QString>   interest; // topics having subscribers on peer
+     };
+
+     SCDTopicServer *router;
+
+     QLocalServer server;
+
+     QString path; // bus directory
+
+     qint64 pid;
+
+     QHash <QLocalSocket *, Link *> links;
+
+     QHash <QString, int> remoteInterest; // topic => number of interested peers
+     QSet  <QString>      localInterest;  // topics having local subscribers
+
+     QString lastErrorMsg;
+
+     void addLink(QLocalSocket *socket, bool outgoing);
+     void removeLink(Link *link);
+
+     void sendHello(Link *link);
+     void sendFrame(Link *link, const QByteArray &frame);
+     void broadcast(const QByteArray &frame);
+
+     void processFrame(Link *link, const QByteArray &frame);
+
+     void addInterest(Link *link, const QString &topic);
+     void removeInterest(Link *link, const QString &topic);
+
+     bool isPreferred(const Link *link) const;
+
+     static QByteArray encodeFrame(int type, const QStringList &fields);
+
+   public:
+
+     explicit SCDTopicBus(SCDTopicServer *router, QObject *parent = 0);
+
+     ~SCDTopicBus();
+
+     int start(const QString &path);
+     void stop();
+
+     // called by router
+
+     void subscribe(const QString &topic);
+     void unsubscribe(const QString &topic);
+
+     bool publish(const QString &topic, const QString &sender, const QString &tag, int priority, const QStringRef &message);
+
+     void topicChanged(const QString &item);
+     void topicRemoved(const QString &topic);
+
+     int peerCount() const;
+
+     QString lastError() const { return lastErrorMsg; }
+
+   private slots:
+
+     void onNewConnection();
+     void onConnected();
+     void onReadyRead();
+     void onDisconnected();
+     void onError(QLocalSocket::LocalSocketError error);
+};
+
+#endif // SCDTOPICBUS_H
@@ -17,6 +17,29 @@
 #include <QStringList>
 #include <QRegularExpression>
 #include <QFile>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QDataStream>
+#include <QDir>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#include <QSet>
+#include <QThread>
+#include <QUuid>
+#include <QLoggingCategory>
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+#include "scdmergepatch.h"
+
+Q_LOGGING_CATEGORY(scdMessages, "scd.messages", QtInfoMsg) // each message received: QT_LOGGING_RULES="scd.messages.debug=true"
 
 /**
  * @brief SCDTopicServer::SCDTopicServer constructor
@@ -30,8 +53,100 @@ SCDTopicServer::SCDTopicServer(QObject *parent, int port) : QWebSocketServer("SC
    commands.insert(TUC, "TUC");
    commands.insert(TRN, "TRN");
    commands.insert(TSM, "TSM");
+   commands.insert(TLT, "TLT");
+   commands.insert(TST, "TST");
+   commands.insert(TAK, "TAK");
+   commands.insert(TDS, "TDS");
+   commands.insert(TBM, "TBM");
+   commands.insert(TMR, "TMR");
+   commands.insert(TSR, "TSR");
+
+   listChunkSize = 256;
+
+   lastConnectionId = 0;
+
+   maxHeaderSize = 1024;
+
+   listTimer.setInterval(0); // one chunk for each pending listing at each event loop iteration
+
+   clock.start();
+
+   heartbeatInterval = 30000;
+   heartbeatTimeout  = 90000;
+
+   heartbeatTimer.setInterval(heartbeatWheel.tickInterval());
+
+   clientMessageRate = 0;
+   clientByteRate    = 0;
+   topicMessageRate  = 0;
+   topicByteRate     = 0;
+
+   rateLimited    = false;
+   delayOverLimit = false;
+
+   maxDelayedMessages = 1000;
+
+   throttleWheel = SCDTimerWheel<quint32>(256, 10); // fine grained: delays are usually short
+
+   throttleTimer.setInterval(throttleWheel.tickInterval());
+
+   maxMessageSize  = 16*1024*1024;
+   maxStreamSize   = 0;
+   streamFragments = true;
+
+   outboundWindow = 256*1024;
+   outboundQueue  = 10000;
+
+   deltaKeyframe = 100;
+
+   reliableWindow    = 100;
+   reliableQueue     = 10000;
+   redeliveryTimeout = 5000;
+   sessionExpiry     = 60000;
+
+   redeliveryWheel = SCDTimerWheel<quint32>(256, 100);
+
+   redeliveryTimer.setInterval(redeliveryWheel.tickInterval());
+
+   lastExpiryCheck = 0;
+
+   expiryTimer.setInterval(expiryWheel.tickInterval());
+
+   fanOutThreshold = 4096;
+   fanOutChunkSize = 1024;
+   fanOutWorkers   = qMax(QThread::idealThreadCount()-1, 0);
+
+   fanOutSerial = 0;
+
+   fanOutTimer.setInterval(0); // one chunk for each topic having fan-outs at each event loop iteration
+
+   fanOutPool.setMaxThreadCount(qMax(fanOutWorkers, 1));
+
+   resumeGrace = 30000;
+
+   epochOffset = SCDLatencyHistogram::epochNow() - SCDLatencyHistogram::now();
+
+   durablePath        = QDir::tempPath() + "/scdtopicspool/" + QString::number(QCoreApplication::applicationPid());
+   durableSegmentSize = 4*1024*1024;
+   durableDiskLimit   = 256*1024*1024;
+
+   reusePort = false;
+
+   bus = 0;
+
+   multicast = 0;
+
+   restored         = false;
+   listenDescriptor = -1;
 
    connect(this,SIGNAL(newConnection()),this,SLOT(onNewConnection()));
+   connect(&listTimer,SIGNAL(timeout()),this,SLOT(onListTimeout()));
+   connect(&heartbeatTimer,SIGNAL(timeout()),this,SLOT(onHeartbeatTimeout()));
+   connect(&throttleTimer,SIGNAL(timeout()),this,SLOT(onThrottleTimeout()));
+   connect(&redeliveryTimer,SIGNAL(timeout()),this,SLOT(onRedeliveryTimeout()));
+   connect(&expiryTimer,SIGNAL(timeout()),this,SLOT(onExpiryTimeout()));
+   connect(&fanOutTimer,SIGNAL(timeout()),this,SLOT(onFanOutTimeout()));
+   connect(&multicastTimer,SIGNAL(timeout()),this,SLOT(onMulticastTimeout()));
 }
 
 /**
@@ -39,21 +154,56 @@ SCDTopicServer::SCDTopicServer(QObject *parent, int port) : QWebSocketServer("SC
  */
 SCDTopicServer::~SCDTopicServer()
 {
+   fanOutPool.waitForDone(); // the workers read the filters
 
+   qDeleteAll(retiredFilters);
+
+   for (QHash<quint32, SCDConnection *>::const_iterator it = connections.constBegin(); it != connections.constEnd(); ++it)
+   {
+      if (it.value()->session && it.value()->session->id.isEmpty()) // anonymous sessions are owned by their connection
+      {
+         delete it.value()->session;
+      }
+   }
+
+   for (QHash<QString, SCDSession *>::const_iterator it = sessions.constBegin(); it != sessions.constEnd(); ++it)
+   {
+      delete it.value()->offline;
+      delete it.value()->spool; // spilled messages do not survive the process
+   }
+
+   qDeleteAll(sessions);
+   qDeleteAll(parkedSessions);
+   qDeleteAll(topics);
+
+   QDir().rmdir(durablePath);
+   qDeleteAll(sockList);
 }
 
 /**
  * @brief SCDTopicServer::start start SCDImg server
+ * @param webSocket false: the Qt web socket server does not listen, connections are accepted by another transport
  */
-int SCDTopicServer::start()
+int SCDTopicServer::start(bool webSocket)
 {
-   loadTopicList(); // load topic list, if fail the list is empty, there are no topic.
+   if (!restored) // taking over: topics and subscriptions are those of the previous process
+   {
+      loadTopicList(); // load topic list, if fail the list is empty, there are no topic.
 
-   unregisterAllSubscriptions();
+      unregisterAllSubscriptions();
+   }
 
-   if (listen(QHostAddress::Any,port))
+   if (!webSocket || (listenDescriptor>=0 ? setSocketDescriptor(listenDescriptor) : reusePort ? listenReusePort() : listen(QHostAddress::Any,port)))
    {
-      lastErrorMsg = "Server is listening on port " + QString::number(port) + " for incoming connections...";
+      if (heartbeatInterval>0)
+      {
+         heartbeatWheel.start(clock.elapsed());
+         heartbeatTimer.start();
+      }
+
+      redeliveryWheel.start(clock.elapsed()); // the timer starts with the first session
+
+      lastErrorMsg = webSocket ? "Server is listening on port " + QString::number(port) + " for incoming connections..." : "Server started";
       qDebug() <<  lastError();
       return 1;
    }
@@ -71,6 +221,8 @@ void SCDTopicServer::stop()
 {
    close();
 
+   heartbeatTimer.stop();
+
    // unregisterAllSubscriptions();
 }
 
@@ -82,20 +234,69 @@ void SCDTopicServer::onNewConnection()
    QWebSocket *socket = nextPendingConnection();
 
    connect(socket, SIGNAL(textMessageReceived(QString)),this,SLOT(onTextMessageReceived(QString)));
+   connect(socket, SIGNAL(textFrameReceived(QString,bool)),this,SLOT(onTextFrameReceived(QString,bool)));
    // connect(socket, SIGNAL(binaryMessageReceived(QByteArray)),this,SLOT(onbinaryMessageReceived(QByteArray)));
    connect(socket, SIGNAL(aboutToClose()),this,SLOT(onAboutToClose()));
    connect(socket, SIGNAL(disconnected()),this,SLOT(onDisconnected()));
    connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),this,SLOT(onSocketError(QAbstractSocket::SocketError)));
+   connect(socket, SIGNAL(pong(quint64,QByteArray)),this,SLOT(onPong(quint64,QByteArray)));
+   connect(socket, SIGNAL(bytesWritten(qint64)),this,SLOT(onBytesWritten(qint64)));
 
-   QString socketId = addressToString(socket->peerAddress(),socket->peerPort());
+#if QT_VERSION >= QT_VERSION_CHECK(5,15,0)
+   if (maxMessageSize>0)
+   {
+      socket->setMaxAllowedIncomingMessageSize(quint64(maxMessageSize) + maxHeaderSize); // larger messages close the socket
+   }
+#endif
 
-   QString hexHash = addressToHex(socket->peerAddress(),socket->peerPort());
+   SCDWebSocketConnection *client = new SCDWebSocketConnection(socket);
 
-   qDebug() << "New Web Socket Connection: " << socketId << hexHash;
+   client->name = addressToHex(socket);    // formatted once for connection lifetime
+   client->peer = addressToString(socket);
 
-   sockList[hexHash] = socket;
+   sockList.insert(socket, client);
 
-   maxHeaderSize = 1024;
+   openConnection(client, true); // the web socket reports the bytes sent: enable priority lanes
+
+   qDebug() << "New Web Socket Connection: " << client->peer << client->name << "id:" << client->id;
+}
+
+/**
+ * @brief SCDTopicServer::openConnection register a new client connection: assign the connection id and schedule
+ *                                       the heartbeat. The connection record is owned by the caller (the transport).
+ * @param client
+ * @param flowControl true if the transport reports the bytes sent (SCDConnection::written): enable priority lanes
+ * @return connection id
+ */
+quint32 SCDTopicServer::openConnection(SCDConnection *client, bool flowControl)
+{
+   do
+   {
+      lastConnectionId++;
+   }
+   while (lastConnectionId==0 || connections.contains(lastConnectionId)); // on wrap around skip 0 and ids still in use
+
+   client->id       = lastConnectionId;
+   client->lastSeen = clock.elapsed();
+   client->closed   = false;
+
+   if (flowControl)
+   {
+      client->window    = outboundWindow;
+      client->maxQueued = outboundQueue;
+   }
+
+   client->messageBucket.configure(clientMessageRate, 0, client->lastSeen);
+   client->byteBucket.configure(clientByteRate, 0, client->lastSeen);
+
+   connections.insert(client->id, client);
+
+   if (heartbeatInterval>0)
+   {
+      heartbeatWheel.schedule(client->id, client->lastSeen + heartbeatInterval);
+   }
+
+   return client->id;
 }
 
 /**
@@ -104,11 +305,156 @@ void SCDTopicServer::onNewConnection()
  */
 void SCDTopicServer::onTextMessageReceived(QString message)
 {
-   QWebSocket *socket = static_cast<QWebSocket *>(sender());
+   SCDConnection *client = sockList.value(static_cast<QWebSocket *>(sender()));
+
+   if (client && !client->closed)
+   {
+      if (client->skipMessage) // already forwarded fragment by fragment
+      {
+         client->skipMessage = false;
+         return;
+      }
+
+      processMessage(client, message);
+   }
+}
+
+/**
+ * @brief SCDTopicServer::onTextFrameReceived forward the fragments of a large message published to a topic as they arrive,
+ *                                           as chunks of message (see publishChunk), instead of waiting for the whole
+ *                                           message. A message received into a single frame is processed as usual.
+ * @param frame
+ * @param isLastFrame
+ */
+void SCDTopicServer::onTextFrameReceived(QString frame, bool isLastFrame)
+{
+   SCDConnection *client = sockList.value(static_cast<QWebSocket *>(sender()));
+
+   if (!client || client->closed)
+   {
+      return;
+   }
+
+   if (!client->inFragments)
+   {
+      if (isLastFrame || !streamFragments) // single frame message: wait for textMessageReceived
+      {
+         return;
+      }
+
+      client->inFragments = true;
+      client->streaming   = startFragmentStream(client, frame); // first fragment
+
+      return;
+   }
+
+   if (isLastFrame)
+   {
+      client->inFragments = false;
+   }
+
+   if (!client->streaming)
+   {
+      return;
+   }
+
+   client->lastSeen      = clock.elapsed();
+   client->fragmentSize += frame.size();
+
+   SCDTopic *entry = topics.value(client->fragmentTopic);
+
+   if (!entry || (maxMessageSize>0 && client->fragmentSize > maxMessageSize))
+   {
+      if (entry)
+      {
+         sendMessageToTopic(client->fragmentTopic, QStringRef(), client, "#" + client->fragmentStream + ":A"); // aborted
+      }
+
+      client->streaming   = false;
+      client->skipMessage = true;
+
+      client->post("[server@notify]:TSM|" + client->fragmentTopic + "|-5|message too large or topic deleted\n", SCDConnection::PR_HIGH);
+
+      return;
+   }
+
+   if (rateLimited) // the message has been admitted with first fragment: take the bytes cost only
+   {
+      qint64 now = clock.elapsed();
+
+      client->byteBucket.available(frame.size(), now);
+      client->byteBucket.consume(frame.size());
+      entry->byteBucket.available(frame.size(), now);
+      entry->byteBucket.consume(frame.size());
+   }
+
+   sendMessageToTopic(client->fragmentTopic, QStringRef(&frame), client, "#" + client->fragmentStream + (isLastFrame ? ":F" : ":M"));
+
+   if (isLastFrame)
+   {
+      client->streaming   = false;
+      client->skipMessage = true;
+
+      client->post("[server@notify]:TSM|" + client->fragmentTopic + "|1|no error\n", SCDConnection::PR_HIGH);
+   }
+}
+
+/**
+ * @brief SCDTopicServer::startFragmentStream check if the first fragment of a message starts a publish which can be
+ *                                           streamed, if so forward the fragment payload as first chunk.
+ * @param client
+ * @param frame first fragment
+ * @return true if the message is streamed
+ */
+bool SCDTopicServer::startFragmentStream(SCDConnection *client, const QString &frame)
+{
+   Command command = TMK;
+
+   int headerSize = readHeader(frame, command);
+
+   if (!headerSize || command!=TSM || header.contains("CHK") || headerSize >= frame.size())
+   {
+      return false; // not a publish, or already chunked by client: processed when complete
+   }
+
+   QString topic = header.value(commands.at(TSM)).toString();
+
+   SCDTopic *entry = topics.value(topic);
 
-   qDebug() << "Received: " + message;
+   if (!entry)
+   {
+      return false;
+   }
+
+   QStringRef payload = frame.midRef(headerSize+1);
+
+   if (header.contains("PRI") || (rateLimited && (!client->delayed.isEmpty() || !admitMessage(client, entry, payload.size(), clock.elapsed()))))
+   {
+      return false; // publish priority, rejected or delayed: processed when complete
+   }
+
+   client->lastSeen       = clock.elapsed();
+   client->fragmentTopic  = topic;
+   client->fragmentStream = "f" + QString::number(++client->lastStreamId);
+   client->fragmentSize   = payload.size();
+
+   sendMessageToTopic(topic, payload, client, "#" + client->fragmentStream + ":M");
+
+   return true;
+}
+
+/**
+ * @brief SCDTopicServer::processMessage process a message received from client
+ * @param client
+ * @param message
+ */
+void SCDTopicServer::processMessage(SCDConnection *client, const QString &message)
+{
+   client->lastSeen = clock.elapsed();
+
+   qCDebug(scdMessages) << "Received: " + message;
 
-   Command command;
+   Command command = TMK;
 
    int headerSize = readHeader(message,command);
 
@@ -116,105 +462,232 @@ void SCDTopicServer::onTextMessageReceived(QString message)
    {
       int ret = 0;
 
-      QString topic      = header[commands[command]].toString();
-      QString hexAddress = addressToHex(socket);
-      QString strAddress = addressToString(socket);
-      QString notifyMsg;
+      QString topic = setText(topicName, header.value(commands.at(command))); // shares the buffer: no copy
 
-      QStringList subscribers;
+      QVector<SCDConnection *> subscribers;
 
       switch (command)
       {
          case TMK: // make a new topic
 
-           notifyMsg = "TMK|" + topic;
-
-           qDebug() << notifyMsg + ": " + topic;
-           qDebug() << "ID: " + strAddress;
+           qDebug() << commands.at(command) + ": " + topic;
+           qDebug() << "ID: " + client->peer;
 
            ret = addTopic(topic); // ret => 0,1,2
 
+           if (ret>0) // the topic options: only a failure overrides the status and the message of addTopic
+           {
+              QString added = lastErrorMsg;
+
+              if (header.contains("PRI") && !setTopicPriority(topic, header.value("PRI").toString())) // priority of new or existing topic
+              {
+                 ret = 0;
+              }
+
+              if (ret>0 && header.contains("DLT") && !setTopicDelta(topic, header.value("DLT").toInt()==1)) // delta encoding
+              {
+                 ret = 0;
+              }
+
+              if (ret>0 && header.contains("MCA") && !setTopicMulticast(topic, header.value("MCA").toInt()==1)) // multicast egress
+              {
+                 ret = 0;
+              }
+
+              if (ret>0)
+              {
+                 lastErrorMsg = added;
+              }
+           }
+
+           if (ret>0 && bus && topics.contains(topic.trimmed())) // the other processes make the same topic
+           {
+              bus->topicChanged(topicItem(topics.value(topic.trimmed())));
+           }
+
          break;
 
          case TDL: // delete a topic
          {
-            notifyMsg = "TDL|" + topic;
-
-            qDebug() <<  notifyMsg + ": " + topic;
+            qDebug() << commands.at(command) + ": " + topic;
 
             ret  = removeTopic(topic,subscribers);            
+
+            if (ret>0 && bus)
+            {
+               bus->topicRemoved(topic.trimmed());
+            }
          }
          break;
 
          case TRN:
          case TRC: // register a client to topic
+         {
+            qDebug() << "Register client '" +  client->name + "' to topic '" + topic + "'";
+
+            SCDFilter *filter = 0;
+
+            if (header.contains("FLT")) // content filter: compiled once for subscription lifetime
+            {
+               filter = new SCDFilter();
+
+               if (!filter->compile(header.value("FLT").toString()))
+               {
+                  lastErrorMsg = filter->lastError();
+
+                  delete filter;
 
-           notifyMsg = ( (command==TRN) ? "TRN|":"TRC|") + topic;
+                  ret = 0;
+                  break;
+               }
+            }
 
-           qDebug() << "Register client '" +  hexAddress + "' to topic '" + topic + "'";
+            QString durable = header.value("DUR").toString(); // durable subscription name
 
-           ret = subscribeToTopic(topic,hexAddress,command==TRN);
+            int qos = durable.isEmpty() ? header.value("QOS").toInt() : 1; // 1: at-least-once, durable subscriptions are QoS 1
 
-         break;
+            bool joined = header.value("MCA").toInt()==1; // the client receives the topic from the multicast group
 
-         case TUC: // unscribe a client from topic
+            if (joined && (filter || qos==1))
+            {
+               lastErrorMsg = "a multicast subscription can't have a content filter or QoS 1";
+
+               delete filter;
+
+               ret = 0;
+               break;
+            }
+
+            if (!durable.isEmpty())
+            {
+               openSession(client, durable, true); // a client reconnecting with the same name gets its subscriptions back
+            }
+            else
+            if (qos==1)
+            {
+               openSession(client, header.value("CID").toString()); // a client reconnecting with its id resumes its session
+            }
+
+            ret = subscribeToTopic(topic,client,command==TRN,filter,qos==1 ? 1 : 0);
+
+            if (ret==3 && header.contains("PRI")) // set the priority of topic just created
+            {
+               setTopicPriority(topic, header.value("PRI").toString());
+            }
 
-           notifyMsg = "TUC|" + topic;
+            if (ret==3 && header.contains("DLT"))
+            {
+               setTopicDelta(topic, header.value("DLT").toInt()==1);
+            }
 
-           qDebug() << notifyMsg + ": " + topic;
+            if (ret==3 && joined)
+            {
+               setTopicMulticast(topic, true);
+            }
 
-           ret = unscribeFromTopic(topic,hexAddress);
+            if (ret>0 && joined)
+            {
+               joinMulticast(topic, client); // multicast topic: the messages are no more sent thru the connection
+            }
 
+            if (ret>0)
+            {
+               sendTopicState(topic, client); // delta encoded topic: the new subscriber needs the full document
+            }
+         }
          break;
 
-         case TSM: // send a message to topic
+         case TUC: // unscribe a client from topic
 
-           message.remove(0,headerSize+1);
+           qDebug() << commands.at(command) + ": " + topic;
 
-           qDebug() << "[" + hexAddress + "] Message to " + topic << " => " << message;
+           ret = unscribeFromTopic(topic,client);
 
-           ret = sendMessageToTopic(topic,message,hexAddress);
+         break;
+
+         case TLT: // list topics
 
-           notifyMsg = "TSM|" + topic;
+           ret = listTopics(client, topic, header.value("CUR").toString(), header.value("MAX").toInt(), header.value("TYP").toString());
+
+           if (ret>0)
+           {
+              return; // the listing is streamed in chunks, notify will be sent when the listing is complete
+           }
 
          break;
-      }
 
-      notifyMsg = "[server@notify]:" + notifyMsg; // prepend notify header to message
+         case TST: // topics statistics
 
-      QString result = QString::number(ret);
+           ret = listTopics(client, topic, header.value("CUR").toString(), header.value("MAX").toInt(), header.value("TYP").toString(), true);
 
-      notifyMsg += "|" + result + "|" + lastErrorMsg + "\n";
+           if (ret>0)
+           {
+              return; // as TLT
+           }
 
-      socket->sendTextMessage(notifyMsg);
+         break;
 
-      if (!subscribers.isEmpty())
-      {
-         sendMessageToSubscribers(subscribers,notifyMsg,hexAddress);
-      }
+         case TAK: // acknowledge the messages of QoS 1 subscriptions, up to a sequence number
 
-      /*if (ret>0)
-      {
-         notifyMsg += "|" + result;
+           acknowledge(client, topic.toULongLong());
+
+         return; // no notify: acknowledges are frequent
 
-         if (ret==2) // warning
+         case TDS: // durable subscription statistics
          {
-            notifyMsg += "|" + lastErrorMsg;
+            QString stats = durableStats(topic);
+
+            if (stats.isEmpty())
+            {
+               lastErrorMsg = "durable subscription '" + topic + "' not found";
+               ret = 0;
+               break;
+            }
+
+            client->post("[server@stats]:" + stats + "\n", SCDConnection::PR_NORMAL);
+
+            lastErrorMsg = "no error";
+            ret = 1;
          }
+         break;
 
-         notifyMsg += "\n";
+         case TSM: // send a message to topic
+         {
+            QStringRef payload = message.midRef(headerSize+1);
 
-         socket->sendTextMessage(notifyMsg);
+            qCDebug(scdMessages) << "[" + client->name + "] Message to " + topic << " => " << payload;
+
+            ret = publishFrame(client, topic, payload);
+         }
+         break;
 
-         if (!subscribers.isEmpty())
+         case TBM: // send a batch of messages: one notify for the whole batch
          {
-            sendMessageToSubscribers(subscribers,notifyMsg,hexAddress);
+            ret = publishBatch(client, message, headerSize+1, topic.toInt());
          }
+         break;
+
+         case TMR: // send again the multicast messages missed by a receiver
+
+           ret = repairMulticast(topic, client, header.value("SEQ").toULongLong(), header.value("END").toULongLong());
+
+         break;
+
+         case TSR: // resume the subscriptions of a token, or get a new token: the notify carries the token
+
+           ret = resumeSession(client, topic);
+
+         break;
       }
-      else
-      {
 
-      }*/
+      formatNotify(notifyBuffer, commands.at(command), topic, ret, lastErrorMsg);
+
+      client->post(notifyBuffer, SCDConnection::PR_HIGH); // notifies are never delayed by queued messages
+
+      if (!subscribers.isEmpty())
+      {
+         sendMessageToSubscribers(subscribers,notifyBuffer,client);
+      }
    }
 }
 
@@ -227,7 +700,19 @@ void SCDTopicServer::onDisconnected()
 
    qDebug() << "Client disconnected:" + addressToString(socket);
 
-   delete socket;
+   SCDWebSocketConnection *client = sockList.take(socket);
+
+   if (client)
+   {
+      if (!client->closed) // aboutToClose not received
+      {
+         closeConnection(client);
+      }
+
+      delete client;
+   }
+
+   socket->deleteLater(); // we are into a socket signal: do not delete it now
 }
 
 /**
@@ -251,155 +736,492 @@ void SCDTopicServer::onAboutToClose()
 
    qDebug() << "Client about to disconnected:" + addressToString(socket);
 
-   QString hashIndex = addressToHex(socket);
+   SCDConnection *client = sockList.value(socket);
 
-   sockList.remove(hashIndex);
-
-   unscribeFromTopics(hashIndex);
+   if (client && !client->closed)
+   {
+      closeConnection(client);
+   }
 }
 
 /**
- * @brief SCDTopicServer::onBinaryMessageReceived
- * @param message
+ * @brief SCDTopicServer::closeConnection remove the client from connections list and unscribe it from all topics.
+ *                                        The connection record is not deleted: it will be deleted by the transport.
+ * @param client
  */
-/*void SCDTopicServer::onBinaryMessageReceived(QByteArray message)
+void SCDTopicServer::closeConnection(SCDConnection *client)
 {
+   client->closed = true;
 
-}*/
+   client->clearLanes();
 
-/**
- * @brief SCDTopicServer::addressToHex
- * @param socket
- * @return
- */
-QString SCDTopicServer::addressToHex(QWebSocket *socket)
-{
-   return addressToHex(socket->peerAddress(),socket->peerPort());
+   connections.remove(client->id);
+
+   if (!fanOutJobs.isEmpty()) // the record may be deleted or reused: the snapshots holding it skip it
+   {
+      fanOutClosed.insert(client, fanOutSerial);
+   }
+
+   if (client->session && client->session->durable) // the QoS 1 subscriptions are kept while the client is offline
+   {
+      moveSubscriptions(client, client->session->offline);
+   }
+
+   if (!client->resumeToken.isEmpty()) // the other subscriptions are kept for the resume grace period
+   {
+      resumeTokens.remove(client->resumeToken);
+
+      parkSubscriptions(client);
+   }
+
+   unscribeFromTopics(client);
+
+   if (client->session)
+   {
+      closeSession(client);
+   }
 }
 
 /**
- * @brief SCDTopicServer::addressToString
- * @param socket
- * @return
+ * @brief SCDTopicServer::onBytesWritten the socket has sent bytes: write the frames waiting into priority lanes
+ * @param bytes
  */
-QString SCDTopicServer::addressToString(QWebSocket *socket)
+void SCDTopicServer::onBytesWritten(qint64 bytes)
 {
-   return addressToString(socket->peerAddress(),socket->peerPort());
+   SCDConnection *client = sockList.value(static_cast<QWebSocket *>(sender()));
+
+   if (client && !client->closed)
+   {
+      client->written(bytes);
+   }
 }
 
 /**
- * @brief SCDTopicServer::checkHdrField
- * @param headerItem
- * @param cmd
- * @return
+ * @brief SCDTopicServer::onPong a pong frame is an activity of the socket too
+ * @param elapsedTime
+ * @param payload
  */
-int SCDTopicServer::checkHeaderField(const QString &headerItem, SCDTopicServer::Command &cmd)
+void SCDTopicServer::onPong(quint64 elapsedTime, const QByteArray &payload)
 {
-   QStringList field = headerItem.split(":"); // split into field name and value pair
+   Q_UNUSED(elapsedTime)
+   Q_UNUSED(payload)
 
-   if (field.size() != 2)
+   SCDConnection *client = sockList.value(static_cast<QWebSocket *>(sender()));
+
+   if (client)
    {
-      lastErrorMsg = "Bad header item:" + headerItem;
-      return 0;
+      touchConnection(client);
    }
+}
+
+/**
+ * @brief SCDTopicServer::touchConnection a frame not passed to processMessage (e.g. pong) is an activity of the connection
+ * @param client
+ */
+void SCDTopicServer::touchConnection(SCDConnection *client)
+{
+   client->lastSeen = clock.elapsed();
+}
+
+/**
+ * @brief SCDTopicServer::onHeartbeatTimeout check the sockets whose heartbeat is expired: a ping is sent to idle sockets,
+ *                                           the sockets idle for more than heartbeat timeout are closed (dead peers).
+ */
+void SCDTopicServer::onHeartbeatTimeout()
+{
+   QList<quint32> expired;
 
-   QString name = field.at(0).trimmed();
+   qint64 now = clock.elapsed();
 
-   if (commands.contains(name))
+   heartbeatWheel.advance(now, expired);
+
+   for (int n=0; n<expired.size(); n++)
    {
-      header.insert(name,field.at(1).trimmed());
+      SCDConnection *client = connections.value(expired.at(n));
+
+      if (!client) // connection closed meanwhile
+      {
+         continue;
+      }
 
-      cmd = static_cast<enum Command>(commands.indexOf(QRegularExpression(name)));
+      qint64 last = client->lastSeen;
+      qint64 idle = now - last;
 
-      return 1;
-   }
+      if (idle >= heartbeatTimeout)
+      {
+         qDebug() << "Dead connection reaped:" + client->peer;
 
-   return 0;
+         closeConnection(client); // unscribe now: the transport will delete the connection when aborted
+
+         client->abort();
+
+         continue;
+      }
+
+      if (idle >= heartbeatInterval)
+      {
+         client->ping();
+
+         heartbeatWheel.schedule(client->id, qMin(now + heartbeatInterval, last + heartbeatTimeout));
+      }
+      else
+      {
+         heartbeatWheel.schedule(client->id, last + heartbeatInterval);
+      }
+   }
 }
 
 /**
- * @brief WebSocketHandler::checkHeaderField split header intem anf get field name and valu,
- *                                           if field name match fieldName param add it to header map and return 1
-         *                                   else return 0;
- * @param headerItem header item in format <field name>:<value>
- * @param fieldName
- * @return 1 on success, 0 un failure
+ * @brief SCDTopicServer::setHeartbeat set heartbeat: set before starting server
+ * @param interval idle time before sending a ping to a client (msec), 0 to disable heartbeat
+ * @param timeout idle time before closing a dead client connection (msec)
  */
-int SCDTopicServer::checkHeaderField(const QString &headerItem, const QString &fieldName)
+void SCDTopicServer::setHeartbeat(int interval, int timeout)
 {
-   QStringList field = headerItem.split(":"); // split into field name and value pair
-
-   if (field.size() != 2)
-   {
-      lastErrorMsg = "Bad header item:" + headerItem;
-      return 0;
-   }
+   heartbeatInterval = qMax(interval,0);
+   heartbeatTimeout  = qMax(timeout,interval);
+}
 
-   QString name = field.at(0).trimmed();
+/**
+ * @brief SCDTopicServer::onBinaryMessageReceived
+ * @param message
+ */
+/*void SCDTopicServer::onBinaryMessageReceived(QByteArray message)
+{
 
-   if (name==fieldName)
-   {
-      header.insert(name,field.at(1).trimmed());
-      return 1;
-   }
+}*/
 
-   lastErrorMsg = "Bad header field name:" + headerItem;
+/**
+ * @brief SCDTopicServer::addressToHex
+ * @param socket
+ * @return
+ */
+QString SCDTopicServer::addressToHex(QWebSocket *socket)
+{
+   return addressToHex(socket->peerAddress(),socket->peerPort());
+}
 
-   return 0;
+/**
+ * @brief SCDTopicServer::addressToString
+ * @param socket
+ * @return
+ */
+QString SCDTopicServer::addressToString(QWebSocket *socket)
+{
+   return addressToString(socket->peerAddress(),socket->peerPort());
 }
 
 /**
  * @brief WebSocketHandler::readHeader read headers lines and fill header map.
  *        Call this method only when statu=WAITFORHEADER.
  *        when header read is complete the stustus change to WAITFORDATA.
- *        on error return 0, otherwise return 1.
+ *        on error return 0, otherwise the header line size.
  *        Do not use the sequence '|' (sharp) char into complete file path
  *
  *        SCDTMH (one line fast header struct)
  *
  *          TMK command => SCDTMH:1.0\tTMK:<topic name>\n          // Topic MaKe   => make a new topic
+ *                      SCDTMH:1.0\tTMK:<topic name>\tPRI:<high|normal|bulk>\n
+ *                                                                // make a new topic, or set the priority of an existing topic
+ *                      SCDTMH:1.0\tTMK:<topic name>\tDLT:<0|1>\n
+ *                                                                // make a delta encoded topic (or set delta encoding of an existing topic):
+ *                                                                // see SCDTopicServer::encodeDelta
+ *                      SCDTMH:1.0\tTMK:<topic name>\tMCA:<0|1>\n
+ *                                                                // make a multicast topic (or set multicast egress of an existing
+ *                                                                // topic): see SCDTopicServer::joinMulticast
  *          TDL command => SCDTMH:1.0\tTDL:<topic name>\n          // Topic DeLete => delete a topic
- *          TRN command => SCDTMH:1.0\tTRN:<topic name>\n          // Topic Register New  => register a client to topic, create the topic if not exists
+ *          TRN command => SCDTMH:1.0\tTRN:<topic name>[\tPRI:<high|normal|bulk>][\tDLT:<0|1>]\n
+ *                                                                // Topic Register New  => register a client to topic, create the topic
+ *                                                                // (with priority) if not exists
  *          TRC command => SCDTMH:1.0\tTRC:<topic name>\n          // Topic Register Client => register a client to topic
+ *                      TRN and TRC commands can carry the FLT:<filter expression> field (see SCDFilter): the client
+ *                      receives only the messages matching the filter, a new subscription replaces the filter
+ *                      TRN and TRC commands can carry the QOS:1 field (at-least-once delivery) and the CID:<client id>
+ *                      field: see SCDTopicServer::deliverReliable
+ *                      TRN and TRC commands can carry the DUR:<name> field: durable QoS 1 subscription, kept while
+ *                      the client is offline (see SCDTopicServer::openSession)
+ *                      TRN and TRC commands can carry the MCA:1 field: the client receives a multicast topic from the
+ *                      multicast group (see SCDTopicServer::joinMulticast), a topic created by TRN is a multicast topic
+ *          TAK command => SCDTMH:1.0\tTAK:<sequence>\n             // Topic AcKnowledge => the messages of QoS 1 subscriptions
+ *                                                                // have been received up to sequence (no notify is sent)
+ *          TDS command => SCDTMH:1.0\tTDS:<name>\n                 // Topic Durable Statistics => statistics of a durable
+ *                                                                // subscription, sent as [server@stats]:<line>\n (see durableStats)
+ *          TMR command => SCDTMH:1.0\tTMR:<topic name>\tSEQ:<first>\tEND:<last>\n
+ *                                                                // Topic Multicast Repair => send again the multicast messages
+ *                                                                // first...last thru web socket: see SCDTopicServer::repairMulticast
+ *          TSR command => SCDTMH:1.0\tTSR:<token>\n               // Topic Session Resume => get a resume token (empty token),
+ *                                                                // or get back the subscriptions of token: see
+ *                                                                // SCDTopicServer::resumeSession
  *          TUC command => SCDTMH:1.0\tTUC:<topic name>\n          // Topic Unregister Client => unregister a client from topic
  *          TSM command => SCDTMH:1.0\tTSM:<topic name>\n<message> // Topic Send Message => send a  message to topic
+ *                                                                // notify status: 1 sent, 4 delayed, -4 rejected by rate limits,
+ *                                                                // -5 message too large
+ *                      SCDTMH:1.0\tTSM:<topic name>\tCHK:<stream id>\tFIN:<0|1>\n<chunk>
+ *                                                                // send a chunk of a large message, FIN:1 for last chunk
+ *                      a TSM command can carry the PRI:<high|normal|bulk> field, overriding the topic priority for the message
+ *                      a TSM command can carry the TRA:<publisher send time, epoch usec> field: the message is traced
+ *                      (see SCDTopicServer::sendMessageToTopic), chunks are not traced
+ *                      a TSM command can carry the TTL:<msec> field: the message is dropped by the server if not delivered
+ *                      within msec (see SCDTopicServer::sendMessageToTopic), chunks do not expire
+ *          TBM command => SCDTMH:1.0\tTBM:<count>\n<size>\n<TSM command><size>\n<TSM command>...
+ *                                                                // Topic Batch Messages => send count messages, each a whole
+ *                                                                // TSM command of size chars: see SCDTopicServer::publishBatch
+ *          TLT command => SCDTMH:1.0\tTLT:<prefix>[\tCUR:<cursor>][\tMAX:<page size>][\tTYP:<static|dynamic>]\n
+ *                                                                // Topic LisT => list topics whose name starts with prefix
+ *          TST command => SCDTMH:1.0\tTST:<prefix>[\tCUR:<cursor>][\tMAX:<page size>][\tTYP:<static|dynamic>]\n
+ *                                                                // Topic STatistics => as TLT, but send topics statistics
  *
- * @return 1 on success, 0 on failure
+ *        Items following the command are optional header fields in format <field name>:<value>
+ *
+ *        The header fields are references into message (see SCDHeader): no copy is made.
+ *
+ * @param message
+ * @param command
+ * @param from header line position into message
+ * @return header line size, 0 on failure
  *
  */
-int SCDTopicServer::readHeader(QString message, Command &command)
+int SCDTopicServer::readHeader(const QString &message, Command &command, int from)
 {
-   QTextStream ts(&message);
+   header.clear();
 
-   QString head = ts.readLine(maxHeaderSize);
+   int end = message.indexOf(QLatin1Char('\n'), from);
 
-   if (head.isEmpty())
+   if (end<0)
+   {
+      end = message.size();
+   }
+
+   if (end==from)
    {
       lastErrorMsg = "Null header line";
       return 0;
    }
 
-   QStringList fields = head.split("\t",QString::SkipEmptyParts);
-
-   if (fields.size()<2) // header must have at least two elements
+   if (end-from > maxHeaderSize)
    {
-      lastErrorMsg = "Invalid header:" + head;
+      lastErrorMsg = "Header too long";
       return 0;
    }
 
-   header.clear();
+   int fields = 0;
 
-   if (checkHeaderField(fields.at(0),"SCDTMH")) // first item must be header type declaration
+   for (int pos=from; pos<end; ) // tab separated items, empty items are skipped
    {
-      if (checkHeaderField(fields.at(1),command))
+      int tab = message.indexOf(QLatin1Char('\t'), pos);
+
+      if (tab<0 || tab>end)
+      {
+         tab = end;
+      }
+
+      if (tab>pos)
       {
-         return head.length();
+         int colon = message.indexOf(QLatin1Char(':'), pos); // <field name>:<value>
+
+         if (colon>=tab)
+         {
+            colon = -1;
+         }
+
+         if (fields<2) // header type and command: a single ':' allowed
+         {
+            int next = (colon<0) ? -1 : message.indexOf(QLatin1Char(':'), colon+1);
+
+            if (colon<0 || (next>=0 && next<tab))
+            {
+               lastErrorMsg = "Bad header item:" + message.mid(pos, tab-pos);
+               return 0;
+            }
+         }
+         else
+         if (colon<=pos) // optional field without name: ignored
+         {
+            pos = tab+1;
+            continue;
+         }
+
+         QStringRef name  = SCDHeader::trimmed(&message, pos, colon);
+         QStringRef value = SCDHeader::trimmed(&message, colon+1, tab);
+
+         if (fields==0) // first item must be header type declaration
+         {
+            if (name!=QLatin1String("SCDTMH"))
+            {
+               lastErrorMsg = "Bad header field name:" + message.mid(pos, tab-pos);
+               return 0;
+            }
+         }
+         else
+         if (fields==1) // command
+         {
+            int n = commands.size()-1;
+
+            while (n>=0 && name!=commands.at(n))
+            {
+               n--;
+            }
+
+            if (n<0)
+            {
+               lastErrorMsg = "Unknown command:" + message.mid(pos, tab-pos);
+               return 0;
+            }
+
+            command = static_cast<Command>(n);
+
+            header.insert(name, value);
+         }
+         else // optional header fields
+         {
+            header.insert(name, value);
+         }
+
+         fields++;
       }
 
-      return head.length();
+      pos = tab+1;
+   }
+
+   if (fields<2) // header must have at least two elements
+   {
+      lastErrorMsg = "Invalid header:" + message.mid(from, end-from);
+      return 0;
+   }
+
+   return end-from;
+}
+
+/**
+ * @brief SCDTopicServer::setText copy text into buffer: the buffer storage is reused when it is not shared
+ * @param buffer
+ * @param text
+ * @return buffer
+ */
+const QString &SCDTopicServer::setText(QString &buffer, const QStringRef &text)
+{
+   buffer.resize(text.size());
+
+   if (text.size()>0)
+   {
+      memcpy(buffer.data(), text.unicode(), size_t(text.size())*sizeof(QChar));
+   }
+
+   return buffer;
+}
+
+/**
+ * @brief putText copy text at out
+ * @return the position following the text
+ */
+static inline QChar *putText(QChar *out, const QChar *text, int size)
+{
+   if (size>0)
+   {
+      memcpy(out, text, size_t(size)*sizeof(QChar));
+   }
+
+   return out + size;
+}
+
+/**
+ * @brief SCDTopicServer::formatFrame format the frame of a message to subscribers: [<sender><tag><traced>@<topic>]:<message>
+ *                                    into buffer, without temporaries: the buffer storage is reused when it is not
+ *                                    shared (no frame of previous message is waiting into a priority lane)
+ * @param buffer
+ * @param sender sender name
+ * @param tag chunk or document tag (see sendMessageToTopic)
+ * @param traced trace suffix of sender field
+ * @param topic
+ * @param message
+ * @return buffer
+ */
+const QString &SCDTopicServer::formatFrame(QString &buffer, const QString &sender, const QString &tag, const QString &traced,
+                                           const QString &topic, const QStringRef &message)
+{
+   buffer.resize(1 + sender.size() + tag.size() + traced.size() + 1 + topic.size() + 2 + message.size());
+
+   QChar *out = buffer.data();
+
+   *out++ = QLatin1Char('[');
+
+   out = putText(out, sender.constData(), sender.size());
+   out = putText(out, tag.constData(), tag.size());
+   out = putText(out, traced.constData(), traced.size());
+
+   *out++ = QLatin1Char('@');
+
+   out = putText(out, topic.constData(), topic.size());
+
+   *out++ = QLatin1Char(']');
+   *out++ = QLatin1Char(':');
+
+   putText(out, message.unicode(), message.size());
+
+   return buffer;
+}
+
+/**
+ * @brief SCDTopicServer::formatNotify format a notify: [server@notify]:<command>|<topic>|<status>|<error>\n into buffer,
+ *                                     as formatFrame
+ * @param buffer
+ * @param command
+ * @param topic
+ * @param status
+ * @param error
+ * @return buffer
+ */
+const QString &SCDTopicServer::formatNotify(QString &buffer, const QString &command, const QString &topic, int status, const QString &error)
+{
+   static const QLatin1String prefix("[server@notify]:");
+
+   char number[12]; // status digits, in reverse order
+
+   int digits = 0;
+
+   quint32 value = (status<0) ? 0u - quint32(status) : quint32(status);
+
+   do
+   {
+      number[digits++] = char('0' + value%10);
+      value /= 10;
+   }
+   while (value);
+
+   if (status<0)
+   {
+      number[digits++] = '-';
+   }
+
+   buffer.resize(prefix.size() + command.size() + 1 + topic.size() + 1 + digits + 1 + error.size() + 1);
+
+   QChar *out = buffer.data();
+
+   for (int n=0; n<prefix.size(); n++)
+   {
+      *out++ = QLatin1Char(prefix.data()[n]);
+   }
+
+   out = putText(out, command.constData(), command.size());
+
+   *out++ = QLatin1Char('|');
+
+   out = putText(out, topic.constData(), topic.size());
+
+   *out++ = QLatin1Char('|');
+
+   for (int n=digits-1; n>=0; n--)
+   {
+      *out++ = QLatin1Char(number[n]);
    }
 
-   return 0;  // failure
+   *out++ = QLatin1Char('|');
+
+   out = putText(out, error.constData(), error.size());
+
+   *out = QLatin1Char('\n');
+
+   return buffer;
 }
 
 /**
@@ -446,7 +1268,8 @@ int SCDTopicServer::listLoadFromFile(QString fileName, QStringList &list)
 }
 
 /**
- * @brief SCDTopicServer::listSaveToFile
+ * @brief SCDTopicServer::listSaveToFile write the list into a temporary file renamed over fileName: a reader never
+ *                                       finds the file truncated or half written
  * @param fileName
  * @param list
  * @return
@@ -468,19 +1291,16 @@ int SCDTopicServer::listSaveToFile(QString fileName, QStringList &list, bool rem
 
    QString topiclist = list.join("\n");
 
-   QFile f(fileName);
+   QSaveFile f(fileName);
 
    if (f.open(QIODevice::WriteOnly))
    {
-      if (f.write(topiclist.toLatin1().constData())==-1)
+      if (f.write(topiclist.toLatin1().constData())==-1 || !f.commit())
       {
-         f.close();
          lastErrorMsg = "error writing file '" + fileName + "' => " + f.errorString();
          return 0;
       }
 
-      f.close();
-
       return 1;
    }
 
@@ -495,557 +1315,3811 @@ int SCDTopicServer::listSaveToFile(QString fileName, QStringList &list, bool rem
  */
 int SCDTopicServer::saveTopicList()
 {
-   topics.removeDuplicates();
+   QStringList list;
 
-   return listSaveToFile("topics",topics);
-}
-
-/**
- * @brief SCDTopicServer::loadTopicList
- * @return
- */
-int SCDTopicServer::loadTopicList()
-{
-   int ret = listLoadFromFile("topics",topics);
+   list.reserve(topics.size());
 
-   if (ret>0)
+   for (QMap<QString, SCDTopic *>::const_iterator it = topics.constBegin(); it != topics.constEnd(); ++it)
    {
-      topics.removeDuplicates(); // remove duplicates if any
+      list.append(topicItem(it.value()));
    }
 
-   return ret;
+   return listSaveToFile("topics",list);
 }
 
 /**
- * @brief SCDTopicServer::topicExists
- * @param topic
- * @return
+ * @brief SCDTopicServer::topicItem
+ * @param entry
+ * @return topics file item: <topic name>:<static|dynamic>[:<high|bulk>][:delta][:multicast]
  */
-bool SCDTopicServer::topicExists(QString topic)
+QString SCDTopicServer::topicItem(const SCDTopic *entry)
 {
-   if (topic.trimmed().isEmpty())
+   QString item = entry->name + ":" + entry->typeName();
+
+   if (entry->priority != SCDConnection::PR_NORMAL)
    {
-      return false;
+      item += ":" + SCDConnection::priorityName(entry->priority);
    }
 
-   QStringList filtered = topics.filter(topic);
+   if (entry->delta)
+   {
+      item += ":delta";
+   }
+
+   if (entry->multicast)
+   {
+      item += ":multicast";
+   }
 
-   return !filtered.isEmpty();
+   return item;
 }
 
 /**
- * @brief SCDTopicServer::isDynamicTopic
- * @param topic
+ * @brief SCDTopicServer::loadTopicList
  * @return
  */
-bool SCDTopicServer::isDynamicTopic(QString topic)
+int SCDTopicServer::loadTopicList()
 {
-   bool dynamic = topics.contains(topic+":dynamic");
+   QStringList list;
 
-   return dynamic;
-}
+   cancelFanOuts();
 
-/**
- * @brief SCDTopicServer::getTopic get name of topic from topics string list
- * @param n topic index must be a valid index for topics string list
- * @return
- */
-QString SCDTopicServer::getTopic(QStringList topics,int n)
-{
-   QString item = topics.at(n);
+   qDeleteAll(topics);
+
+   topics.clear();
 
-   QStringList items = item.split(":");
+   int ret = listLoadFromFile("topics",list);
 
-   return items.at(0);
+   for (int n=0; n<list.size(); n++)
+   {
+      loadTopicItem(list.at(n));
+   }
+
+   return ret;
 }
 
 /**
- * @brief SCDTopicServer::removeTopicClientList Remove the all topic subscribes: the file 'topic' will be removed, the subscribers list to topic
- * @param topic
- * @return 0: failure,
- *         1: success,
- *         2: success but warning: subscribers file not exists
+ * @brief SCDTopicServer::loadTopicItem create the topic of a topics file item, or update its options if it exists
+ * @param item <topic name>:<static|dynamic>[:<high|normal|bulk>][:delta][:multicast]
+ * @return topic entry, 0 if the item is empty
  */
-int SCDTopicServer::removeTopicSubscribers(QString topic)
+SCDTopic *SCDTopicServer::loadTopicItem(QString item)
 {
-   QFile f(topic);
+   int pos = item.lastIndexOf(':'); // <topic name>:<static|dynamic>[:<high|normal|bulk>][:delta][:multicast]
 
-   if (f.exists())
+   int  priority  = -1;
+   bool delta     = false;
+   bool multicast = false;
+
+   while (pos>0) // topic options following the type
    {
-      int ret = f.remove();
+      QString option = item.mid(pos+1).trimmed();
 
-      if (!ret)
+      if (option=="delta")
       {
-         lastErrorMsg = "deleting subscribers file:" + topic +  " failed => " + f.errorString() ;
+         delta = true;
+      }
+      else
+      if (option=="multicast")
+      {
+         multicast = true;
+      }
+      else
+      if (SCDConnection::priorityFromName(option)>=0)
+      {
+         priority = SCDConnection::priorityFromName(option);
+      }
+      else
+      {
+         break;
       }
 
-      return ret;
-   }
-
-   lastErrorMsg = "file '" + topic + "' not found";
-
-   return 2;
-}
-
-/**
- * @brief SignalsHandler::addTopic add new a topic to topic list: topic will be trimmed before inserting into topic list
- * @param topic
- * @return 0: failure,
- *         1: success,
- *         2: success, but warning: topic already exists
- */
-int SCDTopicServer::addTopic(QString topic, bool dynamic)
-{
-   lastErrorMsg = "no error";
+      item.truncate(pos);
 
-   if (!isValidTopicName(topic))
-   {    
+      pos = item.lastIndexOf(':');
+   }
+
+   QString topic = (pos>0) ? item.left(pos).trimmed() : item.trimmed();
+
+   if (topic.isEmpty())
+   {
       return 0;
    }
 
-   if (topicExists(topic))
+   SCDTopic *entry = topics.value(topic);
+
+   if (!entry)
    {
-      lastErrorMsg = "topic '" + topic + "' already exists";
+      entry = createTopic(topic, pos>0 && item.mid(pos+1).trimmed()=="dynamic");
+   }
 
-      return 2; // already exists
+   entry->priority = (priority>=0) ? priority : int(SCDConnection::PR_NORMAL); // no option: normal
+
+   if (entry->delta != delta)
+   {
+      entry->delta = delta;
+
+      entry->clearState();
    }
 
-   if (dynamic)
+   if (entry->multicast && !multicast)
    {
-      topic +=":dynamic";
+      leaveMulticast(entry);
    }
-   else
+
+   entry->multicast = multicast;
+
+   return entry;
+}
+
+/**
+ * @brief SCDTopicServer::topicExists
+ * @param topic
+ * @return
+ */
+bool SCDTopicServer::topicExists(QString topic)
+{
+   if (topic.trimmed().isEmpty())
    {
-      topic +=":static";
+      return false;
    }
 
-   topics.append(topic);
+   return topics.contains(topic);
+}
 
-   return saveTopicList();
+/**
+ * @brief SCDTopicServer::isDynamicTopic
+ * @param topic
+ * @return
+ */
+bool SCDTopicServer::isDynamicTopic(QString topic)
+{
+   SCDTopic *entry = topics.value(topic);
+
+   return entry && entry->dynamic;
 }
 
 /**
- * @brief SignalsHandler::removeTopic
+ * @brief SCDTopicServer::setTopicPriority set the outbound priority class of topic messages
  * @param topic
- * @return  -1: failure, topic not exists
- *           0: failure,
- *           1: success,
- *           2: success, but warning: empty subscribers list
+ * @param priority high, normal or bulk
+ * @return 0: failure, 1: success
  */
-int SCDTopicServer::removeTopic(QString topic, QStringList &removedSubscribers)
+int SCDTopicServer::setTopicPriority(QString topic, QString priority)
 {
-   lastErrorMsg = "no error";
+   SCDTopic *entry = topics.value(topic.trimmed());
 
-   if (!isValidTopicName(topic))
+   if (!entry)
    {
+      lastErrorMsg = "topic '" + topic + "' not found";
       return 0;
    }
 
-   int index = topics.indexOf(QRegularExpression(topic + ":.*"));
+   int value = SCDConnection::priorityFromName(priority.trimmed());
 
-   int retr = 1;
+   if (value<0)
+   {
+      lastErrorMsg = "invalid priority '" + priority + "'";
+      return 0;
+   }
 
-   if (index>-1)
+   if (entry->priority != value)
    {
-      topics.removeAt(index);
+      entry->priority = value;
+
+      return saveTopicList();
    }
-   else
+
+   return 1;
+}
+
+/**
+ * @brief SignalsHandler::removeTopicSubscribers Remove the all topic subscribes: each subscriber is unscribed from topic
+ * @param topic
+ * @return 1: success,
+ *         2: success but warning: topic not exists
+ */
+int SCDTopicServer::removeTopicSubscribers(QString topic)
+{
+   SCDTopic *entry = topics.value(topic);
+
+   if (!entry)
    {
       lastErrorMsg = "topic '" + topic + "' not found";
-      return index;
+      return 2;
    }
 
-   if (QFile::exists(topic))
+   for (int n=0; n<entry->subscribers.size(); n++)
    {
-      listLoadFromFile(topic,removedSubscribers); // load removed subscribers
+      entry->subscribers.at(n)->topics.remove(entry);
+   }
 
-      retr = removeTopicSubscribers(topic); // return 0 or 1 or 2 (warning empty list: subscribers file not exists)
+   if (bus && !entry->subscribers.isEmpty())
+   {
+      bus->unsubscribe(entry->name);
 
-      if (retr==0)
-      {
-         return retr; // remove topic subscriber failure
-      }
+      entry->clearState();
    }
 
-   int ret = saveTopicList(); // return 0 or 1
+   entry->subscribers.clear();
 
-   if (ret==0)
+   for (int n=0; n<entry->filters.size(); n++)
    {
-      return ret;
+      deleteFilter(entry->filters.at(n));
    }
 
-   return 1; // return 1, 2 is ignored (subscribers file not found.)
+   entry->filters.clear();
+   entry->filtered = 0;
+
+   entry->qos.clear();
+   entry->reliable = 0;
+
+   entry->multicastReceivers = 0;
+
+   return 1;
 }
 
 /**
- * @brief SCDTopicServer::subscribeToTopic
- * @param topic
- * @param clientIp
- * @param createNewTopic
- * @return -3: subscription failed, but new topic has been created
- *         -2: subscription failed, but cannot create a new topic becose already exists
- *         -1: subscription failed  becose cannot create a new topic,
- *          0: topic subscribe failure,
- *          1: success,
- *          2: success, but warning: topic already exists
- *          3: success, new topic created
+ * @brief SCDTopicServer::attachSubscriber append the client to topic subscribers array, if not already subscribed,
+ *                                         otherwise replace the subscription filter
+ * @param entry
+ * @param client
+ * @param filter content filter, 0 for none: owned by topic
+ * @param qos 1: at-least-once delivery (the client has a session), 0: at-most-once, 2: from the multicast group
  */
-int SCDTopicServer::subscribeToTopic(QString topic, QString clientIp, bool createNewTopic)
+void SCDTopicServer::attachSubscriber(SCDTopic *entry, SCDConnection *client, SCDFilter *filter, int qos)
 {
-   lastErrorMsg = "no error";
+   QHash<SCDTopic *, int>::const_iterator it = client->topics.constFind(entry);
 
-   if (!isValidTopicName(topic))
+   if (it == client->topics.constEnd())
    {
-      return 0;
-   }
-
-   int newTopicRect = 1;
+      client->topics.insert(entry, entry->subscribers.size());
 
-   if (createNewTopic)
-   {
-      newTopicRect = addTopic(topic,true); // 1: created, 2: already exists, 0: failure
+      entry->subscribers.append(client);
+      entry->filters.append(filter);
+      entry->qos.append(quint8(qos));
 
-      if (newTopicRect==0) // create dynamic topic
+      if (bus && entry->subscribers.size()==1) // first local subscriber: the other processes forward the topic messages
       {
-         return -1;
+         bus->subscribe(entry->name);
       }
    }
+   else
+   {
+      SCDFilter *&current = entry->filters[it.value()];
+
+      entry->filtered -= (current != 0);
+      entry->reliable -= (entry->qos.at(it.value()) == SCDTopic::QOS_AT_LEAST_ONCE);
+
+      entry->multicastReceivers -= (entry->qos.at(it.value()) == SCDTopic::QOS_MULTICAST);
+
+      deleteFilter(current);
+
+      current = filter;
+
+      entry->qos[it.value()] = quint8(qos);
+   }
+
+   entry->filtered += (filter != 0);
+   entry->reliable += (qos == SCDTopic::QOS_AT_LEAST_ONCE);
+
+   entry->multicastReceivers += (qos == SCDTopic::QOS_MULTICAST);
+}
+
+/**
+ * @brief SCDTopicServer::detachSubscriber remove the client from topic subscribers array in O(1):
+ *                                         the last subscriber is moved into the removed subscriber position
+ * @param entry
+ * @param client
+ * @return false if the client is not subscribed to topic
+ */
+bool SCDTopicServer::detachSubscriber(SCDTopic *entry, SCDConnection *client)
+{
+   QHash<SCDTopic *, int>::iterator it = client->topics.find(entry);
 
-   if (topicExists(topic)) // if topic exists
+   if (it == client->topics.end())
    {
-      QStringList topicClients;
+      return false;
+   }
 
-      listLoadFromFile(topic,topicClients); // try to load the topic subscribers list
+   int index = it.value();
 
-      if (!topicClients.contains(clientIp)) // if is not subscribed to topic
-      {
-         topicClients.append(clientIp);     // subscribes to topic
-      }
+   client->topics.erase(it);
 
-      int ret = listSaveToFile(topic,topicClients,true); // always save the subscribers list (this will rewrite corrupt or damaged file);
+   SCDFilter *filter = entry->filters.at(index);
 
-      if (createNewTopic)
-      {
-         switch (newTopicRect)
-         {
-            case 1: // new topic created.
+   entry->filtered -= (filter != 0);
+   entry->reliable -= (entry->qos.at(index) == SCDTopic::QOS_AT_LEAST_ONCE);
 
-              if (ret==0)
-              {
-                 return -3; // subscribe failed,
-              }
-              else
-              {
-                 return 3;  // subscribe success
-              }
+   entry->multicastReceivers -= (entry->qos.at(index) == SCDTopic::QOS_MULTICAST);
 
-            break;
+   deleteFilter(filter);
 
-            case 2: // topic already exists
+   SCDConnection *last = entry->subscribers.last();
 
-              if (ret==0)
-              {
-                 return -2; // subcribe failed
-              }
-              else
-              {
-                 return 2;  // subscribe success
-              }
+   entry->subscribers.removeLast();
 
-            break;
-         }
-      }
+   entry->filters[index] = entry->filters.last();
+   entry->filters.removeLast();
 
-      return ret; // 0: subscribe failure, 1: subscribe success
+   entry->qos[index] = entry->qos.last();
+   entry->qos.removeLast();
+
+   if (last != client)
+   {
+      entry->subscribers[index] = last;
+
+      last->topics[entry] = index;
    }
 
-   lastErrorMsg = "topic '" + topic + "' not found";
+   if (bus && entry->subscribers.isEmpty())
+   {
+      bus->unsubscribe(entry->name);
 
-   return 0;
+      entry->clearState(); // remote messages are no more received: the state would become stale
+   }
+
+   return true;
 }
 
 /**
- * @brief SCDTopicServer::unscribeFromTopic unscribe client from topic
+ * @brief SignalsHandler::addTopic add new a topic to topic list: topic will be trimmed before inserting into topic list
  * @param topic
- * @param clientIp
- * @return   0: unscribe failed.
- *           1: unscribe ok
- *           2: succes but warning: client already unscribed becose topic not exists
- *           3: unscribe ok, topic removed
- *           4: success but warning: delete empty dynamic topic failure
+ * @return 0: failure,
+ *         1: success,
+ *         2: success, but warning: topic already exists
  */
-int SCDTopicServer::unscribeFromTopic(QString topic, QString clientIp)
+int SCDTopicServer::addTopic(QString topic, bool dynamic)
 {
    lastErrorMsg = "no error";
 
    if (!isValidTopicName(topic))
-   {
+   {    
       return 0;
    }
 
-   if (topicExists(topic)) // if is a registered topic
+   if (topicExists(topic))
    {
-      QStringList subscribers;
-
-      int ret = 1;
-
-      //****************************************************************************************************************************
-      //
-      // This section remove the client from list of subscribers to topic.
-      //
-      // return 0 on failure, otherwise continue below to remove topic if needed and return
-      //
-
-      if (QFile::exists(topic)) // if the list of subscribes to topic exists
-      {
-         ret = listLoadFromFile(topic, subscribers); // try to load the list of subscribers to topic
-
-         if (ret<=0) // assumes the file 'topic' to be corrupted and try to remove it
-         {
-            ret = removeTopicSubscribers(topic); // remove the list of subscribers to topic if damaged.
+      lastErrorMsg = "topic '" + topic + "' already exists";
 
-            if (ret==0)
-            {
-               return 0; // remove topic subscribers list failure
-            }
-         }
-         else
-         {
-            if (subscribers.removeAll(clientIp)) // remove the client from list of subscribers to topic if any
-            {
-               ret = listSaveToFile(topic, subscribers, true); // save the list of subscribers to topic or delete it if empty
+      return 2; // already exists
+   }
 
-               if (!ret)
-               {
-                  return ret;
-               }
-            }
-         }         
-      }
+   createTopic(topic, dynamic);
 
-      //*************************************************************************************************************************
-      // this section remove  the topic only if subscribers list is empty. At this stage if subscribers list is empty means that
-      // the  topic subscribers file not exists (is already deleted): cannot never return 2
+   return saveTopicList();
+}
 
-      if (subscribers.isEmpty() && isDynamicTopic(topic))
-      {
-         QStringList subscribers;
+/**
+ * @brief SCDTopicServer::createTopic create the topic entry and insert it into topic index
+ * @param topic
+ * @param dynamic
+ * @return
+ */
+SCDTopic *SCDTopicServer::createTopic(const QString &topic, bool dynamic)
+{
+   SCDTopic *entry = new SCDTopic(topic, dynamic);
 
-         return (removeTopic(topic,subscribers) == 0) ? -1 : 3; // translate error code 0 to -1, return -1 or 3 success (topic delete)
-      }
+   qint64 now = clock.elapsed();
 
-      return ret; // return 0: unscribe from topic failure, 1: unscribe success (client is unscribed, becose subscribers file not exists)
-   }
-   else
-   {
-      removeTopicSubscribers(topic); // remove orphan client list (if exists)
-   }
+   entry->messageBucket.configure(topicMessageRate, 0, now);
+   entry->byteBucket.configure(topicByteRate, 0, now);
 
-   lastErrorMsg = "topic '" + topic + "' not found";
+   topics.insert(topic, entry);
 
-   return 2;
+   return entry;
 }
 
 /**
- * @brief SCDTopicServer::unscribeFromTopics unscribe the client from all topics, the resulting dynamic topic having
- *                                           an empty subscribers list will be removed
- * @param clientIp
- * @param removeEmptyTopic
- * @return error list
+ * @brief SCDTopicServer::setTopicDelta set the delta encoding of topic messages
+ * @param topic
+ * @param delta
+ * @return 0: failure, 1: success
  */
-QStringList SCDTopicServer::unscribeFromTopics(QString clientIp)
+int SCDTopicServer::setTopicDelta(QString topic, bool delta)
 {
-   QString     topic;
-   QStringList errors;
-   QStringList topics = getTopics();
+   SCDTopic *entry = topics.value(topic.trimmed());
 
-   int ret;
+   if (!entry)
+   {
+      lastErrorMsg = "topic '" + topic + "' not found";
+      return 0;
+   }
 
-   for (int n=0; n<topics.length(); n++)  // iterate the topics
+   if (entry->delta != delta)
    {
-      topic = getTopic(topics,n);
+      entry->delta = delta;
 
-      ret = unscribeFromTopic(topic, clientIp); // remove client subscription to topic
+      entry->clearState();
 
-      if (ret==0)
-      {
-         errors << lastErrorMsg;
-      }
+      return saveTopicList();
    }
 
-   return errors;
+   return 1;
 }
 
 /**
- * @brief SCDTopicServer::unscribeAllSubcribers remove all subscribers subscriptions to each topics: topics list must be already loaded before;
- *                                              dynamic topic wil be removed
+ * @brief SCDTopicServer::sendTopicState send the last document of a delta encoded topic to a new subscriber,
+ *                                       as a message of the document sender
+ * @param topic
+ * @param client
  */
-void SCDTopicServer::unregisterAllSubscriptions()
+void SCDTopicServer::sendTopicState(QString topic, SCDConnection *client)
 {
-   QString topic;
+   SCDTopic *entry = topics.value(topic.trimmed());
 
-   QStringList topics = getTopics();
+   if (!entry || !entry->delta || !entry->hasState || !client->topics.contains(entry))
+   {
+      return;
+   }
 
-   QStringList subscribers;
+   SCDExpiry expiry;
 
-   for (int n=0; n<topics.size(); n++)
+   if (entry->stateExpires>0)
    {
-      topic = getTopic(topics,n);
-
-      subscribers.clear();
+      expiry.expires = entry->stateExpires;
+      expiry.count   = entry->expiredCounter();
 
-      if (isDynamicTopic(topic))
-      {         
-         removeTopic(topic, subscribers); // remove topic and its subscribers
-      }
-      else
+      if (expiry.isExpired(SCDExpiry::now()))
       {
-         listLoadFromFile(topic,subscribers);
-
-         removeTopicSubscribers(topic);
+         entry->expireState();
+         return;
       }
    }
+
+   SCDFilter *filter = entry->filters.at(client->topics.value(entry));
+
+   if (filter && !filter->matches(entry->state))
+   {
+      return;
+   }
+
+   client->post("[" + entry->stateSender + "%S@" + entry->name + "]:" + entry->stateMessage, entry->priority, 0, expiry.expires>0 ? &expiry : 0);
+
+   if (expiry.expires>0 && client->queued>0)
+   {
+      scheduleExpiry(client, expiry.expires);
+   }
 }
 
 /**
- * @brief SCDTopicServer::notifyToSubscribers Send a message to the subscribers list, except the sender
- *                                            Subscribers list should be loaeded from file of topic subscribers
- * @param subscribers a topic subscribers list
- * @param notifyMsg
- * @return
+ * @brief SCDTopicServer::setTopicMulticast set the multicast egress of topic messages: the subscribers joining the
+ *                                          multicast group (see joinMulticast) receive them from there
+ * @param topic
+ * @param multicast
+ * @return 0: failure, 1: success
  */
-int SCDTopicServer::sendMessageToSubscribers(QStringList subscribers, QString notifyMsg, QString sender)
+int SCDTopicServer::setTopicMulticast(QString topic, bool multicast)
 {
-   QString subscriber;
-
-   QWebSocket *socket;
+   SCDTopic *entry = topics.value(topic.trimmed());
 
-   for (int n=0; n<subscribers.size(); n++)
+   if (!entry)
    {
-      subscriber = subscribers.at(n);
+      lastErrorMsg = "topic '" + topic + "' not found";
+      return 0;
+   }
 
-      if (subscriber==sender)
+   if (entry->multicast != multicast)
+   {
+      if (!multicast)
       {
-         continue;
+         leaveMulticast(entry);
       }
 
-      if (sockList.contains(subscriber))
-      {
-         socket = sockList[subscriber];
+      entry->multicast = multicast;
 
-         if (socket->isValid())
-         {
-            socket->sendTextMessage(notifyMsg);
-         }
-      }
+      return saveTopicList();
    }
 
    return 1;
 }
 
 /**
- * @brief SCDTopicServer::isValidTopicName remove trailng space from topic name and check if empty
+ * @brief SCDTopicServer::joinMulticast the client receives the messages of a multicast topic from the multicast group
+ *                                      (MCA:1 subscription), instead of thru its connection: it is sent the announce
+ *                                      [server@multicast]:<topic>|<source>|<group>|<port>|<next sequence>\n
+ *                                      then it joins the group, and asks the missing messages (TMR command) when the
+ *                                      sequence numbers have a gap, e.g. the ones sent before it joined, or when the
+ *                                      last sequence number announced to the group (see onMulticastTimeout) is
+ *                                      beyond the messages it received. The client receives its own messages to the
+ *                                      topic too.
+ *                                      If multicast egress is disabled, or the topic is not a multicast topic, the
+ *                                      client receives the messages thru its connection, as any subscriber.
  * @param topic
- * @return true if is an not empty topic name.
+ * @param client subscribed to topic
+ * @return true if the client receives from the multicast group
  */
-bool SCDTopicServer::isValidTopicName(QString &topic)
+bool SCDTopicServer::joinMulticast(QString topic, SCDConnection *client)
 {
-   topic = topic.trimmed();
+   SCDTopic *entry = topics.value(topic.trimmed());
 
-   if (topic.isEmpty())
+   if (!entry || !entry->multicast || !multicast || !multicast->isActive() || !client->topics.contains(entry))
    {
-       lastErrorMsg = "Undefined topic name";
-       return false;
+      return false;
+   }
+
+   attachSubscriber(entry, client, 0, SCDTopic::QOS_MULTICAST);
+
+   client->post(multicast->announce(entry), SCDConnection::PR_HIGH);
+
+   if (!multicastTimer.isActive()) // tail loss detection
+   {
+      multicastTimer.start(multicast->sequenceInterval());
    }
 
    return true;
 }
 
 /**
- * @brief SCDTopicServer::addressToString
- * @param address
- * @param peer
- * @return
+ * @brief SCDTopicServer::onMulticastTimeout send to the group the last sequence number of each multicast topic having
+ *                                           receivers: a receiver which lost the last datagrams of a topic asks them
+ *                                           again (TMR), no later datagram would show the gap
  */
-QString SCDTopicServer::addressToString(QHostAddress address, int port)
+void SCDTopicServer::onMulticastTimeout()
 {
-   return address.toString().toUpper() + ":" + QString::number(port).toUpper();
+   if (!multicast || !multicast->isActive())
+   {
+      multicastTimer.stop();
+      return;
+   }
+
+   int receivers = 0;
+
+   for (QMap<QString, SCDTopic *>::const_iterator it = topics.constBegin(); it != topics.constEnd(); ++it)
+   {
+      SCDTopic *entry = it.value();
+
+      if (entry->multicast && entry->multicastReceivers>0)
+      {
+         multicast->announceSequence(entry);
+
+         receivers += entry->multicastReceivers;
+      }
+   }
+
+   if (receivers==0)
+   {
+      multicastTimer.stop();
+   }
 }
 
 /**
- * @brief SCDTopicServer::addressToHex
- * @param address
- * @param peer
- * @return
+ * @brief SCDTopicServer::leaveMulticast the topic is no more a multicast topic: its receivers get the next messages
+ *                                       thru their connection
+ * @param entry
  */
-QString SCDTopicServer::addressToHex(QHostAddress address, int port)
+void SCDTopicServer::leaveMulticast(SCDTopic *entry)
 {
-   return QString::number(address.toIPv4Address(),16).toUpper() + ":" + QString::number(port,16).toUpper();
+   for (int n=0; n<entry->qos.size(); n++)
+   {
+      if (entry->qos.at(n) == SCDTopic::QOS_MULTICAST)
+      {
+         entry->qos[n] = SCDTopic::QOS_AT_MOST_ONCE;
+      }
+   }
+
+   entry->multicastReceivers = 0;
+
+   entry->multicastHistory.clear();
 }
 
 /**
- * @brief SCDTopicServer::lastError
- * @return
+ * @brief SCDTopicServer::sendMulticast send the frame of a message to the multicast group: a datagram too large for
+ *                                      the group is sent thru the connection of each receiver, as the same text
+ * @param entry multicast topic having receivers
+ * @param frame
+ * @param priority
+ * @param trace traced message: the queue-to-write time is counted once, for the datagram
+ * @param expiry message having a TTL: kept for repairs until it expires, 0: never expires
  */
-QString SCDTopicServer::lastError()
+void SCDTopicServer::sendMulticast(SCDTopic *entry, const QString &frame, int priority, const SCDTraceStamp *trace, const SCDExpiry *expiry)
 {
-   return lastErrorMsg;
+   QByteArray datagram;
+
+   if (multicast->publish(entry, frame, datagram, expiry ? expiry->expires : 0))
+   {
+      if (trace)
+      {
+         trace->written();
+      }
+
+      return;
+   }
+
+   QString text = QString::fromUtf8(datagram);
+
+   for (int n=0; n<entry->subscribers.size(); n++)
+   {
+      SCDConnection *client = entry->subscribers.at(n);
+
+      if (entry->qos.at(n) != SCDTopic::QOS_MULTICAST)
+      {
+         continue;
+      }
+
+      if (!client->isValid() || !client->post(text, priority, trace, expiry)) // the sender too, as from the group
+      {
+         entry->drops++;
+      }
+      else
+      if (expiry && client->queued>0)
+      {
+         scheduleExpiry(client, expiry->expires);
+      }
+   }
 }
 
 /**
- * @brief SCDTopicServer::getTopics
- * @return
+ * @brief SCDTopicServer::repairMulticast send again to a receiver the multicast messages it missed, thru its
+ *                                        connection, as the datagrams text (see SCDMulticast)
+ * @param topic
+ * @param client
+ * @param first first sequence number missing
+ * @param last last sequence number missing
+ * @return 0: failure,
+ *         1: success,
+ *         2: success but warning: some messages are lost (no more kept by server)
  */
-QStringList SCDTopicServer::getTopics()
+int SCDTopicServer::repairMulticast(QString topic, SCDConnection *client, quint64 first, quint64 last)
 {
-   return topics;
+   lastErrorMsg = "no error";
+
+   SCDTopic *entry = topics.value(topic.trimmed());
+
+   if (!entry || !client->topics.contains(entry))
+   {
+      lastErrorMsg = "not subscribed to topic '" + topic + "'";
+      return 0;
+   }
+
+   if (!multicast || !entry->multicast)
+   {
+      lastErrorMsg = "topic '" + topic + "' is not a multicast topic";
+      return 0;
+   }
+
+   QList<QByteArray> datagrams;
+
+   int lost = multicast->repair(entry, first, last, datagrams);
+
+   for (int n=0; n<datagrams.size(); n++)
+   {
+      client->post(QString::fromUtf8(datagrams.at(n)), entry->priority);
+   }
+
+   if (lost>0)
+   {
+      lastErrorMsg = QString::number(lost) + " messages lost";
+      return 2;
+   }
+
+   return 1;
 }
 
 /**
- * @brief SCDTopicServer::sendMessageToTopic send message to all topic subscribers except to sender.
- *                                           the client can send a message to the topics to which he is not subscribed
+ * @brief SignalsHandler::removeTopic
  * @param topic
- * @param message
- * @return o if topic not exists, 1 otherwise
+ * @param removedSubscribers subscribers of removed topic
+ * @param save false: the topics file is not written (removed thru another process, which writes it)
+ * @return  -1: failure, topic not exists
+ *           0: failure,
+ *           1: success
  */
-int SCDTopicServer::sendMessageToTopic(QString topic, QString message, QString sender)
+int SCDTopicServer::removeTopic(QString topic, QVector<SCDConnection *> &removedSubscribers, bool save)
 {
    lastErrorMsg = "no error";
 
-   if (!topicExists(topic))
+   if (!isValidTopicName(topic))
+   {
+      return 0;
+   }
+
+   SCDTopic *entry = topics.value(topic);
+
+   if (!entry)
    {
       lastErrorMsg = "topic '" + topic + "' not found";
+      return -1;
+   }
+
+   removedSubscribers = entry->subscribers;
+
+   removeTopicSubscribers(topic);
+
+   cancelFanOuts(entry);
+
+   delete topics.take(topic);
+
+   return save ? saveTopicList() : 1; // return 0 or 1
+}
+
+/**
+ * @brief SCDTopicServer::subscribeToTopic
+ * @param topic
+ * @param client
+ * @param createNewTopic
+ * @param filter content filter, 0 for none: owned by server (deleted on failure)
+ * @param qos 1: at-least-once delivery (open the client session first), 0: at-most-once
+ * @return -1: subscription failed  becose cannot create a new topic,
+ *          0: topic subscribe failure,
+ *          1: success,
+ *          2: success, but warning: topic already exists
+ *          3: success, new topic created
+ */
+int SCDTopicServer::subscribeToTopic(QString topic, SCDConnection *client, bool createNewTopic, SCDFilter *filter, int qos)
+{
+   lastErrorMsg = "no error";
+
+   if (!isValidTopicName(topic))
+   {
+      delete filter;
+      return 0;
+   }
+
+   int newTopicRect = 1;
+
+   if (createNewTopic)
+   {
+      newTopicRect = addTopic(topic,true); // 1: created, 2: already exists, 0: failure
+
+      if (newTopicRect==0) // create dynamic topic
+      {
+         delete filter;
+         return -1;
+      }
+   }
+
+   SCDTopic *entry = topics.value(topic);
+
+   if (entry) // if topic exists
+   {
+      attachSubscriber(entry, client, filter, qos); // subscribes to topic, if not already subscribed
+
+      if (createNewTopic)
+      {
+         return (newTopicRect==1) ? 3 : 2; // 3: new topic created, 2: topic already exists
+      }
+
+      return 1;
+   }
+
+   delete filter;
+
+   lastErrorMsg = "topic '" + topic + "' not found";
+
+   return 0;
+}
+
+/**
+ * @brief SCDTopicServer::unscribeFromTopic unscribe client from topic
+ * @param topic
+ * @param client
+ * @return  -1: unscribe ok, but delete empty dynamic topic failure
+ *           0: unscribe failed.
+ *           1: unscribe ok
+ *           2: succes but warning: client already unscribed becose topic not exists
+ *           3: unscribe ok, topic removed
+ */
+int SCDTopicServer::unscribeFromTopic(QString topic, SCDConnection *client)
+{
+   lastErrorMsg = "no error";
 
+   if (!isValidTopicName(topic))
+   {
       return 0;
    }
 
-   QStringList subscribers;
+   SCDTopic *entry = topics.value(topic);
+
+   if (entry) // if is a registered topic
+   {
+      detachSubscriber(entry, client); // remove the client from list of subscribers to topic if any
+
+      // remove the dynamic topic when its subscribers list becomes empty
+
+      if (entry->subscribers.isEmpty() && entry->dynamic)
+      {
+         QVector<SCDConnection *> subscribers;
+
+         return (removeTopic(topic,subscribers) == 0) ? -1 : 3; // translate error code 0 to -1, return -1 or 3 success (topic delete)
+      }
+
+      return 1;
+   }
+
+   lastErrorMsg = "topic '" + topic + "' not found";
+
+   return 2;
+}
 
-   listLoadFromFile(topic,subscribers);
+/**
+ * @brief SCDTopicServer::unscribeFromTopics unscribe the client from all topics, the resulting dynamic topic having
+ *                                           an empty subscribers list will be removed
+ * @param client
+ * @return error list
+ */
+QStringList SCDTopicServer::unscribeFromTopics(SCDConnection *client)
+{
+   QStringList errors;
+   QStringList topics;
 
-   QString subscriber;
+   for (QHash<SCDTopic *, int>::const_iterator it = client->topics.constBegin(); it != client->topics.constEnd(); ++it)
+   {
+      topics.append(it.key()->name); // copy: the client topics list changes meanwhile
+   }
 
-   QWebSocket *socket;
+   int ret;
 
-   for (int n=0; n<subscribers.size(); n++)
+   for (int n=0; n<topics.length(); n++)  // iterate the subscribed topics
    {
-      subscriber = subscribers.at(n);
+      ret = unscribeFromTopic(topics.at(n), client); // remove client subscription to topic
 
-      if (subscriber==sender)
+      if (ret<=0)
       {
-         continue;
+         errors << lastErrorMsg;
       }
+   }
+
+   return errors;
+}
+
+/**
+ * @brief SCDTopicServer::unscribeAllSubcribers remove all subscribers subscriptions to each topics: topics list must be already loaded before;
+ *                                              dynamic topic wil be removed
+ */
+void SCDTopicServer::unregisterAllSubscriptions()
+{
+   QString topic;
+
+   QStringList topics = this->topics.keys(); // copy: dynamic topics will be removed meanwhile
+
+   QVector<SCDConnection *> subscribers;
+
+   for (int n=0; n<topics.size(); n++)
+   {
+      topic = topics.at(n);
+
+      if (isDynamicTopic(topic))
+      {
+         removeTopic(topic, subscribers); // remove topic and its subscribers
+      }
+      else
+      {
+         removeTopicSubscribers(topic);
+      }
+   }
+}
+
+/**
+ * @brief SCDTopicServer::notifyToSubscribers Send a message to the subscribers list, except the sender
+ * @param subscribers a topic subscribers list
+ * @param notifyMsg
+ * @param sender
+ * @return
+ */
+int SCDTopicServer::sendMessageToSubscribers(const QVector<SCDConnection *> &subscribers, const QString &notifyMsg, SCDConnection *sender)
+{
+   fanOut(subscribers, notifyMsg, sender, SCDConnection::PR_HIGH);
+
+   return 1;
+}
+
+/**
+ * @brief SCDTopicServer::fanOut write the frame to each subscriber, except the sender: the subscribers array is
+ *                               scanned linearly, no lookup is done for each subscriber.
+ * @param subscribers
+ * @param frame
+ * @param sender
+ * @param priority outbound priority class (SCDConnection::Priority)
+ * @param filters subscribers content filters (parallel to subscribers), 0 to send to all subscribers
+ * @param document message parsed once for all filters, 0 if the message is not a JSON object (filters never match)
+ * @param filteredFrame frame sent to subscribers having a matching filter, 0 to send them the same frame
+ * @param qos subscribers delivery (parallel to subscribers, SCDTopic::Delivery), 0 if no subscriber has QoS 1 or
+ *            receives from the multicast group: the QoS 0 path is unchanged
+ * @param trace traced message: queue-to-write time counted for each subscriber, 0: not traced
+ * @param expiry message having a TTL: the frames waiting for a subscriber are dropped when expired, 0: never expires
+ * @return number of deliveries dropped (subscriber not writable, or its priority lanes full)
+ */
+int SCDTopicServer::fanOut(const QVector<SCDConnection *> &subscribers, const QString &frame, SCDConnection *sender, int priority,
+                           const QVector<SCDFilter *> *filters, const QJsonObject *document, const QString *filteredFrame,
+                           const QVector<quint8> *qos, const SCDTraceStamp *trace, const SCDExpiry *expiry)
+{
+   int drops = 0;
+
+   SCDConnection * const *client = subscribers.constData();
+   SCDConnection * const *end    = client + subscribers.size();
+
+   SCDFilter * const *filter = filters ? filters->constData() : 0;
+
+   const quint8 *level = qos ? qos->constData() : 0;
+
+   for (; client != end; ++client)
+   {
+      const QString *out = &frame;
 
-      if (sockList.contains(subscriber))
+      int delivery = level ? *level++ : SCDTopic::QOS_AT_MOST_ONCE;
+
+      if (filter)
       {
-         socket = sockList[subscriber];
+         SCDFilter *current = *filter++;
 
-         if (socket->isValid())
+         if (current)
          {
-            socket->sendTextMessage("[" + sender + "@" + topic +"]:" + message);
+            if (!document || !current->matches(*document))
+            {
+               continue; // filtered out
+            }
+
+            if (filteredFrame)
+            {
+               out = filteredFrame;
+            }
          }
       }
-   }
 
-   return 1;
+      if (*client == sender || delivery == SCDTopic::QOS_MULTICAST) // multicast receivers: sent once to the group
+      {
+         continue;
+      }
+
+      if (delivery == SCDTopic::QOS_AT_LEAST_ONCE && (*client)->session) // kept until acknowledged
+      {
+         drops += !deliverReliable(*client, *out, priority, trace, expiry);
+         continue;
+      }
+
+      if (!(*client)->isValid() || !(*client)->post(*out, priority, trace, expiry))
+      {
+         drops++;
+         continue;
+      }
+
+      if (expiry && (*client)->queued>0) // waiting into a lane: swept when expired
+      {
+         scheduleExpiry(*client, expiry->expires);
+      }
+   }
+
+   return drops;
+}
+
+/**
+ * @brief SCDTopicServer::startFanOut fan-out of a message to a large topic, or to a topic having fan-outs in progress.
+ *
+ *                                    The message is delivered to an immutable snapshot of the topic subscribers:
+ *                                    the subscribers array is shared (implicitly) by the topic and the snapshot, so
+ *                                    taking it copies nothing, and a subscribe or unsubscribe meanwhile copies the
+ *                                    topic array instead of changing the snapshot. A connection closed meanwhile is
+ *                                    skipped (see closeConnection), an unsubscribed one still receives the message.
+ *
+ *                                    The content filters of all subscribers are evaluated by the worker threads
+ *                                    while the event loop goes on (see evaluateFilters): the fan-out waits for them,
+ *                                    then the next fan-outs of the topic wait for it. The QoS 1 deliveries are done at
+ *                                    once, into the sessions queues (their filters evaluated here), so that a durable
+ *                                    session closed meanwhile does not miss the message. Then the QoS 0 subscribers
+ *                                    are delivered fanOutChunkSize at a time: the first chunk at once, if no other
+ *                                    fan-out of the topic is in progress and the filters are already evaluated, the
+ *                                    next ones from the event loop (see onFanOutTimeout).
+ * @param entry
+ * @param frame
+ * @param sender
+ * @param priority outbound priority class (SCDConnection::Priority)
+ * @param filtered evaluate the content filters of the subscribers
+ * @param document message parsed once for all filters, 0 if the message is not a JSON object (filters never match)
+ * @param filteredFrame frame sent to subscribers having a matching filter, 0 to send them the same frame
+ * @param qos subscribers delivery (parallel to subscribers), 0 if no subscriber has QoS 1 or receives from multicast
+ * @param trace traced message, 0: not traced
+ * @param expiry message having a TTL, 0: never expires
+ * @return number of deliveries dropped meanwhile
+ */
+int SCDTopicServer::startFanOut(SCDTopic *entry, const QString &frame, SCDConnection *sender, int priority, bool filtered,
+                                const QJsonObject *document, const QString *filteredFrame, const QVector<quint8> *qos,
+                                const SCDTraceStamp *trace, const SCDExpiry *expiry)
+{
+   int drops = 0;
+
+   fanOutJobs.append(FanOutJob());
+
+   FanOutJob &job = fanOutJobs.last();
+
+   job.topic       = entry;
+   job.subscribers = entry->subscribers; // shared: no copy
+   job.frame       = frame;
+   job.sender      = sender;
+   job.priority    = priority;
+   job.next        = 0;
+   job.serial      = ++fanOutSerial;
+
+   if (filteredFrame)
+   {
+      job.filteredFrame = *filteredFrame;
+   }
+
+   if (trace)
+   {
+      job.trace = *trace;
+   }
+
+   if (expiry)
+   {
+      job.expiry = *expiry;
+   }
+
+   if (filtered)
+   {
+      job.filters = evaluateFilters(entry->filters, document);
+   }
+
+   if (qos)
+   {
+      job.qos = *qos;
+
+      drops += deliverReliableFanOut(job);
+   }
+
+   entry->fanOuts++;
+
+   if (entry->fanOuts==1 && (!job.filters || !job.filters->tasks)) // no fan-out of the topic in progress: first chunk at once
+   {
+      drops += deliverFanOutChunk(job);
+
+      if (job.next >= job.subscribers.size())
+      {
+         entry->fanOuts--;
+
+         fanOutJobs.removeLast();
+
+         if (fanOutJobs.isEmpty())
+         {
+            fanOutClosed.clear();
+         }
+
+         return drops;
+      }
+   }
+
+   if (!fanOutTimer.isActive())
+   {
+      fanOutTimer.start();
+   }
+
+   return drops;
+}
+
+/**
+ * @brief SCDTopicServer::deliverFanOutChunk deliver the next fanOutChunkSize subscribers of a fan-out, QoS 0 only
+ * @param job
+ * @return number of deliveries dropped
+ */
+int SCDTopicServer::deliverFanOutChunk(FanOutJob &job)
+{
+   int drops = 0;
+
+   const SCDTraceStamp *trace  = job.trace.latency ? &job.trace : 0;
+   const SCDExpiry     *expiry = (job.expiry.expires>0) ? &job.expiry : 0;
+
+   SCDConnection * const *client = job.subscribers.constData();
+
+   const quint8 *level = job.qos.isEmpty() ? 0 : job.qos.constData();
+   const quint8 *match = job.filters ? job.filters->matches.constData() : 0; // evaluated: see onFanOutTimeout
+
+   bool closed = !fanOutClosed.isEmpty();
+
+   int end = qMin(job.next + fanOutChunkSize, job.subscribers.size());
+
+   for (int n=job.next; n<end; n++)
+   {
+      if (client[n] == job.sender || (level && level[n] != SCDTopic::QOS_AT_MOST_ONCE)) // QoS 1 delivered at start
+      {
+         continue;
+      }
+
+      if (match && match[n] == SCDFilterTask::FM_SKIP)
+      {
+         continue;
+      }
+
+      if (closed && fanOutClosed.value(client[n]) >= job.serial) // closed after the snapshot
+      {
+         continue;
+      }
+
+      const QString &out = (match && match[n] == SCDFilterTask::FM_FILTERED && !job.filteredFrame.isNull()) ? job.filteredFrame : job.frame;
+
+      if (!client[n]->isValid() || !client[n]->post(out, job.priority, trace, expiry))
+      {
+         drops++;
+         continue;
+      }
+
+      if (expiry && client[n]->queued>0) // waiting into a lane: swept when expired
+      {
+         scheduleExpiry(client[n], expiry->expires);
+      }
+   }
+
+   job.next = end;
+
+   return drops;
+}
+
+/**
+ * @brief SCDTopicServer::deliverReliableFanOut deliver a fan-out to its QoS 1 subscribers, at start. Their filters are
+ *                                             evaluated here if the workers are still evaluating the others.
+ * @param job
+ * @return number of deliveries dropped
+ */
+int SCDTopicServer::deliverReliableFanOut(FanOutJob &job)
+{
+   int drops = 0;
+
+   const SCDTraceStamp *trace  = job.trace.latency ? &job.trace : 0;
+   const SCDExpiry     *expiry = (job.expiry.expires>0) ? &job.expiry : 0;
+
+   SCDConnection * const *client = job.subscribers.constData();
+
+   const quint8 *level = job.qos.constData();
+
+   bool evaluating = job.filters && job.filters->pending.loadAcquire() > 0; // the matches are written by the workers
+
+   SCDFilter * const *filter   = job.filters ? job.filters->filters.constData() : 0;
+   const QJsonObject *document = (job.filters && job.filters->object) ? &job.filters->document : 0;
+   const quint8      *match    = job.filters ? job.filters->matches.constData() : 0;
+
+   for (int n=0; n<job.subscribers.size(); n++)
+   {
+      if (level[n] != SCDTopic::QOS_AT_LEAST_ONCE || client[n] == job.sender)
+      {
+         continue;
+      }
+
+      quint8 result = !filter ? quint8(SCDFilterTask::FM_FRAME) : evaluating ? SCDFilterTask::match(filter[n], document) : match[n];
+
+      if (result == SCDFilterTask::FM_SKIP)
+      {
+         continue;
+      }
+
+      const QString &out = (result == SCDFilterTask::FM_FILTERED && !job.filteredFrame.isNull()) ? job.filteredFrame : job.frame;
+
+      if (client[n]->session) // kept until acknowledged
+      {
+         drops += !deliverReliable(client[n], out, job.priority, trace, expiry);
+         continue;
+      }
+
+      if (!client[n]->isValid() || !client[n]->post(out, job.priority, trace, expiry))
+      {
+         drops++;
+      }
+   }
+
+   return drops;
+}
+
+/**
+ * @brief SCDTopicServer::evaluateFilters evaluate the content filters of all subscribers of a topic for a message:
+ *                                        the subscribers are split into ranges of a chunk at least, evaluated by the
+ *                                        worker threads while the event loop goes on (see onFanOutTimeout). Less than
+ *                                        a chunk, or no worker, is evaluated at once.
+ * @param filters
+ * @param document
+ * @return batch whose matches are complete when pending is 0
+ */
+QSharedPointer<SCDFilterBatch> SCDTopicServer::evaluateFilters(const QVector<SCDFilter *> &filters, const QJsonObject *document)
+{
+   QSharedPointer<SCDFilterBatch> batch = QSharedPointer<SCDFilterBatch>::create();
+
+   int count = filters.size();
+
+   batch->filters = filters; // shared: no copy
+   batch->object  = (document != 0);
+
+   if (document)
+   {
+      batch->document = *document;
+   }
+
+   batch->matches.resize(count);
+
+   batch->tasks = qMin(count / qMax(fanOutChunkSize,1), fanOutWorkers);
+
+   if (batch->tasks<=0)
+   {
+      batch->tasks = 0;
+      batch->pending.storeRelease(1);
+
+      SCDFilterTask(batch, 0, count).run();
+
+      return batch;
+   }
+
+   batch->pending.storeRelease(batch->tasks);
+
+   int from = 0;
+
+   for (int n=0; n<batch->tasks; n++)
+   {
+      int to = int(qint64(count) * (n+1) / batch->tasks);
+
+      fanOutPool.start(new SCDFilterTask(batch, from, to - from)); // deleted by the pool
+
+      from = to;
+   }
+
+   filterBatches.append(batch);
+
+   return batch;
+}
+
+/**
+ * @brief SCDTopicServer::releaseFilterBatches forget the filter evaluations complete: when none is in progress the
+ *                                             filters deleted meanwhile are freed
+ * @return true if evaluations are still in progress
+ */
+bool SCDTopicServer::releaseFilterBatches()
+{
+   for (int n=0; n<filterBatches.size(); )
+   {
+      if (filterBatches.at(n)->pending.loadAcquire() == 0)
+      {
+         filterBatches.removeAt(n);
+         continue;
+      }
+
+      n++;
+   }
+
+   if (filterBatches.isEmpty() && !retiredFilters.isEmpty())
+   {
+      qDeleteAll(retiredFilters);
+
+      retiredFilters.clear();
+   }
+
+   return !filterBatches.isEmpty();
+}
+
+/**
+ * @brief SCDTopicServer::deleteFilter delete the filter of a subscription: if the workers are evaluating filters it is
+ *                                     freed once they are complete
+ * @param filter
+ */
+void SCDTopicServer::deleteFilter(SCDFilter *filter)
+{
+   if (filter && !filterBatches.isEmpty())
+   {
+      retiredFilters.append(filter);
+      return;
+   }
+
+   delete filter;
+}
+
+/**
+ * @brief SCDTopicServer::cancelFanOuts drop the fan-outs in progress of a topic being deleted (its filters deleted by
+ *                                      deleteFilter). All topics are deleted with their filters: the workers
+ *                                      evaluating them are waited for.
+ * @param entry 0 for all topics
+ */
+void SCDTopicServer::cancelFanOuts(SCDTopic *entry)
+{
+   if (!entry)
+   {
+      fanOutPool.waitForDone();
+
+      releaseFilterBatches();
+   }
+
+   for (int n=0; n<fanOutJobs.size(); )
+   {
+      if (!entry || fanOutJobs.at(n).topic == entry)
+      {
+         fanOutJobs.at(n).topic->fanOuts--;
+
+         fanOutJobs.removeAt(n);
+         continue;
+      }
+
+      n++;
+   }
+
+   if (fanOutJobs.isEmpty())
+   {
+      fanOutClosed.clear();
+
+      if (filterBatches.isEmpty())
+      {
+         fanOutTimer.stop();
+      }
+   }
+}
+
+/**
+ * @brief SCDTopicServer::deleteSubscriber delete a subscriber record owned by the server (parked or offline subscriber):
+ *                                         the fan-out snapshots holding it skip it, as a closed connection
+ * @param record
+ */
+void SCDTopicServer::deleteSubscriber(SCDConnection *record)
+{
+   if (!fanOutJobs.isEmpty()) // the address may be reused by a new record
+   {
+      fanOutClosed.insert(record, fanOutSerial);
+   }
+
+   delete record;
+}
+
+/**
+ * @brief SCDTopicServer::isValidTopicName remove trailng space from topic name and check if empty
+ * @param topic
+ * @return true if is an not empty topic name.
+ */
+bool SCDTopicServer::isValidTopicName(QString &topic)
+{
+   topic = topic.trimmed();
+
+   if (topic.isEmpty())
+   {
+       lastErrorMsg = "Undefined topic name";
+       return false;
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDTopicServer::addressToString
+ * @param address
+ * @param peer
+ * @return
+ */
+QString SCDTopicServer::addressToString(QHostAddress address, int port)
+{
+   return address.toString().toUpper() + ":" + QString::number(port).toUpper();
+}
+
+/**
+ * @brief SCDTopicServer::addressToHex
+ * @param address IPv4 address is formatted as 8 hex digits, IPv6 address as 32 hex digits
+ * @param peer
+ * @return
+ */
+QString SCDTopicServer::addressToHex(QHostAddress address, int port)
+{
+   bool isIPv4 = false;
+
+   quint32 ipv4 = address.toIPv4Address(&isIPv4);
+
+   if (isIPv4)
+   {
+      return QString::number(ipv4,16).toUpper() + ":" + QString::number(port,16).toUpper();
+   }
+
+   Q_IPV6ADDR ipv6 = address.toIPv6Address();
+
+   QByteArray bytes(reinterpret_cast<const char *>(ipv6.c), 16);
+
+   return QString(bytes.toHex()).toUpper() + ":" + QString::number(port,16).toUpper();
+}
+
+/**
+ * @brief SCDTopicServer::lastError
+ * @return
+ */
+QString SCDTopicServer::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDTopicServer::getTopics
+ * @return topic list, sorted by name, each item in format <topic name>:<static|dynamic>
+ */
+QStringList SCDTopicServer::getTopics()
+{
+   QStringList list;
+
+   list.reserve(topics.size());
+
+   for (QMap<QString, SCDTopic *>::const_iterator it = topics.constBegin(); it != topics.constEnd(); ++it)
+   {
+      list.append(it.key() + ":" + it.value()->typeName());
+   }
+
+   return list;
+}
+
+/**
+ * @brief SCDTopicServer::sendMessageToTopic send message to all topic subscribers except to sender.
+ *                                           the client can send a message to the topics to which he is not subscribed
+ *
+ *                                           A message is sent as: [<sender>@<topic>]:<message>
+ *                                           A chunk of message as: [<sender>#<stream id>:<M|F|A>@<topic>]:<chunk>
+ *                                           where M: more chunks follow, F: final chunk, A: message aborted
+ *
+ *                                           A traced message (TRA header field) ends the sender field with its
+ *                                           timestamps, in epoch usec: ~<publisher send>,<server receive>,<server dispatch>
+ *                                           e.g. [<sender>~1571234567000000,1571234567000150,1571234567000180@<topic>]
+ *                                           Receive and dispatch are taken from the monotonic clock: their difference
+ *                                           is the exact server time. The topic counts the queue-to-write time of the
+ *                                           message to each subscriber (see topicStats).
+ *
+ *                                           When some subscribers have a content filter the message is parsed once,
+ *                                           then each filter is evaluated on the parsed message. Filters don't apply
+ *                                           to chunks of message: they are sent to all subscribers.
+ *
+ *                                           A message to a delta encoded topic is sent as a delta (see encodeDelta),
+ *                                           except to filtered subscribers: they could miss the previous document,
+ *                                           so they always receive the full document.
+ *
+ *                                           A message to a multicast topic is sent once to the multicast group, for
+ *                                           the subscribers receiving from there (see joinMulticast), as the full
+ *                                           document if delta encoded.
+ *
+ *                                           A message having a TTL (TTL header field) carries its expiry time to each
+ *                                           frame kept by the server: priority lanes, QoS 1 queues and spools, the
+ *                                           topic last document and the multicast history. An expired frame is dropped
+ *                                           when dequeued (an expired QoS 1 message is sent as [server@expired]:, so
+ *                                           that the sequence numbers stay contiguous), and the holders are swept in
+ *                                           bulk by the expiry wheel (see onExpiryTimeout). The expired messages are
+ *                                           counted by the topic (see topicStats). The TTL is not forwarded thru bus.
+ *
+ *                                           A message to a topic having fanOutThreshold subscribers or more is
+ *                                           delivered in chunks from the event loop (see startFanOut), so that the
+ *                                           other clients are served meanwhile.
+ * @param topic
+ * @param message
+ * @param sender
+ * @param tag chunk tag (#<stream id>:<M|F|A>), empty for a whole message
+ * @param priority outbound priority class, -1 for the topic priority
+ * @param trace traced message timestamps, 0: not traced
+ * @param expires expiry time of a message having a TTL (monotonic msec, SCDExpiry::now), 0: never expires
+ * @return o if topic not exists, 1 otherwise
+ */
+int SCDTopicServer::sendMessageToTopic(const QString &topic, const QStringRef &message, SCDConnection *sender, const QString &tag, int priority, const SCDTrace *trace, qint64 expires)
+{
+   lastErrorMsg = QStringLiteral("no error"); // static data: no allocation
+
+   SCDTopic *entry = topics.value(topic);
+
+   bool forwarded = bus && sender != &remoteSender && bus->publish(topic, sender->name, tag, priority, message); // to the interested processes
+
+   if (!entry)
+   {
+      if (forwarded) // dynamic topic of another process
+      {
+         return 1;
+      }
+
+      lastErrorMsg = "topic '" + topic + "' not found";
+
+      return 0;
+   }
+
+   entry->published(message.size(), clock.elapsed(), QDateTime::currentMSecsSinceEpoch(), tag.isEmpty() || tag.endsWith(":F"));
+
+   if (bus && entry->subscribers.isEmpty()) // the other processes messages are not received: keep no delta state
+   {
+      return 1;
+   }
+
+   QString traced; // trace suffix of sender field
+
+   SCDTraceStamp stamp;
+
+   if (trace)
+   {
+      traced = "~" + QString::number(trace->published) + "," + QString::number(epochOffset + trace->received)
+             + "," + QString::number(epochOffset + SCDLatencyHistogram::now());
+
+      if (!entry->latency)
+      {
+         entry->latency = QSharedPointer<SCDLatencyHistogram>::create();
+      }
+
+      stamp.received = trace->received;
+      stamp.latency  = entry->latency;
+   }
+
+   const SCDTraceStamp *traceStamp = trace ? &stamp : 0;
+
+   SCDExpiry expiry;
+
+   if (expires>0)
+   {
+      expiry.expires = expires;
+      expiry.count   = entry->expiredCounter();
+   }
+
+   const SCDExpiry *messageExpiry = (expires>0) ? &expiry : 0;
+
+   const QString &frame = formatFrame(frameBuffer, sender->name, tag, traced, topic, message); // formatted once for all subscribers
+
+   if (priority<0)
+   {
+      priority = entry->priority;
+   }
+
+   bool parse = (entry->filtered || entry->delta) && tag.isEmpty();
+
+   QJsonDocument document;
+   QJsonObject   object;
+
+   const QJsonObject *parsed = 0;
+
+   QString deltaFrame;
+
+   if (parse)
+   {
+      document = QJsonDocument::fromJson(message.toUtf8()); // parsed once for all filters and delta
+
+      object = document.object();
+
+      parsed = document.isObject() ? &object : 0;
+
+      if (entry->delta && parsed) // the client keeps the state documents: tag them
+      {
+         formatFrame(frameBuffer, sender->name, QStringLiteral("%S"), traced, topic, message);
+      }
+
+      deltaFrame = entry->delta ? encodeDelta(entry, parsed, message, sender, traced) : QString();
+
+      if (entry->hasState) // the last document expires with the message
+      {
+         entry->stateExpires = expires;
+
+         if (expires>0)
+         {
+            ExpiryItem item;
+
+            item.kind       = EX_STATE;
+            item.connection = 0;
+            item.name       = entry->name;
+
+            scheduleExpiry(item, entry->expiryScheduled, expires);
+         }
+      }
+   }
+   else
+   if (entry->delta) // chunks of a message: the next document will be sent in full
+   {
+      entry->clearState();
+   }
+
+   if (entry->multicastReceivers) // the full frame, once for all receivers
+   {
+      sendMulticast(entry, frame, priority, traceStamp, messageExpiry);
+   }
+
+   const QVector<quint8> *qos = (entry->reliable || entry->multicastReceivers) ? &entry->qos : 0;
+
+   if (entry->fanOuts>0 || (fanOutThreshold>0 && entry->subscribers.size()>=fanOutThreshold)) // after the fan-outs in progress
+   {
+      bool filtered = parse && entry->filtered;
+
+      if (!deltaFrame.isEmpty())
+      {
+         entry->drops += startFanOut(entry, deltaFrame, sender, priority, filtered, parsed, &frame, qos, traceStamp, messageExpiry);
+      }
+      else
+      {
+         entry->drops += startFanOut(entry, frame, sender, priority, filtered, parsed, 0, qos, traceStamp, messageExpiry);
+      }
+
+      return 1;
+   }
+
+   if (!deltaFrame.isEmpty())
+   {
+      entry->drops += fanOut(entry->subscribers, deltaFrame, sender, priority, entry->filtered ? &entry->filters : 0, parsed, &frame, qos, traceStamp, messageExpiry);
+
+      return 1;
+   }
+
+   if (parse && entry->filtered)
+   {
+      entry->drops += fanOut(entry->subscribers, frame, sender, priority, &entry->filters, parsed, 0, qos, traceStamp, messageExpiry);
+
+      return 1;
+   }
+
+   entry->drops += fanOut(entry->subscribers, frame, sender, priority, 0, 0, 0, qos, traceStamp, messageExpiry); // subscribers not writable
+
+   return 1;
+}
+
+/**
+ * @brief SCDTopicServer::openSession open the at-least-once delivery session of a client (QOS:1 subscription).
+ *                                    A client reconnecting with the same client id resumes its session: the messages
+ *                                    not acknowledged on the previous connection are sent again at once. A client
+ *                                    reconnecting with the name of a durable session gets back its subscriptions too,
+ *                                    with the messages queued while it was offline.
+ * @param client
+ * @param id client id (CID header field) or durable subscription name (DUR header field), empty for an anonymous
+ *           session, deleted with the connection
+ * @param durable the session keeps its QoS 1 subscriptions while the client is offline
+ * @return
+ */
+SCDSession *SCDTopicServer::openSession(SCDConnection *client, const QString &id, bool durable)
+{
+   SCDSession *session = client->session;
+
+   if (session)
+   {
+      if (durable && !session->durable && (session->id==id || (session->id.isEmpty() && !sessions.contains(id))))
+      {
+         if (session->id.isEmpty()) // the anonymous session of this connection gets the durable name
+         {
+            session->id = id;
+
+            sessions.insert(id, session);
+         }
+
+         makeDurable(session);
+      }
+
+      return session;
+   }
+
+   session = id.isEmpty() ? 0 : sessions.value(id);
+
+   if (!session)
+   {
+      session = new SCDSession(id);
+
+      if (!id.isEmpty())
+      {
+         sessions.insert(id, session);
+      }
+   }
+   else
+   if (session->client) // the same client connected again before its previous connection was reaped: it moves here
+   {
+      session->client->session = 0;
+
+      if (session->durable)
+      {
+         moveSubscriptions(session->client, client);
+      }
+   }
+   else
+   if (session->durable) // back online
+   {
+      moveSubscriptions(session->offline, client);
+   }
+
+   if (durable && !session->durable)
+   {
+      makeDurable(session);
+   }
+
+   session->client    = client;
+   session->sentCount = 0; // messages in flight on the previous connection are sent again
+   session->scheduled = false;
+
+   client->session = session;
+
+   sendReliable(session);
+
+   return session;
+}
+
+/**
+ * @brief SCDTopicServer::closeSession the client disconnected: an anonymous session is deleted, a session having
+ *                                     a client id keeps its messages for sessionExpiry msec, a durable session keeps
+ *                                     them (and its subscriptions) until the client reconnects
+ * @param client
+ */
+void SCDTopicServer::closeSession(SCDConnection *client)
+{
+   SCDSession *session = client->session;
+
+   client->session = 0;
+
+   if (session->id.isEmpty())
+   {
+      delete session;
+      return;
+   }
+
+   if (session->durable && session->offline->topics.isEmpty()) // no subscription left to keep
+   {
+      deleteSession(session);
+      return;
+   }
+
+   session->client    = 0;
+   session->sentCount = 0;
+   session->scheduled = false;
+   session->detached  = clock.elapsed();
+
+   if (!session->durable && !redeliveryTimer.isActive()) // expiry check
+   {
+      redeliveryTimer.start();
+   }
+}
+
+/**
+ * @brief SCDTopicServer::deleteSession delete the session of a disconnected client: a durable session loses its
+ *                                      subscriptions and its spilled messages
+ * @param session
+ */
+void SCDTopicServer::deleteSession(SCDSession *session)
+{
+   if (session->offline)
+   {
+      unscribeFromTopics(session->offline); // the dynamic topics left without subscribers are removed
+
+      deleteSubscriber(session->offline);
+   }
+
+   delete session->spool;
+
+   sessions.remove(session->id);
+
+   delete session;
+}
+
+/**
+ * @brief SCDTopicServer::makeDurable make a session durable: it gets the offline subscriber record and the spool of
+ *                                    the messages over the memory queue. If the spool directory cannot be made
+ *                                    the session keeps at most reliableQueue messages in memory.
+ * @param session
+ */
+void SCDTopicServer::makeDurable(SCDSession *session)
+{
+   session->durable = true;
+   session->offline = new SCDOfflineSubscriber(session);
+
+   QString directory = QCryptographicHash::hash(session->id.toUtf8(), QCryptographicHash::Sha1).toHex(); // any name is a valid file name
+
+   session->spool = new SCDSpool(durablePath + "/" + directory, durableSegmentSize, durableDiskLimit);
+
+   if (!session->spool->open())
+   {
+      qDebug() << session->spool->lastError() << "- durable subscription" << session->id << "kept in memory only";
+
+      delete session->spool;
+
+      session->spool = 0;
+   }
+}
+
+/**
+ * @brief SCDTopicServer::moveSubscriptions move the QoS 1 subscriptions of a durable session, with their filters,
+ *                                          between a client connection and the offline subscriber record: the topics
+ *                                          never lose the subscriber meanwhile (nor the dynamic topics are removed)
+ * @param from
+ * @param to
+ * @param all move all subscriptions, with their delivery mode (session resume)
+ * @return topics moved
+ */
+QList<SCDTopic *> SCDTopicServer::moveSubscriptions(SCDConnection *from, SCDConnection *to, bool all)
+{
+   QList<SCDTopic *> moved;
+
+   for (QHash<SCDTopic *, int>::const_iterator it = from->topics.constBegin(); it != from->topics.constEnd(); ++it)
+   {
+      if (all || it.key()->qos.at(it.value()) == SCDTopic::QOS_AT_LEAST_ONCE)
+      {
+         moved.append(it.key());
+      }
+   }
+
+   for (int n=0; n<moved.size(); n++)
+   {
+      SCDTopic *entry = moved.at(n);
+
+      int index = from->topics.value(entry);
+      int qos   = entry->qos.at(index);
+
+      SCDFilter *filter = entry->filters.at(index);
+
+      entry->filters[index] = 0; // moved: not deleted by detach
+      entry->filtered -= (filter != 0);
+
+      attachSubscriber(entry, to, filter, qos);
+      detachSubscriber(entry, from);
+   }
+
+   return moved;
+}
+
+/**
+ * @brief SCDTopicServer::resumeSession session resume (TSR command). A client asking a token with an empty token
+ *                                      gets a new one: when it disconnects, its subscriptions are parked for
+ *                                      resumeGrace msec (see parkSubscriptions). A client reconnecting with the token
+ *                                      meanwhile gets its whole subscription set back in one step, with filters and
+ *                                      delivery modes: the subscriptions are moved, O(subscriptions), no topic is
+ *                                      removed or made again, and no topics file is saved. A token whose connection
+ *                                      is still open (a dead connection not yet reaped) moves its subscriptions here.
+ *
+ *                                      Resumed QoS 1 subscriptions reopen the client session (the messages not
+ *                                      acknowledged are sent again), delta encoded topics send their last document and
+ *                                      multicast receivers get the announce again. The messages published while the
+ *                                      client was disconnected are lost, except for durable subscriptions.
+ * @param client
+ * @param token token to resume, empty for a new token: set to the token of the client
+ * @return 0: failure (session resume disabled),
+ *         1: success, new token,
+ *         2: success, but warning: token expired or unknown, new token (the client must subscribe again),
+ *         3: success, subscriptions resumed
+ */
+int SCDTopicServer::resumeSession(SCDConnection *client, QString &token)
+{
+   if (resumeGrace<=0)
+   {
+      lastErrorMsg = "session resume disabled";
+      return 0;
+   }
+
+   if (!token.isEmpty() && token==client->resumeToken)
+   {
+      lastErrorMsg = "0 subscriptions resumed";
+      return 3;
+   }
+
+   SCDConnection       *previous = token.isEmpty() ? 0 : resumeTokens.value(token);
+   SCDParkedSubscriber *parked   = (token.isEmpty() || previous) ? 0 : parkedSessions.take(token);
+
+   resumeTokens.remove(client->resumeToken); // a connection has one token
+
+   if (!previous && !parked)
+   {
+      int ret = token.isEmpty() ? 1 : 2;
+
+      token = QUuid::createUuid().toRfc4122().toHex();
+
+      client->resumeToken = token;
+
+      resumeTokens.insert(token, client);
+
+      lastErrorMsg = (ret==1) ? "no error" : "session expired";
+
+      return ret;
+   }
+
+   SCDConnection *from = previous ? previous : parked;
+
+   QString sessionId = previous ? (previous->session ? previous->session->id : QString()) : parked->sessionId;
+
+   bool durable  = previous ? (previous->session && previous->session->durable) : parked->durable;
+   bool reliable = previous ? bool(previous->session) : parked->reliable;
+
+   if (reliable && (!durable || sessions.contains(sessionId))) // before the subscriptions: QoS 1 subscriptions need the session
+   {
+      openSession(client, sessionId, durable);
+   }
+
+   QList<SCDTopic *> moved = moveSubscriptions(from, client, true);
+
+   for (int n=0; n<moved.size(); n++)
+   {
+      SCDTopic *entry = moved.at(n);
+
+      if (entry->qos.at(client->topics.value(entry)) == SCDTopic::QOS_MULTICAST && !joinMulticast(entry->name, client))
+      {
+         attachSubscriber(entry, client, 0, SCDTopic::QOS_AT_MOST_ONCE); // no more a multicast topic
+      }
+
+      sendTopicState(entry->name, client);
+   }
+
+   if (previous)
+   {
+      previous->resumeToken.clear(); // not parked when reaped
+   }
+   else
+   {
+      deleteSubscriber(parked);
+   }
+
+   client->resumeToken = token;
+
+   resumeTokens.insert(token, client);
+
+   lastErrorMsg = QString::number(moved.size()) + " subscriptions resumed";
+
+   return 3;
+}
+
+/**
+ * @brief SCDTopicServer::parkSubscriptions the client having a resume token disconnected: its subscriptions are moved
+ *                                          to a parked subscriber record, kept for resumeGrace msec (the QoS 1
+ *                                          subscriptions of a durable session are kept by the session)
+ * @param client
+ */
+void SCDTopicServer::parkSubscriptions(SCDConnection *client)
+{
+   SCDParkedSubscriber *parked = new SCDParkedSubscriber(client->resumeToken);
+
+   parked->peer     = "parked:" + client->peer;
+   parked->detached = clock.elapsed();
+
+   if (client->session)
+   {
+      parked->sessionId = client->session->id;
+      parked->durable   = client->session->durable;
+      parked->reliable  = true;
+   }
+
+   moveSubscriptions(client, parked, true);
+
+   parkedSessions.insert(parked->token, parked);
+
+   if (!redeliveryTimer.isActive()) // expiry check
+   {
+      redeliveryTimer.start();
+   }
+}
+
+/**
+ * @brief SCDTopicServer::deleteParked the resume grace period of parked subscriptions expired
+ * @param parked
+ */
+void SCDTopicServer::deleteParked(SCDParkedSubscriber *parked)
+{
+   unscribeFromTopics(parked); // the dynamic topics left without subscribers are removed
+
+   deleteSubscriber(parked);
+}
+
+/**
+ * @brief SCDTopicServer::deliverReliable deliver a message to a QoS 1 subscriber. The message gets the next sequence
+ *                                        number of the client session and is sent as: <sequence><frame>
+ *                                        e.g. 42[<sender>@<topic>]:<message>
+ *                                        The client acknowledges the messages received in order, cumulatively (TAK
+ *                                        command): messages not acknowledged within redeliveryTimeout are sent again,
+ *                                        from the first one not acknowledged. At most reliableWindow messages are in
+ *                                        flight, the others wait into the session queue. The messages of a durable
+ *                                        session over reliableQueue are spilled to disk, up to the spool disk limit.
+ *                                        A message having a TTL which expires before it is acknowledged is sent (or
+ *                                        sent again) as an expired marker: <sequence>[server@expired]:
+ * @param client connection or offline subscriber record
+ * @param frame
+ * @param priority
+ * @param trace traced message: queue-to-write time counted at first send, 0: not traced
+ * @param expiry message having a TTL, 0: never expires
+ * @return false if the message is dropped: the session queue (or its spool) is full
+ */
+bool SCDTopicServer::deliverReliable(SCDConnection *client, const QString &frame, int priority, const SCDTraceStamp *trace, const SCDExpiry *expiry)
+{
+   SCDSession *session = client->session;
+
+   bool spill = session->spool && (!session->spool->isEmpty() || session->messages.size() >= reliableQueue); // in order after those on disk
+
+   if (!spill && session->messages.size() >= reliableQueue)
+   {
+      session->drops++;
+      return false;
+   }
+
+   SCDReliableMessage message;
+
+   message.sequence = session->sequence + 1;
+   message.frame    = frame;
+   message.priority = priority;
+   message.sent     = 0;
+   message.dropped  = false;
+
+   if (expiry)
+   {
+      message.expiry = *expiry;
+   }
+
+   if (trace && !spill) // spilled messages are not traced
+   {
+      message.trace = *trace;
+   }
+
+   if (spill)
+   {
+      int ret = session->spool->append(message);
+
+      if (ret<=0)
+      {
+         if (ret<0)
+         {
+            qDebug() << session->spool->lastError();
+         }
+
+         session->drops++;
+         return false;
+      }
+
+      session->sequence++;
+      return true;
+   }
+
+   session->sequence++;
+
+   session->messages.enqueue(message);
+
+   if (expiry)
+   {
+      scheduleExpiry(session, expiry->expires);
+   }
+
+   sendReliable(session);
+
+   return true;
+}
+
+/**
+ * @brief SCDTopicServer::refillSession read back the spilled messages of a durable session as its memory queue
+ *                                      drains, half a queue at a time: the disk is read in large sequential batches
+ *                                      and a reconnected client drains the spool at full window speed
+ * @param session
+ */
+void SCDTopicServer::refillSession(SCDSession *session)
+{
+   if (!session->spool || session->spool->isEmpty() || session->messages.size() > reliableQueue/2)
+   {
+      return;
+   }
+
+   int from = session->messages.size();
+
+   int count = session->spool->read(session->messages, reliableQueue - session->messages.size());
+
+   if (count>0)
+   {
+      expireSpooled(session, from);
+   }
+
+   if (count<0)
+   {
+      qDebug() << session->spool->lastError();
+
+      session->drops += session->spool->size();
+
+      session->spool->clear(); // the messages left on disk are lost: sequence numbers continue from those in memory
+
+      session->sequence = session->messages.isEmpty() ? session->acked : session->messages.last().sequence;
+   }
+}
+
+/**
+ * @brief SCDTopicServer::sendReliable send the queued messages of a session allowed by window
+ * @param session
+ */
+void SCDTopicServer::sendReliable(SCDSession *session)
+{
+   SCDConnection *client = session->client;
+
+   if (!client || !client->isValid())
+   {
+      return;
+   }
+
+   qint64 now = clock.elapsed();
+
+   qint64 expiryNow = 0; // read once, for the first message having a TTL
+
+   int count = qMin(session->messages.size(), reliableWindow);
+
+   while (session->sentCount < count)
+   {
+      SCDReliableMessage &message = session->messages[session->sentCount++];
+
+      message.sent = now;
+
+      if (message.expiry.expires>0 && !message.dropped)
+      {
+         if (expiryNow==0)
+         {
+            expiryNow = SCDExpiry::now();
+         }
+
+         if (message.expiry.isExpired(expiryNow))
+         {
+            session->expire(message);
+         }
+      }
+
+      if (message.dropped) // the client acknowledges it as any message
+      {
+         client->post(QString::number(message.sequence) + QStringLiteral("[server@expired]:"), message.priority);
+         continue;
+      }
+
+      SCDExpiry laneExpiry; // dropped by lanes when expired, counted by the session when sent again
+
+      laneExpiry.expires = message.expiry.expires;
+
+      client->post(QString::number(message.sequence) + message.frame, message.priority, message.trace.latency ? &message.trace : 0,
+                   laneExpiry.expires>0 ? &laneExpiry : 0); // dropped by lanes: sent again on timeout
+
+      if (laneExpiry.expires>0 && client->queued>0)
+      {
+         scheduleExpiry(client, laneExpiry.expires);
+      }
+
+      message.trace.latency.clear(); // redeliveries are not counted
+   }
+
+   if (session->sentCount>0 && !session->scheduled)
+   {
+      session->scheduled = true;
+
+      redeliveryWheel.schedule(client->id, session->messages.head().sent + redeliveryTimeout);
+
+      if (!redeliveryTimer.isActive())
+      {
+         redeliveryTimer.start();
+      }
+   }
+}
+
+/**
+ * @brief SCDTopicServer::acknowledge the client received the messages up to sequence: they are released and
+ *                                    the messages waiting for window are sent
+ * @param client
+ * @param sequence
+ */
+void SCDTopicServer::acknowledge(SCDConnection *client, quint64 sequence)
+{
+   SCDSession *session = client->session;
+
+   if (!session || sequence <= session->acked || sequence > session->sequence)
+   {
+      return;
+   }
+
+   session->acked = sequence;
+
+   while (!session->messages.isEmpty() && session->messages.head().sequence <= sequence)
+   {
+      session->messages.dequeue();
+
+      if (session->sentCount>0)
+      {
+         session->sentCount--;
+      }
+   }
+
+   refillSession(session);
+
+   sendReliable(session);
+}
+
+/**
+ * @brief SCDTopicServer::scheduleExpiry schedule the sweep of the priority lanes (and of the anonymous session) of a
+ *                                      connection holding a frame having a TTL
+ * @param client
+ * @param expires frame expiry time (monotonic msec, SCDExpiry::now)
+ */
+void SCDTopicServer::scheduleExpiry(SCDConnection *client, qint64 expires)
+{
+   ExpiryItem item;
+
+   item.kind       = EX_CONNECTION;
+   item.connection = client->id;
+
+   scheduleExpiry(item, client->expiryScheduled, expires);
+}
+
+/**
+ * @brief SCDTopicServer::scheduleExpiry schedule the sweep of a session holding a message having a TTL: an anonymous
+ *                                      session is swept with its connection
+ * @param session
+ * @param expires message expiry time (monotonic msec, SCDExpiry::now)
+ */
+void SCDTopicServer::scheduleExpiry(SCDSession *session, qint64 expires)
+{
+   if (session->id.isEmpty())
+   {
+      scheduleExpiry(session->client, expires);
+      return;
+   }
+
+   ExpiryItem item;
+
+   item.kind       = EX_SESSION;
+   item.connection = 0;
+   item.name       = session->id;
+
+   scheduleExpiry(item, session->expiryScheduled, expires);
+}
+
+/**
+ * @brief SCDTopicServer::scheduleExpiry schedule a sweep of a holder of messages having a TTL: a holder has one sweep
+ *                                      scheduled at a time, at the earliest expiry time of its messages, and the sweep
+ *                                      schedules the next one
+ * @param item holder
+ * @param scheduled holder sweep time already scheduled (0: none), updated
+ * @param expires expiry time (monotonic msec, SCDExpiry::now), 0: nothing to schedule
+ */
+void SCDTopicServer::scheduleExpiry(const ExpiryItem &item, qint64 &scheduled, qint64 expires)
+{
+   if (expires<=0 || (scheduled>0 && scheduled<=expires)) // an earlier sweep comes first
+   {
+      return;
+   }
+
+   scheduled = expires;
+
+   if (!expiryTimer.isActive()) // wheel is empty: move it to current time
+   {
+      expiryWheel.start(SCDExpiry::now());
+      expiryTimer.start();
+   }
+
+   expiryWheel.schedule(item, expires + expiryWheel.tickInterval() - 1); // the tick following the expiry
+}
+
+/**
+ * @brief SCDTopicServer::purgeSession drop the expired messages of a session memory queue: their frames are released,
+ *                                    they are sent as expired markers
+ * @param session
+ * @param now SCDExpiry::now()
+ * @return earliest expiry time of the messages left, 0: none
+ */
+qint64 SCDTopicServer::purgeSession(SCDSession *session, qint64 now)
+{
+   qint64 next = 0;
+
+   for (int n=0; n<session->messages.size(); n++)
+   {
+      SCDReliableMessage &message = session->messages[n];
+
+      if (message.dropped || message.expiry.expires==0)
+      {
+         continue;
+      }
+
+      if (message.expiry.isExpired(now))
+      {
+         session->expire(message);
+         continue;
+      }
+
+      if (next==0 || message.expiry.expires<next)
+      {
+         next = message.expiry.expires;
+      }
+   }
+
+   return next;
+}
+
+/**
+ * @brief SCDTopicServer::expireSpooled check the expiry of the messages read back from the spool: the expired ones
+ *                                     are dropped, the others are scheduled for the session sweep
+ * @param session
+ * @param from position of the first message read back into the session queue
+ */
+void SCDTopicServer::expireSpooled(SCDSession *session, int from)
+{
+   qint64 now = 0;
+
+   for (int n=from; n<session->messages.size(); n++)
+   {
+      SCDReliableMessage &message = session->messages[n];
+
+      if (message.expiry.expires==0)
+      {
+         continue;
+      }
+
+      const QString &frame = message.frame; // [<sender>@<topic>]:<message>
+
+      int at  = frame.indexOf(QLatin1Char('@'));
+      int end = (at>0) ? frame.indexOf(QLatin1String("]:"), at) : -1;
+
+      SCDTopic *entry = (end>at) ? topics.value(frame.mid(at+1, end-at-1)) : 0;
+
+      if (entry) // the counter of its topic, not kept on disk
+      {
+         message.expiry.count = entry->expiredCounter();
+      }
+
+      if (now==0)
+      {
+         now = SCDExpiry::now();
+      }
+
+      if (message.expiry.isExpired(now))
+      {
+         session->expire(message);
+         continue;
+      }
+
+      scheduleExpiry(session, message.expiry.expires);
+   }
+}
+
+/**
+ * @brief SCDTopicServer::onExpiryTimeout sweep the holders of messages having a TTL whose earliest expiry time has
+ *                                        come: the expired frames of priority lanes and QoS 1 queues are dropped in
+ *                                        one pass, the expired last documents of delta encoded topics are cleared
+ */
+void SCDTopicServer::onExpiryTimeout()
+{
+   QList<ExpiryItem> due;
+
+   qint64 now = SCDExpiry::now();
+
+   expiryWheel.advance(now, due);
+
+   for (int n=0; n<due.size(); n++)
+   {
+      const ExpiryItem &item = due.at(n);
+
+      if (item.kind==EX_CONNECTION)
+      {
+         SCDConnection *client = connections.value(item.connection);
+
+         if (!client || client->expiryScheduled==0 || client->expiryScheduled>now) // closed, or a later sweep of a rescheduled one
+         {
+            continue;
+         }
+
+         client->expiryScheduled = 0;
+
+         qint64 next = client->purgeExpired(now);
+
+         if (client->session && client->session->id.isEmpty())
+         {
+            qint64 pending = purgeSession(client->session, now);
+
+            next = (next==0 || (pending>0 && pending<next)) ? pending : next;
+         }
+
+         scheduleExpiry(item, client->expiryScheduled, next);
+      }
+      else
+      if (item.kind==EX_SESSION)
+      {
+         SCDSession *session = sessions.value(item.name);
+
+         if (!session || session->expiryScheduled==0 || session->expiryScheduled>now)
+         {
+            continue;
+         }
+
+         session->expiryScheduled = 0;
+
+         scheduleExpiry(item, session->expiryScheduled, purgeSession(session, now));
+      }
+      else
+      {
+         SCDTopic *entry = topics.value(item.name);
+
+         if (!entry || entry->expiryScheduled==0 || entry->expiryScheduled>now)
+         {
+            continue;
+         }
+
+         entry->expiryScheduled = 0;
+
+         if (entry->stateExpired(now))
+         {
+            entry->expireState();
+         }
+
+         scheduleExpiry(item, entry->expiryScheduled, entry->hasState ? entry->stateExpires : 0);
+      }
+   }
+
+   if (expiryWheel.size()==0)
+   {
+      expiryTimer.stop();
+   }
+}
+
+/**
+ * @brief SCDTopicServer::onRedeliveryTimeout send again the messages in flight of the sessions whose oldest message
+ *                                            has not been acknowledged within redeliveryTimeout, and delete the
+ *                                            sessions of the clients disconnected since more than sessionExpiry
+ *                                            (except durable sessions), and the subscriptions parked since more than
+ *                                            resumeGrace
+ */
+void SCDTopicServer::onRedeliveryTimeout()
+{
+   QList<quint32> expired;
+
+   qint64 now = clock.elapsed();
+
+   redeliveryWheel.advance(now, expired);
+
+   for (int n=0; n<expired.size(); n++)
+   {
+      SCDConnection *client = connections.value(expired.at(n));
+
+      if (!client || !client->session || !client->session->scheduled) // connection closed or session moved meanwhile
+      {
+         continue;
+      }
+
+      SCDSession *session = client->session;
+
+      session->scheduled = false;
+
+      if (session->sentCount>0 && now - session->messages.head().sent >= redeliveryTimeout)
+      {
+         qDebug() << "Redelivery to" << client->peer << "from sequence" << session->messages.head().sequence;
+
+         session->sentCount = 0; // go back to the first message not acknowledged
+      }
+
+      sendReliable(session); // schedules the next check while messages are in flight
+   }
+
+   if (now - lastExpiryCheck < 1000)
+   {
+      return;
+   }
+
+   lastExpiryCheck = now;
+
+   int expiring = 0; // sessions and parked subscriptions of disconnected clients still kept
+
+   for (QHash<QString, SCDSession *>::iterator it = sessions.begin(); it != sessions.end(); )
+   {
+      if (it.value()->client || it.value()->durable) // durable sessions never expire
+      {
+         ++it;
+      }
+      else
+      if (now - it.value()->detached >= sessionExpiry)
+      {
+         delete it.value();
+
+         it = sessions.erase(it);
+      }
+      else
+      {
+         expiring++;
+         ++it;
+      }
+   }
+
+   for (QHash<QString, SCDParkedSubscriber *>::iterator it = parkedSessions.begin(); it != parkedSessions.end(); )
+   {
+      if (now - it.value()->detached >= resumeGrace)
+      {
+         deleteParked(it.value());
+
+         it = parkedSessions.erase(it);
+      }
+      else
+      {
+         expiring++;
+         ++it;
+      }
+   }
+
+   if (expiring==0 && redeliveryWheel.size()==0)
+   {
+      redeliveryTimer.stop();
+   }
+}
+
+/**
+ * @brief SCDTopicServer::encodeDelta compute the delta of a message to a delta encoded topic, once for all subscribers,
+ *                                    and keep the message as the topic last document.
+ *
+ *                                    The full document is sent as: [<sender>%S@<topic>]:<document>
+ *                                    The delta is the JSON merge patch (RFC 7386) of the last document, sent as:
+ *                                    [<sender>%D@<topic>]:<merge patch>
+ *                                    the client applies it to the last document received. The full document is sent
+ *                                    when it is not a JSON object, when the patch is not smaller than the document,
+ *                                    and after deltaKeyframe deltas, so that a subscriber which lost a delta recovers.
+ * @param entry
+ * @param document message parsed as JSON object, 0 if not a JSON object
+ * @param message
+ * @param sender
+ * @param traced trace suffix of sender field, empty if the message is not traced
+ * @return the delta frame, empty to send the full document
+ */
+QString SCDTopicServer::encodeDelta(SCDTopic *entry, const QJsonObject *document, const QStringRef &message, SCDConnection *sender, const QString &traced)
+{
+   if (!document)
+   {
+      entry->clearState();
+
+      return QString();
+   }
+
+   if (entry->stateExpires>0 && entry->stateExpired(SCDExpiry::now())) // the new subscribers did not get it: no delta from it
+   {
+      entry->expireState();
+   }
+
+   QString frame;
+
+   QJsonObject patch;
+
+   if (entry->hasState && entry->sinceKeyframe < deltaKeyframe && SCDMergePatch::diff(entry->state, *document, patch))
+   {
+      QByteArray delta = QJsonDocument(patch).toJson(QJsonDocument::Compact);
+
+      if (delta.size() < message.size())
+      {
+         frame = "[" + sender->name + "%D" + traced + "@" + entry->name + "]:" + QString::fromUtf8(delta);
+      }
+   }
+
+   entry->sinceKeyframe = frame.isEmpty() ? 0 : entry->sinceKeyframe+1;
+
+   entry->hasState     = true;
+   entry->state        = *document;
+   entry->stateMessage = message.toString();
+   entry->stateSender  = sender->name;
+
+   return frame;
+}
+
+/**
+ * @brief SCDTopicServer::listTopics queue a topic listing for the client. The topics are sent in chunks, one chunk for
+ *                                   each event loop iteration, so that a large listing never stalls the messages routing.
+ *
+ *                                   Each chunk is sent as: [server@topics]:<topic name>:<static|dynamic>\n...
+ *                                   When the listing is complete the notify TLT|<prefix>|<status>|<cursor> is sent,
+ *                                   where cursor is the last topic name sent, to be used for requesting the next page.
+ * @param client requester
+ * @param prefix topic name prefix filter, empty for all topics
+ * @param cursor list topics which follow the cursor (the last topic of previous page), empty to start from first topic
+ * @param max page size, 0 for no limit
+ * @param type 'static', 'dynamic' or empty for all topics
+ * @param stats send topics statistics (see topicStats), chunks are sent as: [server@stats]:<statistics line>\n...
+ * @return 0: failure, 1: listing queued
+ */
+int SCDTopicServer::listTopics(SCDConnection *client, QString prefix, QString cursor, int max, QString type, bool stats)
+{
+   lastErrorMsg = "no error";
+
+   ListJob job;
+
+   job.client    = client->id;
+   job.prefix    = prefix.trimmed();
+   job.cursor    = cursor.trimmed();
+   job.remaining = (max>0) ? max : -1;
+   job.stats     = stats;
+
+   if (type.isEmpty())
+   {
+      job.type = TT_ALL;
+   }
+   else
+   if (type=="static")
+   {
+      job.type = TT_STATIC;
+   }
+   else
+   if (type=="dynamic")
+   {
+      job.type = TT_DYNAMIC;
+   }
+   else
+   {
+      lastErrorMsg = "invalid topic type '" + type + "'";
+      return 0;
+   }
+
+   listJobs.append(job);
+
+   if (!listTimer.isActive())
+   {
+      listTimer.start();
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDTopicServer::sendTopicListChunk send the next chunk of topic listing to the client
+ * @param client
+ * @param job
+ * @return 0: more chunks to send, 1: listing complete, 3: page complete but other topics are available
+ */
+int SCDTopicServer::sendTopicListChunk(SCDConnection *client, ListJob &job)
+{
+   const QMap<QString, SCDTopic *> &index = topics;
+
+   QMap<QString, SCDTopic *>::const_iterator it = index.lowerBound(job.prefix);
+
+   if (!job.cursor.isEmpty() && job.cursor >= job.prefix)
+   {
+      it = index.upperBound(job.cursor); // restart after last sent topic: the index may have changed meanwhile
+   }
+
+   QString chunk;
+
+   int count   = 0;
+   int scanned = 0;
+
+   // scanned items are limited too: type filter could skip a lot of topics
+
+   while (it != topics.constEnd() && job.remaining != 0 && count < listChunkSize && scanned < 4*listChunkSize)
+   {
+      if (!it.key().startsWith(job.prefix))
+      {
+         it = topics.constEnd(); // past the last topic matching the prefix
+         break;
+      }
+
+      SCDTopic *entry = it.value();
+
+      if (job.type == TT_ALL || entry->dynamic == (job.type == TT_DYNAMIC))
+      {
+         if (job.stats)
+         {
+            chunk += topicStats(it.key()) + "\n";
+         }
+         else
+         {
+            chunk += it.key() + ":" + entry->typeName() + "\n";
+         }
+
+         count++;
+
+         if (job.remaining>0)
+         {
+            job.remaining--;
+         }
+      }
+
+      job.cursor = it.key();
+
+      scanned++;
+
+      ++it;
+   }
+
+   if (count)
+   {
+      client->post((job.stats ? "[server@stats]:" : "[server@topics]:") + chunk, SCDConnection::PR_NORMAL);
+   }
+
+   if (it == topics.constEnd() || !it.key().startsWith(job.prefix))
+   {
+      return 1; // no more topics
+   }
+
+   if (job.remaining == 0)
+   {
+      return 3; // page complete
+   }
+
+   return 0;
+}
+
+/**
+ * @brief SCDTopicServer::onListTimeout send a chunk for each pending topic listing
+ */
+void SCDTopicServer::onListTimeout()
+{
+   for (int n=0; n<listJobs.size(); )
+   {
+      ListJob &job = listJobs[n];
+
+      SCDConnection *client = connections.value(job.client);
+
+      if (!client || !client->isValid()) // client gone away
+      {
+         listJobs.removeAt(n);
+         continue;
+      }
+
+      int ret = sendTopicListChunk(client, job);
+
+      if (ret)
+      {
+         QString cursor = (ret==3) ? job.cursor : "";
+
+         // same class of chunks: the notify must follow the listing
+
+         client->post("[server@notify]:" + QString(job.stats ? "TST|" : "TLT|") + job.prefix + "|" + QString::number(ret) + "|" + cursor + "\n", SCDConnection::PR_NORMAL);
+
+         listJobs.removeAt(n);
+         continue;
+      }
+
+      n++;
+   }
+
+   if (listJobs.isEmpty())
+   {
+      listTimer.stop();
+   }
+}
+
+/**
+ * @brief SCDTopicServer::onFanOutTimeout deliver a chunk of the oldest fan-out in progress of each topic, once its
+ *                                        filters are evaluated
+ */
+void SCDTopicServer::onFanOutTimeout()
+{
+   bool evaluating = releaseFilterBatches();
+
+   QVector<SCDTopic *> busy; // topics having delivered a chunk not completing their fan-out
+
+   for (int n=0; n<fanOutJobs.size(); )
+   {
+      FanOutJob &job = fanOutJobs[n];
+
+      SCDTopic *entry = job.topic;
+
+      if (busy.contains(entry)) // after the fan-out in progress
+      {
+         n++;
+         continue;
+      }
+
+      if (job.filters && job.filters->pending.loadAcquire() > 0) // the workers are evaluating its filters
+      {
+         busy.append(entry);
+
+         n++;
+         continue;
+      }
+
+      entry->drops += deliverFanOutChunk(job);
+
+      if (job.next < job.subscribers.size())
+      {
+         busy.append(entry);
+
+         n++;
+         continue;
+      }
+
+      entry->fanOuts--;
+
+      fanOutJobs.removeAt(n);
+   }
+
+   if (fanOutJobs.isEmpty())
+   {
+      fanOutClosed.clear();
+
+      if (!evaluating) // the evaluations of the fan-outs cancelled meanwhile: their filters are freed when complete
+      {
+         fanOutTimer.stop();
+      }
+
+      return;
+   }
+
+   quint64 oldest = fanOutJobs.first().serial; // the jobs are kept in start order
+
+   for (QHash<SCDConnection *, quint64>::iterator it = fanOutClosed.begin(); it != fanOutClosed.end(); )
+   {
+      if (it.value() < oldest) // closed before any snapshot in progress was taken
+      {
+         it = fanOutClosed.erase(it);
+         continue;
+      }
+
+      ++it;
+   }
+}
+
+/**
+ * @brief SCDTopicServer::topicStats get topic statistics
+ * @param topic
+ * @return statistics line in format:
+ *         <topic name>|<subscribers>|<messages>|<bytes>|<rate msg/sec>|<last publish msec since epoch>|<drops>|
+ *         <traced writes>|<mean>|<p50>|<p99>|<p99.9>|<max>|<expired>
+ *         where traced writes...max are the queue-to-write times (usec) of traced messages, from receive to the write
+ *         into each subscriber socket (see SCDLatencyHistogram), and expired the messages having a TTL dropped before
+ *         delivery: frames expired into priority lanes, QoS 1 messages, delayed publishes and last documents
+ *         empty string if topic not exists
+ */
+QString SCDTopicServer::topicStats(QString topic)
+{
+   SCDTopic *entry = topics.value(topic);
+
+   if (!entry)
+   {
+      return QString();
+   }
+
+   return topic + "|" + QString::number(entry->subscribers.size())
+                + "|" + QString::number(entry->messages)
+                + "|" + QString::number(entry->bytes)
+                + "|" + QString::number(entry->currentRate(clock.elapsed()),'f',2)
+                + "|" + QString::number(entry->lastPublish)
+                + "|" + QString::number(entry->drops)
+                + "|" + (entry->latency ? entry->latency->toString() : SCDLatencyHistogram().toString())
+                + "|" + QString::number(entry->expired ? *entry->expired : 0);
+}
+
+/**
+ * @brief SCDTopicServer::durableStats get durable subscription statistics
+ * @param name durable subscription name
+ * @return statistics line in format:
+ *         <name>|<online 0|1>|<messages in memory>|<messages on disk>|<disk bytes>|<disk limit bytes>|<drops>|<expired>
+ *         where expired are the messages having a TTL expired before delivery
+ *         empty string if the durable subscription not exists
+ */
+QString SCDTopicServer::durableStats(const QString &name)
+{
+   SCDSession *session = sessions.value(name);
+
+   if (!session || !session->durable)
+   {
+      return QString();
+   }
+
+   return name + "|" + QString::number(session->client ? 1 : 0)
+               + "|" + QString::number(session->messages.size())
+               + "|" + QString::number(session->spool ? session->spool->size() : 0)
+               + "|" + QString::number(session->spool ? session->spool->diskUsage() : 0)
+               + "|" + QString::number(session->spool ? session->spool->diskLimit() : 0)
+               + "|" + QString::number(session->drops)
+               + "|" + QString::number(session->expired);
+}
+
+/**
+ * @brief SCDTopicServer::setRateLimits set the publish rate limits: set before starting server. A publish over limits
+ *                                      is rejected, or delayed until the limits allow it.
+ * @param clientMessageRate messages/sec for each connection, 0 for unlimited
+ * @param clientByteRate bytes/sec for each connection, 0 for unlimited
+ * @param topicMessageRate messages/sec for each topic, 0 for unlimited
+ * @param topicByteRate bytes/sec for each topic, 0 for unlimited
+ * @param delay true: delay over limit publishes, false: reject them
+ */
+void SCDTopicServer::setRateLimits(int clientMessageRate, int clientByteRate, int topicMessageRate, int topicByteRate, bool delay)
+{
+   this->clientMessageRate = qMax(clientMessageRate,0);
+   this->clientByteRate    = qMax(clientByteRate,0);
+   this->topicMessageRate  = qMax(topicMessageRate,0);
+   this->topicByteRate     = qMax(topicByteRate,0);
+
+   rateLimited    = this->clientMessageRate || this->clientByteRate || this->topicMessageRate || this->topicByteRate;
+   delayOverLimit = delay;
+}
+
+/**
+ * @brief SCDTopicServer::publishFrame publish the message of a TSM command, as described by its header fields
+ * @param client
+ * @param topic
+ * @param message payload following the header line
+ * @return TSM notify status (see readHeader)
+ */
+int SCDTopicServer::publishFrame(SCDConnection *client, const QString &topic, const QStringRef &message)
+{
+   int priority = header.contains("PRI") ? SCDConnection::priorityFromName(header.value("PRI")) : -1; // -1: topic priority
+
+   if (priority<0 && header.contains("PRI"))
+   {
+      lastErrorMsg = "invalid priority '" + header.value("PRI").toString() + "'";
+      return 0;
+   }
+
+   if (maxMessageSize>0 && message.size()>maxMessageSize)
+   {
+      lastErrorMsg = "message too large";
+      return -5;
+   }
+
+   if (header.contains("CHK")) // chunk of a large message
+   {
+      return publishChunk(topic,message,client,header.value("CHK").toString(),header.value("FIN").toInt()==1,priority);
+   }
+
+   qint64 expires = 0;
+
+   if (header.contains("TTL")) // message expiry: TTL:<msec>
+   {
+      bool ok = false;
+
+      qint64 ttl = header.value("TTL").toLongLong(&ok);
+
+      if (!ok || ttl<=0)
+      {
+         lastErrorMsg = "invalid TTL '" + header.value("TTL").toString() + "'";
+         return 0;
+      }
+
+      expires = SCDExpiry::now() + ttl;
+   }
+
+   if (header.contains("TRA")) // traced message: TRA:<publisher time, epoch usec>
+   {
+      SCDTrace trace;
+
+      trace.published = header.value("TRA").toLongLong();
+      trace.received  = SCDLatencyHistogram::now();
+
+      return publishMessage(topic,message,client,QString(),priority,&trace,expires);
+   }
+
+   return publishMessage(topic,message,client,QString(),priority,0,expires);
+}
+
+/**
+ * @brief SCDTopicServer::publishBatch publish the messages of a batch (TBM command), coalesced by a publisher into a
+ *                                     single frame: each message is routed as if it had arrived on its own, in order.
+ *
+ *                                     Batch: <size>\n<TSM command><size>\n<TSM command>...
+ *                                     where size is the length (chars) of the following TSM command, header line and
+ *                                     message, e.g. 27\nSCDTMH:1.0\tTSM:temp\n21.5
+ *
+ *                                     The messages are parsed in place: no copy of them is made.
+ *
+ * @param client
+ * @param message TBM command
+ * @param from batch position into message (following the header line)
+ * @param count messages into batch, as declared by the TBM field
+ * @return 1 if all messages are sent, otherwise the TSM notify status of the first message not sent (lastErrorMsg
+ *         tells which); 0 if the batch is malformed: the messages preceding the error are sent
+ */
+int SCDTopicServer::publishBatch(SCDConnection *client, const QString &message, int from, int count)
+{
+   int ret = 1;
+   int n   = 0;
+   int pos = from;
+
+   QString error = QStringLiteral("no error");
+
+   while (pos<message.size())
+   {
+      int eol = message.indexOf(QLatin1Char('\n'), pos);
+
+      bool ok = false;
+
+      int size = (eol>pos) ? message.midRef(pos, eol-pos).toInt(&ok) : 0;
+
+      if (!ok || size<=0 || size > message.size()-eol-1)
+      {
+         lastErrorMsg = "invalid batch: bad size of message " + QString::number(n+1);
+         return 0;
+      }
+
+      int start = eol+1;
+
+      pos = start + size; // next message
+      n++;
+
+      Command command = TBM;
+
+      int headerSize = readHeader(message, command, start);
+
+      int result;
+
+      if (!headerSize || command!=TSM || start + headerSize >= pos) // the header line must end into the message
+      {
+         lastErrorMsg = "batch message " + QString::number(n) + " is not a TSM command";
+         result = 0;
+      }
+      else
+      {
+         result = publishFrame(client, setText(batchTopic, header.value(commands.at(TSM))), message.midRef(start + headerSize + 1, pos - start - headerSize - 1));
+      }
+
+      if (result!=1 && ret==1)
+      {
+         ret   = result;
+         error = "message " + QString::number(n) + ": " + lastErrorMsg;
+      }
+   }
+
+   if (n!=count)
+   {
+      lastErrorMsg = "invalid batch: " + QString::number(n) + " messages, " + QString::number(count) + " declared";
+      return 0;
+   }
+
+   lastErrorMsg = error;
+
+   return ret;
+}
+
+/**
+ * @brief SCDTopicServer::publishMessage check the rate limits of sender and topic, then send the message to topic.
+ *                                       A sender having delayed messages is always delayed, to preserve order.
+ * @param topic
+ * @param message
+ * @param sender
+ * @param tag chunk tag, see sendMessageToTopic
+ * @param priority outbound priority class, -1 for the topic priority
+ * @param expires expiry time of a message having a TTL (monotonic msec, SCDExpiry::now), 0: never expires
+ * @return  -4: message rejected by rate limits,
+ *           0: topic not exists,
+ *           1: message sent,
+ *           4: message delayed by rate limits
+ */
+int SCDTopicServer::publishMessage(const QString &topic, const QStringRef &message, SCDConnection *sender, const QString &tag, int priority, const SCDTrace *trace, qint64 expires)
+{
+   if (!rateLimited) // fast path
+   {
+      return sendMessageToTopic(topic, message, sender, tag, priority, trace, expires);
+   }
+
+   SCDTopic *entry = topics.value(topic);
+
+   if (!entry)
+   {
+      lastErrorMsg = "topic '" + topic + "' not found";
+
+      return 0;
+   }
+
+   qint64 now = clock.elapsed();
+
+   if (sender->delayed.isEmpty() && admitMessage(sender, entry, message.size(), now))
+   {
+      return sendMessageToTopic(topic, message, sender, tag, priority, trace, expires);
+   }
+
+   if (delayOverLimit && sender->delayed.size() < maxDelayedMessages)
+   {
+      SCDDelayedMessage item;
+
+      item.topic    = topic;
+      item.message  = message.toString();
+      item.tag      = tag;
+      item.priority = priority;
+      item.traced   = (trace != 0);
+      item.expires  = expires; // the delay counts: an expired message is dropped when released
+
+      if (trace) // the delay is part of the traced server time
+      {
+         item.trace = *trace;
+      }
+
+      sender->delayed.append(item);
+
+      if (sender->delayed.size()==1)
+      {
+         releaseDelayedMessages(sender, now); // schedule release
+      }
+
+      lastErrorMsg = QStringLiteral("message delayed: rate limit exceeded");
+
+      return 4;
+   }
+
+   lastErrorMsg = QStringLiteral("message rejected: rate limit exceeded"); // static data: no allocation
+
+   return -4;
+}
+
+/**
+ * @brief SCDTopicServer::admitMessage check the sender and topic token buckets, take the message cost if all allow it
+ * @param sender
+ * @param entry
+ * @param size message size
+ * @param now
+ * @return true if the message can be sent now
+ */
+bool SCDTopicServer::admitMessage(SCDConnection *sender, SCDTopic *entry, int size, qint64 now)
+{
+   if (!sender->messageBucket.available(1, now)    || !sender->byteBucket.available(size, now) ||
+       !entry->messageBucket.available(1, now)     || !entry->byteBucket.available(size, now))
+   {
+      return false;
+   }
+
+   sender->messageBucket.consume(1);
+   sender->byteBucket.consume(size);
+
+   entry->messageBucket.consume(1);
+   entry->byteBucket.consume(size);
+
+   return true;
+}
+
+/**
+ * @brief SCDTopicServer::releaseDelayedMessages send the sender delayed messages allowed by rate limits, in order,
+ *                                               and schedule the release of the remaining ones
+ * @param sender
+ * @param now
+ */
+void SCDTopicServer::releaseDelayedMessages(SCDConnection *sender, qint64 now)
+{
+   while (!sender->delayed.isEmpty())
+   {
+      const SCDDelayedMessage &item = sender->delayed.first();
+
+      SCDTopic *entry = topics.value(item.topic);
+
+      if (entry && item.expires>0 && SCDExpiry::now() >= item.expires) // expired while delayed
+      {
+         (*entry->expiredCounter())++;
+      }
+      else
+      if (entry)
+      {
+         int size = item.message.size();
+
+         if (!admitMessage(sender, entry, size, now))
+         {
+            qint64 wait = qMax(qMax(sender->messageBucket.delay(1), sender->byteBucket.delay(size)),
+                               qMax(entry->messageBucket.delay(1),  entry->byteBucket.delay(size)));
+
+            if (!throttleTimer.isActive()) // wheel is empty: move it to current time
+            {
+               throttleWheel.start(now);
+               throttleTimer.start();
+            }
+
+            throttleWheel.schedule(sender->id, now + wait);
+
+            return;
+         }
+
+         sendMessageToTopic(item.topic, QStringRef(&item.message), sender, item.tag, item.priority, item.traced ? &item.trace : 0, item.expires);
+      }
+
+      sender->delayed.removeFirst(); // sent, expired, or topic deleted meanwhile
+   }
+}
+
+/**
+ * @brief SCDTopicServer::onThrottleTimeout release the delayed messages of connections whose delay is expired
+ */
+void SCDTopicServer::onThrottleTimeout()
+{
+   QList<quint32> expired;
+
+   qint64 now = clock.elapsed();
+
+   throttleWheel.advance(now, expired);
+
+   for (int n=0; n<expired.size(); n++)
+   {
+      SCDConnection *client = connections.value(expired.at(n));
+
+      if (client) // connection closed meanwhile: its delayed messages are discarded
+      {
+         releaseDelayedMessages(client, now);
+      }
+   }
+
+   if (throttleWheel.size()==0)
+   {
+      throttleTimer.stop();
+   }
+}
+
+/**
+ * @brief SCDTopicServer::setMessageLimits set the large messages limits: set before starting server
+ * @param maxMessageSize max size of a message or of a chunk of message, 0 for unlimited
+ * @param maxStreamSize max size of a message sent in chunks, 0 for unlimited
+ * @param streamFragments forward the fragments of a large message as they arrive
+ */
+void SCDTopicServer::setMessageLimits(int maxMessageSize, int maxStreamSize, bool streamFragments)
+{
+   this->maxMessageSize  = qMax(maxMessageSize,0);
+   this->maxStreamSize   = qMax(maxStreamSize,0);
+   this->streamFragments = streamFragments;
+}
+
+/**
+ * @brief SCDTopicServer::publishChunk publish a chunk of a large message: each chunk is forwarded to subscribers as it
+ *                                     arrives, so the server never holds the whole message.
+ * @param topic
+ * @param message chunk
+ * @param sender
+ * @param stream stream id, choosen by sender, identify the chunks of the same message
+ * @param last true for last chunk
+ * @param priority outbound priority class, -1 for the topic priority
+ * @return as publishMessage, -5: message too large (the chunked message is aborted)
+ */
+int SCDTopicServer::publishChunk(const QString &topic, const QStringRef &message, SCDConnection *sender, QString stream, bool last, int priority)
+{
+   QHash<QString, qint64>::iterator it = sender->streams.find(stream);
+
+   if (it == sender->streams.end())
+   {
+      it = sender->streams.insert(stream, 0);
+   }
+
+   if (it.value()<0) // aborted: discard the remaining chunks
+   {
+      if (last)
+      {
+         sender->streams.erase(it);
+      }
+
+      lastErrorMsg = "message too large";
+
+      return -5;
+   }
+
+   it.value() += message.size();
+
+   if (maxStreamSize>0 && it.value() > maxStreamSize)
+   {
+      publishMessage(topic, QStringRef(), sender, "#" + stream + ":A", priority); // subscribers discard the partial message
+
+      if (last)
+      {
+         sender->streams.erase(it);
+      }
+      else
+      {
+         it.value() = -1;
+      }
+
+      lastErrorMsg = "message too large";
+
+      return -5;
+   }
+
+   if (last)
+   {
+      sender->streams.erase(it);
+   }
+
+   return publishMessage(topic, message, sender, "#" + stream + (last ? ":F" : ":M"), priority);
+}
+
+/**
+ * @brief SCDTopicServer::setOutboundLimits set the outbound flow control of web socket connections: set before starting server
+ * @param window max bytes handed to a socket and not yet sent, over this frames wait into priority lanes (0: disabled)
+ * @param queue max frames waiting into priority lanes of a connection
+ */
+void SCDTopicServer::setOutboundLimits(int window, int queue)
+{
+   outboundWindow = qMax(window,0);
+   outboundQueue  = qMax(queue,1);
+}
+
+/**
+ * @brief SCDTopicServer::setDeltaKeyframe set the number of deltas after which a delta encoded topic sends a full document
+ * @param interval
+ */
+void SCDTopicServer::setDeltaKeyframe(int interval)
+{
+   deltaKeyframe = qMax(interval,0);
+}
+
+/**
+ * @brief SCDTopicServer::setFanOut set the chunked delivery of large topics: set before starting server
+ * @param threshold subscribers of a topic over which its messages are delivered in chunks (0: always at once)
+ * @param chunkSize max subscribers delivered for each fan-out at each event loop iteration
+ * @param workers threads evaluating the content filters of a large fan-out, 0: cores - 1
+ */
+void SCDTopicServer::setFanOut(int threshold, int chunkSize, int workers)
+{
+   fanOutThreshold = qMax(threshold,0);
+   fanOutChunkSize = qMax(chunkSize,1);
+   fanOutWorkers   = (workers>0) ? workers : qMax(QThread::idealThreadCount()-1, 0);
+
+   fanOutPool.setMaxThreadCount(qMax(fanOutWorkers,1));
+}
+
+/**
+ * @brief SCDTopicServer::setReliableDelivery set the limits of at-least-once delivery (QoS 1 subscriptions)
+ * @param window max messages sent to a client and not yet acknowledged
+ * @param queue max messages kept for a client (in flight included), over this limit messages are dropped
+ * @param timeout msec: messages not acknowledged meanwhile are sent again
+ * @param expiry msec: the session of a disconnected client (having a client id) is kept so long
+ */
+void SCDTopicServer::setReliableDelivery(int window, int queue, int timeout, int expiry)
+{
+   reliableWindow    = qMax(window,1);
+   reliableQueue     = qMax(queue,reliableWindow);
+   redeliveryTimeout = qMax(timeout,redeliveryWheel.tickInterval());
+   sessionExpiry     = qMax(expiry,0);
+}
+
+/**
+ * @brief SCDTopicServer::setDurableSpool set the disk spill of durable subscriptions: set before start
+ * @param path spool directory: each process spills into its own subdirectory (pid), removed when it quits
+ * @param segmentSize bytes: size of spool segment files
+ * @param diskLimit bytes: max disk usage of each durable subscription, over this limit messages are dropped (0: unlimited)
+ */
+void SCDTopicServer::setDurableSpool(const QString &path, qint64 segmentSize, qint64 diskLimit)
+{
+   durablePath        = path + "/" + QString::number(QCoreApplication::applicationPid());
+   durableSegmentSize = segmentSize;
+   durableDiskLimit   = qMax(diskLimit,qint64(0));
+}
+
+/**
+ * @brief SCDTopicServer::setSessionResume set the resume grace period: the subscriptions of a client having a resume
+ *                                        token are kept so long after it disconnects (see resumeSession)
+ * @param grace msec, 0: session resume disabled
+ */
+void SCDTopicServer::setSessionResume(int grace)
+{
+   resumeGrace = qMax(grace,0);
+}
+
+/**
+ * @brief SCDTopicServer::setReusePort listen with SO_REUSEPORT, so that more server processes share the port and the
+ *                                     kernel balances the connections among them (see SCDTopicBus). Set before start.
+ * @param reusePort
+ */
+void SCDTopicServer::setReusePort(bool reusePort)
+{
+   this->reusePort = reusePort;
+}
+
+/**
+ * @brief SCDTopicServer::setBus set the routing bus to the other processes sharing the port
+ * @param bus 0 for single process mode
+ */
+void SCDTopicServer::setBus(SCDTopicBus *bus)
+{
+   this->bus = bus;
+
+   if (bus)
+   {
+      for (QMap<QString, SCDTopic *>::const_iterator it = topics.constBegin(); it != topics.constEnd(); ++it)
+      {
+         if (!it.value()->subscribers.isEmpty())
+         {
+            bus->subscribe(it.key());
+         }
+      }
+   }
+}
+
+/**
+ * @brief SCDTopicServer::setMulticast set the multicast egress of multicast topics (see joinMulticast)
+ * @param multicast started multicast sender, 0 to send all messages thru the connections
+ */
+void SCDTopicServer::setMulticast(SCDMulticast *multicast)
+{
+   this->multicast = multicast;
+}
+
+/**
+ * @brief SCDTopicServer::setListenDescriptor listen on a socket already listening, handed over by the previous
+ *                                           process: no connection is refused meanwhile. Set before start.
+ * @param fd -1 to listen on a new socket
+ */
+void SCDTopicServer::setListenDescriptor(int fd)
+{
+   listenDescriptor = fd;
+}
+
+/**
+ * @brief SCDTopicServer::saveState save topics, last documents of delta encoded topics and the subscriptions
+ *                                  of the connections handed over to the process taking over
+ *
+ *                                  State: <topic items:QStringList><states:QStringList><connections:quint32>
+ *                                         {<name><peer><subscriptions:QStringList><session:bool><client id><durable:bool>}
+ *                                         <offline durable sessions:quint32>{<name><subscriptions:QStringList>}
+ *                                         <resume tokens:QStringList><state TTLs:QStringList> (QDataStream)
+ *
+ *                                  states:        {<topic><sender><document>}, expired documents are not handed over
+ *                                  state TTLs:    {<topic><msec left>} of the documents having a TTL
+ *                                  subscriptions: {<topic><filter expression><qos>} (empty expression: no filter)
+ *
+ *                                  The messages not yet acknowledged by QoS 1 subscribers are not handed over, as
+ *                                  the messages spilled by durable sessions: their subscriptions are.
+ *                                  resume tokens: a token for each connection handed over (empty: none), the
+ *                                  subscriptions parked for the clients disconnected are not handed over.
+ * @param clients connections handed over, in the order the transport adopts them
+ * @return
+ */
+QByteArray SCDTopicServer::saveState(const QVector<SCDConnection *> &clients)
+{
+   QByteArray state;
+
+   QDataStream stream(&state, QIODevice::WriteOnly);
+
+   QStringList items;
+   QStringList states;
+   QStringList stateTtls;
+
+   qint64 now = SCDExpiry::now();
+
+   for (QMap<QString, SCDTopic *>::const_iterator it = topics.constBegin(); it != topics.constEnd(); ++it)
+   {
+      items.append(topicItem(it.value()));
+
+      if (it.value()->hasState && !it.value()->stateExpired(now))
+      {
+         states << it.key() << it.value()->stateSender << it.value()->stateMessage;
+
+         if (it.value()->stateExpires>0) // monotonic times are not passed: the time left is
+         {
+            stateTtls << it.key() << QString::number(it.value()->stateExpires - now);
+         }
+      }
+   }
+
+   stream << items << states << quint32(clients.size());
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      SCDConnection *client = clients.at(n);
+
+      stream << client->name << client->peer << saveSubscriptions(client) << bool(client->session)
+             << (client->session ? client->session->id : QString()) << (client->session && client->session->durable);
+   }
+
+   QSet<SCDConnection *> handed = clients.toList().toSet();
+
+   QList<SCDSession *> offline; // durable sessions of the clients not handed over: they reconnect to the new process
+
+   for (QHash<QString, SCDSession *>::const_iterator it = sessions.constBegin(); it != sessions.constEnd(); ++it)
+   {
+      if (it.value()->durable && !handed.contains(it.value()->client))
+      {
+         offline.append(it.value());
+      }
+   }
+
+   stream << quint32(offline.size());
+
+   for (int n=0; n<offline.size(); n++)
+   {
+      SCDSession *session = offline.at(n);
+
+      stream << session->id << saveSubscriptions(session->client ? session->client : session->offline, true);
+   }
+
+   QStringList tokens;
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      tokens.append(clients.at(n)->resumeToken);
+   }
+
+   stream << tokens << stateTtls;
+
+   return state;
+}
+
+/**
+ * @brief SCDTopicServer::saveSubscriptions
+ * @param client
+ * @param reliableOnly save only the QoS 1 subscriptions
+ * @return subscriptions of client: {<topic><filter expression><qos>} (empty expression: no filter)
+ */
+QStringList SCDTopicServer::saveSubscriptions(SCDConnection *client, bool reliableOnly)
+{
+   QStringList subscriptions;
+
+   for (QHash<SCDTopic *, int>::const_iterator it = client->topics.constBegin(); it != client->topics.constEnd(); ++it)
+   {
+      if (reliableOnly && it.key()->qos.at(it.value()) != SCDTopic::QOS_AT_LEAST_ONCE)
+      {
+         continue;
+      }
+
+      SCDFilter *filter = it.key()->filters.at(it.value());
+
+      subscriptions << it.key()->name << (filter ? filter->expression() : QString()) << QString::number(it.key()->qos.at(it.value()));
+   }
+
+   return subscriptions;
+}
+
+/**
+ * @brief SCDTopicServer::restoreSubscriptions subscribe a client to the saved subscriptions (see saveSubscriptions):
+ *                                             missing topics and invalid filters are skipped. Multicast receivers
+ *                                             get the messages thru their connection: the datagrams of this process
+ *                                             have another source (see SCDMulticast)
+ * @param client
+ * @param subscriptions
+ */
+void SCDTopicServer::restoreSubscriptions(SCDConnection *client, const QStringList &subscriptions)
+{
+   for (int i=0; i+2<subscriptions.size(); i+=3)
+   {
+      SCDTopic *entry = topics.value(subscriptions.at(i));
+
+      if (!entry)
+      {
+         continue;
+      }
+
+      SCDFilter *filter = 0;
+
+      if (!subscriptions.at(i+1).isEmpty())
+      {
+         filter = new SCDFilter();
+
+         if (!filter->compile(subscriptions.at(i+1)))
+         {
+            delete filter;
+            continue;
+         }
+      }
+
+      bool reliable = client->session && subscriptions.at(i+2).toInt()==SCDTopic::QOS_AT_LEAST_ONCE;
+
+      attachSubscriber(entry, client, filter, reliable ? SCDTopic::QOS_AT_LEAST_ONCE : SCDTopic::QOS_AT_MOST_ONCE);
+   }
+}
+
+/**
+ * @brief SCDTopicServer::restoreTopics load topics and last documents from the state of the previous process,
+ *                                      instead of the topics file: call before start
+ * @param state see saveState
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDTopicServer::restoreTopics(const QByteArray &state)
+{
+   QDataStream stream(state);
+
+   QStringList items;
+   QStringList states;
+
+   stream >> items >> states;
+
+   if (stream.status() != QDataStream::Ok)
+   {
+      lastErrorMsg = "Invalid handover state";
+      return 0;
+   }
+
+   cancelFanOuts();
+
+   qDeleteAll(topics);
+
+   topics.clear();
+
+   for (int n=0; n<items.size(); n++)
+   {
+      loadTopicItem(items.at(n));
+   }
+
+   for (int n=0; n+2<states.size(); n+=3)
+   {
+      SCDTopic *entry = topics.value(states.at(n));
+
+      QJsonDocument document = QJsonDocument::fromJson(states.at(n+2).toUtf8());
+
+      if (entry && entry->delta && document.isObject())
+      {
+         entry->hasState     = true;
+         entry->state        = document.object();
+         entry->stateSender  = states.at(n+1);
+         entry->stateMessage = states.at(n+2);
+      }
+   }
+
+   restored = true;
+
+   return 1;
+}
+
+/**
+ * @brief SCDTopicServer::restoreConnections open the connections adopted by a transport and restore their subscriptions,
+ *                                           and the durable sessions of offline clients (without messages):
+ *                                           call after start. The dynamic topics left without subscribers (those of
+ *                                           connections not handed over) are removed.
+ * @param state see saveState
+ * @param clients connections adopted, in the order they were saved: 0 (or missing) for those not adopted, skipped
+ * @return number of connections restored
+ */
+int SCDTopicServer::restoreConnections(const QByteArray &state, const QVector<SCDConnection *> &clients)
+{
+   QDataStream stream(state);
+
+   QStringList items;
+   QStringList states;
+   quint32     count = 0;
+
+   stream >> items >> states >> count;
+
+   int restoredCount = 0;
+
+   for (quint32 n=0; n<count && stream.status()==QDataStream::Ok; n++)
+   {
+      QString     name;
+      QString     peer;
+      QStringList subscriptions;
+      bool        session = false;
+      QString     clientId;
+      bool        durable = false;
+
+      stream >> name >> peer >> subscriptions >> session >> clientId >> durable;
+
+      SCDConnection *client = clients.value(int(n));
+
+      if (!client) // not adopted by transport
+      {
+         continue;
+      }
+
+      client->name = name;
+      client->peer = peer;
+
+      openConnection(client, true);
+
+      if (session)
+      {
+         openSession(client, clientId, durable);
+      }
+
+      restoreSubscriptions(client, subscriptions);
+
+      restoredCount++;
+   }
+
+   quint32 offlineCount = 0;
+
+   stream >> offlineCount;
+
+   for (quint32 n=0; n<offlineCount && stream.status()==QDataStream::Ok; n++) // durable sessions of offline clients
+   {
+      QString     name;
+      QStringList subscriptions;
+
+      stream >> name >> subscriptions;
+
+      if (sessions.contains(name))
+      {
+         continue;
+      }
+
+      SCDSession *session = new SCDSession(name);
+
+      sessions.insert(name, session);
+
+      makeDurable(session);
+
+      session->detached = clock.elapsed();
+
+      restoreSubscriptions(session->offline, subscriptions);
+   }
+
+   QStringList tokens;
+   QStringList stateTtls;
+
+   if (!stream.atEnd()) // missing in the state of a previous version
+   {
+      stream >> tokens;
+   }
+
+   if (!stream.atEnd())
+   {
+      stream >> stateTtls;
+   }
+
+   for (int n=0; n+1<stateTtls.size() && stream.status()==QDataStream::Ok; n+=2) // restored by restoreTopics
+   {
+      SCDTopic *entry = topics.value(stateTtls.at(n));
+
+      if (entry && entry->hasState)
+      {
+         entry->stateExpires = SCDExpiry::now() + qMax(stateTtls.at(n+1).toLongLong(), qint64(1));
+
+         ExpiryItem item;
+
+         item.kind       = EX_STATE;
+         item.connection = 0;
+         item.name       = entry->name;
+
+         scheduleExpiry(item, entry->expiryScheduled, entry->stateExpires);
+      }
+   }
+
+   for (int n=0; n<tokens.size() && n<clients.size() && stream.status()==QDataStream::Ok; n++)
+   {
+      if (!tokens.at(n).isEmpty() && clients.at(n) && clients.at(n)->id) // opened above
+      {
+         clients.at(n)->resumeToken = tokens.at(n);
+
+         resumeTokens.insert(tokens.at(n), clients.at(n));
+      }
+   }
+
+   QStringList names = topics.keys(); // copy: dynamic topics are removed meanwhile
+
+   QVector<SCDConnection *> subscribers;
+
+   for (int n=0; n<names.size(); n++)
+   {
+      SCDTopic *entry = topics.value(names.at(n));
+
+      if (entry->dynamic && entry->subscribers.isEmpty())
+      {
+         removeTopic(names.at(n), subscribers);
+      }
+   }
+
+   return restoredCount;
+}
+
+/**
+ * @brief SCDTopicServer::listenReusePort listen on all addresses with SO_REUSEPORT: the socket is created here and
+ *                                        handed to QWebSocketServer
+ * @return true on success
+ */
+bool SCDTopicServer::listenReusePort()
+{
+   int fd = reusePortSocket(quint16(port), lastErrorMsg);
+
+   if (fd == -2) // SO_REUSEPORT not available: single process
+   {
+      return listen(QHostAddress::Any,port);
+   }
+
+   return fd>=0 && setSocketDescriptor(fd);
+}
+
+/**
+ * @brief SCDTopicServer::reusePortSocket create a socket listening on all addresses (IPv6 and IPv4) with SO_REUSEPORT
+ * @param port
+ * @param error error message on failure
+ * @return socket descriptor, -1 on failure, -2 if SO_REUSEPORT is not available
+ */
+int SCDTopicServer::reusePortSocket(quint16 port, QString &error)
+{
+#if defined(Q_OS_UNIX) && defined(SO_REUSEPORT)
+   int on  = 1;
+   int off = 0;
+
+   int fd = ::socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+   sockaddr_in6 addr = sockaddr_in6();
+
+   addr.sin6_family = AF_INET6;
+   addr.sin6_addr   = in6addr_any;
+   addr.sin6_port   = htons(port);
+
+   if (fd>=0)
+   {
+      ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)); // IPv4 too
+      ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+      if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))==0 && ::listen(fd, SOMAXCONN)==0)
+      {
+         return fd;
+      }
+
+      ::close(fd);
+   }
+
+   error = "Unable to listen on port " + QString::number(port) + ": " + QString::fromLocal8Bit(strerror(errno));
+
+   return -1;
+#else
+   Q_UNUSED(port)
+
+   error = "SO_REUSEPORT not available";
+
+   return -2;
+#endif
+}
+
+/**
+ * @brief SCDTopicServer::deliverRemoteMessage deliver a message published thru another process to the local subscribers:
+ *                                             rate limits have been applied by the publisher process
+ * @param topic
+ * @param sender sender name
+ * @param tag chunk tag, see sendMessageToTopic
+ * @param priority outbound priority class, -1 for the topic priority
+ * @param message
+ * @return 0 if topic not exists, 1 otherwise
+ */
+int SCDTopicServer::deliverRemoteMessage(QString topic, QString sender, QString tag, int priority, QString message)
+{
+   remoteSender.name = sender;
+
+   return sendMessageToTopic(topic, QStringRef(&message), &remoteSender, tag, priority);
+}
+
+/**
+ * @brief SCDTopicServer::applyRemoteTopic a topic has been made or changed thru another process: applied in memory
+ *                                         only, the topics file shared by the processes is written by that process
+ * @param item topics file item
+ */
+void SCDTopicServer::applyRemoteTopic(QString item)
+{
+   loadTopicItem(item);
+}
+
+/**
+ * @brief SCDTopicServer::removeRemoteTopic a topic has been deleted thru another process: the local subscribers
+ *                                          receive the same notify of the subscribers of the deleting process
+ * @param topic
+ */
+void SCDTopicServer::removeRemoteTopic(QString topic)
+{
+   QVector<SCDConnection *> subscribers;
+
+   int ret = removeTopic(topic, subscribers, false); // the topics file is written by that process
+
+   if (ret>0 && !subscribers.isEmpty())
+   {
+      sendMessageToSubscribers(subscribers, "[server@notify]:TDL|" + topic + "|" + QString::number(ret) + "|" + lastErrorMsg + "\n", 0);
+   }
 }
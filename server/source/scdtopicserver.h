@@ -6,14 +6,74 @@
 #include <QWebSocketServer>
 #include <QHostAddress>
 #include <QByteArray>
+#include <QMap>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QThreadPool>
+
+#include "scdtopic.h"
+#include "scdconnection.h"
+#include "scdheader.h"
+#include "scdtimerwheel.h"
+#include "scdspool.h"
+#include "scdtopicbus.h"
+#include "scdmulticast.h"
 
 class SCDTopicServer : public QWebSocketServer
 {
    Q_OBJECT
 
+   friend class SCDTopicBench; // server/bench: private hot functions are measured in isolation
+
    private:
 
-     enum Command {TMK=0,TDL=1,TRC=2,TUC=3,TRN=4,TSM=5};
+     enum Command {TMK=0,TDL=1,TRC=2,TUC=3,TRN=4,TSM=5,TLT=6,TST=7,TAK=8,TDS=9,TBM=10,TMR=11,TSR=12};
+
+     enum TopicType {TT_ALL=0,TT_STATIC=1,TT_DYNAMIC=2};
+
+     /**
+      * @brief The ListJob struct pending topic listing, streamed to client in chunks
+      */
+     struct ListJob
+     {
+        quint32 client;              // requester connection id
+        QString prefix;              // topic name prefix filter
+        QString cursor;              // last topic name sent (listing restarts after it)
+        int     remaining;           // topics left for the current page (-1: no limit)
+        int     type;                // TopicType filter
+        bool    stats;               // send topic statistics instead of topic type
+     };
+
+     enum ExpiryKind {EX_CONNECTION=0,EX_SESSION=1,EX_STATE=2};
+
+     /**
+      * @brief The ExpiryItem struct holder of messages having a TTL, swept by the expiry wheel
+      */
+     struct ExpiryItem
+     {
+        int     kind;       // ExpiryKind
+        quint32 connection; // EX_CONNECTION: connection id (priority lanes and anonymous session)
+        QString name;       // EX_SESSION: client id or durable name, EX_STATE: delta encoded topic name
+     };
+
+     /**
+      * @brief The FanOutJob struct fan-out of a message to a large topic, delivered in chunks from the event loop
+      */
+     struct FanOutJob
+     {
+        SCDTopic                       *topic;         // the jobs of a topic are delivered in order
+        QVector<SCDConnection *>        subscribers;   // snapshot of topic subscribers: shared with the topic until it changes
+        QVector<quint8>                 qos;           // snapshot of subscribers delivery, empty if no QoS 1 or multicast subscriber
+        QSharedPointer<SCDFilterBatch>  filters;       // content filters evaluated at publish, null: no filter
+        QString                         frame;
+        QString                         filteredFrame; // frame sent to matching filtered subscribers, null: the same frame
+        SCDConnection                  *sender;        // compared only: it may be closed meanwhile
+        int                             priority;
+        SCDTraceStamp                   trace;         // traced message: latency set
+        SCDExpiry                       expiry;        // message having a TTL: expires set
+        int                             next;          // next subscriber to deliver
+        quint64                         serial;        // start order: the connections closed after the start are skipped
+     };
 
      int command;
 
@@ -23,24 +83,150 @@ class SCDTopicServer : public QWebSocketServer
 
      QString lastErrorMsg;
 
-     QHash <QString, QWebSocket *> sockList;
+     QHash <quint32, SCDConnection *> connections; // connection id => connection
+
+     QHash <QWebSocket *, SCDWebSocketConnection *> sockList; // socket => web socket connection
+
+     quint32 lastConnectionId;
+
+     QMap <QString, SCDTopic *> topics; // sorted topic index: topic name => topic entry
+
+     QList <ListJob> listJobs; // pending topic listings
+
+     QTimer listTimer; // drives topic listing chunks from the event loop
+
+     int listChunkSize; // max topics sent for each listing chunk
+
+     QElapsedTimer clock; // monotonic clock for statistics and heartbeat
+
+     SCDTimerWheel <quint32> heartbeatWheel; // next heartbeat check of each connection id
+
+     QTimer heartbeatTimer; // drives heartbeat wheel
+
+     int heartbeatInterval; // idle time before sending a ping (msec), 0: heartbeat disabled
+     int heartbeatTimeout;  // idle time before reaping a dead connection (msec)
+
+     // publish rate limits (0: unlimited)
+
+     int clientMessageRate; // messages/sec for each connection
+     int clientByteRate;    // bytes/sec for each connection
+     int topicMessageRate;  // messages/sec for each topic
+     int topicByteRate;     // bytes/sec for each topic
+
+     bool rateLimited;      // at least a rate limit is set
+     bool delayOverLimit;   // delay over limit publishes, otherwise reject them
+
+     int maxDelayedMessages; // max delayed publishes for each connection, over this limit publishes are rejected
+
+     SCDTimerWheel <quint32> throttleWheel; // next delayed publishes release of each connection id
+
+     QTimer throttleTimer; // drives throttle wheel, active only while publishes are delayed
+
+     // large messages
+
+     int  maxMessageSize;  // max size of a message or a chunk, 0: unlimited
+     int  maxStreamSize;   // max size of a chunked message, 0: unlimited
+     bool streamFragments; // forward the fragments of a large message as they arrive
+
+     // outbound flow control
+
+     int outboundWindow; // max bytes handed to each web socket and not yet sent, over this frames wait into priority lanes
+     int outboundQueue;  // max frames waiting into priority lanes of each connection
+
+     int deltaKeyframe; // delta encoded topics: a full document is sent after this number of deltas
+
+     qint64 epochOffset; // epoch usec - monotonic usec: timestamps of traced messages are sent in epoch time
+
+     // at-least-once delivery (QoS 1 subscriptions)
+
+     QHash <QString, SCDSession *> sessions; // client id => session of the clients having an id
+
+     int reliableWindow;    // max messages sent to a session and not yet acknowledged
+     int reliableQueue;     // max messages kept for a session, over this limit messages are dropped
+     int redeliveryTimeout; // msec: messages not acknowledged meanwhile are sent again
+     int sessionExpiry;     // msec: a session of a disconnected client is kept so long
+
+     SCDTimerWheel <quint32> redeliveryWheel; // next redelivery check of each connection id having messages in flight
+
+     QTimer redeliveryTimer; // drives redelivery wheel and sessions expiry
+
+     qint64 lastExpiryCheck; // monotonic time of last sessions expiry check (msec)
+
+     // message expiry (TTL header field): expired messages are dropped when dequeued, and swept in bulk
+
+     SCDHierarchicalWheel <ExpiryItem> expiryWheel; // next sweep of each holder of messages having a TTL
+
+     QTimer expiryTimer; // drives expiry wheel, active only while messages having a TTL are kept
+
+     // large fan-outs: delivered in chunks, so that a publish to a topic having many subscribers does not hold the event loop
+
+     int fanOutThreshold; // subscribers of a topic over which its messages are delivered in chunks, 0: always at once
+     int fanOutChunkSize; // max subscribers delivered for each fan-out at each event loop iteration
+     int fanOutWorkers;   // threads evaluating the content filters of a large fan-out
+
+     QList <FanOutJob> fanOutJobs; // fan-outs in progress
+
+     quint64 fanOutSerial; // serial of last fan-out started
+
+     QHash <SCDConnection *, quint64> fanOutClosed; // record closed or deleted while fan-outs are in progress => fanOutSerial then
+
+     QTimer fanOutTimer; // drives fan-out chunks from the event loop, active only while fan-outs are in progress
+
+     QThreadPool fanOutPool; // filter evaluation workers
+
+     QList <QSharedPointer<SCDFilterBatch> > filterBatches; // filter evaluations started into the workers, until complete
+     QVector <SCDFilter *> retiredFilters; // filters deleted while evaluations are in progress: freed once they are complete
+
+     // session resume: the subscriptions of a disconnected client are kept for its resume token
 
-     QStringList topics;
+     QHash <QString, SCDConnection *> resumeTokens;         // resume token => connection
+     QHash <QString, SCDParkedSubscriber *> parkedSessions; // resume token => subscriptions of a disconnected client, owned
 
-     QMap <QString,QVariant> header; // current header entries readed
+     int resumeGrace; // msec: parked subscriptions are kept so long, 0: session resume disabled
+
+     // durable subscriptions: messages over reliableQueue are spilled to disk
+
+     QString durablePath;        // spool directory of this process, one subdirectory for each durable session
+     qint64  durableSegmentSize; // bytes: spool segment files size
+     qint64  durableDiskLimit;   // bytes: max disk usage of each durable session, 0: unlimited
+
+     // multi-process mode
+
+     bool reusePort; // listen with SO_REUSEPORT: more processes share the port
+
+     SCDTopicBus *bus; // routing bus to the other processes, 0: single process
+
+     SCDRemoteSender remoteSender; // sender of the messages received thru bus
+
+     SCDMulticast *multicast; // multicast egress of multicast topics, 0: disabled
+
+     QTimer multicastTimer; // drives the last sequence announces, active only while multicast topics have receivers
+
+     // handover (zero-downtime restart)
+
+     bool restored;        // topics restored from the state of the previous process: the topics file is not loaded
+     int  listenDescriptor; // listening socket handed over by the previous process, -1: none
+
+     SCDHeader header; // current header entries readed
 
      int maxHeaderSize;
 
-     QMap <QString,QVariant> getHeader();
+     // publish path buffers: reused for each message, so that a publish does no allocation once they have grown
+
+     QString topicName;  // topic of the command being processed
+     QString batchTopic; // topic of the batch message being processed
+     QString frameBuffer;  // frame sent to subscribers
+     QString notifyBuffer; // notify sent to the client
 
      QString addressToHex(QWebSocket *socket);
      QString addressToString(QWebSocket *socket);
 
-     int checkHeaderField(const QString &headerItem, const QString &fieldName);
-
-     int checkHeaderField(const QString &headerItem, enum Command &cmd);
+     int readHeader(const QString &message, Command &command, int from=0);
 
-     int readHeader(QString message, Command &command);
+     static const QString &setText(QString &buffer, const QStringRef &text);
+     static const QString &formatFrame(QString &buffer, const QString &sender, const QString &tag, const QString &traced,
+                                       const QString &topic, const QStringRef &message);
+     static const QString &formatNotify(QString &buffer, const QString &command, const QString &topic, int status, const QString &error);
 
      int listLoadFromFile(QString fileName, QStringList &list);
      int listSaveToFile(QString fileName, QStringList &list, bool removeEmpty=false);
@@ -48,44 +234,156 @@ class SCDTopicServer : public QWebSocketServer
      int saveTopicList();
      int loadTopicList();
 
-     QString getTopic(QStringList topics, int n);
+     QString topicItem(const SCDTopic *entry);
+     SCDTopic *loadTopicItem(QString item);
+
+     bool listenReusePort();
+
+     QStringList saveSubscriptions(SCDConnection *client, bool reliableOnly=false);
+     void restoreSubscriptions(SCDConnection *client, const QStringList &subscriptions);
+
+     void attachSubscriber(SCDTopic *entry, SCDConnection *client, SCDFilter *filter=0, int qos=0);
+     bool detachSubscriber(SCDTopic *entry, SCDConnection *client);
 
-     int subscribeToTopic(QString topic, QString clientIp, bool createNewTopic=true);
-     int unscribeFromTopic(QString topic, QString clientIp);
+     int subscribeToTopic(QString topic, SCDConnection *client, bool createNewTopic=true, SCDFilter *filter=0, int qos=0);
+     int unscribeFromTopic(QString topic, SCDConnection *client);
 
-     QStringList unscribeFromTopics(QString clientIp);
+     QStringList unscribeFromTopics(SCDConnection *client);
 
      int removeTopicSubscribers(QString topic);
 
-     int sendMessageToTopic(QString topic, QString message, QString sender);
+     int sendMessageToTopic(const QString &topic, const QStringRef &message, SCDConnection *sender, const QString &tag=QString(), int priority=-1, const SCDTrace *trace=0, qint64 expires=0);
+
+     int publishMessage(const QString &topic, const QStringRef &message, SCDConnection *sender, const QString &tag=QString(), int priority=-1, const SCDTrace *trace=0, qint64 expires=0);
+     int publishChunk(const QString &topic, const QStringRef &message, SCDConnection *sender, QString stream, bool last, int priority=-1);
+     int publishFrame(SCDConnection *client, const QString &topic, const QStringRef &message);
+     int publishBatch(SCDConnection *client, const QString &message, int from, int count);
+
+     bool startFragmentStream(SCDConnection *client, const QString &frame);
+
+     bool admitMessage(SCDConnection *sender, SCDTopic *entry, int size, qint64 now);
+     void releaseDelayedMessages(SCDConnection *sender, qint64 now);
+
+     SCDTopic *createTopic(const QString &topic, bool dynamic);
 
      void unregisterAllSubscriptions();
 
-     int sendMessageToSubscribers(QStringList subscribers, QString notifyMsg, QString sender);
+     int sendMessageToSubscribers(const QVector<SCDConnection *> &subscribers, const QString &notifyMsg, SCDConnection *sender);
+
+     int fanOut(const QVector<SCDConnection *> &subscribers, const QString &frame, SCDConnection *sender, int priority,
+                const QVector<SCDFilter *> *filters=0, const QJsonObject *document=0, const QString *filteredFrame=0,
+                const QVector<quint8> *qos=0, const SCDTraceStamp *trace=0, const SCDExpiry *expiry=0);
+
+     int startFanOut(SCDTopic *entry, const QString &frame, SCDConnection *sender, int priority, bool filtered,
+                     const QJsonObject *document, const QString *filteredFrame, const QVector<quint8> *qos,
+                     const SCDTraceStamp *trace, const SCDExpiry *expiry);
+     int deliverFanOutChunk(FanOutJob &job);
+     int deliverReliableFanOut(FanOutJob &job);
+     QSharedPointer<SCDFilterBatch> evaluateFilters(const QVector<SCDFilter *> &filters, const QJsonObject *document);
+     bool releaseFilterBatches();
+     void deleteFilter(SCDFilter *filter);
+     void cancelFanOuts(SCDTopic *entry=0);
+     void deleteSubscriber(SCDConnection *record);
+
+     SCDSession *openSession(SCDConnection *client, const QString &id, bool durable=false);
+     void closeSession(SCDConnection *client);
+     void deleteSession(SCDSession *session);
+
+     void makeDurable(SCDSession *session);
+     QList<SCDTopic *> moveSubscriptions(SCDConnection *from, SCDConnection *to, bool all=false);
+     void refillSession(SCDSession *session);
+
+     int  resumeSession(SCDConnection *client, QString &token);
+     void parkSubscriptions(SCDConnection *client);
+     void deleteParked(SCDParkedSubscriber *parked);
+
+     bool deliverReliable(SCDConnection *client, const QString &frame, int priority, const SCDTraceStamp *trace=0, const SCDExpiry *expiry=0);
+     void sendReliable(SCDSession *session);
+     void acknowledge(SCDConnection *client, quint64 sequence);
+
+     void scheduleExpiry(SCDConnection *client, qint64 expires);
+     void scheduleExpiry(SCDSession *session, qint64 expires);
+     void scheduleExpiry(const ExpiryItem &item, qint64 &scheduled, qint64 expires);
+     qint64 purgeSession(SCDSession *session, qint64 now);
+     void expireSpooled(SCDSession *session, int from);
+
+     int setTopicPriority(QString topic, QString priority);
+     int setTopicDelta(QString topic, bool delta);
+     int setTopicMulticast(QString topic, bool multicast);
+
+     bool joinMulticast(QString topic, SCDConnection *client);
+     void leaveMulticast(SCDTopic *entry);
+     void sendMulticast(SCDTopic *entry, const QString &frame, int priority, const SCDTraceStamp *trace, const SCDExpiry *expiry=0);
+     int  repairMulticast(QString topic, SCDConnection *client, quint64 first, quint64 last);
+
+     QString encodeDelta(SCDTopic *entry, const QJsonObject *document, const QStringRef &message, SCDConnection *sender, const QString &traced=QString());
+
+     void sendTopicState(QString topic, SCDConnection *client);
 
      bool isValidTopicName(QString &topic);
 
+     int listTopics(SCDConnection *client, QString prefix, QString cursor, int max, QString type, bool stats=false);
+     int sendTopicListChunk(SCDConnection *client, ListJob &job);
+
    public:
 
      explicit SCDTopicServer(QObject *parent = 0, int port=12345);
 
      ~SCDTopicServer();
 
-     int start(); // Start tcp server for incoming connections
+     int start(bool webSocket=true); // Start tcp server for incoming connections (webSocket false: another transport accepts them)
      void stop(); // Start tcp server for incoming connections
 
      QString lastError();
      QStringList getTopics();
 
+     void setHeartbeat(int interval, int timeout);
+     void setRateLimits(int clientMessageRate, int clientByteRate, int topicMessageRate, int topicByteRate, bool delay);
+     void setMessageLimits(int maxMessageSize, int maxStreamSize, bool streamFragments);
+     void setOutboundLimits(int window, int queue);
+     void setDeltaKeyframe(int interval);
+     void setFanOut(int threshold, int chunkSize, int workers);
+     void setReliableDelivery(int window, int queue, int timeout, int expiry);
+     void setDurableSpool(const QString &path, qint64 segmentSize, qint64 diskLimit);
+     void setSessionResume(int grace);
+     void setReusePort(bool reusePort);
+     void setBus(SCDTopicBus *bus);
+     void setMulticast(SCDMulticast *multicast);
+     void setListenDescriptor(int fd);
+
+     // handover interface: the state passed to the process taking over (see SCDHandover)
+
+     QByteArray saveState(const QVector<SCDConnection *> &clients);
+     int restoreTopics(const QByteArray &state);
+     int restoreConnections(const QByteArray &state, const QVector<SCDConnection *> &clients);
+
+     // routing bus interface: the messages and static topic changes of the other processes
+
+     int deliverRemoteMessage(QString topic, QString sender, QString tag, int priority, QString message);
+     void applyRemoteTopic(QString item);
+     void removeRemoteTopic(QString topic);
+
+     // transport interface: a transport opens a connection record, passes it the received messages and closes it
+
+     quint32 openConnection(SCDConnection *client, bool flowControl=false);
+     void processMessage(SCDConnection *client, const QString &message);
+     void closeConnection(SCDConnection *client);
+     void touchConnection(SCDConnection *client);
+
      bool topicExists(QString topic);
      bool isDynamicTopic(QString topic);
 
+     QString topicStats(QString topic);
+     QString durableStats(const QString &name);
+
      int addTopic(QString topic, bool dynamic=false);
-     int removeTopic(QString topic, QStringList &removedSubscribers);
+     int removeTopic(QString topic, QVector<SCDConnection *> &removedSubscribers, bool save=true);
 
      QString addressToString(QHostAddress address, int port);
      QString addressToHex(QHostAddress address, int port);
 
+     static int reusePortSocket(quint16 port, QString &error);
+
    signals:
 
    private slots:
@@ -93,8 +391,18 @@ class SCDTopicServer : public QWebSocketServer
      void onNewConnection();
      void onDisconnected();
      void onTextMessageReceived(QString message);
+     void onTextFrameReceived(QString frame, bool isLastFrame);
      void onSocketError(QAbstractSocket::SocketError error);
      void onAboutToClose();
+     void onListTimeout();
+     void onHeartbeatTimeout();
+     void onThrottleTimeout();
+     void onRedeliveryTimeout();
+     void onExpiryTimeout();
+     void onFanOutTimeout();
+     void onMulticastTimeout();
+     void onPong(quint64 elapsedTime, const QByteArray &payload);
+     void onBytesWritten(qint64 bytes);
      //void onBinaryMessageReceived(QByteArray message);
 };
 
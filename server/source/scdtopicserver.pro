@@ -17,8 +17,40 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 DESTDIR = ../bin
 
+# session ticket keys shared by the TLS contexts (scdtlsacceptor.cpp)
+LIBS += -lssl -lcrypto
+
 SOURCES += main.cpp \
-    scdtopicserver.cpp
+    scdtopicserver.cpp \
+    scdfilter.cpp \
+    scdtopicbus.cpp \
+    scdtlsacceptor.cpp \
+    scdhandover.cpp \
+    scdspool.cpp \
+    scdmulticast.cpp
 
 HEADERS += \
-    scdtopicserver.h
+    scdtopicserver.h \
+    scdtopic.h \
+    scdconnection.h \
+    scdtimerwheel.h \
+    scdtokenbucket.h \
+    scdfilter.h \
+    scdmergepatch.h \
+    scdtopicbus.h \
+    scdtlsacceptor.h \
+    scdhandover.h \
+    scdspool.h \
+    scdlatency.h \
+    scdheader.h \
+    scdmulticast.h \
+    scdbufferpool.h
+
+# epoll web socket backend (linux only): qmake CONFIG+=epoll
+epoll {
+    DEFINES += SCD_EPOLL_BACKEND
+
+    SOURCES += scdepollserver.cpp
+
+    HEADERS += scdepollserver.h
+}